@@ -21,7 +21,10 @@ let package = Package(
         .target(
             name: "SampleThreads",
             dependencies: [],
-            path: "Sources/SampleThreads"
+            path: "Sources/SampleThreads",
+            linkerSettings: [
+                .linkedLibrary("z")
+            ]
         ),
         .target(
             name: "PowerMetricsKit",
@@ -29,6 +32,20 @@ let package = Package(
                 .target(name: "SampleThreads")
             ],
             path: "Sources/PowerMetricsKit"
+        ),
+        .executableTarget(
+            name: "SampleThreadsBenchmark",
+            dependencies: [
+                .target(name: "SampleThreads")
+            ],
+            path: "Sources/SampleThreadsBenchmark"
+        ),
+        .executableTarget(
+            name: "SampleThreadsTests",
+            dependencies: [
+                .target(name: "SampleThreads")
+            ],
+            path: "Tests/SampleThreadsTests"
         )
     ],
     swiftLanguageVersions: [.v5, .version("6")]
@@ -1,6 +1,6 @@
 //
 //  File.swift
-//  
+//
 //
 //  Created by Raúl Montón Pinillos on 10/3/24.
 //
@@ -9,154 +9,250 @@ import Foundation
 import os
 
 /// A graph containing the recorded backtrace information.
+///
+/// The graph is a prefix tree of the sampled backtraces, starting at their outermost address.
+/// Nodes are stored in contiguous arrays and referenced by index, and the child of a node for
+/// a given address is found through a hash table. Samples reference their backtrace by stack
+/// ID, and each stack's path is only walked the first time the stack is seen, so the cost of
+/// updating the graph grows with the number of unique stacks, not with the number of samples.
+/// Only raw addresses are stored: symbol information is retrieved lazily, when displayed
+/// (see `SymbolicateBacktraces.symbolicated(_:)`).
 public final class BacktraceGraph: @unchecked Sendable {
     
+    /// The index of a node in the graph.
+    public typealias NodeIndex = Int
+    
     /// Top level nodes of the backtrace graph.
     ///
     /// These are the addresses from which all the function calls sampled come from.
     public var nodes: [BacktraceInfo] {
+        return snapshot().roots
+    }
+    
+    /// The number of nodes in the graph.
+    public var nodeCount: Int {
         nodeLock.withLock {
-            return _nodes.map { BacktraceInfo(mutableBacktraceInfo: $0) }
+            return storage.count - 1
         }
     }
     
     private var nodeLock = OSAllocatedUnfairLock()
-    private var _nodes = [MutableBacktraceInfo]()
-        
-    private func insertInGraph(at insertionPoint: MutableBacktraceInfo?, newInfo: MutableBacktraceInfo) {
-        if var insertionPoint {
-            // precondition(addressToBacktrace.keys.contains(insertionPoint.address))
-            insertionPoint.children.append(newInfo)
-        } else {
-            // print("New info not in graph, adding it as root element")
-            nodeLock.lock()
-            _nodes.append(newInfo)
-            nodeLock.unlock()
-        }
-    }
+    private var storage = NodeStorage()
+    /// Maps a node and an address to the child of the node for that address.
+    private var childIndex = [ChildKey: NodeIndex]()
+    /// The innermost node of each stack, by stack ID, or `NodeStorage.noNode` if the stack
+    /// wasn't inserted yet.
+    private var leafByStack = [NodeIndex]()
+    /// Whether the energies of the nodes must be added up again before taking a snapshot.
+    private var needsEnergyUpdate = false
     
-    struct InsertionPointResult {
-        let insertionPoint: MutableBacktraceInfo?
-        let remainingAddresses: [BacktraceAddress]
+    private struct ChildKey: Hashable {
+        let parent: NodeIndex
+        let address: BacktraceAddress
     }
     
-    private func findInsertionPoint(for newBacktrace: Backtrace) throws -> InsertionPointResult {
-        guard let outermostAddress = newBacktrace.addresses.last else {
-            // Empty backtrace, move on...
-            // print("Attempted to insert empty backtrace")
-            throw BacktraceGraphError.emptyBacktrace
+    // MARK: - Snapshot
+    
+    /// An immutable copy of the graph at some point in time.
+    ///
+    /// The snapshot shares the graph's storage, which is only copied if the graph is modified
+    /// while the snapshot is still alive. Taking a snapshot is O(1), plus a single pass over
+    /// the nodes to add up their energies if samples were inserted since the last one.
+    public struct Snapshot: Sendable {
+        fileprivate let storage: NodeStorage
+        
+        /// The top level nodes of the graph.
+        public var roots: [BacktraceInfo] {
+            return children(of: NodeStorage.root)
         }
-        nodeLock.lock()
-        defer {
-            nodeLock.unlock()
+        
+        /// The number of nodes in the graph.
+        public var nodeCount: Int {
+            return storage.count - 1
         }
-        if var existingInfo = _nodes.first(where: { $0.address == outermostAddress }) {
-            
-            // Add the energy information from the new backtrace to the outermost node
-            existingInfo.energy += newBacktrace.energy ?? .zero
-            
-            var insertionPoint = existingInfo
-            var remainingAddresses = newBacktrace.addresses.dropLast()
-            var nextAddress = remainingAddresses.last
-            while true {
-                if nextAddress == nil {
-                    // No more children in the backtrace, must be fully contained in graph
-                    throw BacktraceGraphError.backtraceFullyContainedInGraph
-                } else if insertionPoint.children.isEmpty {
-                    // Existing backtrace doesn't contain any child
-                    // print("Existing backtrace doesn't contain any other child")
-                    return InsertionPointResult(
-                        insertionPoint: insertionPoint,
-                        remainingAddresses: Array(remainingAddresses)
-                    )
-                } else if var matchingChild = insertionPoint.children.first(where: { $0.address == nextAddress }) {
-                    // Add the energy information from the new backtrace to the children
-                    matchingChild.energy += newBacktrace.energy ?? .zero
-                    // Existing backtrace info contains a child with the same address
-                    insertionPoint = matchingChild
-                    remainingAddresses = remainingAddresses.dropLast()
-                    nextAddress = remainingAddresses.last
-                } else {
-                    // Existing backtrace doesn't contain this child in particular
-                    /*
-                    print(
-                        """
-                        Insertion point \(insertionPoint.info?.symbolName ?? "UNKNOWN") does not contain child \
-                        \(SymbolicateBacktraces.shared.symbolicatedInfo(for: nextAddress ?? .zero)?.symbolName ?? "UNKNOWN")
-                        """
-                    )
-                     */
-                    return InsertionPointResult(
-                        insertionPoint: insertionPoint,
-                        remainingAddresses: Array(remainingAddresses)
-                    )
-                }
+        
+        /// The nodes that were called from the given node.
+        public func children(of node: NodeIndex) -> [BacktraceInfo] {
+            var children = [BacktraceInfo]()
+            var child = storage.firstChild[node]
+            while child != NodeStorage.noNode {
+                children.append(backtraceInfo(for: child))
+                child = storage.nextSibling[child]
             }
-        } else {
-            // Doesn't exist, must be a new top-level backtrace
-            // print("Insertion point not found, possible top-level element")
-            return InsertionPointResult(
-                insertionPoint: nil,
-                remainingAddresses: newBacktrace.addresses
+            return children
+        }
+        
+        /// The information of the given node.
+        public func backtraceInfo(for node: NodeIndex) -> BacktraceInfo {
+            return BacktraceInfo(
+                node: node,
+                address: storage.addresses[node],
+                energy: storage.energies[node],
+                selfEnergy: storage.selfEnergies[node],
+                snapshot: self
             )
         }
-    }
         
-    func insertInGraph(newBacktrace: Backtrace) {
-        var newBacktrace = newBacktrace
-        newBacktrace = sanitizedBacktrace(&newBacktrace)
-        guard newBacktrace.addresses.last != nil else {
-            // Empty backtrace, move on...
-            // print("Attempted to insert empty backtrace")
-            return
+        /// The address of the given node.
+        public func address(of node: NodeIndex) -> BacktraceAddress {
+            return storage.addresses[node]
+        }
+        
+        /// The energy of the backtraces whose innermost address is the given node's.
+        public func selfEnergy(of node: NodeIndex) -> Energy {
+            return storage.selfEnergies[node]
         }
-        do {
-            let insertionResult = try findInsertionPoint(for: newBacktrace)
-            let newInfo = createBacktraceInfo(for: insertionResult.remainingAddresses)
-            insertInGraph(at: insertionResult.insertionPoint, newInfo: newInfo)
-        } catch {
-            // No need to do anything
+        
+        /// The number of samples whose innermost address is the given node's.
+        public func selfSampleCount(of node: NodeIndex) -> Int {
+            return storage.selfSampleCounts[node]
+        }
+        
+        /// Visits every node of the graph in depth-first order, parents before children,
+        /// without recursion.
+        /// - Parameter body: Called with each node and its depth (0 for the top level nodes).
+        public func forEachNode(_ body: (_ node: NodeIndex, _ depth: Int) -> Void) {
+            var stack = [(node: NodeIndex, depth: Int)]()
+            var child = storage.firstChild[NodeStorage.root]
+            while child != NodeStorage.noNode {
+                stack.append((child, 0))
+                child = storage.nextSibling[child]
+            }
+            while let entry = stack.popLast() {
+                body(entry.node, entry.depth)
+                var child = storage.firstChild[entry.node]
+                while child != NodeStorage.noNode {
+                    stack.append((child, entry.depth + 1))
+                    child = storage.nextSibling[child]
+                }
+            }
         }
     }
     
-    // MARK: - Utils
-    
-    private func sanitizedBacktrace(_ backtrace: inout Backtrace) -> Backtrace {
-        var addresses = backtrace.addresses
-        while addresses.last == 0 {
-            addresses = addresses.dropLast()
+    /// Takes an immutable snapshot of the graph, which can be read from any thread.
+    public func snapshot() -> Snapshot {
+        nodeLock.withLock {
+            if needsEnergyUpdate {
+                storage.updateEnergies()
+                needsEnergyUpdate = false
+            }
+            return Snapshot(storage: storage)
         }
-        backtrace.addresses = addresses
-        return backtrace
     }
     
-    private func createBacktraceInfo(for addresses: [BacktraceAddress]) -> MutableBacktraceInfo {
-        if let outermostAddress = addresses.last {
-            if outermostAddress == .zero {
-                return createBacktraceInfo(for: addresses.dropLast())
+    // MARK: - Insertion
+    
+    /// Inserts a batch of samples in the graph, adding their energy to the innermost node of
+    /// their backtrace.
+    ///
+    /// The first time a stack is inserted, its path is walked (O(1) per address) and its
+    /// innermost node is remembered, so inserting any later sample of the same stack is O(1)
+    /// regardless of the depth of the backtrace. The energy of the nodes along the paths is
+    /// only added up when a snapshot is taken.
+    /// - Parameters:
+    ///   - samples: The samples to insert.
+    ///   - stacks: The addresses of every stack, by stack ID, innermost address first.
+    func insert(_ samples: [StackSample], stacks: [[BacktraceAddress]]) {
+        nodeLock.lock()
+        defer {
+            nodeLock.unlock()
+        }
+        for sample in samples {
+            let stackIndex = Int(sample.stackID)
+            if stackIndex >= leafByStack.count {
+                leafByStack.append(contentsOf: repeatElement(NodeStorage.noNode, count: stackIndex - leafByStack.count + 1))
             }
-            let symbolicatedInfo = SymbolicateBacktraces.shared.symbolicatedInfo(for: outermostAddress)
-            let children: [MutableBacktraceInfo] = if addresses.count != 1 {
-                [createBacktraceInfo(for: addresses.dropLast())]
+            var leaf = leafByStack[stackIndex]
+            if leaf == NodeStorage.noNode {
+                leaf = insertPath(stacks[stackIndex])
+                leafByStack[stackIndex] = leaf
+            }
+            guard leaf != NodeStorage.root else {
+                // Empty backtrace, move on...
+                continue
+            }
+            storage.selfEnergies[leaf] += sample.energy
+            storage.selfSampleCounts[leaf] += sample.sampleCount
+            needsEnergyUpdate = true
+        }
+    }
+    
+    /// Forgets the stack IDs inserted so far, as they're not valid anymore once the stack table
+    /// they come from is discarded. The nodes and their energy are kept.
+    func resetStacks() {
+        nodeLock.withLock {
+            leafByStack.removeAll()
+        }
+    }
+    
+    /// Creates the nodes of a backtrace that don't exist yet. `nodeLock` must be held.
+    /// - Returns: The innermost node of the backtrace, or the root if the backtrace is empty.
+    private func insertPath(_ addresses: [BacktraceAddress]) -> NodeIndex {
+        var node = NodeStorage.root
+        // Backtraces go from the innermost to the outermost address, but the graph
+        // starts from the outermost one.
+        for address in addresses.reversed() where address != .zero {
+            let key = ChildKey(parent: node, address: address)
+            if let child = childIndex[key] {
+                node = child
             } else {
-                []
+                let child = storage.append(address: address, parent: node)
+                childIndex[key] = child
+                node = child
             }
-            let backtraceInfo = MutableBacktraceInfo(
-                address: outermostAddress,
-                info: symbolicatedInfo,
-                energy: .zero,
-                children: children
-            )
-            return backtraceInfo
-        } else {
-            return MutableBacktraceInfo(address: .zero, info: nil, energy: .zero, children: [])
         }
+        return node
     }
 }
 
-// MARK: - Error
+// MARK: - NodeStorage
 
-enum BacktraceGraphError: Error {
-    case emptyBacktrace
-    case backtraceFullyContainedInGraph
+/// The nodes of a `BacktraceGraph`, stored as a struct of arrays indexed by node.
+///
+/// Node 0 is a virtual root, the parent of all top level nodes. Children of each node are
+/// linked through `firstChild` and `nextSibling`.
+fileprivate struct NodeStorage: Sendable {
+    
+    static let root: BacktraceGraph.NodeIndex = 0
+    /// Marks the absence of a node.
+    static let noNode: BacktraceGraph.NodeIndex = -1
+    
+    var addresses: [BacktraceAddress] = [.zero]
+    /// Energy of all the backtraces that include the node.
+    var energies: [Energy] = [.zero]
+    /// Energy of the backtraces whose innermost address is the node's.
+    var selfEnergies: [Energy] = [.zero]
+    /// Number of samples whose innermost address is the node's.
+    var selfSampleCounts: [Int] = [0]
+    var parents: [BacktraceGraph.NodeIndex] = [NodeStorage.noNode]
+    var firstChild: [BacktraceGraph.NodeIndex] = [NodeStorage.noNode]
+    var nextSibling: [BacktraceGraph.NodeIndex] = [NodeStorage.noNode]
+    
+    var count: Int {
+        return addresses.count
+    }
+    
+    mutating func append(address: BacktraceAddress, parent: BacktraceGraph.NodeIndex) -> BacktraceGraph.NodeIndex {
+        let node = addresses.count
+        addresses.append(address)
+        energies.append(.zero)
+        selfEnergies.append(.zero)
+        selfSampleCounts.append(0)
+        parents.append(parent)
+        firstChild.append(Self.noNode)
+        nextSibling.append(firstChild[parent])
+        firstChild[parent] = node
+        return node
+    }
+    
+    /// Recomputes the energy of every node as its self energy plus the energy of its children.
+    ///
+    /// Nodes are always appended after their parent, so visiting them in reverse order visits
+    /// every child before its parent, and a single pass is enough.
+    mutating func updateEnergies() {
+        energies = selfEnergies
+        for node in stride(from: count - 1, to: Self.root, by: -1) {
+            energies[parents[node]] += energies[node]
+        }
+    }
 }
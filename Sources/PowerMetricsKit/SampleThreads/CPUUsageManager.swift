@@ -9,49 +9,59 @@ import Foundation
 import SampleThreads
 
 /// Class used to retrieve the usage (occupancy) of each CPU core.
+///
+/// This wraps the C `cpu_usage_reader_t` (see `get_cpu_usage.h`), which reuses its resources
+/// between reads and computes the ticks since the previous read in place, into buffers owned
+/// by this class.
 public final class CPUUsageManager {
     
-    private var results: RingBuffer<[CoreUsage]>
+    private let reader: OpaquePointer?
+    /// Ticks of each core since boot, as of the last read.
+    private var totals: [core_usage_t]
+    /// Ticks of each core between the last two reads.
+    private var deltas: [core_usage_t]
+    /// Whether `totals` holds a previous read to compute the deltas from.
+    private var hasPreviousRead = false
     
     // MARK: - Init
     
     nonisolated public init(config: PowerMetricsConfig = .default) {
-        self.results = RingBuffer<[CoreUsage]>(length: config.numberOfStoredSamples)
+        self.reader = cpu_usage_reader_create()
+        let coreCount = reader.map { Int(cpu_usage_reader_core_count($0)) } ?? 0
+        self.totals = [core_usage_t](repeating: core_usage_t(), count: coreCount)
+        self.deltas = [core_usage_t](repeating: core_usage_t(), count: coreCount)
+    }
+    
+    deinit {
+        cpu_usage_reader_destroy(reader)
     }
     
     // MARK: - Functions
     
+    /// Retrieves the usage of each core since the previous call.
+    /// - Returns: `nil` on the first call, or if the usage couldn't be read.
     func getCPUUsage() -> CPUUsage? {
-        
-        let rawCPUUsage = get_cpu_usage()
-        
-        // This points directly to the C array.
-        let rawCoreUsages = UnsafeBufferPointer(
-            start: rawCPUUsage.core_usages,
-            count: Int(rawCPUUsage.num_cores)
-        )
-        // This creates a Swift copy of the C array.
-        let coreUsages = [CoreUsage](rawCoreUsages)
-        
-        // Free the memory allocated with malloc in get_cpu_usage.c, as we've
-        // created a copy for Swift code.
-        free(rawCPUUsage.core_usages)
-        
-        defer {
-            results.add(element: coreUsages)
+        guard let reader else {
+            return nil
         }
-        
-        guard let previousResult = results.last else {
+        let capacity = Int32(totals.count)
+        let numberOfCores = totals.withUnsafeMutableBufferPointer { totals in
+            deltas.withUnsafeMutableBufferPointer { deltas in
+                cpu_usage_reader_read(reader, totals.baseAddress, deltas.baseAddress, capacity)
+            }
+        }
+        guard numberOfCores > 0 else {
             return nil
         }
-        
-        var results = [CoreUsage]()
-        for index in 0..<rawCPUUsage.num_cores {
-            results.append(coreUsages[Int(index)] - previousResult[Int(index)])
+        defer {
+            hasPreviousRead = true
+        }
+        guard hasPreviousRead else {
+            return nil
         }
         return CPUUsage(
-            numberOfCores: Int(rawCPUUsage.num_cores),
-            coreUsages: results
+            numberOfCores: Int(numberOfCores),
+            coreUsages: deltas.prefix(Int(numberOfCores)).map { CoreUsage($0) }
         )
     }
 }
@@ -0,0 +1,182 @@
+//
+//  FlatProfile.swift
+//
+
+import Foundation
+
+/// The energy used by each sampled address, regardless of the backtrace it was found in.
+///
+/// Entries are found through an address-keyed hash table and updated in place. The entries of
+/// each stack are only looked up the first time the stack is seen, so adding a sample of a
+/// known stack doesn't hash any address.
+public struct FlatProfile: Sendable {
+    
+    /// The energy used by a single address.
+    public struct Entry: Sendable {
+        /// A specific address in the backtraces.
+        public let address: BacktraceAddress
+        /// Symbol information for the given address, recovered using `dladdr`. This is `nil`
+        /// until retrieved with `SymbolicateBacktraces`.
+        public internal(set) var info: SymbolicatedInfo?
+        /// The energy of the backtraces whose innermost address is this one: the energy used
+        /// by the code at the address itself.
+        public fileprivate(set) var selfEnergy: Energy = .zero
+        /// The energy of all the backtraces that include this address: the energy used by the
+        /// code at the address and all the code called from it.
+        public fileprivate(set) var inclusiveEnergy: Energy = .zero
+        /// The number of backtraces whose innermost address is this one.
+        public fileprivate(set) var selfSamples: Int = 0
+        /// The number of backtraces that include this address.
+        public fileprivate(set) var inclusiveSamples: Int = 0
+    }
+    
+    /// The figure used to rank the entries of the profile.
+    public enum Ordering: Sendable {
+        case selfEnergy
+        case inclusiveEnergy
+    }
+    
+    /// The number of distinct addresses in the profile.
+    public var count: Int {
+        return entries.count
+    }
+    
+    private var entries = [Entry]()
+    private var indexByAddress = [BacktraceAddress: Int]()
+    /// The entries of the distinct addresses of each stack, by stack ID, with the entry of
+    /// the innermost address first. `nil` for stacks that weren't added yet.
+    private var entriesByStack = [[Int]?]()
+    
+    // MARK: - Adding samples
+    
+    /// Adds the energy of a batch of samples to all the addresses of their backtraces.
+    /// - Parameters:
+    ///   - samples: The samples to add.
+    ///   - stacks: The addresses of every stack, by stack ID, innermost address first.
+    mutating func add(_ samples: [StackSample], stacks: [[BacktraceAddress]]) {
+        for sample in samples {
+            let stackEntries = entries(forStack: Int(sample.stackID), stacks: stacks)
+            guard let innermost = stackEntries.first else {
+                continue
+            }
+            entries[innermost].selfEnergy += sample.energy
+            entries[innermost].selfSamples += sample.sampleCount
+            // Recursive calls, that include an address more than once in a backtrace, were
+            // already merged, so they're only counted once.
+            for index in stackEntries {
+                entries[index].inclusiveEnergy += sample.energy
+                entries[index].inclusiveSamples += sample.sampleCount
+            }
+        }
+    }
+    
+    /// Forgets the stack IDs added so far, as they're not valid anymore once the stack table
+    /// they come from is discarded. The entries and their energy are kept.
+    mutating func resetStacks() {
+        entriesByStack.removeAll()
+    }
+    
+    /// The entries of the distinct addresses of a stack, created if they don't exist.
+    private mutating func entries(forStack stackIndex: Int, stacks: [[BacktraceAddress]]) -> [Int] {
+        if stackIndex >= entriesByStack.count {
+            entriesByStack.append(contentsOf: repeatElement(nil, count: stackIndex - entriesByStack.count + 1))
+        }
+        if let stackEntries = entriesByStack[stackIndex] {
+            return stackEntries
+        }
+        var stackEntries = [Int]()
+        for address in stacks[stackIndex] where address != .zero {
+            let index = entryIndex(for: address)
+            if !stackEntries.contains(index) {
+                stackEntries.append(index)
+            }
+        }
+        entriesByStack[stackIndex] = stackEntries
+        return stackEntries
+    }
+    
+    /// The index of the entry for the given address, created if it doesn't exist.
+    private mutating func entryIndex(for address: BacktraceAddress) -> Int {
+        if let index = indexByAddress[address] {
+            return index
+        }
+        let index = entries.count
+        entries.append(Entry(address: address))
+        indexByAddress[address] = index
+        return index
+    }
+    
+    // MARK: - Reading
+    
+    /// The entry for the given address, if it was ever sampled.
+    public func entry(for address: BacktraceAddress) -> Entry? {
+        guard let index = indexByAddress[address] else {
+            return nil
+        }
+        return entries[index]
+    }
+    
+    /// The `k` entries with the highest energy, sorted from highest to lowest.
+    ///
+    /// This keeps a heap of the best `k` entries while scanning the profile, which is
+    /// O(n log k) instead of sorting the whole profile.
+    public func top(_ k: Int, by ordering: Ordering = .selfEnergy) -> [Entry] {
+        guard k > 0 else {
+            return []
+        }
+        let energy: (Entry) -> Energy
+        switch ordering {
+        case .selfEnergy:
+            energy = { $0.selfEnergy }
+        case .inclusiveEnergy:
+            energy = { $0.inclusiveEnergy }
+        }
+        // Min-heap of the best entries found so far: the root is the worst of them.
+        var heap = [Int]()
+        heap.reserveCapacity(Swift.min(k, entries.count))
+        for index in entries.indices {
+            if heap.count < k {
+                heap.append(index)
+                siftUp(&heap, from: heap.count - 1, energy: energy)
+            } else if energy(entries[index]) > energy(entries[heap[0]]) {
+                heap[0] = index
+                siftDown(&heap, from: 0, energy: energy)
+            }
+        }
+        return heap
+            .map { entries[$0] }
+            .sorted(by: { energy($0) > energy($1) })
+    }
+    
+    private func siftUp(_ heap: inout [Int], from position: Int, energy: (Entry) -> Energy) {
+        var child = position
+        while child > 0 {
+            let parent = (child - 1) / 2
+            guard energy(entries[heap[child]]) < energy(entries[heap[parent]]) else {
+                return
+            }
+            heap.swapAt(child, parent)
+            child = parent
+        }
+    }
+    
+    private func siftDown(_ heap: inout [Int], from position: Int, energy: (Entry) -> Energy) {
+        var parent = position
+        while true {
+            let left = 2 * parent + 1
+            let right = left + 1
+            var smallest = parent
+            if left < heap.count && energy(entries[heap[left]]) < energy(entries[heap[smallest]]) {
+                smallest = left
+            }
+            if right < heap.count && energy(entries[heap[right]]) < energy(entries[heap[smallest]]) {
+                smallest = right
+            }
+            guard smallest != parent else {
+                return
+            }
+            heap.swapAt(parent, smallest)
+            parent = smallest
+        }
+    }
+}
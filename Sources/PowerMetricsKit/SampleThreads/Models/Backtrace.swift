@@ -14,6 +14,35 @@ public struct Backtrace: Sendable, Hashable, Equatable {
     public var addresses: [BacktraceAddress]
     public var energy: Energy?
 }
+/// Identifies a unique backtrace in the sampling session's stack table (see `stack_table.h`).
+public typealias StackID = UInt32
+/// The energy usage associated with a backtrace, referenced by its stack ID.
+public struct StackSample: Sendable, Hashable, Equatable {
+    /// The ID of the backtrace.
+    public var stackID: StackID
+    /// The energy used while the backtrace was sampled.
+    public var energy: Energy
+    /// The number of samples with this backtrace merged in this one.
+    public var sampleCount: Int = 1
+    
+    /// Merges the samples with the same stack ID, so each backtrace is only processed once
+    /// per batch. Many threads (ie: idle ones) are often sampled with the same backtrace.
+    static func coalesced(_ samples: [StackSample]) -> [StackSample] {
+        var indexByStack = [StackID: Int](minimumCapacity: samples.count)
+        var coalesced = [StackSample]()
+        coalesced.reserveCapacity(samples.count)
+        for sample in samples {
+            if let index = indexByStack[sample.stackID] {
+                coalesced[index].energy += sample.energy
+                coalesced[index].sampleCount += sample.sampleCount
+            } else {
+                indexByStack[sample.stackID] = coalesced.count
+                coalesced.append(sample)
+            }
+        }
+        return coalesced
+    }
+}
 /// Symbol information of a backtrace, recovered using `dladdr`.
 ///
 /// On iOS, `dladdr` may return `<redacted>` as the image and symbol names.
@@ -31,70 +60,46 @@ public struct SymbolicatedInfo: Sendable, Hashable {
         return "0x\(String(format: "%llx", addressInImage)), \(imageName)"
     }
 }
-/// Minimal piece of information of a backtrace address.
-public struct SimpleBacktraceInfo: Sendable {
-    /// A specific address in the backtrace.
-    public let address: BacktraceAddress
-    /// Symbol information for the given address, recovered using `dladdr`.
-    public let info: SymbolicatedInfo?
-    /// The energy reported by the CLPC for the thread at the moment when the backtrace was
-    /// sampled.
-    public var energy: Energy
-    
-    init(address: BacktraceAddress, info: SymbolicatedInfo?, energy: Energy) {
-        self.address = address
-        self.energy = energy
-        self.info = info
-    }
-}
 /// Full backtrace information.
 public struct BacktraceInfo: Sendable, Identifiable {
-    /// A unique identifier for the backtrace information.
-    public let id = UUID()
+    /// A unique identifier for the backtrace information, stable across snapshots of the graph.
+    public var id: BacktraceGraph.NodeIndex {
+        return node
+    }
+    /// The node of the `BacktraceGraph` this information comes from.
+    public let node: BacktraceGraph.NodeIndex
     /// A specific address in the backtrace.
     public let address: BacktraceAddress
-    /// Symbol information for the given address, recovered using `dladdr`.
-    public let info: SymbolicatedInfo?
+    /// Symbol information for the given address, recovered using `dladdr`. This is `nil`
+    /// until retrieved with `SymbolicateBacktraces`.
+    public internal(set) var info: SymbolicatedInfo?
     /// The energy reported by the CLPC for the thread at the moment when the backtrace was
-    /// sampled.
+    /// sampled, for all the backtraces that went through this address.
     public let energy: Energy
+    /// The energy of the backtraces whose innermost address is this `address`.
+    public let selfEnergy: Energy
     /// Backtrace address that were called from this `address`.
-    public let children: [BacktraceInfo]
-    
-    public init(mutableBacktraceInfo: MutableBacktraceInfo) {
-        self.address = mutableBacktraceInfo.address
-        self.energy = mutableBacktraceInfo.energy
-        self.info = mutableBacktraceInfo.info
-        self.children = mutableBacktraceInfo.children.map {
-            BacktraceInfo(mutableBacktraceInfo: $0)
-        }
+    ///
+    /// These are read from the graph snapshot on demand, so only the levels of the graph
+    /// that are actually visited are ever materialized.
+    public var children: [BacktraceInfo] {
+        return snapshot.children(of: node)
     }
     
-    init(address: BacktraceAddress, info: SymbolicatedInfo?, energy: Energy, children: [BacktraceInfo]) {
-        self.address = address
-        self.energy = energy
-        self.info = info
-        self.children = children
-    }
-}
-/// Full backtrace information.
-public final class MutableBacktraceInfo: Identifiable {
-    /// A unique identifier for the backtrace information.
-    public let id = UUID()
-    /// A specific address in the backtrace.
-    public let address: BacktraceAddress
-    /// Symbol information for the given address, recovered using `dladdr`.
-    public let info: SymbolicatedInfo?
-    /// The energy reported by the CLPC for the thread at the moment when the backtrace was
-    /// sampled.
-    public var energy: Energy
-    /// Backtrace address that were called from this `address`.
-    public var children: [MutableBacktraceInfo]
+    private let snapshot: BacktraceGraph.Snapshot
     
-    init(address: BacktraceAddress, info: SymbolicatedInfo?, energy: Energy, children: [MutableBacktraceInfo]) {
+    init(
+        node: BacktraceGraph.NodeIndex,
+        address: BacktraceAddress,
+        energy: Energy,
+        selfEnergy: Energy,
+        snapshot: BacktraceGraph.Snapshot
+    ) {
+        self.node = node
         self.address = address
+        self.info = nil
         self.energy = energy
-        self.info = info
-        self.children = children
+        self.selfEnergy = selfEnergy
+        self.snapshot = snapshot
     }
 }
@@ -18,11 +18,21 @@ public struct CoreUsage: Sendable, AdditiveArithmetic {
     public var niceTicks: Int
     /// Number of idle CPU ticks.
     public var idleTicks: Int
+    /// Number of idle CPU ticks while there was I/O pending. Always 0 on Apple platforms.
+    public var iowaitTicks: Int
+    /// Number of CPU ticks servicing hardware interrupts. Always 0 on Apple platforms.
+    public var irqTicks: Int
+    /// Number of CPU ticks servicing software interrupts. Always 0 on Apple platforms.
+    public var softirqTicks: Int
+    /// Number of CPU ticks taken by the hypervisor for other virtual machines. Always 0 on
+    /// Apple platforms.
+    public var stealTicks: Int
     
-    /// Proportion of non-idle vs total ticks. Ranges from 0 to 1.
+    /// Proportion of non-idle vs total ticks. Ranges from 0 to 1. Time waiting for I/O counts
+    /// as idle, as the core could have run something else.
     public var usage: Double {
-        let nonIdleTicks = systemTicks + userTicks + niceTicks
-        return Double(nonIdleTicks) / Double(nonIdleTicks + idleTicks)
+        let nonIdleTicks = systemTicks + userTicks + niceTicks + irqTicks + softirqTicks + stealTicks
+        return Double(nonIdleTicks) / Double(nonIdleTicks + idleTicks + iowaitTicks)
     }
     /// Proportion of system ticks vs total ticks. Ranges from 0 to 1.
     public var systemUsage: Double {
@@ -30,11 +40,24 @@ public struct CoreUsage: Sendable, AdditiveArithmetic {
     }
     
     /// Initializes a `CoreUsage` object.
-    public init(systemTicks: Int, userTicks: Int, niceTicks: Int, idleTicks: Int) {
+    public init(
+        systemTicks: Int,
+        userTicks: Int,
+        niceTicks: Int,
+        idleTicks: Int,
+        iowaitTicks: Int = 0,
+        irqTicks: Int = 0,
+        softirqTicks: Int = 0,
+        stealTicks: Int = 0
+    ) {
         self.systemTicks = systemTicks
         self.userTicks = userTicks
         self.niceTicks = niceTicks
         self.idleTicks = idleTicks
+        self.iowaitTicks = iowaitTicks
+        self.irqTicks = irqTicks
+        self.softirqTicks = softirqTicks
+        self.stealTicks = stealTicks
     }
     
     init(_ core_usage: core_usage_t) {
@@ -42,6 +65,10 @@ public struct CoreUsage: Sendable, AdditiveArithmetic {
         self.userTicks = Int(core_usage.user_ticks)
         self.niceTicks = Int(core_usage.nice_ticks)
         self.idleTicks = Int(core_usage.idle_ticks)
+        self.iowaitTicks = Int(core_usage.iowait_ticks)
+        self.irqTicks = Int(core_usage.irq_ticks)
+        self.softirqTicks = Int(core_usage.softirq_ticks)
+        self.stealTicks = Int(core_usage.steal_ticks)
     }
     
     // MARK: - AdditiveArithmetic
@@ -54,7 +81,11 @@ public struct CoreUsage: Sendable, AdditiveArithmetic {
             systemTicks: lhs.systemTicks + rhs.systemTicks,
             userTicks: lhs.userTicks + rhs.userTicks,
             niceTicks: lhs.niceTicks + rhs.niceTicks,
-            idleTicks: lhs.idleTicks + rhs.idleTicks
+            idleTicks: lhs.idleTicks + rhs.idleTicks,
+            iowaitTicks: lhs.iowaitTicks + rhs.iowaitTicks,
+            irqTicks: lhs.irqTicks + rhs.irqTicks,
+            softirqTicks: lhs.softirqTicks + rhs.softirqTicks,
+            stealTicks: lhs.stealTicks + rhs.stealTicks
         )
     }
     
@@ -63,7 +94,11 @@ public struct CoreUsage: Sendable, AdditiveArithmetic {
             systemTicks: lhs.systemTicks - rhs.systemTicks,
             userTicks: lhs.userTicks - rhs.userTicks,
             niceTicks: lhs.niceTicks - rhs.niceTicks,
-            idleTicks: lhs.idleTicks - rhs.idleTicks
+            idleTicks: lhs.idleTicks - rhs.idleTicks,
+            iowaitTicks: lhs.iowaitTicks - rhs.iowaitTicks,
+            irqTicks: lhs.irqTicks - rhs.irqTicks,
+            softirqTicks: lhs.softirqTicks - rhs.softirqTicks,
+            stealTicks: lhs.stealTicks - rhs.stealTicks
         )
     }
 }
@@ -0,0 +1,42 @@
+//
+//  EnergyModel.swift
+//
+
+import Foundation
+import SampleThreads
+
+/// How the energy measured for the whole system is attributed to each thread on Linux, where
+/// RAPL only measures the energy of whole packages (see `energy_model.h`). On Apple platforms,
+/// the energy of each thread is measured directly, and the model is not used.
+public enum EnergyModel: Sendable, Equatable {
+    /// A linear model of the cycles and instructions executed on each core cluster, fitted
+    /// while sampling.
+    case linear
+    /// A linear model with the weights fitted in a calibration run, read with
+    /// `SampleThreadsManager.energyModelWeights` after running a representative workload.
+    case calibratedLinear(weights: [Double])
+    /// Energy is attributed proportionally to the cycles executed.
+    case cycles
+    /// Energy is attributed proportionally to the instructions retired.
+    case instructions
+    
+    /// The kind of the model in the C session configuration.
+    var kind: energy_model_kind_t {
+        switch self {
+        case .linear, .calibratedLinear:
+            return ENERGY_MODEL_LINEAR
+        case .cycles:
+            return ENERGY_MODEL_CYCLES
+        case .instructions:
+            return ENERGY_MODEL_INSTRUCTIONS
+        }
+    }
+    
+    /// The calibrated weights of the model, if any.
+    var weights: [Double] {
+        if case .calibratedLinear(let weights) = self {
+            return weights
+        }
+        return []
+    }
+}
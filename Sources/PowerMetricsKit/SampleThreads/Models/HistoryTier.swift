@@ -0,0 +1,89 @@
+//
+//  HistoryTier.swift
+//
+
+import Foundation
+
+/// The configuration of a downsampled tier of the power history.
+public struct HistoryTierConfig: Sendable {
+    /// The span of time summarized by each bucket of the tier, in seconds.
+    public let resolution: TimeInterval
+    /// The number of buckets kept by the tier. The tier covers `resolution * capacity`
+    /// seconds.
+    public let capacity: Int
+    
+    public init(resolution: TimeInterval, capacity: Int) {
+        self.resolution = resolution
+        self.capacity = capacity
+    }
+    
+    /// 1 second buckets for an hour, 10 second buckets for a day, and 1 minute buckets for a
+    /// week (~20k buckets in total).
+    public static let `default`: [HistoryTierConfig] = [
+        HistoryTierConfig(resolution: 1, capacity: 3600),
+        HistoryTierConfig(resolution: 10, capacity: 8640),
+        HistoryTierConfig(resolution: 60, capacity: 10080)
+    ]
+}
+
+/// A downsampled tier of the power history: a fixed number of `PowerSummary` buckets, each one
+/// covering `resolution` seconds.
+///
+/// Buckets are aligned to multiples of the resolution, so the buckets of a coarser tier
+/// contain whole buckets of the finer tiers. A bucket is open until a sample (or finer bucket)
+/// of a later bucket is added, at which point it's stored and returned, so it can be added to
+/// the next tier.
+struct HistoryTier {
+    let resolution: TimeInterval
+    
+    private let buckets: RingBuffer<PowerSummary>
+    private var openBucket: PowerSummaryAccumulator?
+    
+    /// The stored buckets, in chronological order, followed by the open bucket (if any).
+    var summaries: [PowerSummary] {
+        var summaries = buckets.elements
+        if let openBucket {
+            summaries.append(openBucket.summary)
+        }
+        return summaries
+    }
+    
+    init(_ config: HistoryTierConfig) {
+        self.resolution = config.resolution
+        self.buckets = RingBuffer(length: config.capacity)
+    }
+    
+    /// Adds a sample to its bucket.
+    /// - Returns: The bucket that was closed by adding the sample, if any.
+    mutating func add(_ sample: SampleThreadsResult) -> PowerSummary? {
+        let closedBucket = openBucket(for: sample.time)
+        openBucket?.add(sample)
+        return closedBucket
+    }
+    
+    /// Adds the bucket of a finer tier to its bucket.
+    /// - Returns: The bucket that was closed by adding the summary, if any.
+    mutating func add(_ summary: PowerSummary) -> PowerSummary? {
+        let closedBucket = openBucket(for: summary.start)
+        openBucket?.add(summary)
+        return closedBucket
+    }
+    
+    // MARK: - Private
+    
+    /// Makes the bucket of the given time the open bucket.
+    /// - Returns: The previous open bucket, if it was closed.
+    private mutating func openBucket(for time: Date) -> PowerSummary? {
+        let seconds = time.timeIntervalSinceReferenceDate
+        let bucketStart = Date(timeIntervalSinceReferenceDate: (seconds / resolution).rounded(.down) * resolution)
+        if let openBucket, openBucket.start == bucketStart {
+            return nil
+        }
+        let closedBucket = openBucket?.summary
+        if let closedBucket {
+            buckets.add(element: closedBucket)
+        }
+        openBucket = PowerSummaryAccumulator(start: bucketStart)
+        return closedBucket
+    }
+}
@@ -0,0 +1,120 @@
+//
+//  LRUCache.swift
+//
+
+import Foundation
+
+/// A fixed-capacity cache that evicts the least recently used value when full.
+///
+/// Entries are stored in preallocated arrays and linked in recency order by index, so both
+/// lookups and insertions are O(1) and don't allocate once the cache is full.
+struct LRUCache<Key: Hashable, Value> {
+    
+    /// Marks the absence of an entry in the recency list.
+    private static var noEntry: Int { -1 }
+    
+    private let capacity: Int
+    private var indexByKey: [Key: Int]
+    private var keys = [Key]()
+    private var values = [Value]()
+    /// The next more recently used entry of each entry.
+    private var newer = [Int]()
+    /// The next less recently used entry of each entry.
+    private var older = [Int]()
+    private var newest = LRUCache.noEntry
+    private var oldest = LRUCache.noEntry
+    
+    /// The number of values in the cache.
+    var count: Int {
+        return keys.count
+    }
+    
+    /// Creates an empty cache.
+    /// - Parameter capacity: The maximum number of values stored.
+    init(capacity: Int) {
+        self.capacity = max(capacity, 1)
+        self.indexByKey = [Key: Int](minimumCapacity: self.capacity)
+    }
+    
+    /// The value for the given key, if cached, marking it as the most recently used.
+    mutating func value(for key: Key) -> Value? {
+        guard let index = indexByKey[key] else {
+            return nil
+        }
+        moveToFront(index)
+        return values[index]
+    }
+    
+    /// Caches a value, evicting the least recently used one if the cache is full.
+    mutating func insert(_ value: Value, for key: Key) {
+        if let index = indexByKey[key] {
+            values[index] = value
+            moveToFront(index)
+            return
+        }
+        let index: Int
+        if keys.count < capacity {
+            index = keys.count
+            keys.append(key)
+            values.append(value)
+            newer.append(Self.noEntry)
+            older.append(Self.noEntry)
+        } else {
+            // Reuse the storage of the least recently used entry.
+            index = oldest
+            unlink(index)
+            indexByKey[keys[index]] = nil
+            keys[index] = key
+            values[index] = value
+        }
+        indexByKey[key] = index
+        linkAtFront(index)
+    }
+    
+    /// Removes all the values in the cache.
+    mutating func removeAll() {
+        indexByKey.removeAll(keepingCapacity: true)
+        keys.removeAll(keepingCapacity: true)
+        values.removeAll(keepingCapacity: true)
+        newer.removeAll(keepingCapacity: true)
+        older.removeAll(keepingCapacity: true)
+        newest = Self.noEntry
+        oldest = Self.noEntry
+    }
+    
+    // MARK: - Private
+    
+    private mutating func moveToFront(_ index: Int) {
+        guard index != newest else {
+            return
+        }
+        unlink(index)
+        linkAtFront(index)
+    }
+    
+    private mutating func unlink(_ index: Int) {
+        if newer[index] != Self.noEntry {
+            older[newer[index]] = older[index]
+        } else {
+            newest = older[index]
+        }
+        if older[index] != Self.noEntry {
+            newer[older[index]] = newer[index]
+        } else {
+            oldest = newer[index]
+        }
+        newer[index] = Self.noEntry
+        older[index] = Self.noEntry
+    }
+    
+    private mutating func linkAtFront(_ index: Int) {
+        older[index] = newest
+        newer[index] = Self.noEntry
+        if newest != Self.noEntry {
+            newer[newest] = index
+        } else {
+            oldest = index
+        }
+        newest = index
+    }
+}
@@ -13,33 +13,49 @@ public typealias Power = Double
 public typealias Energy = Double
 
 /// A combined power measurement composed of measurements for different core types.
+///
+/// The power of each core cluster is stored in a fixed-size vector, indexed like the clusters
+/// of the sampled system (see `core_topology_t`), so combining measurements costs the same
+/// regardless of how many clusters the system has.
 public struct CombinedPower: Sendable, Equatable, Hashable, AdditiveArithmetic {
-    /// Power used by the performance cores.
-    public let performance: Power
-    /// Power used by the efficiency cores.
-    public let efficiency: Power
+    /// Power used by each core cluster, from the fastest to the most efficient cores.
+    /// Clusters the system doesn't have are zero.
+    public let clusters: SIMD8<Power>
+    /// Power used by the performance cores (the fastest cluster).
+    public var performance: Power {
+        return clusters[0]
+    }
+    /// Power used by the efficiency cores (every cluster other than the fastest one).
+    public var efficiency: Power {
+        return total - performance
+    }
     /// Power used by all cores.
     var total: Power {
-        return performance + efficiency
+        return clusters.sum()
+    }
+    
+    public init(clusters: SIMD8<Power>) {
+        self.clusters = clusters
+    }
+    
+    public init(performance: Power, efficiency: Power) {
+        var clusters = SIMD8<Power>.zero
+        clusters[0] = performance
+        clusters[1] = efficiency
+        self.clusters = clusters
     }
     
     /// Zero power.
     public static var zero: CombinedPower {
-        return CombinedPower(performance: .zero, efficiency: .zero)
+        return CombinedPower(clusters: .zero)
     }
     
     public static func + (lhs: CombinedPower, rhs: CombinedPower) -> CombinedPower {
-        return CombinedPower(
-            performance: lhs.performance + rhs.performance,
-            efficiency: lhs.efficiency + rhs.efficiency
-        )
+        return CombinedPower(clusters: lhs.clusters + rhs.clusters)
     }
     
     public static func - (lhs: CombinedPower, rhs: CombinedPower) -> CombinedPower {
-        return CombinedPower(
-            performance: lhs.performance - rhs.performance,
-            efficiency: lhs.efficiency - rhs.efficiency
-        )
+        return CombinedPower(clusters: lhs.clusters - rhs.clusters)
     }
 }
 
@@ -18,13 +18,35 @@ public struct PowerMetricsConfig: Sendable {
     public let retrieveDispatchQueueName: Bool
     /// Whether or not backtraces of the sampled threads should be retrieved.
     public let retrieveBacktraces: Bool
+    /// The maximum fraction of one core the sampler may use on average (ie: `0.01` for 1%),
+    /// or `0` to never adapt the sampling to its cost.
+    ///
+    /// When sampling is over budget, backtraces are retrieved less often, then dispatch queue
+    /// names stop being retrieved, and finally the time between samples is stretched.
+    public let cpuBudget: Double
+    /// The downsampled tiers of the power history, which keep summaries of the samples for
+    /// longer than `numberOfStoredSamples` at a coarser resolution.
+    public let historyTiers: [HistoryTierConfig]
+    /// The number of worker threads that sample the threads of the process in parallel with
+    /// the sampling thread, or `0` to sample them all from the sampling thread.
+    ///
+    /// Only worth it for processes with thousands of threads, where a single thread can't
+    /// read all of them within `samplingTime`. The workers' CPU time counts towards
+    /// `cpuBudget`.
+    public let samplingWorkerCount: Int
+    /// How the energy measured for the whole system is attributed to each thread on Linux.
+    public let energyModel: EnergyModel
     
     /// Create a PowerMetricsKit configuration.
-    public init(samplingTime: TimeInterval, numberOfStoredSamples: Int, retrieveDispatchQueueName: Bool, retrieveBacktraces: Bool) {
+    public init(samplingTime: TimeInterval, numberOfStoredSamples: Int, retrieveDispatchQueueName: Bool, retrieveBacktraces: Bool, cpuBudget: Double = 0.01, historyTiers: [HistoryTierConfig] = HistoryTierConfig.default, samplingWorkerCount: Int = 0, energyModel: EnergyModel = .linear) {
         self.samplingTime = samplingTime
         self.numberOfStoredSamples = numberOfStoredSamples
         self.retrieveDispatchQueueName = retrieveDispatchQueueName
         self.retrieveBacktraces = retrieveBacktraces
+        self.cpuBudget = cpuBudget
+        self.historyTiers = historyTiers
+        self.samplingWorkerCount = samplingWorkerCount
+        self.energyModel = energyModel
     }
     /// The default PowerMetricsKit configuration.
     public static let `default`: PowerMetricsConfig = {
@@ -0,0 +1,140 @@
+//
+//  PowerSummary.swift
+//
+
+import Foundation
+
+/// The power used during a span of time of the history, either a single sample or a bucket
+/// of a downsampled tier, in a fixed-size record.
+///
+/// Only the threads that used the most energy (up to `maxThreadCount`) are kept
+/// individually, the rest are added to `otherThreadsEnergy`. This keeps the record the same
+/// size no matter how many threads the process has, so a tier's memory only depends on its
+/// number of buckets.
+public struct PowerSummary: Sendable {
+    /// The maximum number of threads whose energy is kept individually.
+    public static let maxThreadCount = 8
+    
+    /// The start of the span of time: the time of the sample, or the start of the bucket.
+    public let start: Date
+    /// The time covered by the summarized samples (the sum of their intervals).
+    public internal(set) var duration: TimeInterval
+    /// The number of summarized samples.
+    public internal(set) var sampleCount: Int
+    /// The energy used by all threads on each core cluster, in Watts-hour.
+    public internal(set) var clusterEnergy: SIMD8<Energy>
+    /// The smallest total power of the summarized samples.
+    public internal(set) var minPower: Power
+    /// The largest total power of the summarized samples.
+    public internal(set) var maxPower: Power
+    /// The energy used by the threads that are not in `threadEnergy`, in Watts-hour.
+    public internal(set) var otherThreadsEnergy: Energy
+    /// The `threadCounter` of the threads that used the most energy, from the most to the
+    /// least energy, or `-1` for unused entries.
+    var threadCounters: SIMD8<Int64>
+    /// The energy used by each of the threads in `threadCounters`, in Watts-hour.
+    var threadEnergies: SIMD8<Energy>
+    
+    /// The energy used by all threads, in Watts-hour.
+    public var energy: Energy {
+        return clusterEnergy.sum()
+    }
+    
+    /// The mean total power over the span of time.
+    public var meanPower: Power {
+        return meanClusterPower.total
+    }
+    
+    /// The mean power used on each core cluster over the span of time.
+    public var meanClusterPower: CombinedPower {
+        guard duration > 0 else {
+            return .zero
+        }
+        return CombinedPower(clusters: clusterEnergy * 3600 / duration)
+    }
+    
+    /// The threads that used the most energy, with the energy they used (in Watts-hour),
+    /// from the most to the least energy.
+    public var threadEnergy: [(threadCounter: Int, energy: Energy)] {
+        return (0..<Self.maxThreadCount)
+            .filter { threadCounters[$0] >= 0 }
+            .map { (threadCounter: Int(threadCounters[$0]), energy: threadEnergies[$0]) }
+    }
+    
+    /// Summarizes a single sample.
+    init(_ sample: SampleThreadsResult) {
+        var accumulator = PowerSummaryAccumulator(start: sample.time)
+        accumulator.add(sample)
+        self = accumulator.summary
+    }
+    
+    init(start: Date) {
+        self.start = start
+        self.duration = .zero
+        self.sampleCount = 0
+        self.clusterEnergy = .zero
+        self.minPower = .infinity
+        self.maxPower = -.infinity
+        self.otherThreadsEnergy = .zero
+        self.threadCounters = SIMD8(repeating: -1)
+        self.threadEnergies = .zero
+    }
+}
+
+// MARK: - PowerSummaryAccumulator
+
+/// Builds a `PowerSummary` from samples, or from the summaries of a finer tier.
+///
+/// The energy of every thread is kept until the summary is read, so the threads that used the
+/// most energy are chosen from all the threads of the span of time, not just of each sample.
+struct PowerSummaryAccumulator {
+    private var partial: PowerSummary
+    private var threadEnergy = [Int: Energy]()
+    
+    /// The start of the span of time.
+    var start: Date {
+        return partial.start
+    }
+    
+    /// The summary of everything added so far.
+    var summary: PowerSummary {
+        var summary = partial
+        let topThreads = threadEnergy.sorted { $0.value > $1.value }.prefix(PowerSummary.maxThreadCount)
+        for (index, (threadCounter, energy)) in topThreads.enumerated() {
+            summary.threadCounters[index] = Int64(threadCounter)
+            summary.threadEnergies[index] = energy
+        }
+        summary.otherThreadsEnergy += threadEnergy.values.reduce(0, +) - topThreads.reduce(0) { $0 + $1.value }
+        return summary
+    }
+    
+    init(start: Date) {
+        self.partial = PowerSummary(start: start)
+    }
+    
+    /// Adds a sample.
+    mutating func add(_ sample: SampleThreadsResult) {
+        let power = sample.allThreadsPower.total
+        partial.duration += sample.interval
+        partial.sampleCount += 1
+        partial.clusterEnergy += sample.allThreadsPower.clusters * (sample.interval / 3600)
+        partial.minPower = min(partial.minPower, power)
+        partial.maxPower = max(partial.maxPower, power)
+        for threadSample in sample.threadSamples {
+            threadEnergy[threadSample.threadCounter, default: .zero] += threadSample.power.total * sample.interval / 3600
+        }
+    }
+    
+    /// Adds the summary of a shorter span of time.
+    mutating func add(_ summary: PowerSummary) {
+        partial.duration += summary.duration
+        partial.sampleCount += summary.sampleCount
+        partial.clusterEnergy += summary.clusterEnergy
+        partial.minPower = min(partial.minPower, summary.minPower)
+        partial.maxPower = max(partial.maxPower, summary.maxPower)
+        partial.otherThreadsEnergy += summary.otherThreadsEnergy
+        for (threadCounter, energy) in summary.threadEnergy {
+            threadEnergy[threadCounter, default: .zero] += energy
+        }
+    }
+}
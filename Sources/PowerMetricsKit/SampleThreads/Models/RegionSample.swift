@@ -0,0 +1,27 @@
+//
+//  RegionSample.swift
+//
+
+import Foundation
+
+/// The resources used by the threads that were in a region of the app (see
+/// `withEnergyRegion(_:_:)`) during a sample.
+///
+/// Threads are attributed to the region they're in when sampled, so the figures of short
+/// regions are statistical: they converge to the right values over many samples.
+public struct RegionSample: Sendable {
+    /// The name of the region.
+    public let name: String
+    /// The number of sampled threads that were in the region.
+    public let threadCount: Int
+    /// The combined power used in the interval by the threads in the region.
+    public let power: CombinedPower
+    /// The energy used in the interval by the threads in the region, in Watts-hour.
+    public let energy: Energy
+    /// The CPU time used in the interval by the threads in the region, in seconds.
+    public let cpuTime: TimeInterval
+    /// The cycles executed in the interval by the threads in the region.
+    public let cycles: UInt64
+    /// The instructions retired in the interval by the threads in the region.
+    public let instructions: UInt64
+}
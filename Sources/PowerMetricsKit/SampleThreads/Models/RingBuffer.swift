@@ -33,7 +33,8 @@ public final class RingBuffer<T>: @unchecked Sendable {
             lock.unlock()
         }
         guard isFull else {
-            return Array(array.prefix(index)).compactMap { $0 }
+            // The first element is stored at index 1, and the latest one at `index`.
+            return Array(array.prefix(index + 1)).compactMap { $0 }
         }
         if index == (length - 1) {
             return array.map { $0! }
@@ -69,7 +70,8 @@ public final class RingBuffer<T>: @unchecked Sendable {
     }
     
     /// Adds a new element to the ring buffer.
-    public func add(element: T) {
+    /// - Returns: The element that was overwritten to make room for the new one, if any.
+    @discardableResult public func add(element: T) -> T? {
         lock.lock()
         defer {
             lock.unlock()
@@ -81,12 +83,15 @@ public final class RingBuffer<T>: @unchecked Sendable {
                 nextIndex = 0
             }
             self.index = nextIndex
+            let evicted = array[index]
             array[index] = element
-            return
+            return evicted
         }
         
         self.index = (index + 1) % length
+        let evicted = array[index]
         array[index] = element
+        return evicted
     }
 }
 
@@ -17,13 +17,32 @@ public struct SampleThreadsResult: Sendable, Identifiable {
     public let allThreadsPower: CombinedPower
     
     public let threadSamples: [ThreadSample]
+    /// The resources used in the interval by the threads in each region of the app (see
+    /// `withEnergyRegion(_:_:)`), only for the regions some sampled thread was in.
+    public let regions: [RegionSample]
+    /// The time elapsed since the previous sample, as measured when sampling. This may differ
+    /// from the configured sampling time (ie: if the app was suspended).
+    public let interval: TimeInterval
+    /// The CPU time used by the sampler to take this sample.
+    public let samplerCPUTime: TimeInterval
+    
+    /// The fraction of one core used by the sampler during the interval.
+    public var samplerOverhead: Double {
+        guard interval > 0 else {
+            return .zero
+        }
+        return samplerCPUTime / interval
+    }
     
     /// Empty sample with zero power.
     public static var zero: SampleThreadsResult {
         return SampleThreadsResult(
             time: .now,
             allThreadsPower: .zero,
-            threadSamples: [ThreadSample]()
+            threadSamples: [ThreadSample](),
+            regions: [RegionSample](),
+            interval: .zero,
+            samplerCPUTime: .zero
         )
     }
 }
@@ -0,0 +1,117 @@
+//
+//  SamplerStatistics.swift
+//
+
+import Foundation
+import SampleThreads
+
+/// The phases of taking a sample, timed to measure the cost of the sampler itself.
+public enum SamplerPhase: CaseIterable, Sendable {
+    /// A whole sample, as taken by the C code.
+    case tick
+    /// Listing the threads of the process.
+    case enumerateThreads
+    /// Reading the counters of all threads.
+    case readCounters
+    /// Reading thread names and dispatch queue names.
+    case readNames
+    /// Retrieving the backtraces of all threads.
+    case backtraces
+    /// How long each thread was interrupted to retrieve its backtrace. Unlike the rest of the
+    /// phases, which are timed once per sample, this is timed once per thread.
+    case threadBacktrace
+    /// Computing the counter deltas since the previous sample.
+    case deltas
+    /// Processing the sample in Swift, after the C code returns.
+    case postProcess
+    
+    var phase: sampler_phase_t {
+        switch self {
+        case .tick:
+            return SAMPLER_PHASE_TICK
+        case .enumerateThreads:
+            return SAMPLER_PHASE_ENUMERATE_THREADS
+        case .readCounters:
+            return SAMPLER_PHASE_READ_COUNTERS
+        case .readNames:
+            return SAMPLER_PHASE_READ_NAMES
+        case .backtraces:
+            return SAMPLER_PHASE_BACKTRACES
+        case .threadBacktrace:
+            return SAMPLER_PHASE_THREAD_BACKTRACE
+        case .deltas:
+            return SAMPLER_PHASE_DELTAS
+        case .postProcess:
+            return SAMPLER_PHASE_POST_PROCESS
+        }
+    }
+}
+
+/// Aggregates of the values recorded for one measure of the sampler's cost. Percentiles are
+/// estimated within the precision of the underlying histogram (~3%).
+public struct SamplerMeasureSummary: Sendable {
+    /// The number of recorded values.
+    public let count: Int
+    /// The smallest recorded value.
+    public let min: Double
+    /// The largest recorded value.
+    public let max: Double
+    /// The mean of the recorded values.
+    public let mean: Double
+    /// The latest recorded value.
+    public let latest: Double
+    /// The 50th, 90th, 99th and 99.9th percentiles of the recorded values.
+    public let p50: Double
+    public let p90: Double
+    public let p99: Double
+    public let p999: Double
+    
+    /// Converts the summary of a C histogram, multiplying its values by `scale`.
+    init(_ summary: sampler_summary_t, scale: Double = 1) {
+        self.count = Int(summary.count)
+        self.min = Double(summary.min) * scale
+        self.max = Double(summary.max) * scale
+        self.mean = summary.mean * scale
+        self.latest = Double(summary.latest) * scale
+        self.p50 = Double(summary.p50) * scale
+        self.p90 = Double(summary.p90) * scale
+        self.p99 = Double(summary.p99) * scale
+        self.p999 = Double(summary.p999) * scale
+    }
+}
+
+/// The cost of the sampler itself, to be reported next to the power figures it produces.
+///
+/// Together with `SampleThreadsResult.samplerOverhead` (the fraction of a core used by each
+/// sample), this tells whether the sampler is perturbing the sampled process: ie: if threads
+/// are interrupted for too long to retrieve their backtraces, or if each sample makes too
+/// many calls into the kernel.
+public struct SamplerStatistics: Sendable {
+    /// The number of samples measured.
+    public let sampleCount: Int
+    /// The time spent in each phase, in seconds.
+    public let phases: [SamplerPhase: SamplerMeasureSummary]
+    /// The memory allocations made by the C code in each sample. This should be zero once
+    /// the sampler warmed up.
+    public let allocationsPerSample: SamplerMeasureSummary
+    /// The calls into the kernel (syscalls and Mach traps) made by the C code in each sample.
+    public let syscallsPerSample: SamplerMeasureSummary
+    /// The memory allocations made by the C code across all samples.
+    public let totalAllocations: Int
+    /// The calls into the kernel made by the C code across all samples.
+    public let totalSyscalls: Int
+    
+    /// Reads the statistics of a C `sampler_stats_t`.
+    init(_ stats: OpaquePointer) {
+        self.sampleCount = Int(sampler_stats_tick_count(stats))
+        var phases = [SamplerPhase: SamplerMeasureSummary]()
+        for phase in SamplerPhase.allCases {
+            phases[phase] = SamplerMeasureSummary(sampler_stats_phase_summary(stats, phase.phase), scale: 1e-9)
+        }
+        self.phases = phases
+        self.allocationsPerSample = SamplerMeasureSummary(sampler_stats_counter_summary(stats, SAMPLER_COUNTER_ALLOCATIONS))
+        self.syscallsPerSample = SamplerMeasureSummary(sampler_stats_counter_summary(stats, SAMPLER_COUNTER_SYSCALLS))
+        self.totalAllocations = Int(sampler_stats_counter_total(stats, SAMPLER_COUNTER_ALLOCATIONS))
+        self.totalSyscalls = Int(sampler_stats_counter_total(stats, SAMPLER_COUNTER_SYSCALLS))
+    }
+}
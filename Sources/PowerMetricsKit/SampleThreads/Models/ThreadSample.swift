@@ -17,8 +17,13 @@ public struct ThreadSample: Sendable {
     public let pthreadName: String?
     /// The name for the Dispatch Queue of the thread.
     public let dispatchQueueName: String?
+    /// The region of the app the thread was in when sampled (see `withEnergyRegion(_:_:)`).
+    public let region: String?
     /// The combined power used by this thread in the interval across all core types.
     public let power: CombinedPower
+    /// A number unique to this thread, increasing with every new thread found while sampling.
+    /// Unlike `threadID`, it's never reused.
+    public let threadCounter: Int
     /// The name of this thread when displayed in the UI. Matched the `pthreadName` (if available),
     /// defaults to the `threadID` otherwise.
     public var displayName: String {
@@ -28,13 +33,12 @@ public struct ThreadSample: Sendable {
         return String("Thread \(threadCounter)")
     }
     
-    private var threadCounter: Int
-    
     init(
         threadID: UInt64,
         sampleTime: Date,
         pthreadName: String?,
         dispatchQueueName: String?,
+        region: String?,
         power: CombinedPower,
         threadCounter: Int
     ) {
@@ -50,6 +54,7 @@ public struct ThreadSample: Sendable {
         } else {
             self.dispatchQueueName = nil
         }
+        self.region = region
         self.power = power
         self.threadCounter = threadCounter
     }
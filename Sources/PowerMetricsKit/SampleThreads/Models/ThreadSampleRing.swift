@@ -0,0 +1,79 @@
+//
+//  ThreadSampleRing.swift
+//
+
+import Foundation
+import SampleThreads
+
+/// A lock-free ring buffer with the latest raw thread samples.
+///
+/// This wraps the C `sample_ring_t` (see `sample_ring.h`): the sampler pushes records
+/// without ever waiting for readers, and any number of readers can take snapshots or read
+/// incrementally from a ``Cursor`` concurrently, without taking any lock.
+public final class ThreadSampleRing: @unchecked Sendable {
+    
+    /// The position of a reader in the ring.
+    public struct Cursor: Sendable {
+        fileprivate var sequence: UInt64
+        
+        /// A cursor pointing to the oldest sample still in the ring.
+        public static let oldest = Cursor(sequence: 0)
+    }
+    
+    private let ring: OpaquePointer
+    
+    /// The number of samples the ring can hold.
+    public let capacity: Int
+    
+    /// A cursor pointing past the latest sample, used to read only samples pushed from now on.
+    public var latest: Cursor {
+        return Cursor(sequence: sample_ring_head(ring))
+    }
+    
+    /// Initializes the ring with room for at least `capacity` samples.
+    /// - Parameter capacity: The minimum capacity, rounded up to the next power of two.
+    public init(capacity: Int) {
+        guard let ring = sample_ring_create(UInt32(max(capacity, 1))) else {
+            fatalError("Failed to allocate a sample ring with capacity \(capacity).")
+        }
+        self.ring = ring
+        self.capacity = Int(sample_ring_capacity(ring))
+    }
+    
+    deinit {
+        sample_ring_destroy(ring)
+    }
+    
+    /// Pushes the thread info of the given records. Must never be called concurrently.
+    func push(_ records: UnsafeBufferPointer<sampled_thread_record_t>) {
+        for record in records {
+            withUnsafePointer(to: record.info) { info in
+                sample_ring_push(ring, info, 1)
+            }
+        }
+    }
+    
+    /// The latest samples in the ring, oldest first.
+    ///
+    /// The returned samples are always consecutive, even if the sampler pushed new
+    /// samples while they were being copied.
+    public func snapshot() -> [sampled_thread_info_t] {
+        return [sampled_thread_info_t](unsafeUninitializedCapacity: capacity) { buffer, count in
+            count = Int(sample_ring_snapshot(ring, buffer.baseAddress, UInt32(capacity), nil))
+        }
+    }
+    
+    /// Reads the samples pushed since `cursor`, advancing it past the last returned sample.
+    /// - Parameters:
+    ///   - cursor: The position to read from. Use ``Cursor/oldest`` or ``latest`` to start.
+    ///   - maxCount: The maximum number of samples returned.
+    /// - Returns: The samples, and the number of samples that were overwritten before they
+    /// could be read.
+    public func read(from cursor: inout Cursor, maxCount: Int) -> (samples: [sampled_thread_info_t], dropped: Int) {
+        var dropped: UInt64 = 0
+        let samples = [sampled_thread_info_t](unsafeUninitializedCapacity: maxCount) { buffer, count in
+            count = Int(sample_ring_read_from(ring, &cursor.sequence, buffer.baseAddress, UInt32(maxCount), &dropped))
+        }
+        return (samples, Int(dropped))
+    }
+}
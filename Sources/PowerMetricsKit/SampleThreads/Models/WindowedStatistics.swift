@@ -0,0 +1,189 @@
+//
+//  WindowedStatistics.swift
+//
+
+import Foundation
+
+/// Aggregates (maximum, minimum, mean and quantiles) of the values in a sliding window,
+/// updated incrementally as values enter and leave the window.
+///
+/// Values must leave the window in the same order they entered it. Adding or removing a
+/// value is amortized O(1), and so is reading any of the aggregates: quantiles are read
+/// from a fixed-size histogram, whose cost doesn't depend on the size of the window.
+public struct WindowedStatistics: Sendable {
+    
+    /// The number of values in the window.
+    public private(set) var count: Int = 0
+    /// The sum of the values in the window.
+    public private(set) var sum: Double = 0
+    
+    private var maxima = MonotonicDeque(keepsMaxima: true)
+    private var minima = MonotonicDeque(keepsMaxima: false)
+    private var histogram = LogHistogram()
+    
+    /// The mean of the values in the window, or `nil` if the window is empty.
+    public var mean: Double? {
+        guard count > 0 else {
+            return nil
+        }
+        return sum / Double(count)
+    }
+    
+    /// The largest value in the window, or `nil` if the window is empty.
+    public var max: Double? {
+        return maxima.front
+    }
+    
+    /// The smallest value in the window, or `nil` if the window is empty.
+    public var min: Double? {
+        return minima.front
+    }
+    
+    /// An estimate of the given quantile of the values in the window, within the relative
+    /// error of the histogram buckets (~2.5%).
+    /// - Parameter quantile: The quantile, from `0` to `1` (ie: `0.95` for P95).
+    /// - Returns: The estimate, or `nil` if the window is empty.
+    public func quantile(_ quantile: Double) -> Double? {
+        guard count > 0 else {
+            return nil
+        }
+        return histogram.quantile(quantile, count: count)
+    }
+    
+    /// Adds a new value to the window.
+    /// - Parameters:
+    ///   - value: The value.
+    ///   - sequence: A number identifying the value, increasing with each added value.
+    mutating func add(_ value: Double, sequence: Int) {
+        count += 1
+        sum += value
+        maxima.push(value, sequence: sequence)
+        minima.push(value, sequence: sequence)
+        histogram.add(value)
+    }
+    
+    /// Removes the oldest value from the window.
+    /// - Parameters:
+    ///   - value: The value, as it was added.
+    ///   - sequence: The number used to add the value.
+    mutating func removeOldest(_ value: Double, sequence: Int) {
+        count -= 1
+        // Floating point errors accumulate over time when adding and removing values,
+        // but they can be discarded every time the window is emptied.
+        sum = count == 0 ? 0 : sum - value
+        maxima.popFront(ifSequence: sequence)
+        minima.popFront(ifSequence: sequence)
+        histogram.remove(value)
+    }
+}
+
+// MARK: - MonotonicDeque
+
+/// A deque of the values in a sliding window that can be the window's maximum (or minimum)
+/// at some point in the future: a value is discarded as soon as a newer value is larger (or
+/// smaller), so the front of the deque is always the maximum (or minimum) of the window.
+struct MonotonicDeque: Sendable {
+    
+    private let keepsMaxima: Bool
+    private var values = [Double]()
+    private var sequences = [Int]()
+    /// Index of the front of the deque. Elements before it were already popped.
+    private var head = 0
+    
+    var front: Double? {
+        return head < values.count ? values[head] : nil
+    }
+    
+    init(keepsMaxima: Bool) {
+        self.keepsMaxima = keepsMaxima
+    }
+    
+    mutating func push(_ value: Double, sequence: Int) {
+        while values.count > head, keepsMaxima ? values[values.count - 1] <= value : values[values.count - 1] >= value {
+            values.removeLast()
+            sequences.removeLast()
+        }
+        values.append(value)
+        sequences.append(sequence)
+    }
+    
+    /// Pops the front of the deque, if it's the value identified by `sequence`. If it's not,
+    /// that value was already discarded when pushing a newer one.
+    mutating func popFront(ifSequence sequence: Int) {
+        guard head < values.count, sequences[head] == sequence else {
+            return
+        }
+        head += 1
+        // Compact the storage once most of it is popped elements, so the deque doesn't
+        // grow forever. Each element is moved at most once per compaction, which keeps
+        // popping amortized O(1).
+        if head == values.count {
+            values.removeAll(keepingCapacity: true)
+            sequences.removeAll(keepingCapacity: true)
+            head = 0
+        } else if head >= 32 && head * 2 >= values.count {
+            values.removeFirst(head)
+            sequences.removeFirst(head)
+            head = 0
+        }
+    }
+}
+
+// MARK: - LogHistogram
+
+/// A histogram with logarithmically-sized buckets, so all values are stored with the same
+/// relative precision, used to estimate quantiles of a sliding window.
+struct LogHistogram: Sendable {
+    
+    /// Values below this one (zero included) are counted as zero.
+    private static let minimumValue = 1e-4
+    /// Ratio between the bounds of consecutive buckets.
+    private static let growthFactor = 1.05
+    private static let logGrowthFactor = log(growthFactor)
+    /// Enough buckets to cover values up to ~1kW, which is larger than any expected power.
+    private static let bucketCount = Int((log(1e3 / minimumValue) / logGrowthFactor).rounded(.up))
+    
+    private var zeroCount = 0
+    private var buckets = [Int32](repeating: 0, count: bucketCount)
+    
+    private static func bucket(for value: Double) -> Int? {
+        guard value >= minimumValue else {
+            return nil
+        }
+        let bucket = Int(log(value / minimumValue) / logGrowthFactor)
+        return Swift.min(bucket, bucketCount - 1)
+    }
+    
+    mutating func add(_ value: Double) {
+        if let bucket = Self.bucket(for: value) {
+            buckets[bucket] += 1
+        } else {
+            zeroCount += 1
+        }
+    }
+    
+    mutating func remove(_ value: Double) {
+        if let bucket = Self.bucket(for: value) {
+            buckets[bucket] -= 1
+        } else {
+            zeroCount -= 1
+        }
+    }
+    
+    /// The given quantile of the `count` values in the histogram, estimated as the geometric
+    /// midpoint of the bucket containing it.
+    func quantile(_ quantile: Double, count: Int) -> Double {
+        let rank = Int((quantile * Double(count - 1)).rounded(.down))
+        var seen = zeroCount
+        guard rank >= seen else {
+            return .zero
+        }
+        for bucket in 0..<buckets.count {
+            seen += Int(buckets[bucket])
+            if rank < seen {
+                return Self.minimumValue * pow(Self.growthFactor, Double(bucket) + 0.5)
+            }
+        }
+        return Self.minimumValue * pow(Self.growthFactor, Double(buckets.count))
+    }
+}
@@ -0,0 +1,356 @@
+//
+//  ProfileDiff.swift
+//
+
+import Foundation
+
+/// How the frames of two profiles are matched when comparing them.
+public enum FrameMatching: Sendable {
+    /// Frames match if they're at the same offset of the same symbol (or of the same image,
+    /// for addresses without a symbol). Raw addresses are never compared, so different ASLR
+    /// slides don't matter.
+    case symbolAndOffset
+    /// Frames match if they're in the same symbol, regardless of the offset. Use this to
+    /// compare different builds, where the code of a symbol may have moved.
+    case symbol
+}
+
+/// An error reading a profile.
+public enum ProfileReadError: Error {
+    /// The file couldn't be read.
+    case cannotReadFile
+    /// A line of the file is not a folded stack followed by its weight.
+    case invalidLine(Int)
+}
+
+// MARK: - ProfileTree
+
+/// A call tree whose frames are identified by name (symbol and offset) instead of by address,
+/// so trees of different runs or builds of the app can be compared (see `ProfileDiff`).
+///
+/// Like `BacktraceGraph`, nodes are stored in contiguous arrays, always after their parent,
+/// and the child of a node for a given frame is found through a hash table. Frame names are
+/// stored once, and nodes reference them by frame ID.
+public struct ProfileTree: Sendable {
+    
+    /// The index of a node in the tree.
+    public typealias NodeIndex = Int
+    
+    /// The virtual root, the parent of all top level nodes.
+    static let root: NodeIndex = 0
+    /// Marks the absence of a node.
+    static let noNode: NodeIndex = -1
+    
+    /// The number of nodes in the tree.
+    public var nodeCount: Int {
+        return frames.count - 1
+    }
+    
+    /// The energy of all the backtraces of the tree, in Watts-hour.
+    public var totalEnergy: Energy {
+        return selfEnergies.reduce(.zero, +)
+    }
+    
+    /// The distinct frame names, by frame ID.
+    private(set) var frameNames = [String]()
+    private var frameIDByName = [String: Int]()
+    /// The frame ID of each node.
+    private(set) var frames = [-1]
+    private(set) var parents = [ProfileTree.noNode]
+    private(set) var firstChild = [ProfileTree.noNode]
+    private(set) var nextSibling = [ProfileTree.noNode]
+    /// Energy of the backtraces whose innermost frame is the node.
+    private(set) var selfEnergies: [Energy] = [.zero]
+    private var childIndex = [ChildKey: NodeIndex]()
+    
+    private struct ChildKey: Hashable {
+        let parent: NodeIndex
+        let frame: Int
+    }
+    
+    /// Creates an empty tree.
+    public init() {}
+    
+    /// Reads a tree from a file of folded stacks weighted by energy, as written by
+    /// `SymbolicateBacktraces.exportFoldedStacks(to:weight:)`.
+    ///
+    /// Frames are matched by the names in the file, so compare the tree with trees built
+    /// using `FrameMatching.symbol`, which names frames the same way.
+    /// - Parameter url: The file URL of the folded stacks.
+    public init(foldedStacks url: URL) throws {
+        guard let data = try? Data(contentsOf: url, options: .mappedIfSafe) else {
+            throw ProfileReadError.cannotReadFile
+        }
+        var lineNumber = 0
+        for line in data.split(separator: UInt8(ascii: "\n")) {
+            lineNumber += 1
+            guard let weightStart = line.lastIndex(of: UInt8(ascii: " ")),
+                  let nanojoules = Double(String(decoding: line[(weightStart + 1)...], as: UTF8.self)) else {
+                throw ProfileReadError.invalidLine(lineNumber)
+            }
+            var node = Self.root
+            for frameName in line[..<weightStart].split(separator: UInt8(ascii: ";")) {
+                node = child(of: node, frame: frameID(for: String(decoding: frameName, as: UTF8.self)))
+            }
+            addSelf(node, energy: nanojoules / nanojoulesPerWattHour)
+        }
+    }
+    
+    /// The name of the given node's frame.
+    public func frameName(of node: NodeIndex) -> String {
+        return frameNames[frames[node]]
+    }
+    
+    /// Visits every node of the tree in depth-first order, parents before children, without
+    /// recursion.
+    /// - Parameter body: Called with each node and its depth (0 for the top level nodes).
+    public func forEachNode(_ body: (_ node: NodeIndex, _ depth: Int) -> Void) {
+        var stack = [(node: NodeIndex, depth: Int)]()
+        var child = firstChild[Self.root]
+        while child != Self.noNode {
+            stack.append((child, 0))
+            child = nextSibling[child]
+        }
+        while let entry = stack.popLast() {
+            body(entry.node, entry.depth)
+            var child = firstChild[entry.node]
+            while child != Self.noNode {
+                stack.append((child, entry.depth + 1))
+                child = nextSibling[child]
+            }
+        }
+    }
+    
+    // MARK: - Building
+    
+    /// The ID of a frame name, added to the tree if it's new.
+    mutating func frameID(for name: String) -> Int {
+        if let frameID = frameIDByName[name] {
+            return frameID
+        }
+        let frameID = frameNames.count
+        frameNames.append(name)
+        frameIDByName[name] = frameID
+        return frameID
+    }
+    
+    /// The child of a node for the given frame, created if it doesn't exist.
+    mutating func child(of parent: NodeIndex, frame: Int) -> NodeIndex {
+        let key = ChildKey(parent: parent, frame: frame)
+        if let child = childIndex[key] {
+            return child
+        }
+        let child = frames.count
+        frames.append(frame)
+        parents.append(parent)
+        firstChild.append(Self.noNode)
+        nextSibling.append(firstChild[parent])
+        firstChild[parent] = child
+        selfEnergies.append(.zero)
+        childIndex[key] = child
+        return child
+    }
+    
+    /// Adds energy to the backtraces whose innermost frame is the given node.
+    mutating func addSelf(_ node: NodeIndex, energy: Energy) {
+        selfEnergies[node] += energy
+    }
+    
+    /// The name of a frame, as used to match it with `matching`. `;` separates frames in
+    /// folded stacks, so it's replaced in symbol names.
+    static func frameName(address: BacktraceAddress, info: SymbolicatedInfo?, matching: FrameMatching) -> String {
+        guard let info else {
+            return "0x\(String(address, radix: 16))"
+        }
+        guard let symbolName = info.symbolName else {
+            return "\(info.imageName)+0x\(String(info.addressInImage, radix: 16))"
+        }
+        let name = symbolName.replacingOccurrences(of: ";", with: ":")
+        switch matching {
+        case .symbolAndOffset:
+            return "\(name)+0x\(String(info.addressInSymbol, radix: 16))"
+        case .symbol:
+            return name
+        }
+    }
+}
+
+// MARK: - ProfileDiff
+
+/// The comparison of two call trees (ie: before and after a change): a tree with the nodes of
+/// both, and the energy of each node in each of them.
+///
+/// The trees are merged in a single pass over each of them, matching the nodes by the path of
+/// frame names from the top level, so the cost is linear in the number of nodes of both.
+public struct ProfileDiff: Sendable {
+    
+    /// The index of a node in the diff.
+    public typealias NodeIndex = ProfileTree.NodeIndex
+    
+    /// The energy of a node in each of the compared trees.
+    public struct Entry: Sendable {
+        /// The node of the diff this entry comes from.
+        public let node: NodeIndex
+        /// The name of the node's frame.
+        public let frameName: String
+        /// The energy of all the backtraces that include the node, in the base tree.
+        public let baseEnergy: Energy
+        /// The energy of all the backtraces that include the node, in the current tree.
+        public let currentEnergy: Energy
+        /// The energy of the backtraces whose innermost frame is the node, in the base tree.
+        public let baseSelfEnergy: Energy
+        /// The energy of the backtraces whose innermost frame is the node, in the current
+        /// tree.
+        public let currentSelfEnergy: Energy
+        
+        /// The change of the node's energy, positive if it used more energy in the current tree.
+        public var delta: Energy {
+            return currentEnergy - baseEnergy
+        }
+        
+        /// The change of the node's energy relative to the base tree (ie: `0.1` for 10% more
+        /// energy), or `nil` if the node is not in the base tree.
+        public var relativeChange: Double? {
+            guard baseEnergy > 0 else {
+                return nil
+            }
+            return delta / baseEnergy
+        }
+    }
+    
+    /// The nodes of both trees, with the energies of the current tree.
+    private(set) var tree: ProfileTree
+    /// The energy of the backtraces whose innermost frame is each node, in the base tree.
+    private(set) var baseSelfEnergies: [Energy]
+    /// The energy of all the backtraces that include each node, in each tree.
+    private var baseEnergies: [Energy]
+    private var currentEnergies: [Energy]
+    
+    /// The number of nodes in the diff.
+    public var nodeCount: Int {
+        return tree.nodeCount
+    }
+    
+    /// The top level nodes.
+    public var roots: [Entry] {
+        return children(of: ProfileTree.root)
+    }
+    
+    /// Compares two call trees.
+    /// - Parameters:
+    ///   - base: The tree to compare against (ie: before a change).
+    ///   - current: The tree being compared (ie: after a change).
+    public init(base: ProfileTree, current: ProfileTree) {
+        var tree = ProfileTree()
+        let baseNodes = Self.merge(base, into: &tree)
+        var baseSelfEnergies = [Energy](repeating: .zero, count: tree.frames.count)
+        for node in 1..<base.frames.count {
+            baseSelfEnergies[baseNodes[node]] += base.selfEnergies[node]
+        }
+        let currentNodes = Self.merge(current, into: &tree)
+        for node in 1..<current.frames.count {
+            tree.addSelf(currentNodes[node], energy: current.selfEnergies[node])
+        }
+        // Nodes of the current tree were appended after the base tree's ones.
+        baseSelfEnergies.append(contentsOf: repeatElement(.zero, count: tree.frames.count - baseSelfEnergies.count))
+        
+        // Nodes are always appended after their parent, so visiting them in reverse order
+        // visits every child before its parent.
+        var baseEnergies = baseSelfEnergies
+        var currentEnergies = tree.selfEnergies
+        for node in stride(from: tree.frames.count - 1, to: ProfileTree.root, by: -1) {
+            let parent = tree.parents[node]
+            baseEnergies[parent] += baseEnergies[node]
+            currentEnergies[parent] += currentEnergies[node]
+        }
+        self.tree = tree
+        self.baseSelfEnergies = baseSelfEnergies
+        self.baseEnergies = baseEnergies
+        self.currentEnergies = currentEnergies
+    }
+    
+    /// The energy of the given node in each tree.
+    public func entry(for node: NodeIndex) -> Entry {
+        return Entry(
+            node: node,
+            frameName: tree.frameName(of: node),
+            baseEnergy: baseEnergies[node],
+            currentEnergy: currentEnergies[node],
+            baseSelfEnergy: baseSelfEnergies[node],
+            currentSelfEnergy: tree.selfEnergies[node]
+        )
+    }
+    
+    /// The nodes that were called from the given node.
+    public func children(of node: NodeIndex) -> [Entry] {
+        var children = [Entry]()
+        var child = tree.firstChild[node]
+        while child != ProfileTree.noNode {
+            children.append(entry(for: child))
+            child = tree.nextSibling[child]
+        }
+        return children
+    }
+    
+    /// The nodes whose energy changed the most, in either direction.
+    /// - Parameter count: The maximum number of nodes returned.
+    public func largestChanges(count: Int) -> [Entry] {
+        return (1..<tree.frames.count)
+            .sorted { abs(currentEnergies[$0] - baseEnergies[$0]) > abs(currentEnergies[$1] - baseEnergies[$1]) }
+            .prefix(count)
+            .map { entry(for: $0) }
+    }
+    
+    /// Visits every node of the diff in depth-first order, parents before children, without
+    /// recursion.
+    /// - Parameter body: Called with each node and its depth (0 for the top level nodes).
+    public func forEachNode(_ body: (_ node: NodeIndex, _ depth: Int) -> Void) {
+        tree.forEachNode(body)
+    }
+    
+    // MARK: - Private
+    
+    /// Adds the nodes of a tree to another one, matching them by frame name.
+    /// - Returns: The node of `merged` for each node of `tree`.
+    private static func merge(_ tree: ProfileTree, into merged: inout ProfileTree) -> [NodeIndex] {
+        // Frame names are only hashed once per distinct frame, not once per node.
+        let mergedFrames = tree.frameNames.map { merged.frameID(for: $0) }
+        var mergedNodes = [NodeIndex](repeating: ProfileTree.root, count: tree.frames.count)
+        for node in 1..<tree.frames.count {
+            mergedNodes[node] = merged.child(of: mergedNodes[tree.parents[node]], frame: mergedFrames[tree.frames[node]])
+        }
+        return mergedNodes
+    }
+}
+
+// MARK: - SymbolicateBacktraces
+
+extension SymbolicateBacktraces {
+    
+    /// Builds a call tree of the backtrace graph that can be compared with the trees of other
+    /// runs (see `ProfileDiff`).
+    ///
+    /// Each distinct address is symbolicated once. Nodes of the graph whose addresses have the
+    /// same frame name (ie: different offsets of a symbol, with `FrameMatching.symbol`) are
+    /// merged.
+    /// - Parameter matching: How frames are named, and so how they're matched.
+    public func profileTree(matching: FrameMatching = .symbolAndOffset) -> ProfileTree {
+        let snapshot = backtraceGraph.snapshot()
+        let symbols = profileSymbols(for: snapshot)
+        var tree = ProfileTree()
+        let frameIDs = symbols.addresses.indices.map { index in
+            tree.frameID(for: ProfileTree.frameName(address: symbols.addresses[index], info: symbols.infos[index], matching: matching))
+        }
+        // The tree node of each frame of the current node's backtrace.
+        var path = [ProfileTree.NodeIndex]()
+        snapshot.forEachNode { node, depth in
+            path.removeLast(path.count - depth)
+            let parent = path.last ?? ProfileTree.root
+            let frameID = frameIDs[symbols.indexByAddress[snapshot.address(of: node)]!]
+            let child = tree.child(of: parent, frame: frameID)
+            tree.addSelf(child, energy: snapshot.selfEnergy(of: node))
+            path.append(child)
+        }
+        return tree
+    }
+}
@@ -0,0 +1,478 @@
+//
+//  ProfileExport.swift
+//
+
+import Foundation
+import SampleThreads
+
+/// An error exporting a profile.
+public enum ProfileExportError: Error {
+    /// The file couldn't be created.
+    case cannotCreateFile
+    /// Writing to the file failed, so it's not complete.
+    case writeFailed
+}
+
+/// The value each backtrace is weighted by in a folded-stack export.
+public enum FoldedStackWeight: Sendable {
+    /// The energy used while the backtrace was sampled, in nanojoules.
+    case energy
+    /// The number of times the backtrace was sampled.
+    case sampleCount
+}
+
+/// Energies are exported as an integer number of nanojoules.
+let nanojoulesPerWattHour: Double = 3.6e12
+
+extension SymbolicateBacktraces {
+    
+    // MARK: - Folded stacks
+    
+    /// Exports the backtrace graph as folded stacks, the text format read by flame graph
+    /// tools (ie: `flamegraph.pl`, speedscope): a line for each backtrace with its frames from
+    /// the outermost one, separated by `;`, followed by its weight.
+    ///
+    /// The graph is walked without recursion, writing each line as soon as it's found, and
+    /// only the line of the current node is kept in memory. Each distinct address is
+    /// symbolicated once.
+    /// - Parameters:
+    ///   - url: The file URL to export to. Any file at that URL is replaced.
+    ///   - weight: The value each backtrace is weighted by.
+    public func exportFoldedStacks(to url: URL, weight: FoldedStackWeight = .energy) throws {
+        let snapshot = backtraceGraph.snapshot()
+        let symbols = profileSymbols(for: snapshot)
+        let frameNames = symbols.addresses.indices.map { index in
+            Array(ProfileTree.frameName(address: symbols.addresses[index], info: symbols.infos[index], matching: .symbol).utf8)
+        }
+        
+        let sink = try ProfileSink(url: url, gzip: false)
+        // The frames of the current node's backtrace, and the length of the line up to the
+        // frame at each depth.
+        var line = [UInt8]()
+        var frameEnds = [Int]()
+        snapshot.forEachNode { node, depth in
+            frameEnds.removeLast(frameEnds.count - depth)
+            line.removeLast(line.count - (frameEnds.last ?? 0))
+            if depth > 0 {
+                line.append(UInt8(ascii: ";"))
+            }
+            line.append(contentsOf: frameNames[symbols.indexByAddress[snapshot.address(of: node)]!])
+            frameEnds.append(line.count)
+            
+            let value = switch weight {
+            case .energy:
+                Int64((snapshot.selfEnergy(of: node) * nanojoulesPerWattHour).rounded())
+            case .sampleCount:
+                Int64(snapshot.selfSampleCount(of: node))
+            }
+            if value > 0 {
+                sink.write(line)
+                sink.write(" \(value)\n")
+            }
+        }
+        try sink.close()
+    }
+    
+    // MARK: - pprof
+    
+    /// Exports the backtrace graph as a gzip-compressed pprof profile (see
+    /// `github.com/google/pprof/proto/profile.proto`), with the energy (in nanojoules) and
+    /// the number of samples of each backtrace.
+    ///
+    /// Every distinct address is a location, and locations are grouped into a function for
+    /// each distinct symbol and a mapping for each image, so symbol information is only
+    /// written once. The graph is walked without recursion, writing each sample as soon as
+    /// it's found.
+    /// - Parameter url: The file URL to export to. Any file at that URL is replaced.
+    public func exportPprof(to url: URL) throws {
+        let snapshot = backtraceGraph.snapshot()
+        let symbols = profileSymbols(for: snapshot)
+        
+        let sink = try ProfileSink(url: url, gzip: true)
+        var strings = ProtobufStringTable()
+        var message = ProtobufWriter()
+        var field = ProtobufWriter()
+        
+        // Profile.sample_type
+        for (type, unit) in [("energy", "nanojoules"), ("samples", "count")] {
+            let typeIndex = strings.index(of: type, sink: sink)
+            let unitIndex = strings.index(of: unit, sink: sink)
+            message.reset()
+            message.writeVarintField(1, UInt64(typeIndex))
+            message.writeVarintField(2, UInt64(unitIndex))
+            field.reset()
+            field.writeMessageField(1, message)
+            sink.write(field.bytes)
+        }
+        
+        // Profile.mapping, Profile.function and Profile.location
+        var mappingByImage = [String: UInt64]()
+        var functionBySymbol = [FunctionKey: UInt64]()
+        for index in symbols.addresses.indices {
+            let locationID = UInt64(index + 1)
+            var mappingID: UInt64 = 0
+            var functionID: UInt64 = 0
+            if let info = symbols.infos[index] {
+                if let existingID = mappingByImage[info.imageName] {
+                    mappingID = existingID
+                } else {
+                    mappingID = UInt64(mappingByImage.count + 1)
+                    mappingByImage[info.imageName] = mappingID
+                    let filenameIndex = strings.index(of: info.imageName, sink: sink)
+                    message.reset()
+                    message.writeVarintField(1, mappingID)
+                    message.writeVarintField(5, UInt64(filenameIndex))
+                    message.writeVarintField(7, 1)
+                    field.reset()
+                    field.writeMessageField(3, message)
+                    sink.write(field.bytes)
+                }
+                if let symbolName = info.symbolName {
+                    let key = FunctionKey(imageName: info.imageName, symbolName: symbolName)
+                    if let existingID = functionBySymbol[key] {
+                        functionID = existingID
+                    } else {
+                        functionID = UInt64(functionBySymbol.count + 1)
+                        functionBySymbol[key] = functionID
+                        let nameIndex = strings.index(of: symbolName, sink: sink)
+                        let filenameIndex = strings.index(of: info.imageName, sink: sink)
+                        message.reset()
+                        message.writeVarintField(1, functionID)
+                        message.writeVarintField(2, UInt64(nameIndex))
+                        message.writeVarintField(3, UInt64(nameIndex))
+                        message.writeVarintField(4, UInt64(filenameIndex))
+                        field.reset()
+                        field.writeMessageField(5, message)
+                        sink.write(field.bytes)
+                    }
+                }
+            }
+            message.reset()
+            message.writeVarintField(1, locationID)
+            if mappingID != 0 {
+                message.writeVarintField(2, mappingID)
+            }
+            message.writeVarintField(3, symbols.addresses[index])
+            if functionID != 0 {
+                // Location.line, with a single Line.function_id.
+                var line = ProtobufWriter()
+                line.writeVarintField(1, functionID)
+                message.writeMessageField(4, line)
+            }
+            field.reset()
+            field.writeMessageField(4, message)
+            sink.write(field.bytes)
+        }
+        
+        // Profile.sample
+        var locationPath = [UInt64]()
+        var packed = ProtobufWriter()
+        snapshot.forEachNode { node, depth in
+            locationPath.removeLast(locationPath.count - depth)
+            locationPath.append(UInt64(symbols.indexByAddress[snapshot.address(of: node)]! + 1))
+            
+            let energy = Int64((snapshot.selfEnergy(of: node) * nanojoulesPerWattHour).rounded())
+            let sampleCount = Int64(snapshot.selfSampleCount(of: node))
+            guard energy > 0 || sampleCount > 0 else {
+                return
+            }
+            message.reset()
+            // Sample.location_id, innermost location first.
+            packed.reset()
+            for locationID in locationPath.reversed() {
+                packed.writeVarint(locationID)
+            }
+            message.writeBytesField(1, packed.bytes)
+            // Sample.value, in the order of Profile.sample_type.
+            packed.reset()
+            packed.writeVarint(UInt64(bitPattern: energy))
+            packed.writeVarint(UInt64(bitPattern: sampleCount))
+            message.writeBytesField(2, packed.bytes)
+            field.reset()
+            field.writeMessageField(2, message)
+            sink.write(field.bytes)
+        }
+        
+        // Profile.default_sample_type
+        let energyIndex = strings.index(of: "energy", sink: sink)
+        field.reset()
+        field.writeVarintField(14, UInt64(energyIndex))
+        sink.write(field.bytes)
+        try sink.close()
+    }
+    
+    // MARK: - Private
+    
+    /// The distinct addresses of a graph snapshot, with their symbol information.
+    struct ProfileSymbols {
+        var addresses = [BacktraceAddress]()
+        var indexByAddress = [BacktraceAddress: Int]()
+        var infos = [SymbolicatedInfo?]()
+    }
+    
+    private struct FunctionKey: Hashable {
+        let imageName: String
+        let symbolName: String
+    }
+    
+    /// Finds the distinct addresses of a graph snapshot, and symbolicates them in a single
+    /// batch.
+    func profileSymbols(for snapshot: BacktraceGraph.Snapshot) -> ProfileSymbols {
+        var symbols = ProfileSymbols()
+        snapshot.forEachNode { node, _ in
+            let address = snapshot.address(of: node)
+            if symbols.indexByAddress[address] == nil {
+                symbols.indexByAddress[address] = symbols.addresses.count
+                symbols.addresses.append(address)
+            }
+        }
+        symbols.infos = symbolicate(symbols.addresses)
+        return symbols
+    }
+}
+
+// MARK: - ProfileDiff
+
+extension ProfileDiff {
+    
+    /// Exports the diff as differential folded stacks, the format read by `flamegraph.pl`
+    /// (and written by `difffolded.pl`): a line for each backtrace with its frames, followed by
+    /// its energy in the base tree and in the current tree, in nanojoules.
+    /// - Parameter url: The file URL to export to. Any file at that URL is replaced.
+    public func exportFoldedStacks(to url: URL) throws {
+        let frameNames = tree.frameNames.map { Array($0.utf8) }
+        
+        let sink = try ProfileSink(url: url, gzip: false)
+        var line = [UInt8]()
+        var frameEnds = [Int]()
+        forEachNode { node, depth in
+            frameEnds.removeLast(frameEnds.count - depth)
+            line.removeLast(line.count - (frameEnds.last ?? 0))
+            if depth > 0 {
+                line.append(UInt8(ascii: ";"))
+            }
+            line.append(contentsOf: frameNames[tree.frames[node]])
+            frameEnds.append(line.count)
+            
+            let baseValue = Int64((baseSelfEnergies[node] * nanojoulesPerWattHour).rounded())
+            let currentValue = Int64((tree.selfEnergies[node] * nanojoulesPerWattHour).rounded())
+            if baseValue > 0 || currentValue > 0 {
+                sink.write(line)
+                sink.write(" \(baseValue) \(currentValue)\n")
+            }
+        }
+        try sink.close()
+    }
+    
+    /// Exports the diff as a gzip-compressed pprof profile with the energy of each backtrace
+    /// in the base tree, in the current tree, and its change (the default sample type), in
+    /// nanojoules.
+    ///
+    /// Frames are only known by name, so every distinct frame is a location with a function of
+    /// that name, and there are no mappings.
+    /// - Parameter url: The file URL to export to. Any file at that URL is replaced.
+    public func exportPprof(to url: URL) throws {
+        let sink = try ProfileSink(url: url, gzip: true)
+        var strings = ProtobufStringTable()
+        var message = ProtobufWriter()
+        var field = ProtobufWriter()
+        
+        // Profile.sample_type
+        for type in ["base_energy", "energy", "energy_delta"] {
+            let typeIndex = strings.index(of: type, sink: sink)
+            let unitIndex = strings.index(of: "nanojoules", sink: sink)
+            message.reset()
+            message.writeVarintField(1, UInt64(typeIndex))
+            message.writeVarintField(2, UInt64(unitIndex))
+            field.reset()
+            field.writeMessageField(1, message)
+            sink.write(field.bytes)
+        }
+        
+        // Profile.function and Profile.location, with the same ID for each frame.
+        for (frame, frameName) in tree.frameNames.enumerated() {
+            let id = UInt64(frame + 1)
+            let nameIndex = strings.index(of: frameName, sink: sink)
+            message.reset()
+            message.writeVarintField(1, id)
+            message.writeVarintField(2, UInt64(nameIndex))
+            message.writeVarintField(3, UInt64(nameIndex))
+            field.reset()
+            field.writeMessageField(5, message)
+            sink.write(field.bytes)
+            
+            var line = ProtobufWriter()
+            line.writeVarintField(1, id)
+            message.reset()
+            message.writeVarintField(1, id)
+            message.writeMessageField(4, line)
+            field.reset()
+            field.writeMessageField(4, message)
+            sink.write(field.bytes)
+        }
+        
+        // Profile.sample
+        var locationPath = [UInt64]()
+        var packed = ProtobufWriter()
+        forEachNode { node, depth in
+            locationPath.removeLast(locationPath.count - depth)
+            locationPath.append(UInt64(tree.frames[node] + 1))
+            
+            let baseEnergy = Int64((baseSelfEnergies[node] * nanojoulesPerWattHour).rounded())
+            let currentEnergy = Int64((tree.selfEnergies[node] * nanojoulesPerWattHour).rounded())
+            guard baseEnergy > 0 || currentEnergy > 0 else {
+                return
+            }
+            message.reset()
+            // Sample.location_id, innermost location first.
+            packed.reset()
+            for locationID in locationPath.reversed() {
+                packed.writeVarint(locationID)
+            }
+            message.writeBytesField(1, packed.bytes)
+            // Sample.value, in the order of Profile.sample_type. Negative values are
+            // encoded as their two's complement, like any int64.
+            packed.reset()
+            packed.writeVarint(UInt64(bitPattern: baseEnergy))
+            packed.writeVarint(UInt64(bitPattern: currentEnergy))
+            packed.writeVarint(UInt64(bitPattern: currentEnergy - baseEnergy))
+            message.writeBytesField(2, packed.bytes)
+            field.reset()
+            field.writeMessageField(2, message)
+            sink.write(field.bytes)
+        }
+        
+        // Profile.default_sample_type
+        let deltaIndex = strings.index(of: "energy_delta", sink: sink)
+        field.reset()
+        field.writeVarintField(14, UInt64(deltaIndex))
+        sink.write(field.bytes)
+        try sink.close()
+    }
+}
+
+// MARK: - ProfileSink
+
+/// Buffers the output of an export, writing it to an `export_sink_t` in large blocks.
+private final class ProfileSink {
+    
+    private static let bufferSize = 64 * 1024
+    
+    private let sink: OpaquePointer
+    private var buffer = [UInt8]()
+    private var isClosed = false
+    
+    init(url: URL, gzip: Bool) throws {
+        let sink = url.withUnsafeFileSystemRepresentation { path -> OpaquePointer? in
+            guard let path else {
+                return nil
+            }
+            return export_sink_create(path, gzip)
+        }
+        guard let sink else {
+            throw ProfileExportError.cannotCreateFile
+        }
+        self.sink = sink
+        self.buffer.reserveCapacity(Self.bufferSize)
+    }
+    
+    deinit {
+        if !isClosed {
+            export_sink_close(sink)
+        }
+    }
+    
+    func write(_ bytes: [UInt8]) {
+        buffer.append(contentsOf: bytes)
+        if buffer.count >= Self.bufferSize {
+            flush()
+        }
+    }
+    
+    func write(_ string: String) {
+        buffer.append(contentsOf: string.utf8)
+        if buffer.count >= Self.bufferSize {
+            flush()
+        }
+    }
+    
+    /// Writes the pending output and closes the file.
+    func close() throws {
+        flush()
+        isClosed = true
+        guard export_sink_close(sink) else {
+            throw ProfileExportError.writeFailed
+        }
+    }
+    
+    private func flush() {
+        buffer.withUnsafeBufferPointer { bytes in
+            _ = export_sink_write(sink, bytes.baseAddress, bytes.count)
+        }
+        buffer.removeAll(keepingCapacity: true)
+    }
+}
+
+// MARK: - Protobuf
+
+/// Encodes protobuf fields into a byte buffer.
+private struct ProtobufWriter {
+    
+    private(set) var bytes = [UInt8]()
+    
+    mutating func reset() {
+        bytes.removeAll(keepingCapacity: true)
+    }
+    
+    mutating func writeVarint(_ value: UInt64) {
+        var value = value
+        while value >= 0x80 {
+            bytes.append(UInt8(truncatingIfNeeded: value) | 0x80)
+            value >>= 7
+        }
+        bytes.append(UInt8(value))
+    }
+    
+    mutating func writeVarintField(_ field: Int, _ value: UInt64) {
+        writeVarint(UInt64(field << 3))
+        writeVarint(value)
+    }
+    
+    mutating func writeBytesField(_ field: Int, _ payload: [UInt8]) {
+        writeVarint(UInt64(field << 3 | 2))
+        writeVarint(UInt64(payload.count))
+        bytes.append(contentsOf: payload)
+    }
+    
+    mutating func writeMessageField(_ field: Int, _ message: ProtobufWriter) {
+        writeBytesField(field, message.bytes)
+    }
+}
+
+/// The string table of a pprof profile (`Profile.string_table`), written to the sink as
+/// strings are first used.
+private struct ProtobufStringTable {
+    
+    private var indexByString = [String: Int]()
+    private var field = ProtobufWriter()
+    
+    /// The index of a string in the table, writing the string to the sink if it's new.
+    mutating func index(of string: String, sink: ProfileSink) -> Int {
+        if indexByString.isEmpty {
+            // The first string of the table must be the empty string.
+            indexByString[""] = 0
+            field.reset()
+            field.writeBytesField(6, [])
+            sink.write(field.bytes)
+        }
+        if let index = indexByString[string] {
+            return index
+        }
+        let index = indexByString.count
+        indexByString[string] = index
+        field.reset()
+        field.writeBytesField(6, Array(string.utf8))
+        sink.write(field.bytes)
+        return index
+    }
+}
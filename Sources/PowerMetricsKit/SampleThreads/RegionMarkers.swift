@@ -0,0 +1,29 @@
+//
+//  RegionMarkers.swift
+//
+
+import Foundation
+import SampleThreads
+
+/// Runs `body` in a region of the app (ie: a request type or a pipeline stage), so the energy
+/// of the calling thread is attributed to the region while it runs (see
+/// `SampleThreadsResult.regions`).
+///
+/// Marking a region only stores the region in a slot of the calling thread, without any lock,
+/// so it can be used on hot paths. Regions nest: the enclosing region becomes the current one
+/// again when `body` returns. As the region belongs to the calling thread, `body` can't be
+/// `async`: it could resume on another thread.
+/// - Parameters:
+///   - name: The name of the region. Regions with the same name are aggregated together.
+///   - body: The work done in the region.
+public func withEnergyRegion<T>(_ name: StaticString, _ body: () throws -> T) rethrows -> T {
+    // Static strings are stored NUL-terminated for the lifetime of the process, which is
+    // what the sampler needs to read them at any time.
+    precondition(name.hasPointerRepresentation, "Region names must be string literals")
+    let region = UnsafeRawPointer(name.utf8Start).assumingMemoryBound(to: CChar.self)
+    let previous = sample_region_begin(region)
+    defer {
+        sample_region_end(previous)
+    }
+    return try body()
+}
@@ -16,6 +16,9 @@ import SampleThreads
 /// The main class interfacing with the C code that retrieves the energy data.
 @SampleThreadsActor public final class SampleThreadsManager {
     
+    /// The number of raw thread samples kept in `rawSamples`.
+    private static let rawSampleCapacity = 4096
+    
     // MARK: - Public properties
     
     /// The configuration of the thread sampling.
@@ -24,52 +27,121 @@ import SampleThreads
     public private(set) var currentThreadCount: Int = 1
     /// Total energy used by the app since launch, in Watts-hour.
     public private(set) var totalEnergyUsage: Energy = 0
+    /// Energy used by each region of the app (see `withEnergyRegion(_:_:)`) since launch, in
+    /// Watts-hour.
+    public private(set) var regionEnergyUsage = [String: Energy]()
     /// Historic power figures for the app.
     public let history: SampledResultsHistory
+    /// The latest raw samples of each thread, which can be read from any thread without
+    /// blocking the sampler.
+    public let rawSamples: ThreadSampleRing
     
     // MARK: - Private properties
     
-    private var samplingTask: Task<Void, Never>?
-    private var continuousClock = ContinuousClock()
-    private var lastSampleTime: ContinuousClock.Instant?
-    private var previousRawSamples = [UInt64: sampled_thread_info_t]()
-    /// Maps a unique thread ID with a counter that increases by `1` every time a new thread appears.
-    private var threadIDToCounter = [UInt64: Int]()
+    /// Drives `sampleThreads` periodically while sampling is started.
+    private var scheduler: SamplingScheduler?
+    /// The C sampling session, which owns the memory the samples are written to.
+    private var session: OpaquePointer?
+    /// The PID sampled by `session`.
+    private var sessionPID: Int32?
+    /// Maps the slot of each thread in `session` with a counter that increases by `1` every
+    /// time a new thread appears.
+    private var slotToCounter = [Int]()
     /// The last value of the counter used to map thread IDs to a monotonously increasing counter.
     private var lastCounter: Int = 0
+    /// The number of stacks of `session` already sent to `SymbolicateBacktraces`.
+    private var knownStackCount: Int = 0
+    /// The names of the name table of `session`, indexed by name ID. Each name is only
+    /// converted to a `String` once, the first time a sample references it.
+    private var threadNames = [String]()
+    /// The C capture writer the samples of `session` are recorded to, if recording.
+    private var captureWriter: OpaquePointer?
+    /// Set when a recording starts, to empty the stack and name tables of `session` before the
+    /// next sample. Otherwise, the tables keep every stack and name seen while sampling.
+    private var resetTablesBeforeNextSample = false
     
     // MARK: - Init
     
     nonisolated public init(config: PowerMetricsConfig = .default) {
         self.config = config
-        self.history = SampledResultsHistory(numerOfStoredSamples: config.numberOfStoredSamples)
+        self.history = SampledResultsHistory(
+            numerOfStoredSamples: config.numberOfStoredSamples,
+            tiers: config.historyTiers
+        )
+        self.rawSamples = ThreadSampleRing(capacity: Self.rawSampleCapacity)
+    }
+    
+    deinit {
+        scheduler?.stop()
+        if let captureWriter {
+            capture_writer_close(captureWriter)
+        }
+        sample_session_destroy(session)
     }
     
     // MARK: - Sampling
     
     /// Starts sampling CPU power used for the given PID.
+    ///
+    /// Samples are taken from a dedicated thread, every `config.samplingTime` seconds measured
+    /// from the first sample (so the time each sample takes doesn't delay the next ones). If
+    /// sampling uses more than `config.cpuBudget`, backtraces and dispatch queue names are
+    /// retrieved less often, and the time between samples is stretched.
     /// - Parameter pid: PID of the process to sample.
     public func startSampling(pid: Int32) {
-        guard self.samplingTask == nil else {
+        guard self.scheduler == nil, let scheduler = SamplingScheduler(config: config) else {
             return
         }
-        self.samplingTask = Task(priority: .high) { [weak self] in
-            while !Task.isCancelled {
-                guard let self else {
-                    return
-                }
-                await self.sampleThreads(pid)
-                try? await Task.sleep(
-                    for: .seconds(config.samplingTime),
-                    tolerance: .seconds(config.samplingTime * 0.01)
-                )
+        self.scheduler = scheduler
+        scheduler.start { [weak self] plan in
+            guard let self else {
+                return .zero
             }
+            let result = await self.sampleThreads(
+                pid,
+                retrieveDispatchQueueName: plan.retrieveDispatchQueueName,
+                retrieveBacktraces: plan.retrieveBacktraces
+            )
+            return result.samplerCPUTime
         }
     }
     
     /// Stop sampling threads.
     public func stopSampling() {
-        self.samplingTask?.cancel()
+        self.scheduler?.stop()
+        self.scheduler = nil
+    }
+    
+    // MARK: - Recording
+    
+    /// Starts recording every sample to a capture file, which can be read offline with
+    /// `capture_reader_open` (see `capture_file.h`). Any previous recording is stopped.
+    ///
+    /// Recording stops when the sampled PID changes, as a capture can only hold the samples
+    /// of a single session. Starting a recording also empties the stacks and names the session
+    /// has seen so far, so rotating captures keeps the memory used by the session bounded.
+    /// - Parameter url: The file URL of the capture. Any file at that URL is replaced.
+    /// - Returns: Whether the capture file could be created.
+    @discardableResult public func startRecording(to url: URL) -> Bool {
+        stopRecording()
+        resetTablesBeforeNextSample = true
+        captureWriter = url.withUnsafeFileSystemRepresentation { path in
+            guard let path else {
+                return nil
+            }
+            return capture_writer_create(path)
+        }
+        return captureWriter != nil
+    }
+    
+    /// Stops recording samples, completing the capture file.
+    /// - Returns: Whether the capture file was completed successfully.
+    @discardableResult public func stopRecording() -> Bool {
+        guard let captureWriter else {
+            return false
+        }
+        self.captureWriter = nil
+        return capture_writer_close(captureWriter)
     }
     
     /// Given the pid for a process, sample all the threads belonging to that process and
@@ -77,175 +149,319 @@ import SampleThreads
     /// - Parameter pid: The pid of the process to inspect.
     /// - Returns: A `SampleThreadsResult` object.
     @discardableResult public func sampleThreads(_ pid: Int32) async -> SampleThreadsResult {
-        let currentSampleTime = continuousClock.now
+        return await sampleThreads(
+            pid,
+            retrieveDispatchQueueName: config.retrieveDispatchQueueName,
+            retrieveBacktraces: config.retrieveBacktraces
+        )
+    }
+    
+    /// Samples all the threads of the given process, retrieving only the information planned
+    /// for this sample.
+    private func sampleThreads(_ pid: Int32, retrieveDispatchQueueName: Bool, retrieveBacktraces: Bool) async -> SampleThreadsResult {
+        if session == nil || sessionPID != pid {
+            if session != nil && knownStackCount > 0 {
+                await SymbolicateBacktraces.shared.resetStacks()
+            }
+            if session != nil {
+                stopRecording()
+            }
+            sample_session_destroy(session)
+            // The session copies the weights, so they only need to outlive its creation.
+            session = config.energyModel.weights.withUnsafeBufferPointer { weights in
+                let sessionConfig = sample_session_config_t(
+                    worker_count: UInt32(max(config.samplingWorkerCount, 0)),
+                    energy_model: config.energyModel.kind,
+                    energy_model_weights: weights.isEmpty ? nil : weights.baseAddress,
+                    energy_model_weight_count: UInt32(weights.count)
+                )
+                return sample_session_create_with_config(pid, sessionConfig)
+            }
+            sessionPID = pid
+            knownStackCount = 0
+            threadNames.removeAll()
+        }
+        guard let session else {
+            return .zero
+        }
+        if resetTablesBeforeNextSample {
+            // The IDs of the stacks and names are reused after the reset.
+            resetTablesBeforeNextSample = false
+            sample_session_reset_tables(session)
+            if knownStackCount > 0 {
+                await SymbolicateBacktraces.shared.resetStacks()
+            }
+            knownStackCount = 0
+            threadNames.removeAll()
+        }
+        // Everything from here to the point the backtraces are handed to
+        // SymbolicateBacktraces runs without suspending, so it runs on a single thread and
+        // its CPU time (plus that of the session's workers) can be measured.
+        let cpuTimeAtStart = sample_thread_cpu_time() + sample_session_worker_cpu_time(session)
+        
         // Invoke the C code in sample_threads.c that uses proc_pidinfo to retrieve
-        // performance counters including energy usage.
-        let result = sample_threads(pid, config.retrieveDispatchQueueName, config.retrieveBacktraces)
-        // This points directly to the C array.
-        let counters = UnsafeBufferPointer(start: result.cpu_counters, count: Int(result.thread_count))
-        // This creates a Swift copy of the C array.
-        let rawThreadSamples = [sampled_thread_info_t](counters.map({ $0.info }))
+        // performance counters including energy usage. The samples are written into
+        // memory owned by the session, which is reused between samples, and the session
+        // also computes the change of each counter since the previous sample.
+        let result = sample_session_sample_into(session, retrieveDispatchQueueName, retrieveBacktraces)
+        let postProcessStart = sampler_stats_now_ns()
+        // These point directly to the session's memory: no copies are made, but they're
+        // only valid until the next call to sample_session_sample_into.
+        let records = UnsafeBufferPointer(start: result.threads, count: Int(result.thread_count))
+        let events = UnsafeBufferPointer(start: result.events, count: Int(result.event_count))
+        rawSamples.push(records)
+        if let captureWriter {
+            let timeNanoseconds = UInt64(Date.now.timeIntervalSince1970 * 1_000_000_000)
+            withUnsafePointer(to: result) { result in
+                _ = capture_writer_append(captureWriter, result, timeNanoseconds)
+            }
+        }
         
-        let sampleTime = Date.now
-        var combinedPPower = 0.0
-        var combinedEPower = 0.0
-        var threadSamples = [ThreadSample]()
-        var threadEnergyChanges = [Energy]()
-        for rawThreadSample in rawThreadSamples.sorted(by: { $0.thread_id < $1.thread_id }) {
-            var threadCounter: Int
-            if let counter = threadIDToCounter[rawThreadSample.thread_id] {
-                threadCounter = counter
-            } else {
-                lastCounter += 1
-                threadIDToCounter[rawThreadSample.thread_id] = lastCounter
-                threadCounter = lastCounter
+        // Only new threads need to be assigned a counter. Slots are reused once a thread
+        // exits, so the counter of a slot is overwritten by the next thread that takes it.
+        for event in events where event.type == THREAD_EVENT_BIRTH {
+            let slot = Int(event.slot)
+            if slot >= slotToCounter.count {
+                slotToCounter.append(contentsOf: repeatElement(0, count: slot - slotToCounter.count + 1))
             }
-            let pthreadName = withUnsafePointer(to: rawThreadSample.pthread_name) { ptr in
-                let start = ptr.pointer(to: \.0)!
-                return String(cString: start)
+            lastCounter += 1
+            slotToCounter[slot] = lastCounter
+        }
+        
+        // Names are interned by the session, so only the ones that weren't seen before are
+        // converted to strings.
+        let nameCount = Int(name_table_count(result.names))
+        if nameCount > threadNames.count {
+            threadNames += (threadNames.count..<nameCount).map { nameIndex in
+                String(cString: name_table_name(result.names, name_id_t(nameIndex)))
             }
+        }
+        
+        let sampleTime = Date.now
+        var threadSamples = [ThreadSample]()
+        threadSamples.reserveCapacity(records.count)
+        for record in records where !record.is_new {
+            let pthreadName = threadName(record.pthread_name_id)
             
             // Retrieve the queue name only if configured to do so
             var dispatchQueueName: String?
-            if config.retrieveDispatchQueueName {
-                dispatchQueueName = withUnsafePointer(to: rawThreadSample.dispatch_queue_name) { ptr in
-                    let start = ptr.pointer(to: \.0)!
-                    return String(cString: start)
-                }
+            if retrieveDispatchQueueName {
+                dispatchQueueName = threadName(record.dispatch_queue_name_id)
             }
             
-            if let previousCounter = previousRawSamples[rawThreadSample.thread_id], let lastSampleTime {
-                let performancePower = computePower(
-                    previousTime: lastSampleTime,
-                    currentTime: currentSampleTime,
-                    previousCounters: previousCounter,
-                    currentCounter: rawThreadSample,
-                    type: .performance
-                )
-                let efficiencyPower = computePower(
-                    previousTime: lastSampleTime,
-                    currentTime: currentSampleTime,
-                    previousCounters: previousCounter,
-                    currentCounter: rawThreadSample,
-                    type: .efficiency
+            threadSamples.append(ThreadSample(
+                threadID: record.info.thread_id,
+                sampleTime: sampleTime,
+                pthreadName: pthreadName,
+                dispatchQueueName: dispatchQueueName,
+                region: threadName(record.region_name_id),
+                power: power(energy: clusterEnergies(record.deltas), interval: result.interval),
+                threadCounter: slotToCounter[Int(record.slot)]
+            ))
+        }
+        
+        // The session already added up the deltas of the threads in each region.
+        let regions = UnsafeBufferPointer(start: result.regions, count: Int(result.region_count))
+            .compactMap { region -> RegionSample? in
+                guard let name = threadName(region.name_id) else {
+                    return nil
+                }
+                let energy = clusterEnergies(region.deltas)
+                let totals = counterTotals(region.deltas)
+                return RegionSample(
+                    name: name,
+                    threadCount: Int(region.thread_count),
+                    power: power(energy: energy, interval: result.interval),
+                    energy: energy.sum() / 3600,
+                    cpuTime: totals.time,
+                    cycles: totals.cycles,
+                    instructions: totals.instructions
                 )
-                combinedPPower += performancePower.power
-                combinedEPower += efficiencyPower.power
-                
-                threadSamples.append(ThreadSample(
-                    threadID: rawThreadSample.thread_id, 
-                    sampleTime: sampleTime,
-                    pthreadName: pthreadName,
-                    dispatchQueueName: dispatchQueueName,
-                    power: CombinedPower(
-                        performance: performancePower.power,
-                        efficiency: efficiencyPower.power
-                    ),
-                    threadCounter: threadCounter
-                ))
-                threadEnergyChanges.append(performancePower.energy + efficiencyPower.energy)
             }
-        }
         
-        // Reset previous counters with the latest samples
-        self.previousRawSamples = [UInt64: sampled_thread_info_t]()
-        for counter in rawThreadSamples {
-            self.previousRawSamples[counter.thread_id] = counter
+        // Retrieve the backtraces only if planned for this sample
+        var stackSamples = [StackSample]()
+        var newStacks = [[BacktraceAddress]]()
+        if retrieveBacktraces {
+            // Each sample only carries the ID of its backtrace in the session's stack table,
+            // with the energy (in Watts-hour) used by its thread since the previous sample.
+            // Only the stacks that weren't seen before are copied to Swift.
+            let stackCount = Int(stack_table_count(result.stacks))
+            newStacks = (knownStackCount..<stackCount).map { stackIndex in
+                var length: UInt32 = 0
+                let addresses = stack_table_stack(result.stacks, StackID(stackIndex), &length)
+                return UnsafeBufferPointer(start: addresses, count: Int(length))
+                    .map { $0.address & UInt64(PAC_STRIPPING_BITMASK) }
+            }
+            knownStackCount = stackCount
+            stackSamples = records
+                .filter { $0.stack_id != StackID(STACK_ID_NONE) }
+                .map { record in
+                    StackSample(
+                        stackID: record.stack_id,
+                        energy: clusterEnergies(record.deltas).sum() / 3600
+                    )
+                }
         }
         
-        self.lastSampleTime = currentSampleTime
         self.currentThreadCount = Int(result.thread_count)
+        let allThreadsEnergy = clusterEnergies(result.deltas)
         let sampleResult = SampleThreadsResult(
             time: sampleTime,
-            allThreadsPower: CombinedPower(
-                performance: combinedPPower,
-                efficiency: combinedEPower
-            ), 
-            threadSamples: threadSamples
+            allThreadsPower: power(energy: allThreadsEnergy, interval: result.interval),
+            threadSamples: threadSamples,
+            regions: regions,
+            interval: result.interval,
+            samplerCPUTime: sample_thread_cpu_time() + sample_session_worker_cpu_time(session) - cpuTimeAtStart
         )
         
-        self.history.addSample(sampleResult)
-        self.totalEnergyUsage += sampleResult.allThreadsPower.total * config.samplingTime / 3600
-        
-        // Retrieve the backtraces only if configured to do so
-        if config.retrieveBacktraces {
-            // This creates a Swift copy of the backtraces.
-            let backtraces = [Backtrace](counters.map { counter in
-                let backtraceLength = counter.backtrace.length
-                let rawBacktrace = UnsafeBufferPointer(
-                    start: counter.backtrace.addresses,
-                    count: Int(backtraceLength)
-                )
-                let backtrace = Backtrace(
-                    addresses: [UInt64](rawBacktrace.map({ $0.address & UInt64(PAC_STRIPPING_BITMASK) })),
-                    energy: nil
-                )
-                if counter.backtrace.length != 0 {
-                    // Free the memory allocated with malloc in get_backtrace.c, as we've
-                    // created a copy for Swift code.
-                    free(counter.backtrace.addresses)
-                }
-                return backtrace
-            })
-            // Add power info to the backtraces
-            let backtracesWithPower = zip(backtraces, threadEnergyChanges).map { (backtrace, energy) in
-                return Backtrace(addresses: backtrace.addresses, energy: energy)
-            }
-            await SymbolicateBacktraces.shared.addToBacktraceGraph(backtracesWithPower)
+        // The energy used during the sample is measured directly, so it's correct even if
+        // the time between samples was not the configured sampling time.
+        let energy = allThreadsEnergy.sum() / 3600
+        self.history.addSample(sampleResult, energy: energy)
+        self.totalEnergyUsage += energy
+        for region in regions {
+            self.regionEnergyUsage[region.name, default: .zero] += region.energy
         }
+        sampler_stats_record_phase(
+            sample_session_stats(session),
+            SAMPLER_PHASE_POST_PROCESS,
+            sampler_stats_now_ns() - postProcessStart
+        )
         
-        // Free the memory allocated with malloc in sample_threads.c, as we've created
-        // a copy for Swift code.
-        free(result.cpu_counters)
+        if retrieveBacktraces {
+            await SymbolicateBacktraces.shared.addToBacktraceGraph(stackSamples, newStacks: newStacks)
+        }
         
         return sampleResult
     }
     
+    // MARK: - Sampler statistics
+    
+    /// The cost of the sampler itself (the time spent in each phase of sampling, and the
+    /// allocations and kernel calls made), since the sampled process last changed. `nil` if
+    /// no sample was taken yet.
+    public var samplerStatistics: SamplerStatistics? {
+        guard let session else {
+            return nil
+        }
+        return SamplerStatistics(sample_session_stats(session))
+    }
+    
+    /// Forgets the cost of the samples taken so far.
+    public func resetSamplerStatistics() {
+        guard let session else {
+            return
+        }
+        sampler_stats_reset(sample_session_stats(session))
+    }
+    
+    // MARK: - Thread names
+    
+    /// Makes the next sample read the names of all threads again. Names are cached between
+    /// samples, so call this after renaming a thread for the new name to show up right away.
+    public func invalidateThreadNames() {
+        guard let session else {
+            return
+        }
+        sample_session_invalidate_names(session)
+    }
+    
+    // MARK: - Core clusters
+    
+    /// The names of the core clusters the power of each `CombinedPower` is broken down by, from
+    /// the fastest to the most efficient cores, or `nil` if not sampling.
+    public var coreClusterNames: [String]? {
+        guard let session, let topology = sample_session_topology(session) else {
+            return nil
+        }
+        return withUnsafeBytes(of: topology.pointee.clusters) { bytes in
+            let clusters = bytes.bindMemory(to: core_cluster_t.self)
+            return clusters.prefix(Int(topology.pointee.cluster_count)).map { cluster in
+                withUnsafePointer(to: cluster.name) { ptr in
+                    let start = ptr.pointer(to: \.0)!
+                    return String(cString: start)
+                }
+            }
+        }
+    }
+    
     // MARK: - Energy
     
+    /// The weights of the linear energy model used on Linux, either calibrated or fitted while
+    /// sampling so far, or `nil` if not sampling or the model is not fitted yet. Pass them as a
+    /// `.calibratedLinear` energy model to reuse them in later runs on the same machine.
+    public var energyModelWeights: [Double]? {
+        guard let session else {
+            return nil
+        }
+        var weights = [Double](repeating: 0, count: Int(ENERGY_MODEL_MAX_FEATURES))
+        let count = Int(sample_session_energy_model_weights(session, &weights))
+        return count > 0 ? Array(weights.prefix(count)) : nil
+    }
+    
     /// Reset the global count of energy used.
     public func resetEnergyUsed() {
         self.totalEnergyUsage = .zero
+        self.regionEnergyUsage.removeAll()
     }
     
     // MARK: - Private
     
-    private struct ComputePowerResult {
-        let energy: Energy
-        let power: Power
-    }
-    
-    private func computePower(
-        previousTime: ContinuousClock.Instant,
-        currentTime: ContinuousClock.Instant,
-        previousCounters: sampled_thread_info_t,
-        currentCounter: sampled_thread_info_t,
-        type: CoreType
-    ) -> ComputePowerResult {
-        let energyChange: Double
-        switch type {
-        case .performance:
-            energyChange = currentCounter.performance.energy - previousCounters.performance.energy
-        case .efficiency:
-            energyChange = currentCounter.efficiency.energy - previousCounters.efficiency.energy
-        }
-        if !energyChange.isZero {
-            // The *power* used during a time interval is the *total* energy consumed
-            // divided by the time between measurements. Using the counters' ptcd times
-            // instead would NOT yield the correct result, as that excludes times where
-            // the threads were not running.
-            //
-            // If the sampling could be guaranteed to be done with precise timing, one
-            // could also divide by SampleThreadsManager.samplingTime, but anything that
-            // messes with the schedule at which sampleThreads() is called is going to
-            // give wrong results (ie: suspending the app, stopping at a breakpoint
-            // while debugging...).
-            let elapsedTime = currentTime - previousTime
-            let elapsedSeconds = Double(elapsedTime.components.seconds) + Double(elapsedTime.components.attoseconds) * 1e-18
-            let energyChangeInWattsHour = energyChange / 3600
-            return ComputePowerResult(energy: energyChangeInWattsHour, power: energyChange / elapsedSeconds)
-        } else {
-            return ComputePowerResult(energy: .zero, power: .zero)
+    /// The name with the given ID in the session's name table, or `nil` if there's no name.
+    private func threadName(_ nameID: name_id_t) -> String? {
+        guard nameID != name_id_t(NAME_ID_NONE), Int(nameID) < threadNames.count else {
+            return nil
+        }
+        return threadNames[Int(nameID)]
+    }
+    
+    /// The power used by each core cluster during a time interval, given the energy (in
+    /// Joules) each cluster consumed during it.
+    private func power(energy: SIMD8<Double>, interval: Double) -> CombinedPower {
+        // The *power* used during a time interval is the *total* energy consumed
+        // divided by the time between measurements. Using the counters' ptcd times
+        // instead would NOT yield the correct result, as that excludes times where
+        // the threads were not running.
+        //
+        // If the sampling could be guaranteed to be done with precise timing, one
+        // could also divide by SampleThreadsManager.samplingTime, but anything that
+        // messes with the schedule at which sampleThreads() is called is going to
+        // give wrong results (ie: suspending the app, stopping at a breakpoint
+        // while debugging...).
+        guard interval > 0 else {
+            return .zero
+        }
+        return CombinedPower(clusters: energy / interval)
+    }
+    
+    /// The energy (in Joules) in the per-cluster counter deltas of a sample, which C exposes
+    /// as a tuple of `SAMPLE_MAX_CLUSTERS` counters.
+    private func clusterEnergies<Deltas>(_ deltas: Deltas) -> SIMD8<Double> {
+        return withUnsafeBytes(of: deltas) { bytes in
+            var energies = SIMD8<Double>.zero
+            let stride = MemoryLayout<cpu_counters_t>.stride
+            for cluster in 0..<min(bytes.count / stride, energies.scalarCount) {
+                energies[cluster] = bytes.load(fromByteOffset: cluster * stride, as: cpu_counters_t.self).energy
+            }
+            return energies
+        }
+    }
+    
+    /// The sum of the per-cluster counter deltas of a sample, which C exposes as a tuple of
+    /// `SAMPLE_MAX_CLUSTERS` counters.
+    private func counterTotals<Deltas>(_ deltas: Deltas) -> cpu_counters_t {
+        return withUnsafeBytes(of: deltas) { bytes in
+            var totals = cpu_counters_t()
+            let stride = MemoryLayout<cpu_counters_t>.stride
+            for cluster in 0..<(bytes.count / stride) {
+                let counters = bytes.load(fromByteOffset: cluster * stride, as: cpu_counters_t.self)
+                totals.cycles += counters.cycles
+                totals.instructions += counters.instructions
+                totals.energy += counters.energy
+                totals.time += counters.time
+            }
+            return totals
         }
     }
 }
@@ -11,27 +11,133 @@ import Foundation
 ///
 /// Storing the samples is relatively low overhead, using a ring buffer. Reading them
 /// triggers sorting of the sample array, which may be costly (but reading the samples
-/// might be rare if not displaying the `PowerWidgetView`).
+/// might be rare if not displaying the `PowerWidgetView`). The aggregates of the stored
+/// samples (maximum, mean, percentiles...) are updated incrementally as samples are added
+/// and evicted, so reading them doesn't require reading the samples.
+///
+/// Besides the latest samples at full resolution, the history keeps downsampled tiers (1 s,
+/// 10 s and 1 min buckets by default, see `HistoryTierConfig`) with the energy and power of
+/// each bucket in fixed-size `PowerSummary` records. Samples are rolled up into the tiers as
+/// they're added, so long spans of time can be charted in bounded memory.
 @SampleThreadsActor public class SampledResultsHistory {
     /// The maximum value for total power of any of the stored power samples.
-    public var maxPower: Power = .zero
+    public var maxPower: Power {
+        return totalPower.max ?? .zero
+    }
     /// The stored power samples.
     public var samples: [SampleThreadsResult] {
-        return ringBuffer.elements
+        return ringBuffer.elements.map(\.result)
     }
+    /// Aggregates of the total power used by all threads, across the stored samples.
+    public private(set) var totalPower = WindowedStatistics()
+    /// Aggregates of the power used by all threads in the performance cores, across the
+    /// stored samples.
+    public private(set) var performancePower = WindowedStatistics()
+    /// Aggregates of the power used by all threads in the efficiency cores, across the
+    /// stored samples.
+    public private(set) var efficiencyPower = WindowedStatistics()
+    /// The energy used by all threads during the stored samples, in Watts-hour.
+    public private(set) var energy: Energy = .zero
     
     private let numberOfStoredSamples: Int
-    private var ringBuffer: RingBuffer<SampleThreadsResult>
-    private var writeIndex: Int = 0
-    private var displayableSamples: Int = 0
+    private var ringBuffer: RingBuffer<StoredSample>
+    /// The downsampled tiers, from the finest to the coarsest resolution.
+    private var tiers: [HistoryTier]
+    /// Sequence number of the next added sample.
+    private var nextSequence: Int = 0
+    /// Aggregates of the total power used by each thread, keyed by thread counter. Threads
+    /// are removed once none of the stored samples include them.
+    private var threadPowers = [Int: WindowedStatistics]()
+    
+    /// A sample, with the energy used during it.
+    private struct StoredSample {
+        let result: SampleThreadsResult
+        let energy: Energy
+    }
     
-    nonisolated init(numerOfStoredSamples: Int) {
+    nonisolated init(numerOfStoredSamples: Int, tiers: [HistoryTierConfig] = HistoryTierConfig.default) {
         self.numberOfStoredSamples = numerOfStoredSamples
         self.ringBuffer = RingBuffer(length: numerOfStoredSamples)
+        self.tiers = tiers
+            .sorted { $0.resolution < $1.resolution }
+            .map { HistoryTier($0) }
+    }
+    
+    /// Aggregates of the total power used by the given thread, across the stored samples.
+    /// - Parameter threadCounter: The `threadCounter` of the thread.
+    /// - Returns: The aggregates, or `nil` if none of the stored samples include the thread.
+    public func threadPower(threadCounter: Int) -> WindowedStatistics? {
+        return threadPowers[threadCounter]
+    }
+    
+    /// The power history since the given date, at the coarsest resolution that is at least as
+    /// fine as the requested one.
+    ///
+    /// Requesting a resolution finer than every tier returns the samples kept at full
+    /// resolution. The last summary of a tier covers its current bucket, which is still
+    /// receiving samples.
+    /// - Parameters:
+    ///   - start: The oldest date of interest.
+    ///   - resolution: The longest acceptable span of time for each summary, in seconds.
+    /// - Returns: The summaries, in chronological order.
+    public func powerSummaries(since start: Date, resolution: TimeInterval) -> [PowerSummary] {
+        guard let tier = tiers.last(where: { $0.resolution <= resolution }) else {
+            return ringBuffer.elements
+                .filter { $0.result.time >= start }
+                .map { PowerSummary($0.result) }
+        }
+        // A bucket is included if any of it is after the start date.
+        return tier.summaries.filter { $0.start.addingTimeInterval(tier.resolution) > start }
+    }
+    
+    /// Adds a new sample to the history, evicting the oldest one if the history is full.
+    /// - Parameters:
+    ///   - sample: The sample.
+    ///   - energy: The energy used by all threads during the sample, in Watts-hour.
+    func addSample(_ sample: SampleThreadsResult, energy: Energy) {
+        let sequence = nextSequence
+        nextSequence += 1
+        if let evicted = ringBuffer.add(element: StoredSample(result: sample, energy: energy)) {
+            remove(evicted, sequence: sequence - numberOfStoredSamples)
+        }
+        
+        totalPower.add(sample.allThreadsPower.total, sequence: sequence)
+        performancePower.add(sample.allThreadsPower.performance, sequence: sequence)
+        efficiencyPower.add(sample.allThreadsPower.efficiency, sequence: sequence)
+        self.energy += energy
+        for threadSample in sample.threadSamples {
+            threadPowers[threadSample.threadCounter, default: WindowedStatistics()]
+                .add(threadSample.power.total, sequence: sequence)
+        }
+        rollUp(sample)
+    }
+    
+    // MARK: - Private
+    
+    /// Adds a sample to the finest tier, and each bucket closed by it to the next tier.
+    private func rollUp(_ sample: SampleThreadsResult) {
+        guard !tiers.isEmpty else {
+            return
+        }
+        var closedBucket = tiers[0].add(sample)
+        var tierIndex = 1
+        while let bucket = closedBucket, tierIndex < tiers.count {
+            closedBucket = tiers[tierIndex].add(bucket)
+            tierIndex += 1
+        }
     }
     
-    func addSample(_ sample: SampleThreadsResult) {
-        ringBuffer.add(element: sample)
-        maxPower = ringBuffer.unsortedElements.map({$0.allThreadsPower.total}).max() ?? .zero
+    private func remove(_ storedSample: StoredSample, sequence: Int) {
+        let sample = storedSample.result
+        totalPower.removeOldest(sample.allThreadsPower.total, sequence: sequence)
+        performancePower.removeOldest(sample.allThreadsPower.performance, sequence: sequence)
+        efficiencyPower.removeOldest(sample.allThreadsPower.efficiency, sequence: sequence)
+        energy = totalPower.count == 0 ? .zero : energy - storedSample.energy
+        for threadSample in sample.threadSamples {
+            threadPowers[threadSample.threadCounter]?.removeOldest(threadSample.power.total, sequence: sequence)
+            if threadPowers[threadSample.threadCounter]?.count == 0 {
+                threadPowers[threadSample.threadCounter] = nil
+            }
+        }
     }
 }
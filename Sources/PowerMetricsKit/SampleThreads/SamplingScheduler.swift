@@ -0,0 +1,82 @@
+//
+//  SamplingScheduler.swift
+//
+
+import Foundation
+import SampleThreads
+
+/// What to retrieve in a single sample, as planned by a `SamplingScheduler`.
+struct SamplingPlan: Sendable {
+    /// Whether the name of the dispatch queue of each thread should be retrieved.
+    let retrieveDispatchQueueName: Bool
+    /// Whether the backtrace of each thread should be retrieved.
+    let retrieveBacktraces: Bool
+}
+
+/// Drives periodic sampling from a dedicated thread, at absolute deadlines.
+///
+/// This wraps the C `sample_scheduler_t` (see `sample_scheduler.h`). The thread waits for
+/// each deadline, runs a tick and reports the CPU time it used, so the scheduler can retrieve
+/// less information (or stretch the period) to stay within `PowerMetricsConfig.cpuBudget`.
+/// Unlike sleeping for the sampling time after each sample, the time each sample takes
+/// doesn't make the schedule drift.
+final class SamplingScheduler: @unchecked Sendable {
+    
+    private let scheduler: OpaquePointer
+    
+    /// Creates a scheduler for the given configuration.
+    /// - Returns: `nil` if the scheduler couldn't be created.
+    init?(config: PowerMetricsConfig) {
+        let schedulerConfig = sample_scheduler_config_t(
+            period: config.samplingTime,
+            cpu_budget: config.cpuBudget,
+            retrieve_backtraces: config.retrieveBacktraces,
+            retrieve_dispatch_queue_names: config.retrieveDispatchQueueName
+        )
+        guard let scheduler = sample_scheduler_create(schedulerConfig) else {
+            return nil
+        }
+        self.scheduler = scheduler
+    }
+    
+    deinit {
+        sample_scheduler_destroy(scheduler)
+    }
+    
+    /// Starts the sampling thread, which runs until `stop()` is called.
+    /// - Parameter tick: Takes a sample as planned, returning the CPU time it used in
+    /// seconds. The thread waits for each tick to finish before waiting for the next deadline.
+    func start(_ tick: @escaping @Sendable (SamplingPlan) async -> TimeInterval) {
+        let thread = Thread { [self] in
+            let tickFinished = DispatchSemaphore(value: 0)
+            let cpuTime = TickCPUTime()
+            var plan = sample_tick_plan_t()
+            while sample_scheduler_wait(scheduler, &plan) {
+                let samplingPlan = SamplingPlan(
+                    retrieveDispatchQueueName: plan.retrieve_dispatch_queue_names,
+                    retrieveBacktraces: plan.retrieve_backtraces
+                )
+                Task(priority: .high) {
+                    cpuTime.value = await tick(samplingPlan)
+                    tickFinished.signal()
+                }
+                tickFinished.wait()
+                sample_scheduler_end_tick(scheduler, cpuTime.value, nil)
+            }
+        }
+        thread.name = "PowerMetricsKit.SamplingScheduler"
+        thread.qualityOfService = .userInitiated
+        thread.start()
+    }
+    
+    /// Stops the sampling thread once the current tick, if any, finishes.
+    func stop() {
+        sample_scheduler_stop(scheduler)
+    }
+}
+
+/// The CPU time used by the latest tick. Written by the tick's task, and only read by the
+/// sampling thread after the task signals that it finished.
+private final class TickCPUTime: @unchecked Sendable {
+    var value: TimeInterval = .zero
+}
@@ -9,19 +9,48 @@ import Foundation
 import SampleThreads
 
 /// An actor to interact to `dladdr` to retrieve information about the sampled backtraces.
+///
+/// Sampling only records raw addresses: symbol information is retrieved lazily, in batches,
+/// when it's going to be displayed or exported. Addresses are mapped to images using a
+/// snapshot of the loaded images (see `image_map.h`), and symbol lookups are cached by
+/// image-relative offset, so `dladdr` is only called once for each distinct address.
 public actor SymbolicateBacktraces {
     
     public var backtraceGraph = BacktraceGraph()
-    public var flatBacktraces = [SimpleBacktraceInfo]()
-    private var addressToBacktrace = [BacktraceAddress: BacktraceInfo]()
-        
+    public var flatProfile = FlatProfile()
+    /// The addresses of every sampled backtrace, by stack ID. Each distinct backtrace is only
+    /// copied from the sampling session once, the first time it's seen.
+    private(set) var stacks = [[BacktraceAddress]]()
+    
+    /// The loaded images, refreshed only when images are loaded or unloaded.
+    private let imageMap: OpaquePointer?
+    /// The generation of `imageMap` that `imageNames` and `cache` belong to.
+    private var imageMapGeneration: UInt64 = 0
+    /// The name of each image in `imageMap`, by image index.
+    private var imageNames = [String]()
+    private var cache = LRUCache<ImageOffset, SymbolicatedInfo?>(capacity: 8192)
+    
+    /// An address, identified by its image and its offset in it.
+    private struct ImageOffset: Hashable {
+        let imageIndex: Int32
+        let offset: UInt64
+    }
+    
     // MARK: - Init
     
-    private init() {}
+    private init() {
+        self.imageMap = image_map_create()
+    }
     public static let shared = SymbolicateBacktraces()
     
+    deinit {
+        image_map_destroy(imageMap)
+    }
+    
     // MARK: - Functions
     
+    /// Retrieves the symbol information of a single address using `dladdr`, without any
+    /// caching. Prefer ``symbolicate(_:)`` to symbolicate several addresses.
     nonisolated public func symbolicatedInfo(for address: UInt64) -> SymbolicatedInfo? {
         var dlInfo = Dl_info()
         let addressPointer = UnsafeRawPointer(bitPattern: UInt(address))
@@ -29,7 +58,7 @@ public actor SymbolicateBacktraces {
             let imageName = (String(cString: dlInfo.dli_fname) as NSString).lastPathComponent
             let addressInImage = address - (unsafeBitCast(dlInfo.dli_fbase, to: UInt64.self))
             let symbolName: String? = if let symbolNamePointer = dlInfo.dli_sname {
-                (String(cString: dlInfo.dli_sname) as NSString).lastPathComponent
+                (String(cString: symbolNamePointer) as NSString).lastPathComponent
             } else {
                 nil
             }
@@ -46,29 +75,122 @@ public actor SymbolicateBacktraces {
         }
     }
     
-    func addToBacktraceGraph(_ backtraces: [Backtrace]) {
-        for backtrace in backtraces {
-            backtraceGraph.insertInGraph(newBacktrace: backtrace)
+    /// Retrieves the symbol information of a batch of addresses.
+    /// - Returns: The symbol information of each address, `nil` for addresses that are not
+    /// in any loaded image.
+    public func symbolicate(_ addresses: [BacktraceAddress]) -> [SymbolicatedInfo?] {
+        guard let imageMap else {
+            return addresses.map { symbolicatedInfo(for: $0) }
         }
+        refreshImages(imageMap)
         
-        // Get the energy for every single memory address in all new backtraces
-        for backtrace in backtraces {
-            guard let energy = backtrace.energy else {
-                // Backtrace doesn't contain any energy information...
+        var imageIndices = [Int32](repeating: -1, count: addresses.count)
+        var offsets = [UInt64](repeating: 0, count: addresses.count)
+        image_map_resolve(imageMap, addresses, UInt32(addresses.count), &imageIndices, &offsets)
+        
+        var infos = [SymbolicatedInfo?]()
+        infos.reserveCapacity(addresses.count)
+        for index in addresses.indices {
+            let imageIndex = imageIndices[index]
+            guard imageIndex >= 0 else {
+                infos.append(nil)
                 continue
             }
-            // Add energies to backtrace flatmap
-            for address in backtrace.addresses {
-                if var existingInfo = flatBacktraces.first(where: { $0.address == address }) {
-                    existingInfo.energy += energy
-                } else {
-                    flatBacktraces.append(SimpleBacktraceInfo(
-                        address: address,
-                        info: symbolicatedInfo(for: address),
-                        energy: energy
-                    ))
-                }
+            let key = ImageOffset(imageIndex: imageIndex, offset: offsets[index])
+            if let cachedInfo = cache.value(for: key) {
+                infos.append(cachedInfo)
+                continue
             }
+            let info = symbolInfo(
+                for: addresses[index],
+                imageName: imageNames[Int(imageIndex)],
+                addressInImage: offsets[index]
+            )
+            cache.insert(info, for: key)
+            infos.append(info)
+        }
+        return infos
+    }
+    
+    /// Returns a copy of the given items, with their symbol information retrieved.
+    func symbolicated<T: Symbolicatable>(_ items: [T]) -> [T] {
+        let infos = symbolicate(items.map(\.address))
+        return zip(items, infos).map { item, info in
+            var item = item
+            item.info = info
+            return item
+        }
+    }
+    
+    /// Adds the energy of a batch of samples to the graph and the flat profile.
+    /// - Parameters:
+    ///   - samples: The samples, referencing their backtrace by stack ID.
+    ///   - newStacks: The addresses of the stacks first seen in this batch, in stack ID order.
+    func addToBacktraceGraph(_ samples: [StackSample], newStacks: [[BacktraceAddress]]) {
+        stacks.append(contentsOf: newStacks)
+        let samples = StackSample.coalesced(samples)
+        backtraceGraph.insert(samples, stacks: stacks)
+        
+        // Add the energy of every backtrace to each of its addresses
+        flatProfile.add(samples, stacks: stacks)
+    }
+    
+    /// Discards the stacks of a sampling session that is not used anymore, as their stack IDs
+    /// will be reused by the next one. The energy already added is kept.
+    func resetStacks() {
+        stacks.removeAll()
+        backtraceGraph.resetStacks()
+        flatProfile.resetStacks()
+    }
+    
+    // MARK: - Private
+    
+    /// Refreshes the snapshot of the loaded images, discarding all cached information if
+    /// images were loaded or unloaded.
+    private func refreshImages(_ imageMap: OpaquePointer) {
+        image_map_refresh(imageMap)
+        let generation = image_map_generation(imageMap)
+        guard generation != imageMapGeneration else {
+            return
+        }
+        imageMapGeneration = generation
+        cache.removeAll()
+        imageNames = (0..<image_map_image_count(imageMap)).map { imageIndex in
+            let path = String(cString: image_map_image_path(imageMap, imageIndex))
+            return (path as NSString).lastPathComponent
         }
     }
+    
+    /// Retrieves the symbol containing an address using `dladdr`. The image information is
+    /// already known from the image map.
+    private func symbolInfo(for address: BacktraceAddress, imageName: String, addressInImage: UInt64) -> SymbolicatedInfo {
+        var dlInfo = Dl_info()
+        let addressPointer = UnsafeRawPointer(bitPattern: UInt(address))
+        guard dladdr(addressPointer, &dlInfo) != 0, let symbolNamePointer = dlInfo.dli_sname else {
+            return SymbolicatedInfo(
+                imageName: imageName,
+                addressInImage: addressInImage,
+                symbolName: nil,
+                addressInSymbol: .zero
+            )
+        }
+        return SymbolicatedInfo(
+            imageName: imageName,
+            addressInImage: addressInImage,
+            symbolName: (String(cString: symbolNamePointer) as NSString).lastPathComponent,
+            addressInSymbol: address - (unsafeBitCast(dlInfo.dli_saddr, to: UInt64.self))
+        )
+    }
 }
+
+// MARK: - Symbolicatable
+
+/// A value referencing an address, whose symbol information can be retrieved lazily.
+protocol Symbolicatable {
+    var address: BacktraceAddress { get }
+    var info: SymbolicatedInfo? { get set }
+}
+
+extension BacktraceInfo: Symbolicatable {}
+
+extension FlatProfile.Entry: Symbolicatable {}
@@ -70,10 +70,10 @@ import SwiftUI
                 .listStyle(.plain)
                 .scrollContentBackground(.hidden)
             } else {
-                List(callStackViewModel.sortedFlatBacktraces, id: \.address) { simpleBacktraceInfo in
+                List(callStackViewModel.sortedFlatBacktraces, id: \.address) { flatProfileEntry in
                     BacktraceRowContentView(
-                        symbolInfo: simpleBacktraceInfo.info,
-                        energy: simpleBacktraceInfo.energy
+                        symbolInfo: flatProfileEntry.info,
+                        energy: flatProfileEntry.inclusiveEnergy
                     )
                     .listRowBackground(Color.clear)
                 }
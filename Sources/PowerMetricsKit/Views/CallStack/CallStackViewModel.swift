@@ -13,7 +13,10 @@ import SwiftUI
     let symbolicator = SymbolicateBacktraces.shared
     var expandedInfos = [BacktraceInfo]()
     var sortedGraphBacktraces = [BacktraceInfo]()
-    var sortedFlatBacktraces = [SimpleBacktraceInfo]()
+    var sortedFlatBacktraces = [FlatProfile.Entry]()
+    
+    /// The maximum number of addresses displayed in the flat visualization.
+    private static let maxFlatBacktraces = 100
     
     init(sampleManager: SampleThreadsManager) {
         periodicRefresh(samplingTime: sampleManager.config.samplingTime)
@@ -22,17 +25,22 @@ import SwiftUI
     @objc func update() {
         Task(priority: .high) {
             let sortedGraphBacktraces = if let lastExpanded = expandedInfos.last {
-                lastExpanded.children
+                await symbolicator.backtraceGraph.snapshot()
+                    .children(of: lastExpanded.node)
                     .sorted(by: { $0.energy > $1.energy })
             } else {
                 await symbolicator.backtraceGraph.nodes
                     .sorted(by: { $0.energy > $1.energy })
             }
-            let sortedFlatBacktraces = await symbolicator.flatBacktraces
-                .sorted(by: { $0.energy > $1.energy })
+            let sortedFlatBacktraces = await symbolicator.flatProfile
+                .top(Self.maxFlatBacktraces, by: .inclusiveEnergy)
+            // Only the displayed addresses are symbolicated
+            let symbolicatedGraphBacktraces = await symbolicator.symbolicated(sortedGraphBacktraces)
+            let symbolicatedFlatBacktraces = await symbolicator.symbolicated(sortedFlatBacktraces)
             
             Task(priority: .high) { @MainActor in
-                self.sortedGraphBacktraces = sortedGraphBacktraces
+                self.sortedGraphBacktraces = symbolicatedGraphBacktraces
+                self.sortedFlatBacktraces = symbolicatedFlatBacktraces
             }
         }
     }
@@ -0,0 +1,148 @@
+//
+//  capture_file.h
+//
+
+#ifndef capture_file_h
+#define capture_file_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "get_backtrace.h"
+#include "sample_threads.h"
+#include "sample_session.h"
+#include "stack_table.h"
+
+/// Identifies a unique thread or dispatch queue name in a capture. IDs are assigned in
+/// order, starting at 0.
+typedef uint32_t capture_name_id_t;
+
+/// Marks the absence of a name (ie: the thread has no name).
+#define CAPTURE_NAME_NONE 0xFFFFFFFF
+
+// MARK: - Writer
+
+/// Records the samples of a `sample_session_t` to a file, so long sessions can be analysed
+/// offline.
+///
+/// Each sample is appended as a self-contained chunk, with the records of all its threads
+/// stored as columns (thread IDs, names, stack IDs, then each counter). Integers are written
+/// as varints, and thread IDs and the addresses of each stack are delta-encoded, so most
+/// values take one or two bytes. Stacks and names are only written the first time they are
+/// seen, in the chunk of the sample that first used them, and are referenced by ID from
+/// then on. Closing the writer appends an index of every chunk, stack and name, so the file
+/// can be read without decoding it from the start.
+///
+/// Counters are stored with a fixed resolution: CPU times in nanoseconds, and energies in
+/// nanojoules. Each sample stores the counters of as many core clusters as its session
+/// samples.
+typedef struct capture_writer capture_writer_t;
+
+/// Creates a capture file at the given path, replacing any file already there.
+/// - Returns: The writer, or `NULL` if the file couldn't be created.
+capture_writer_t *capture_writer_create(const char *path);
+
+/// Appends a sample to the capture.
+///
+/// All the samples of a capture must come from the same session, as the stack IDs of its
+/// records are written as they are: only the stacks added to the session's stack table
+/// since the previous call are written to the file. For the same reason, samples taken after
+/// the session's tables were reset (see `sample_session_reset_tables`) are rejected: rotate
+/// the capture instead, closing it and appending the later samples to a new one.
+/// - Parameters:
+///   - result: The sample, as returned by `sample_session_sample_into`.
+///   - time_ns: Time of the sample in nanoseconds, in any timeline chosen by the caller (ie:
+///   since the Unix epoch). Times earlier than the previous sample's are clamped to it, so
+///   samples are always sorted by time.
+/// - Returns: `false` if the sample couldn't be written, or if its stack table was reset.
+bool capture_writer_append(capture_writer_t *writer, const sample_session_result_t *result, uint64_t time_ns);
+
+/// Writes the index of the capture and closes the file, destroying the writer.
+///
+/// A capture whose writer was never closed (ie: the process crashed) can still be read,
+/// but opening it requires reading every chunk to rebuild the index.
+/// - Returns: `false` if the capture couldn't be completed.
+bool capture_writer_close(capture_writer_t *writer);
+
+// MARK: - Reader
+
+typedef struct {
+    /// Thread ID.
+    uint64_t thread_id;
+    /// ID of the name of the pthread, or `CAPTURE_NAME_NONE`.
+    capture_name_id_t pthread_name;
+    /// ID of the name of the thread's Dispatch Queue, or `CAPTURE_NAME_NONE`.
+    capture_name_id_t dispatch_queue_name;
+    /// ID of the thread's backtrace, or `STACK_ID_NONE`.
+    stack_id_t stack_id;
+    /// Counters of each core cluster accumulated since the previous sample. Clusters past the
+    /// tick's `cluster_count` are zero.
+    cpu_counters_t clusters[SAMPLE_MAX_CLUSTERS];
+} capture_thread_t;
+
+typedef struct {
+    /// Time of the sample in nanoseconds, as passed to `capture_writer_append`.
+    uint64_t time_ns;
+    /// Time elapsed since the previous sample in seconds.
+    double interval;
+    /// Number of core clusters the counters are broken down by. Captures in the first
+    /// version of the format always have two: performance and efficiency cores.
+    uint32_t cluster_count;
+    /// Number of sampled threads.
+    uint32_t thread_count;
+    /// The sampled threads. Owned by the reader.
+    const capture_thread_t *threads;
+} capture_tick_t;
+
+/// Reads a capture file written by `capture_writer_t`.
+///
+/// The file is mapped into memory, and only the index at its end is read when opening it:
+/// each sample is decoded when requested, so any sample can be read (or found by time)
+/// without decoding the ones before it.
+typedef struct capture_reader capture_reader_t;
+
+/// Opens a capture file.
+/// - Returns: The reader, or `NULL` if the file couldn't be opened or is not a capture.
+capture_reader_t *capture_reader_open(const char *path);
+
+/// Closes the capture file, destroying the reader.
+void capture_reader_close(capture_reader_t *reader);
+
+/// Number of samples in the capture.
+uint64_t capture_reader_tick_count(const capture_reader_t *reader);
+
+/// Time of the sample at the given index in nanoseconds, or 0 if the index is not valid.
+uint64_t capture_reader_tick_time(const capture_reader_t *reader, uint64_t index);
+
+/// Finds the first sample taken at or after the given time.
+/// - Returns: The index of the sample, or `capture_reader_tick_count` if there's none.
+uint64_t capture_reader_find_tick(const capture_reader_t *reader, uint64_t time_ns);
+
+/// Decodes the sample at the given index.
+///
+/// The threads of the returned tick point to memory owned by the reader, and are only valid
+/// until the next call to `capture_reader_read_tick` or `capture_reader_close`.
+/// - Returns: `false` if the index is not valid or the sample is corrupt.
+bool capture_reader_read_tick(capture_reader_t *reader, uint64_t index, capture_tick_t *tick);
+
+/// Number of unique stacks in the capture. All IDs below this number are valid.
+uint32_t capture_reader_stack_count(const capture_reader_t *reader);
+
+/// Decodes a stack, writing at most `capacity` of its addresses (innermost address first).
+/// - Returns: The number of addresses in the stack, which may be larger than `capacity`, or
+/// 0 if the ID is not valid.
+uint32_t capture_reader_stack(const capture_reader_t *reader,
+                              stack_id_t stack_id,
+                              backtrace_address_t *addresses,
+                              uint32_t capacity);
+
+/// Number of unique names in the capture. All IDs below this number are valid.
+uint32_t capture_reader_name_count(const capture_reader_t *reader);
+
+/// The characters of a name, which are NOT NUL-terminated.
+///
+/// The returned pointer points into the mapped file, and is valid until the reader is
+/// closed.
+/// - Returns: The name, or `NULL` (with a length of 0) if the ID is not valid.
+const char *capture_reader_name(const capture_reader_t *reader, capture_name_id_t name_id, uint32_t *length);
+
+#endif /* capture_file_h */
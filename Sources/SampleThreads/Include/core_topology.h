@@ -0,0 +1,53 @@
+//
+//  core_topology.h
+//
+
+#ifndef core_topology_h
+#define core_topology_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sample_threads.h"
+
+typedef struct {
+    /// Name of the cluster, ie: "Performance" on Apple platforms, or the name of its PMU on
+    /// Linux ("cpu_core", "cpu_atom", "armv8_cortex_a76"...).
+    char name[32];
+    /// Number of logical CPUs in the cluster.
+    uint32_t cpu_count;
+    /// Compute capacity of the cluster's cores relative to the fastest cores of the system,
+    /// which have a capacity of 1024. 0 if unknown.
+    uint32_t capacity;
+    /// Maximum frequency of the cluster's cores in MHz, 0 if unknown.
+    uint32_t max_frequency_mhz;
+    /// Whether counters can be bound to this cluster alone. On Linux, this means the cluster
+    /// has its own PMU, with type `pmu_type`.
+    bool has_pmu;
+    /// The `perf_event_attr.type` of the cluster's PMU, if `has_pmu`.
+    uint32_t pmu_type;
+} core_cluster_t;
+
+/// The groups of cores of the same type (clusters) in the system.
+///
+/// On Apple platforms, clusters are the perf levels reported by `hw.nperflevels`. On Linux,
+/// they are discovered from sysfs: hybrid and big.LITTLE systems expose one core PMU per
+/// core type (`cpu_core` and `cpu_atom` on Intel, one per core model on ARM), each with its
+/// own `cpus` list. Systems without per-cluster PMUs are split by `cpu_capacity` instead,
+/// and homogeneous systems have a single cluster.
+///
+/// Clusters are sorted from the fastest to the slowest cores, so cluster 0 is always the
+/// performance cluster, and the last one the most efficient cluster.
+typedef struct {
+    uint32_t cluster_count;
+    core_cluster_t clusters[SAMPLE_MAX_CLUSTERS];
+} core_topology_t;
+
+/// Discovers the core clusters of this system. There's always at least one cluster.
+void core_topology_discover(core_topology_t *topology);
+
+#if defined(__linux__)
+/// Discovers the core clusters from a sysfs tree mounted at `sysfs_root` (ie: `/sys`).
+void core_topology_discover_at(core_topology_t *topology, const char *sysfs_root);
+#endif
+
+#endif /* core_topology_h */
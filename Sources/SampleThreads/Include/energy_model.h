@@ -0,0 +1,109 @@
+//
+//  energy_model.h
+//
+
+#ifndef energy_model_h
+#define energy_model_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sample_threads.h"
+
+// The features of the linear model: the length of the interval (for the static power),
+// then the cycles and instructions of each cluster. The weights of a model with N clusters
+// are in the same order: the static power, then the weights of the cycles and instructions
+// of cluster 0, those of cluster 1... up to cluster N - 1, 1 + 2 × N weights in total.
+#define ENERGY_MODEL_MAX_FEATURES (1 + 2 * SAMPLE_MAX_CLUSTERS)
+
+typedef enum {
+    /// Energy is attributed with a linear model of the cycles and instructions of each
+    /// cluster, fitted by least squares to the measured energy. Until the model has enough
+    /// observations, energy is attributed by cycles.
+    ENERGY_MODEL_LINEAR,
+    /// Energy is attributed proportionally to the cycles executed on every cluster.
+    ENERGY_MODEL_CYCLES,
+    /// Energy is attributed proportionally to the instructions retired on every cluster.
+    ENERGY_MODEL_INSTRUCTIONS
+} energy_model_kind_t;
+
+/// Estimates how much of the energy measured during an interval was used by each thread.
+///
+/// The proportional models (and the linear model, until it's fitted) don't predict any
+/// energy: each thread is attributed the measured energy in proportion to its estimate (see
+/// `energy_model_estimate`). A fitted linear model predicts the energy used by each thread
+/// on each cluster, in J, which is attributed as it is, plus a static term for the energy
+/// used regardless of the work done (see `energy_model_static_energy`).
+///
+/// The linear model keeps the normal equations of the fit (XᵀX and Xᵀy) and refits after
+/// every observation, which only means solving a system of `feature_count` equations.
+/// Older observations are exponentially forgotten, so the weights follow changes of
+/// frequency or workload. Weights fitted in a calibration run can be loaded with
+/// `energy_model_set_weights`, which stops the online fitting.
+typedef struct {
+    energy_model_kind_t kind;
+    uint32_t cluster_count;
+    uint32_t feature_count;
+    /// Whether `weights` were fitted (or loaded) and are used for the estimates.
+    bool fitted;
+    /// Whether `weights` were loaded from a calibration run, so they're not refitted.
+    bool calibrated;
+    /// Weight of each feature, in J/s for the interval and in J per 10⁹ events for cycles
+    /// and instructions.
+    double weights[ENERGY_MODEL_MAX_FEATURES];
+    /// Number of observations, discounted by the forgetting factor.
+    double observation_count;
+    double xtx[ENERGY_MODEL_MAX_FEATURES][ENERGY_MODEL_MAX_FEATURES];
+    double xty[ENERGY_MODEL_MAX_FEATURES];
+} energy_model_t;
+
+void energy_model_init(energy_model_t *model, energy_model_kind_t kind, uint32_t cluster_count);
+
+/// Adds the measured energy of an interval to the fit of a linear model, and refits it.
+/// - Parameter totals: The cycles and instructions of all threads on each cluster during the
+/// interval, for the model's `cluster_count` clusters.
+/// - Parameter interval: The length of the interval, in seconds.
+/// - Parameter energy: The energy measured during the interval, J.
+void energy_model_observe(energy_model_t *model, const cpu_counters_t *totals, double interval, double energy);
+
+/// The estimated energy used by a thread on a cluster during an interval: in J if
+/// `energy_model_is_absolute`, or any other value proportional to it otherwise (only the
+/// ratio between the estimates of all threads matters). Never negative.
+static inline double energy_model_estimate(const energy_model_t *model, uint32_t cluster, uint64_t cycles, uint64_t instructions) {
+    if (model->kind == ENERGY_MODEL_INSTRUCTIONS) {
+        return (double) instructions;
+    }
+    if (model->kind == ENERGY_MODEL_CYCLES || !model->fitted) {
+        return (double) cycles;
+    }
+    double estimate = model->weights[1 + 2 * cluster] * (cycles / 1e9)
+        + model->weights[2 + 2 * cluster] * (instructions / 1e9);
+    return estimate > 0 ? estimate : 0;
+}
+
+/// Whether the estimates of the model are energies in J, not just proportional to them: only
+/// for a linear model that was fitted, or loaded with calibrated weights.
+static inline bool energy_model_is_absolute(const energy_model_t *model) {
+    return model->kind == ENERGY_MODEL_LINEAR && model->fitted;
+}
+
+/// The energy a fitted linear model predicts is used during an interval regardless of what
+/// the threads execute (the static term), J. 0 if the model is not absolute.
+static inline double energy_model_static_energy(const energy_model_t *model, double interval) {
+    if (!energy_model_is_absolute(model)) {
+        return 0;
+    }
+    double energy = model->weights[0] * interval;
+    return energy > 0 ? energy : 0;
+}
+
+/// Loads the weights of a linear model, ie: fitted during a calibration run. They are used
+/// as they are from then on.
+void energy_model_set_weights(energy_model_t *model, const double *weights, uint32_t weight_count);
+
+/// Copies the weights of a fitted linear model to `weights`, which must have room for
+/// `ENERGY_MODEL_MAX_FEATURES` values. The weights can be loaded into a later model (with
+/// the same clusters) with `energy_model_set_weights`.
+/// - Returns: The number of weights, or 0 if the model is not fitted.
+uint32_t energy_model_weights(const energy_model_t *model, double *weights);
+
+#endif /* energy_model_h */
@@ -0,0 +1,32 @@
+//
+//  export_sink.h
+//
+
+#ifndef export_sink_h
+#define export_sink_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/// A file that exported profiles are streamed to, optionally compressed with gzip.
+///
+/// Bytes are compressed (if enabled) as they are written, and the output is written to the
+/// file in fixed-size blocks, so the size of an export doesn't affect the memory used.
+typedef struct export_sink export_sink_t;
+
+/// Creates the file at the given path, replacing any file already there.
+/// - Parameter gzip: Whether to compress the output with gzip (ie: for pprof profiles).
+/// - Returns: The sink, or `NULL` if the file couldn't be created.
+export_sink_t *export_sink_create(const char *path, bool gzip);
+
+/// Appends bytes to the file.
+/// - Returns: `false` if the bytes couldn't be written. Once a write fails, all later writes
+/// fail too.
+bool export_sink_write(export_sink_t *sink, const uint8_t *bytes, size_t count);
+
+/// Writes any pending output and closes the file, destroying the sink.
+/// - Returns: `false` if any write failed, so the file is not complete.
+bool export_sink_close(export_sink_t *sink);
+
+#endif /* export_sink_h */
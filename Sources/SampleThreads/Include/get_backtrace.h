@@ -11,7 +11,11 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#if defined(__APPLE__)
 #include <mach/mach_types.h>
+#elif defined(__linux__)
+#include <sys/types.h>
+#endif
 
 // Max number of frames in stack trace
 #define MAX_FRAME_DEPTH 128
@@ -33,6 +37,43 @@ typedef struct {
     backtrace_address_t *addresses;
 } backtrace_t;
 
-backtrace_t get_backtrace(thread_t thread);
+#if defined(__APPLE__)
+/// Writes the backtrace of the given thread into a caller-owned buffer.
+///
+/// No memory is allocated: at most `capacity` addresses are written to `addresses`.
+/// - Returns: The number of addresses written.
+int get_backtrace_into(thread_t thread, backtrace_address_t *addresses, int capacity);
+#elif defined(__linux__)
+typedef struct {
+    /// Thread ID of the thread to unwind. Must be a thread of the calling process.
+    pid_t tid;
+    /// Bounds of the thread's stack, 0 if unknown. These are found the first time a
+    /// thread is unwound (and whenever its stack pointer leaves them), and must be kept
+    /// between calls: frames are only walked once they're known.
+    uint64_t stack_low;
+    uint64_t stack_high;
+    /// Number of addresses in `addresses`, 0 if the thread couldn't be unwound.
+    int length;
+    /// Time the thread spent unwinding its stack in the signal handler, in nanoseconds.
+    uint64_t interrupted_ns;
+    /// The backtrace of the thread, innermost address first. Owned by the unwinder and
+    /// only valid until the next call to `get_backtraces_linux`.
+    const uint64_t *addresses;
+} backtrace_request_t;
+
+/// Retrieves the backtraces of several threads of the calling process at once.
+///
+/// A real-time signal is sent to every thread first, and then all the replies are
+/// collected. Each thread walks its own frame pointers from the signal handler, starting
+/// at the interrupted context and bounded by its stack, writing the addresses into a
+/// preallocated buffer: threads are only interrupted for as long as the walk takes, and
+/// no memory is read through syscalls.
+///
+/// Threads that don't handle the signal in time (ie: because they block it) are
+/// reported with an empty backtrace.
+/// - Returns: `false` if the signal handler couldn't be installed, because the signal is
+/// already in use.
+bool get_backtraces_linux(backtrace_request_t *requests, uint32_t count);
+#endif
 
 #endif /* get_backtrace_h */
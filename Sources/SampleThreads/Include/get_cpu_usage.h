@@ -1,5 +1,5 @@
 //
-//  get_cpu_usage_h.h
+//  get_cpu_usage.h
 //
 //
 //  Created by Raúl Montón Pinillos on 21/4/24.
@@ -9,6 +9,7 @@
 #define get_cpu_usage_h
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 typedef struct {
@@ -20,6 +21,15 @@ typedef struct {
     uint64_t nice_ticks;
     /// Number of idle CPU ticks.
     uint64_t idle_ticks;
+    /// Number of idle CPU ticks while there was I/O pending. Always 0 on Apple platforms.
+    uint64_t iowait_ticks;
+    /// Number of CPU ticks servicing hardware interrupts. Always 0 on Apple platforms.
+    uint64_t irq_ticks;
+    /// Number of CPU ticks servicing software interrupts. Always 0 on Apple platforms.
+    uint64_t softirq_ticks;
+    /// Number of CPU ticks taken by the hypervisor for other virtual machines, while the
+    /// core was runnable. Always 0 on Apple platforms.
+    uint64_t steal_ticks;
 } core_usage_t;
 
 typedef struct {
@@ -29,6 +39,49 @@ typedef struct {
     core_usage_t *core_usages;
 } cpu_usage_t;
 
+/// Retrieves the usage of each core since boot. Only available on Apple platforms.
+///
+/// The returned `core_usages` array is allocated with `malloc` and must be freed by the
+/// caller. For periodic sampling, prefer `cpu_usage_reader_t`, which reuses its resources
+/// between reads and computes the deltas.
 cpu_usage_t get_cpu_usage();
 
+/// Reads the usage of each core periodically.
+///
+/// On Apple platforms, ticks are read with `host_processor_info`. On Linux, `/proc/stat` is
+/// kept open and re-read with `pread` into a buffer allocated once, and parsed without any
+/// allocation or copies.
+///
+/// Cores are identified by their index in the system (ie: `cpu7` in `/proc/stat` is always
+/// written at index 7), so the indices stay stable if cores go offline. Offline cores keep
+/// their previous totals, with zero deltas.
+typedef struct cpu_usage_reader cpu_usage_reader_t;
+
+/// Creates a reader.
+/// - Returns: The reader, or `NULL` if the core usage can't be read in this system.
+cpu_usage_reader_t *cpu_usage_reader_create(void);
+
+void cpu_usage_reader_destroy(cpu_usage_reader_t *reader);
+
+/// The number of cores the buffers passed to `cpu_usage_reader_read` must have room for.
+int cpu_usage_reader_core_count(const cpu_usage_reader_t *reader);
+
+/// Reads the ticks of each core since boot into `totals`, and the ticks since the previous
+/// read into `deltas` (if not `NULL`).
+///
+/// Deltas are computed in place, while parsing: `totals` must hold the totals of the previous
+/// read, and should be zeroed before the first read. Counters that go backwards (ie: iowait on
+/// some kernels) report a zero delta.
+/// - Parameter capacity: The number of cores `totals` and `deltas` have room for. Cores with
+/// higher indices are ignored.
+/// - Returns: The number of cores written (the highest index written, plus one), or -1 if the
+/// usage couldn't be read.
+int cpu_usage_reader_read(cpu_usage_reader_t *reader, core_usage_t *totals, core_usage_t *deltas, int capacity);
+
+#if defined(__linux__)
+/// Parses the per-core lines of the contents of `/proc/stat`, as `cpu_usage_reader_read`.
+/// `text` must be NUL-terminated.
+int cpu_usage_parse_proc_stat(const char *text, core_usage_t *totals, core_usage_t *deltas, int capacity);
+#endif
+
 #endif /* get_cpu_usage_h */
@@ -0,0 +1,66 @@
+//
+//  image_map.h
+//
+
+#ifndef image_map_h
+#define image_map_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    /// Address of the first byte of the image's executable code.
+    uint64_t start;
+    /// Address past the last byte of the image's executable code.
+    uint64_t end;
+    /// Address the image was loaded at. Offsets in the image are relative to it.
+    uint64_t base;
+    /// Index of the image in the map, stable until the map is refreshed.
+    uint32_t image_index;
+} image_range_t;
+
+/// A snapshot of the images (executable and shared libraries) loaded in the process, used to
+/// map addresses to images without calling `dladdr`.
+///
+/// The snapshot is only rebuilt when the dynamic loader reports that images were loaded or
+/// unloaded: on Apple platforms, through the dyld add/remove image callbacks, and on Linux,
+/// through the load/unload counters reported by `dl_iterate_phdr`.
+typedef struct image_map image_map_t;
+
+/// Creates an image map with a snapshot of the currently loaded images.
+/// - Returns: The map, or `NULL` if it couldn't be created.
+image_map_t *image_map_create(void);
+
+/// Destroys the map.
+void image_map_destroy(image_map_t *map);
+
+/// Rebuilds the snapshot if images were loaded or unloaded since it was taken.
+/// - Returns: `true` if the snapshot was rebuilt, in which case image indices may have changed.
+bool image_map_refresh(image_map_t *map);
+
+/// Number of times the snapshot was rebuilt.
+uint64_t image_map_generation(const image_map_t *map);
+
+/// Number of images in the snapshot.
+uint32_t image_map_image_count(const image_map_t *map);
+
+/// Path of the image with the given index. Empty for the main executable on Linux.
+const char *image_map_image_path(const image_map_t *map, uint32_t image_index);
+
+/// Load address of the image with the given index.
+uint64_t image_map_image_base(const image_map_t *map, uint32_t image_index);
+
+/// Finds the image containing the given address, by binary search over the sorted image ranges.
+/// - Returns: The range of the image, or `NULL` if the address is not in any image.
+const image_range_t *image_map_find(const image_map_t *map, uint64_t address);
+
+/// Maps a batch of addresses to images. For each address, writes the index of its image (or
+/// -1 if it's not in any image) to `image_indices`, and its offset relative to the image's base
+/// (or the address itself) to `offsets`.
+void image_map_resolve(const image_map_t *map,
+                       const uint64_t *addresses,
+                       uint32_t count,
+                       int32_t *image_indices,
+                       uint64_t *offsets);
+
+#endif /* image_map_h */
@@ -0,0 +1,74 @@
+//
+//  linux_rapl.h
+//
+
+#ifndef linux_rapl_h
+#define linux_rapl_h
+
+#if defined(__linux__)
+
+#include <stdint.h>
+
+// Max number of RAPL domains: the package domains (one per CPU socket) and their
+// subdomains.
+#define MAX_RAPL_DOMAINS 32
+
+typedef enum {
+    /// A whole CPU socket, which includes its cores and uncore.
+    RAPL_DOMAIN_PACKAGE,
+    /// The cores of a package (PP0).
+    RAPL_DOMAIN_CORE,
+    /// The uncore of a package, usually the integrated GPU (PP1).
+    RAPL_DOMAIN_UNCORE,
+    /// The memory attached to a package. Not included in the package energy.
+    RAPL_DOMAIN_DRAM
+} rapl_domain_kind_t;
+
+typedef struct {
+    /// File descriptor for the energy_uj file of the domain.
+    int fd;
+    /// What the domain measures.
+    rapl_domain_kind_t kind;
+    /// Value of max_energy_range_uj, used to handle the counter wrapping around.
+    uint64_t max_energy_range_uj;
+    /// Value of energy_uj at the previous read.
+    uint64_t previous_energy_uj;
+} rapl_domain_t;
+
+/// Energy used by each kind of domain during an interval, summed over all packages, J.
+typedef struct {
+    double package;
+    double core;
+    double uncore;
+    double dram;
+} rapl_energy_t;
+
+/// Reads the energy counters exposed by the powercap sysfs interface.
+///
+/// RAPL only reports package-wide energy, so callers apportion it between threads.
+typedef struct {
+    rapl_domain_t domains[MAX_RAPL_DOMAINS];
+    int domain_count;
+} rapl_reader_t;
+
+/// Opens the energy counters of all the RAPL domains. If they're not readable (energy_uj
+/// is root-only on most distributions), the reader has no domains and always reports 0.
+void rapl_reader_open(rapl_reader_t *reader);
+
+/// Opens the energy counters of the RAPL domains of a powercap tree mounted at
+/// `powercap_root` (ie: `/sys/class/powercap`).
+void rapl_reader_open_at(rapl_reader_t *reader, const char *powercap_root);
+
+void rapl_reader_close(rapl_reader_t *reader);
+
+/// Energy used by each kind of domain since the previous call (or since the reader was
+/// opened).
+void rapl_reader_read(rapl_reader_t *reader, rapl_energy_t *energy);
+
+/// Energy used by all package domains since the previous call (or since the reader was
+/// opened), J.
+double rapl_reader_read_energy(rapl_reader_t *reader);
+
+#endif /* defined(__linux__) */
+
+#endif /* linux_rapl_h */
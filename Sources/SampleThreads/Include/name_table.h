@@ -0,0 +1,63 @@
+//
+//  name_table.h
+//
+
+#ifndef name_table_h
+#define name_table_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Identifies a unique name in a `name_table_t`. IDs are assigned in order, starting at 0,
+/// and are stable until the table is reset.
+typedef uint32_t name_id_t;
+
+/// Marks the absence of a name (ie: the thread has no name).
+#define NAME_ID_NONE 0xFFFFFFFF
+
+/// A deduplicated store of thread and dispatch queue names.
+///
+/// Each distinct name is stored once, NUL-terminated, in a single character arena, and is
+/// identified by a 32-bit name ID. Threads keep their names for most of their lives, so
+/// samples can carry name IDs and consumers only need to convert each name to their own
+/// representation once, the first time its ID shows up.
+///
+/// Like stacks (see `stack_table.h`), names are never removed one by one, only all at once by
+/// `name_table_reset`.
+typedef struct name_table name_table_t;
+
+/// Creates an empty name table.
+/// - Returns: The table, or `NULL` if it couldn't be created.
+name_table_t *name_table_create(void);
+
+/// Destroys the table, releasing all its memory.
+void name_table_destroy(name_table_t *table);
+
+/// Finds the ID of a name, adding the name to the table if it wasn't seen before.
+/// - Parameters:
+///   - name: The characters of the name. They don't need to be NUL-terminated.
+///   - length: The number of characters. The name ends at the first NUL, if any.
+/// - Returns: The ID of the name, or `NAME_ID_NONE` if the name is empty or there was no
+/// memory to add it.
+name_id_t name_table_intern(name_table_t *table, const char *name, size_t length);
+
+/// Number of unique names in the table. All IDs below this number are valid.
+uint32_t name_table_count(const name_table_t *table);
+
+/// The NUL-terminated name with the given ID.
+///
+/// The returned pointer is owned by the table, and is only valid until the next call to
+/// `name_table_intern`, as the character arena may be reallocated to grow.
+/// - Returns: The name, or an empty string if the ID is not valid.
+const char *name_table_name(const name_table_t *table, name_id_t name_id);
+
+/// Forgets all the names, releasing the memory the table grew to. Name IDs are reused by the
+/// names interned from then on, so consumers that keep anything by name ID must discard it
+/// when the table's generation changes.
+void name_table_reset(name_table_t *table);
+
+/// Incremented every time the table is reset, starting at 0.
+uint32_t name_table_generation(const name_table_t *table);
+
+#endif /* name_table_h */
@@ -0,0 +1,42 @@
+//
+//  region_markers.h
+//
+
+#ifndef region_markers_h
+#define region_markers_h
+
+#include <stdint.h>
+
+/// A region of the application (ie: a request type or a pipeline stage), identified by a
+/// static string, which the energy of the threads running it is attributed to.
+///
+/// Each thread keeps its current region in a slot of its own: beginning and ending a region
+/// is a single store to that slot, without any lock. Sampling sessions of the current process
+/// read the slot of every thread on each sample, and attribute the thread's counter deltas
+/// since the previous sample to the region it's in at that time (see
+/// `sample_session_result_t.regions`). Regions are only visible to sessions of the process
+/// that marks them.
+typedef const char *sample_region_t;
+
+/// No region.
+#define SAMPLE_REGION_NONE ((sample_region_t) 0)
+
+/// Makes `region` the current region of the calling thread.
+///
+/// Regions nest by passing the returned region to `sample_region_end`, which makes it the
+/// current region again.
+/// - Parameter region: The name of the region. It's read while sampling, so it must stay
+/// valid (and unchanged) for the lifetime of the process, ie: a string literal. Regions are
+/// told apart by their contents, not their addresses.
+/// - Returns: The region the thread was in before, `SAMPLE_REGION_NONE` if none.
+sample_region_t sample_region_begin(sample_region_t region);
+
+/// Ends the current region of the calling thread.
+/// - Parameter previous: The region returned by the matching `sample_region_begin`, which
+/// becomes the current region again.
+void sample_region_end(sample_region_t previous);
+
+/// The current region of the calling thread, `SAMPLE_REGION_NONE` if none.
+sample_region_t sample_region_current(void);
+
+#endif /* region_markers_h */
@@ -0,0 +1,66 @@
+//
+//  sample_ring.h
+//
+
+#ifndef sample_ring_h
+#define sample_ring_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sample_threads.h"
+
+/// A fixed-capacity, lock-free ring of `sampled_thread_info_t` records with a single writer
+/// and any number of concurrent readers.
+///
+/// Every record pushed to the ring gets a sequence number, starting at 0. The ring keeps the
+/// latest `capacity` records, overwriting the oldest ones. Each slot is versioned like a
+/// seqlock: the writer never waits for readers, and readers detect (and discard) records
+/// that were overwritten while they were being copied. Neither the writer nor the readers
+/// take any lock or allocate any memory.
+typedef struct sample_ring sample_ring_t;
+
+/// Creates a ring with room for at least `capacity` records. The capacity is rounded up to
+/// the next power of two.
+/// - Returns: The ring, or `NULL` if it couldn't be created.
+sample_ring_t *sample_ring_create(uint32_t capacity);
+
+/// Destroys the ring. There must be no concurrent readers or writer.
+void sample_ring_destroy(sample_ring_t *ring);
+
+/// The number of records the ring can hold.
+uint32_t sample_ring_capacity(const sample_ring_t *ring);
+
+/// The sequence number the next pushed record will get, which is also the total number of
+/// records pushed to the ring since it was created.
+uint64_t sample_ring_head(const sample_ring_t *ring);
+
+/// Pushes the given records to the ring, overwriting the oldest ones if it's full.
+///
+/// Only one thread may push to a given ring.
+void sample_ring_push(sample_ring_t *ring, const sampled_thread_info_t *records, uint32_t count);
+
+/// Copies the records pushed since `*cursor` into `out`, up to `max_count` records, and
+/// advances the cursor past the last copied record.
+///
+/// If the writer already overwrote some of the records after the cursor, those are skipped
+/// and their number is added to `*dropped` (if not `NULL`). Start with a cursor of 0 to read
+/// from the oldest record still in the ring, or with `sample_ring_head` to read only records
+/// pushed from then on.
+/// - Returns: The number of records copied.
+uint32_t sample_ring_read_from(const sample_ring_t *ring,
+                               uint64_t *cursor,
+                               sampled_thread_info_t *out,
+                               uint32_t max_count,
+                               uint64_t *dropped);
+
+/// Copies the latest records in the ring into `out`, oldest first, up to `max_count`
+/// records. The copied records always have consecutive sequence numbers, and none of them is
+/// torn by a concurrent push.
+/// - Parameter first_sequence: If not `NULL`, receives the sequence number of `out[0]`.
+/// - Returns: The number of records copied.
+uint32_t sample_ring_snapshot(const sample_ring_t *ring,
+                              sampled_thread_info_t *out,
+                              uint32_t max_count,
+                              uint64_t *first_sequence);
+
+#endif /* sample_ring_h */
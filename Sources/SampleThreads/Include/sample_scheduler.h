@@ -0,0 +1,89 @@
+//
+//  sample_scheduler.h
+//
+
+#ifndef sample_scheduler_h
+#define sample_scheduler_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    /// Target time between samples, in seconds.
+    double period;
+    /// The maximum fraction of one core the sampler may use on average (ie: 0.01 for 1%), 0
+    /// to never adapt the sampling to its cost.
+    double cpu_budget;
+    /// Whether backtraces should be retrieved, if the budget allows it.
+    bool retrieve_backtraces;
+    /// Whether dispatch queue names should be retrieved, if the budget allows it.
+    bool retrieve_dispatch_queue_names;
+} sample_scheduler_config_t;
+
+typedef struct {
+    /// Number of the tick, starting at 0.
+    uint64_t sequence;
+    /// Time elapsed since the start of the previous tick in seconds, 0 for the first tick.
+    double interval;
+    /// Number of deadlines skipped because the previous tick took longer than the period.
+    uint64_t missed_deadlines;
+    /// The current period in seconds, which may be longer than the configured one if the
+    /// sampler is over its budget.
+    double period;
+    /// Whether backtraces should be retrieved in this tick.
+    bool retrieve_backtraces;
+    /// Whether dispatch queue names should be retrieved in this tick.
+    bool retrieve_dispatch_queue_names;
+} sample_tick_plan_t;
+
+typedef struct {
+    /// CPU time used by the tick, in seconds.
+    double cpu_time;
+    /// Time elapsed between the start of the tick and `sample_scheduler_end_tick`, in seconds.
+    double wall_time;
+    /// Fraction of one core used by the sampler during the latest complete measurement
+    /// window, 0 until the first window completes.
+    double cpu_usage;
+} sample_tick_cost_t;
+
+/// Schedules periodic samples at absolute deadlines, adapting what is sampled to stay within a
+/// CPU budget.
+///
+/// Deadlines are multiples of the period since the first tick, so the time taken by each
+/// sample doesn't make the schedule drift. A tick that runs past the next deadline skips it,
+/// instead of sampling several times in a row to catch up. On Linux, deadlines are waited for
+/// with a `timerfd` armed with an absolute time (`TFD_TIMER_ABSTIME`).
+///
+/// The caller reports the CPU time used by each tick, and the usage (CPU time over elapsed
+/// time) is measured over windows of at least 8 ticks, including at least one that retrieves
+/// backtraces. If the usage of a window goes over the budget, the scheduler degrades the
+/// sampling one step: it first retrieves backtraces less often (every 2, 4, 8, then 16
+/// ticks), then stops retrieving dispatch queue names, and finally stretches the period (up
+/// to 8 times the configured one). Once the usage of a window is well under the budget, the
+/// latest step is undone.
+typedef struct sample_scheduler sample_scheduler_t;
+
+/// Creates a scheduler. The first tick is due immediately.
+/// - Returns: The scheduler, or `NULL` if it couldn't be created.
+sample_scheduler_t *sample_scheduler_create(sample_scheduler_config_t config);
+
+/// Destroys the scheduler. No thread may be waiting on it.
+void sample_scheduler_destroy(sample_scheduler_t *scheduler);
+
+/// Waits until the next deadline, and plans the tick that starts then. Only one thread may
+/// wait on a given scheduler.
+/// - Returns: `false` if the scheduler was stopped, either before or while waiting.
+bool sample_scheduler_wait(sample_scheduler_t *scheduler, sample_tick_plan_t *plan);
+
+/// Reports the CPU time used by the tick planned by the latest call to
+/// `sample_scheduler_wait`, adapting the next ticks to the budget.
+/// - Parameter cost: If not `NULL`, receives the cost of the tick.
+void sample_scheduler_end_tick(sample_scheduler_t *scheduler, double cpu_time, sample_tick_cost_t *cost);
+
+/// Stops the scheduler, waking up any thread waiting on it. Can be called from any thread.
+void sample_scheduler_stop(sample_scheduler_t *scheduler);
+
+/// CPU time used by the calling thread since it started, in seconds.
+double sample_thread_cpu_time(void);
+
+#endif /* sample_scheduler_h */
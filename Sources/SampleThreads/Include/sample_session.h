@@ -0,0 +1,208 @@
+//
+//  sample_session.h
+//
+
+#ifndef sample_session_h
+#define sample_session_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "get_backtrace.h"
+#include "sample_threads.h"
+#include "core_topology.h"
+#include "stack_table.h"
+#include "name_table.h"
+#include "region_markers.h"
+#include "sampler_stats.h"
+#include "energy_model.h"
+
+/// Number of samples after which the cached thread names of a session are read again.
+#define SAMPLE_NAME_REFRESH_INTERVAL 16
+
+typedef struct {
+    /// The energy sampling info.
+    sampled_thread_info_t info;
+    /// Counters of each core cluster accumulated since the previous sample, indexed like the
+    /// clusters of the session's topology.
+    cpu_counters_t deltas[SAMPLE_MAX_CLUSTERS];
+    /// Stable index of the thread in the session, kept for as long as the thread is alive.
+    /// Slots of threads that exited are reused by new threads.
+    uint32_t slot;
+    /// Whether this is the first sample of the thread. The deltas of new threads are zero.
+    bool is_new;
+    /// ID of the thread's backtrace in the session's stack table, or `STACK_ID_NONE` if no
+    /// backtrace was retrieved.
+    stack_id_t stack_id;
+    /// ID of `info.pthread_name` in the session's name table, or `NAME_ID_NONE` if the thread
+    /// has no name.
+    name_id_t pthread_name_id;
+    /// ID of `info.dispatch_queue_name` in the session's name table, or `NAME_ID_NONE` if the
+    /// thread is not running a dispatch queue (or queue names were not retrieved).
+    name_id_t dispatch_queue_name_id;
+    /// ID of the name of the thread's current region (see `region_markers.h`) in the
+    /// session's name table, or `NAME_ID_NONE` if the thread is not in a region.
+    name_id_t region_name_id;
+} sampled_thread_record_t;
+
+typedef struct {
+    /// ID of the region's name in the session's name table.
+    name_id_t name_id;
+    /// Number of sampled threads that were in the region.
+    uint32_t thread_count;
+    /// Sum of the deltas of the threads that were in the region, for each core cluster.
+    cpu_counters_t deltas[SAMPLE_MAX_CLUSTERS];
+} sampled_region_t;
+
+typedef enum {
+    /// The thread was seen for the first time.
+    THREAD_EVENT_BIRTH,
+    /// The thread was not found anymore. Its slot may be reused from the next sample on.
+    THREAD_EVENT_DEATH
+} thread_event_type_t;
+
+typedef struct {
+    /// Whether the thread was born or died.
+    thread_event_type_t type;
+    /// The slot of the thread.
+    uint32_t slot;
+    /// The thread ID.
+    uint64_t thread_id;
+} thread_event_t;
+
+typedef struct {
+    /// Number of sampled threads.
+    uint64_t thread_count;
+    /// The sampled threads. Owned by the session.
+    const sampled_thread_record_t *threads;
+    /// The unique backtraces seen by the session so far, referenced by the threads' stack
+    /// IDs. Owned by the session. Stacks are only removed by `sample_session_reset_tables`, so
+    /// while `stack_table_generation` doesn't change, stack IDs keep their meaning and the
+    /// stacks first seen in this sample are the ones with IDs above the previous
+    /// `stack_table_count`.
+    const stack_table_t *stacks;
+    /// The unique thread and dispatch queue names seen by the session so far, referenced by
+    /// the threads' name IDs. Owned by the session. Like stacks, names are only removed by
+    /// `sample_session_reset_tables`, and while `name_table_generation` doesn't change, the
+    /// names first seen in this sample are the ones with IDs above the previous
+    /// `name_table_count`.
+    const name_table_t *names;
+    /// Number of regions that at least one sampled thread was in.
+    uint32_t region_count;
+    /// The counter deltas of the threads in each region, attributed to the region each
+    /// thread was in when sampled. Owned by the session. Only sessions of the current process
+    /// see regions.
+    const sampled_region_t *regions;
+    /// Number of thread births and deaths since the previous sample.
+    uint64_t event_count;
+    /// The thread births and deaths since the previous sample. Owned by the session.
+    const thread_event_t *events;
+    /// Time elapsed since the previous sample in seconds, 0 for the first sample.
+    ///
+    /// This is measured with a clock that keeps running while the system is asleep, as
+    /// power is the energy consumed divided by the *total* time between samples (the
+    /// counters' own times exclude the periods where the threads were not running).
+    double interval;
+    /// Number of core clusters the counters are broken down by, as in the session's topology.
+    uint32_t cluster_count;
+    /// Sum of the deltas of all threads, for each core cluster. Clusters past
+    /// `cluster_count` are zero.
+    cpu_counters_t deltas[SAMPLE_MAX_CLUSTERS];
+} sample_session_result_t;
+
+typedef struct {
+    /// Number of worker threads sampling the threads of the process in parallel, in addition
+    /// to the calling thread. 0 samples all threads on the calling thread.
+    ///
+    /// Workers pay off for processes with thousands of threads, where reading the counters of
+    /// every thread one after another takes longer than the sampling period. Only the
+    /// counters are read by the workers: backtraces are always retrieved from the calling
+    /// thread, as unwinding suspends threads. The workers are created with the session,
+    /// pinned to their own CPUs when possible (see `sample_session_pinned_worker_count`),
+    /// and are sampled (but not unwound) like any other thread of the process.
+    uint32_t worker_count;
+    /// How the energy measured for the whole system is attributed to the threads. Only used
+    /// on Linux, where RAPL measures the energy of whole packages: on Apple platforms, the
+    /// CLPC measures the energy of each thread.
+    energy_model_kind_t energy_model;
+    /// Weights of a linear energy model fitted in a calibration run (ie: read with
+    /// `sample_session_energy_model_weights` at the end of a previous session), laid out as
+    /// described in `energy_model.h`. They are used as they are, instead of fitting the model
+    /// while sampling. `NULL` to fit the model online. Copied by the session.
+    const double *energy_model_weights;
+    /// Number of values of `energy_model_weights`.
+    uint32_t energy_model_weight_count;
+} sample_session_config_t;
+
+/// A persistent sampling session for a process.
+///
+/// The session owns the memory used to store the samples: a slab of thread records, reused
+/// between samples and only grown when a sample doesn't fit, and a stack table where every
+/// distinct backtrace is stored once. Sampling a process with a stable number of threads
+/// whose backtraces were already seen doesn't allocate any memory.
+typedef struct sample_session sample_session_t;
+
+/// Creates a sampling session for the given process.
+/// - Returns: The session, or `NULL` if it couldn't be created.
+sample_session_t *sample_session_create(int pid);
+
+/// Creates a sampling session for the given process, with the given configuration.
+/// - Returns: The session, or `NULL` if it couldn't be created.
+sample_session_t *sample_session_create_with_config(int pid, sample_session_config_t config);
+
+/// Samples all the threads of the session's process, computing the counter deltas of each
+/// thread since the previous sample.
+///
+/// The returned result points directly to the session's memory, and is only valid until the
+/// next call to `sample_session_sample_into` or `sample_session_destroy`.
+sample_session_result_t sample_session_sample_into(sample_session_t *session, bool retrieve_dispatch_queue_names, bool retrieve_backtraces);
+
+/// Makes the session read the names of all threads again on the next sample, ie: after a
+/// thread was renamed.
+///
+/// Thread names are cached by the session, and only read when a thread is first seen, and
+/// then every `SAMPLE_NAME_REFRESH_INTERVAL` samples, so renames are otherwise picked up
+/// with some delay. Dispatch queue names are not affected, as the queue a thread is running
+/// is checked on every sample.
+void sample_session_invalidate_names(sample_session_t *session);
+
+/// Empties the session's stack and name tables, releasing the memory they grew to.
+///
+/// The tables only grow while the session runs, as every distinct backtrace and name is kept
+/// in case a later sample references it. Long-running sessions should reset them when the
+/// previous IDs are no longer needed, ie: when the sampled process changes, or when a capture
+/// is rotated. The generation of both tables changes, so consumers that cached IDs can tell
+/// that they must forget them, and thread names are read again on the next sample.
+void sample_session_reset_tables(sample_session_t *session);
+
+/// Copies the weights of the session's linear energy model (see `energy_model.h`), either
+/// calibrated or fitted so far, to `weights`, which must have room for
+/// `ENERGY_MODEL_MAX_FEATURES` values. Running a representative workload and saving these
+/// weights calibrates the model for later sessions on the same machine.
+/// - Returns: The number of weights, or 0 if the model is not linear or not fitted yet.
+uint32_t sample_session_energy_model_weights(const sample_session_t *session, double *weights);
+
+/// The core clusters the counters of the session are broken down by. Owned by the session.
+///
+/// This may have fewer clusters than the system (see `core_topology_discover`): on Linux,
+/// clusters without their own PMU can't be told apart by the counters, so they are sampled
+/// as a single cluster.
+const core_topology_t *sample_session_topology(const sample_session_t *session);
+
+/// The cost of the samples taken by the session. Owned by the session, and only valid until
+/// `sample_session_destroy`.
+sampler_stats_t *sample_session_stats(sample_session_t *session);
+
+/// CPU time used by the session's workers since the session was created, in seconds, or 0 if
+/// it has none. Together with the CPU time of the thread calling `sample_session_sample_into`,
+/// this is the CPU time used by sampling.
+double sample_session_worker_cpu_time(const sample_session_t *session);
+
+/// Number of the session's workers that were pinned to their own CPU. Workers are not pinned
+/// on Apple platforms, nor when the process may only run on one CPU, and may be fewer than
+/// `worker_count` if pinning failed.
+uint32_t sample_session_pinned_worker_count(const sample_session_t *session);
+
+/// Destroys the session, releasing all its memory.
+void sample_session_destroy(sample_session_t *session);
+
+#endif /* sample_session_h */
@@ -12,9 +12,15 @@
 #include <stdbool.h>
 #include "get_backtrace.h"
 
+/// Maximum number of core clusters the counters of a thread are broken down by (see
+/// `core_topology.h`). Systems with more clusters have the extra ones merged into the last.
+#define SAMPLE_MAX_CLUSTERS 8
+
 typedef struct {
     /// Cycles executed by the thread.
     uint64_t cycles;
+    /// Instructions retired by the thread.
+    uint64_t instructions;
     /// Energy used by thread, J.
     double energy;
     /// Sampling interval in seconds.
@@ -28,10 +34,10 @@ typedef struct {
     char pthread_name[64];
     /// Name of the thread's Dispatch Queue, if any
     char dispatch_queue_name[128];
-    /// Performance core counters.
-    cpu_counters_t performance;
-    /// Efficiency core counters.
-    cpu_counters_t efficiency;
+    /// Counters of the time spent on each core cluster, indexed like the clusters of the
+    /// sampling topology (so cluster 0 holds the counters of the fastest cores). The counters
+    /// of clusters past the topology's `cluster_count` are zero.
+    cpu_counters_t clusters[SAMPLE_MAX_CLUSTERS];
 } sampled_thread_info_t;
 
 typedef struct {
@@ -46,6 +52,15 @@ typedef struct {
     sampled_thread_info_w_backtrace_t *cpu_counters;
 } sample_threads_result;
 
+/// Samples all the threads of the given process.
+///
+/// On Apple platforms, counters are read from the CLPC using `proc_pidinfo`. On Linux,
+/// cycles and instructions come from `perf_event_open`, CPU time from
+/// `/proc/<pid>/task/<tid>/schedstat` and energy from RAPL (see `sample_threads_linux.c`).
+///
+/// The returned `cpu_counters` array (and each backtrace's `addresses`) is allocated with
+/// `malloc` and must be freed by the caller. For periodic sampling, prefer `sample_session_t`
+/// (see `sample_session.h`), which reuses its memory between samples.
 sample_threads_result sample_threads(int pid, bool retrieve_dispatch_queue_names, bool retrieve_backtraces);
 
 #endif /* sample_threads_h */
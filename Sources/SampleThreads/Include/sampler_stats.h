@@ -0,0 +1,93 @@
+//
+//  sampler_stats.h
+//
+
+#ifndef sampler_stats_h
+#define sampler_stats_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    /// A whole sample, from the start of `sample_session_sample_into` to its return.
+    SAMPLER_PHASE_TICK,
+    /// Listing the threads of the process.
+    SAMPLER_PHASE_ENUMERATE_THREADS,
+    /// Reading the counters of all threads (and, on Linux, apportioning the RAPL energy).
+    SAMPLER_PHASE_READ_COUNTERS,
+    /// Reading thread names and dispatch queue names.
+    SAMPLER_PHASE_READ_NAMES,
+    /// Retrieving and interning the backtraces of all threads.
+    SAMPLER_PHASE_BACKTRACES,
+    /// How long each thread was interrupted to retrieve its backtrace. Unlike the rest of the
+    /// phases, which record one value per sample, this records one value per thread.
+    SAMPLER_PHASE_THREAD_BACKTRACE,
+    /// Computing the counter deltas since the previous sample.
+    SAMPLER_PHASE_DELTAS,
+    /// Processing the sample after `sample_session_sample_into` returns (ie: in Swift),
+    /// recorded by the caller with `sampler_stats_record_phase`.
+    SAMPLER_PHASE_POST_PROCESS,
+    SAMPLER_PHASE_COUNT
+} sampler_phase_t;
+
+typedef enum {
+    /// Memory allocations made by the sampler in a sample.
+    SAMPLER_COUNTER_ALLOCATIONS,
+    /// Calls into the kernel (syscalls and Mach traps) made by the sampler in a sample.
+    SAMPLER_COUNTER_SYSCALLS,
+    SAMPLER_COUNTER_COUNT
+} sampler_counter_t;
+
+typedef struct {
+    /// Number of recorded values.
+    uint64_t count;
+    /// Smallest recorded value.
+    uint64_t min;
+    /// Largest recorded value.
+    uint64_t max;
+    /// Mean of the recorded values.
+    double mean;
+    /// Latest recorded value.
+    uint64_t latest;
+    /// Percentiles of the recorded values, within the precision of the histogram (~3%).
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+} sampler_summary_t;
+
+/// Measures the cost of the sampler itself, so it can be reported next to the power figures
+/// and it can be noticed when sampling starts perturbing the sampled process.
+///
+/// The time spent in each phase of sampling (in nanoseconds) and the number of allocations and
+/// kernel calls made in each sample are recorded into HDR histograms: log-linear buckets with
+/// a fixed relative precision, so recording a value is O(1), never allocates, and percentiles
+/// can be read at any time. Timestamps are taken from a raw monotonic clock, which is read
+/// from user space (the vDSO on Linux) without entering the kernel.
+///
+/// Each `sample_session_t` owns a `sampler_stats_t` (see `sample_session_stats`). It's not
+/// thread-safe: it must only be used from the thread that samples, or between samples.
+typedef struct sampler_stats sampler_stats_t;
+
+/// Current time of the clock used to time the phases, in nanoseconds.
+uint64_t sampler_stats_now_ns(void);
+
+/// Records the duration of a phase, in nanoseconds.
+void sampler_stats_record_phase(sampler_stats_t *stats, sampler_phase_t phase, uint64_t duration_ns);
+
+/// Summary of the durations of a phase, in nanoseconds.
+sampler_summary_t sampler_stats_phase_summary(const sampler_stats_t *stats, sampler_phase_t phase);
+
+/// Summary of a counter's values per sample.
+sampler_summary_t sampler_stats_counter_summary(const sampler_stats_t *stats, sampler_counter_t counter);
+
+/// Total of a counter across all samples.
+uint64_t sampler_stats_counter_total(const sampler_stats_t *stats, sampler_counter_t counter);
+
+/// Number of samples recorded.
+uint64_t sampler_stats_tick_count(const sampler_stats_t *stats);
+
+/// Forgets all the recorded values.
+void sampler_stats_reset(sampler_stats_t *stats);
+
+#endif /* sampler_stats_h */
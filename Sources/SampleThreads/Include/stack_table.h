@@ -0,0 +1,69 @@
+//
+//  stack_table.h
+//
+
+#ifndef stack_table_h
+#define stack_table_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "get_backtrace.h"
+
+/// Identifies a unique stack in a `stack_table_t`. IDs are assigned in order, starting at 0,
+/// and are stable until the table is reset.
+typedef uint32_t stack_id_t;
+
+/// Marks the absence of a stack (ie: no backtrace was retrieved).
+#define STACK_ID_NONE 0xFFFFFFFF
+
+/// A deduplicated store of backtraces.
+///
+/// Each distinct sequence of addresses is stored once, in a single frame arena, and is
+/// identified by a 32-bit stack ID. Stacks are found by the hash of their addresses, using
+/// open addressing, so interning a stack that was already seen doesn't allocate any memory
+/// and only costs hashing and comparing its addresses. Samples can then carry a stack ID
+/// instead of a copy of their backtrace, so memory grows with the number of unique stacks
+/// rather than with the number of samples.
+///
+/// Stacks are never removed one by one. Long-running samplers bound the table's memory by
+/// resetting it (see `stack_table_reset`) at points where consumers can forget the stack IDs
+/// they know, ie: when a capture file is rotated.
+typedef struct stack_table stack_table_t;
+
+/// Creates an empty stack table.
+/// - Returns: The table, or `NULL` if it couldn't be created.
+stack_table_t *stack_table_create(void);
+
+/// Destroys the table, releasing all its memory.
+void stack_table_destroy(stack_table_t *table);
+
+/// Finds the ID of a stack, adding the stack to the table if it wasn't seen before.
+/// - Parameters:
+///   - addresses: The addresses of the stack, innermost address first.
+///   - length: The number of addresses.
+/// - Returns: The ID of the stack, or `STACK_ID_NONE` if the stack is empty or there was no
+/// memory to add it.
+stack_id_t stack_table_intern(stack_table_t *table, const backtrace_address_t *addresses, uint32_t length);
+
+/// Number of unique stacks in the table. All IDs below this number are valid.
+uint32_t stack_table_count(const stack_table_t *table);
+
+/// The addresses of a stack, innermost address first.
+///
+/// The returned pointer is owned by the table, and is only valid until the next call to
+/// `stack_table_intern`, as the frame arena may be reallocated to grow.
+/// - Returns: The addresses, or `NULL` (with a length of 0) if the ID is not valid.
+const backtrace_address_t *stack_table_stack(const stack_table_t *table, stack_id_t stack_id, uint32_t *length);
+
+/// Total number of addresses stored in the table's frame arena.
+uint64_t stack_table_frame_count(const stack_table_t *table);
+
+/// Forgets all the stacks, releasing the memory the table grew to. Stack IDs are reused by
+/// the stacks interned from then on, so consumers that keep anything by stack ID must
+/// discard it when the table's generation changes.
+void stack_table_reset(stack_table_t *table);
+
+/// Incremented every time the table is reset, starting at 0.
+uint32_t stack_table_generation(const stack_table_t *table);
+
+#endif /* stack_table_h */
@@ -0,0 +1,101 @@
+//
+//  system_sampler.h
+//
+
+#ifndef system_sampler_h
+#define system_sampler_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    /// Number of worker threads sampling processes in parallel, in addition to the calling
+    /// thread. 0 samples all processes on the calling thread.
+    uint32_t worker_count;
+    /// Whether to report a row for every thread, in addition to the per-process rows.
+    bool include_threads;
+} system_sampler_config_t;
+
+typedef struct {
+    /// A NUL-terminated process or thread name.
+    char name[64];
+} system_sample_name_t;
+
+/// The samples of all the processes of the system in a single tick, stored as columns: every
+/// `process_*` array has `process_count` elements, and every `thread_*` array has
+/// `thread_count` elements. Counters are the change since the previous tick, and are 0 for
+/// the first tick a process or thread is seen.
+///
+/// All the arrays are owned by the sampler, and are only valid until the next call to
+/// `system_sampler_sample` or `system_sampler_destroy`.
+typedef struct {
+    /// Time elapsed since the previous tick in seconds, 0 for the first tick.
+    double interval;
+    /// Energy used by the whole system during the interval, J. On Linux, this is the energy
+    /// reported by RAPL, 0 if it is not readable.
+    double energy;
+
+    /// Number of processes sampled, sorted by PID.
+    uint32_t process_count;
+    const int32_t *process_ids;
+    const system_sample_name_t *process_names;
+    /// Index of the first thread of each process in the thread columns. The threads of a
+    /// process are contiguous, sorted by thread ID.
+    const uint32_t *process_first_thread;
+    /// Number of threads of each process. Also reported if `include_threads` is `false`.
+    const uint32_t *process_thread_count;
+    /// Cycles executed by the process' threads (0 where not available).
+    const uint64_t *process_cycles;
+    /// Instructions retired by the process' threads (0 where not available).
+    const uint64_t *process_instructions;
+    /// CPU time used by the process' threads, in seconds.
+    const double *process_cpu_time;
+    /// Energy attributed to the process' threads, J.
+    const double *process_energy;
+
+    /// Number of thread rows, 0 if `include_threads` is `false`.
+    uint32_t thread_count;
+    const uint64_t *thread_ids;
+    /// Index of the process of each thread in the process columns.
+    const uint32_t *thread_process_index;
+    const system_sample_name_t *thread_names;
+    const uint64_t *thread_cycles;
+    const uint64_t *thread_instructions;
+    const double *thread_cpu_time;
+    const double *thread_energy;
+} system_sample_batch_t;
+
+/// Samples the threads of every process in the system, for system-wide attribution of CPU
+/// time and energy (ie: a `powermetrics`-style agent).
+///
+/// The sampler keeps the state of every process (and of every thread) between ticks, so only
+/// processes and threads that appeared since the previous tick need to be set up. Processes
+/// are sampled independently, sharded over a small worker pool, and their results are then
+/// gathered into a single columnar batch.
+///
+/// On Linux, processes and threads are enumerated through `/proc` and `/proc/<pid>/task`,
+/// using directory file descriptors kept open between ticks, and CPU time is read from each
+/// thread's `schedstat`. RAPL package energy is apportioned to the threads proportionally to
+/// their CPU time. Sampling other users' processes requires root (or `CAP_SYS_PTRACE`);
+/// processes that can't be read are skipped.
+///
+/// On macOS, processes are enumerated with `proc_listallpids`, and the CLPC counters of each
+/// thread are read with `proc_pidinfo`, which requires root for processes of other users.
+/// This mode is not available on iOS.
+typedef struct system_sampler system_sampler_t;
+
+/// Creates a system-wide sampler.
+/// - Returns: The sampler, or `NULL` if it couldn't be created or system-wide sampling is
+/// not available on this platform.
+system_sampler_t *system_sampler_create(system_sampler_config_t config);
+
+/// Samples all the processes in the system.
+///
+/// The returned batch points directly to the sampler's memory, and is only valid until the
+/// next call to `system_sampler_sample` or `system_sampler_destroy`.
+system_sample_batch_t system_sampler_sample(system_sampler_t *sampler);
+
+/// Destroys the sampler, stopping its workers and releasing all its resources.
+void system_sampler_destroy(system_sampler_t *sampler);
+
+#endif /* system_sampler_h */
@@ -0,0 +1,882 @@
+//
+//  capture_file.c
+//
+
+#include "capture_file.h"
+#include "intern_table.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// File layout. Fixed-width integers are little-endian.
+//
+//   Header:  "PMKCAPT1", u32 version, u32 reserved
+//   Chunks:  u32 CHUNK_MAGIC, u32 payload size, payload (one chunk per sample)
+//   Index:   for each chunk: u64 time_ns, u64 offset, u32 payload size, u32 thread count
+//            for each stack: u64 offset of its definition
+//            for each name:  u64 offset of its definition
+//   Trailer: u64 offset and u64 count of the chunk, stack and name indices, "PMKCAPND"
+//
+// The payload of a chunk is a sequence of varints:
+//
+//   time_ns, interval_ns, thread count, core cluster count
+//   one column per field, with a value for each thread:
+//       thread ID (zigzag delta from the previous thread's)
+//       pthread name ID + 1, dispatch queue name ID + 1, stack ID + 1 (0 if none)
+//       for each cluster: cycles, instructions, time in ns (zigzag), energy in nJ (zigzag)
+//   first new stack ID, new stack count, then for each stack: length, and each address
+//   (zigzag delta from the previous address)
+//   first new name ID, new name count, then for each name: length, and its characters
+//
+// The chunk index makes the trailer the only part of the file that must be read to find a
+// sample, but every chunk is also self-describing, so the index can be rebuilt from the
+// chunks alone if the writer was never closed.
+//
+// Version 1 captures have no cluster count in their chunks, and always two clusters
+// (performance and efficiency cores).
+
+#define HEADER_MAGIC "PMKCAPT1"
+#define TRAILER_MAGIC "PMKCAPND"
+#define FORMAT_VERSION 2
+/// Oldest version that can still be read.
+#define MIN_FORMAT_VERSION 1
+#define HEADER_SIZE 16
+#define CHUNK_MAGIC 0x434B4D50 // "PMKC"
+#define CHUNK_HEADER_SIZE 8
+#define CHUNK_INDEX_ENTRY_SIZE 24
+#define TRAILER_SIZE 56
+
+/// Maximum number of bytes of a 64-bit varint.
+#define MAX_VARINT_SIZE 10
+/// Number of values written for each thread, besides its counters.
+#define THREAD_COLUMN_COUNT 4
+/// Number of counters written for each thread and core cluster.
+#define CLUSTER_COLUMN_COUNT 4
+/// Chunks are buffered, and written to the file once the buffer reaches this size. This is
+/// also the most that is lost if the writer is never closed.
+#define FLUSH_THRESHOLD (1 << 20)
+
+#define INITIAL_NAME_CAPACITY 64
+#define INITIAL_NAME_CHARACTER_CAPACITY (64 * 16)
+
+// MARK: - Encoding
+
+static inline uint8_t *put_varint(uint8_t *cursor, uint64_t value) {
+    while (value >= 0x80) {
+        *cursor++ = (uint8_t) value | 0x80;
+        value >>= 7;
+    }
+    *cursor++ = (uint8_t) value;
+    return cursor;
+}
+
+static inline uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static inline void put_u32(uint8_t *cursor, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        cursor[i] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+static inline void put_u64(uint8_t *cursor, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        cursor[i] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+static inline uint32_t get_u32(const uint8_t *cursor) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t) cursor[i] << (8 * i);
+    }
+    return value;
+}
+
+static inline uint64_t get_u64(const uint8_t *cursor) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t) cursor[i] << (8 * i);
+    }
+    return value;
+}
+
+/// Converts a time or energy to an integer number of billionths.
+static inline uint64_t encode_billionths(double value) {
+    return zigzag_encode((int64_t) llround(value * 1e9));
+}
+
+static inline double decode_billionths(uint64_t value) {
+    return (double) zigzag_decode(value) / 1e9;
+}
+
+/// Reads varints from a byte range, without ever reading past its end. Reading a truncated or
+/// overlong varint sets `failed`, and any later read returns 0.
+typedef struct {
+    const uint8_t *cursor;
+    const uint8_t *end;
+    bool failed;
+} decoder_t;
+
+static inline uint64_t get_varint(decoder_t *decoder) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64 && decoder->cursor < decoder->end; shift += 7) {
+        uint8_t byte = *decoder->cursor++;
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+    decoder->failed = true;
+    decoder->cursor = decoder->end;
+    return 0;
+}
+
+// MARK: - Writer
+
+typedef struct {
+    uint64_t time_ns;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t thread_count;
+} chunk_entry_t;
+
+struct capture_writer {
+    int fd;
+    /// Chunks not written to the file yet.
+    uint8_t *buffer;
+    size_t buffer_size;
+    size_t buffer_capacity;
+    /// Number of bytes already written to the file.
+    uint64_t file_size;
+    /// Set if a write failed, as the file can't be completed after that.
+    bool failed;
+    uint64_t last_time_ns;
+
+    chunk_entry_t *chunks;
+    uint64_t chunk_count;
+    uint64_t chunk_capacity;
+    /// File offset of the definition of each stack written so far.
+    uint64_t *stack_offsets;
+    uint32_t stack_count;
+    uint32_t stack_capacity;
+    /// Generation of the session's stack table the stack IDs belong to, set by the first
+    /// sample with stacks.
+    uint32_t stack_generation;
+    bool has_stack_generation;
+
+    /// The unique names, indexed by name ID.
+    intern_table_t names;
+    /// File offset of the definition of each name written so far. Names are interned
+    /// before they are written, so there may be fewer offsets than names.
+    uint64_t *name_offsets;
+    uint32_t written_name_count;
+    uint32_t name_offset_capacity;
+};
+
+/// Grows an array to fit at least `count` elements, doubling its capacity.
+static bool grow(void **array, uint64_t *capacity, uint64_t count, size_t element_size) {
+    if (count <= *capacity) {
+        return true;
+    }
+    uint64_t new_capacity = *capacity == 0 ? 64 : *capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    void *new_array = realloc(*array, new_capacity * element_size);
+    if (new_array == NULL) {
+        return false;
+    }
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+static bool grow32(void **array, uint32_t *capacity, uint32_t count, size_t element_size) {
+    uint64_t capacity64 = *capacity;
+    if (!grow(array, &capacity64, count, element_size)) {
+        return false;
+    }
+    *capacity = (uint32_t) capacity64;
+    return true;
+}
+
+static bool write_all(int fd, const uint8_t *bytes, size_t count) {
+    while (count > 0) {
+        ssize_t written = write(fd, bytes, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        count -= (size_t) written;
+    }
+    return true;
+}
+
+static bool flush_buffer(capture_writer_t *writer) {
+    if (!write_all(writer->fd, writer->buffer, writer->buffer_size)) {
+        writer->failed = true;
+        return false;
+    }
+    writer->file_size += writer->buffer_size;
+    writer->buffer_size = 0;
+    return true;
+}
+
+/// Ensures there's room for `count` more bytes in the buffer.
+/// - Returns: The end of the buffered bytes, or `NULL` if the buffer couldn't grow.
+static uint8_t *reserve_bytes(capture_writer_t *writer, size_t count) {
+    uint64_t capacity = writer->buffer_capacity;
+    if (!grow((void **) &writer->buffer, &capacity, writer->buffer_size + count, 1)) {
+        return NULL;
+    }
+    writer->buffer_capacity = (size_t) capacity;
+    return writer->buffer + writer->buffer_size;
+}
+
+/// Offset in the file of the next buffered byte.
+static inline uint64_t buffer_offset(const capture_writer_t *writer, const uint8_t *cursor) {
+    return writer->file_size + (uint64_t) (cursor - writer->buffer);
+}
+
+static uint64_t hash_name(const char *characters, uint32_t length) {
+    // FNV-1a.
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (uint32_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) characters[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+/// Finds the ID of a NUL-terminated name of at most `capacity` characters, adding it to the
+/// writer's names if it wasn't seen before.
+static capture_name_id_t intern_name(capture_writer_t *writer, const char *name, size_t capacity) {
+    uint32_t length = (uint32_t) strnlen(name, capacity);
+    if (length == 0) {
+        return CAPTURE_NAME_NONE;
+    }
+    capture_name_id_t name_id = intern_table_intern(&writer->names, hash_name(name, length), name, length, 0);
+    _Static_assert(CAPTURE_NAME_NONE == INTERN_ID_NONE, "Names that can't be interned must have no name");
+    return name_id;
+}
+
+capture_writer_t *capture_writer_create(const char *path) {
+    capture_writer_t *writer = calloc(1, sizeof(capture_writer_t));
+    if (writer == NULL) {
+        return NULL;
+    }
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer->fd < 0) {
+        free(writer);
+        return NULL;
+    }
+    uint8_t *header = reserve_bytes(writer, FLUSH_THRESHOLD + HEADER_SIZE);
+    if (header == NULL || !intern_table_init(&writer->names, INITIAL_NAME_CAPACITY, INITIAL_NAME_CHARACTER_CAPACITY)) {
+        close(writer->fd);
+        free(writer->buffer);
+        free(writer);
+        return NULL;
+    }
+    memcpy(header, HEADER_MAGIC, 8);
+    put_u32(header + 8, FORMAT_VERSION);
+    put_u32(header + 12, 0);
+    writer->buffer_size = HEADER_SIZE;
+    return writer;
+}
+
+static uint8_t *put_counters(uint8_t *cursor, const sampled_thread_record_t *threads, uint64_t count, uint32_t cluster) {
+    for (uint64_t i = 0; i < count; i++) {
+        cursor = put_varint(cursor, threads[i].deltas[cluster].cycles);
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        cursor = put_varint(cursor, threads[i].deltas[cluster].instructions);
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        cursor = put_varint(cursor, encode_billionths(threads[i].deltas[cluster].time));
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        cursor = put_varint(cursor, encode_billionths(threads[i].deltas[cluster].energy));
+    }
+    return cursor;
+}
+
+bool capture_writer_append(capture_writer_t *writer, const sample_session_result_t *result, uint64_t time_ns) {
+    if (writer->failed
+        || result->thread_count > UINT32_MAX
+        || !grow((void **) &writer->chunks, &writer->chunk_capacity, writer->chunk_count + 1, sizeof(chunk_entry_t))) {
+        return false;
+    }
+    if (time_ns < writer->last_time_ns) {
+        time_ns = writer->last_time_ns;
+    }
+    const sampled_thread_record_t *threads = result->threads;
+    uint64_t thread_count = result->thread_count;
+    uint32_t cluster_count = result->cluster_count < SAMPLE_MAX_CLUSTERS ? result->cluster_count : SAMPLE_MAX_CLUSTERS;
+    uint64_t column_count = THREAD_COLUMN_COUNT + (uint64_t) cluster_count * CLUSTER_COLUMN_COUNT;
+    // Names interned by a sample that couldn't be written are written with this one.
+    uint32_t first_new_name = writer->written_name_count;
+    size_t chunk_start = writer->buffer_size;
+
+    // The thread columns.
+    uint8_t *cursor = reserve_bytes(writer, CHUNK_HEADER_SIZE + 4 * MAX_VARINT_SIZE + thread_count * column_count * MAX_VARINT_SIZE);
+    if (cursor == NULL) {
+        return false;
+    }
+    cursor += CHUNK_HEADER_SIZE;
+    cursor = put_varint(cursor, time_ns);
+    cursor = put_varint(cursor, zigzag_encode((int64_t) llround(result->interval * 1e9)));
+    cursor = put_varint(cursor, thread_count);
+    cursor = put_varint(cursor, cluster_count);
+    uint64_t previous_thread_id = 0;
+    for (uint64_t i = 0; i < thread_count; i++) {
+        cursor = put_varint(cursor, zigzag_encode((int64_t) (threads[i].info.thread_id - previous_thread_id)));
+        previous_thread_id = threads[i].info.thread_id;
+    }
+    // Adding 1 to the IDs maps CAPTURE_NAME_NONE and STACK_ID_NONE to 0.
+    for (uint64_t i = 0; i < thread_count; i++) {
+        const char *name = threads[i].info.pthread_name;
+        capture_name_id_t name_id = intern_name(writer, name, sizeof(threads[i].info.pthread_name));
+        cursor = put_varint(cursor, (uint32_t) (name_id + 1));
+    }
+    for (uint64_t i = 0; i < thread_count; i++) {
+        const char *name = threads[i].info.dispatch_queue_name;
+        capture_name_id_t name_id = intern_name(writer, name, sizeof(threads[i].info.dispatch_queue_name));
+        cursor = put_varint(cursor, (uint32_t) (name_id + 1));
+    }
+    for (uint64_t i = 0; i < thread_count; i++) {
+        cursor = put_varint(cursor, (uint32_t) (threads[i].stack_id + 1));
+    }
+    for (uint32_t cluster = 0; cluster < cluster_count; cluster++) {
+        cursor = put_counters(cursor, threads, thread_count, cluster);
+    }
+    writer->buffer_size = (size_t) (cursor - writer->buffer);
+
+    // The stacks first used by this sample. Stack IDs only keep their meaning within a
+    // generation of the session's table, and the stacks already written can't be taken back.
+    uint32_t stack_count = result->stacks != NULL ? stack_table_count(result->stacks) : 0;
+    if (result->stacks != NULL) {
+        uint32_t stack_generation = stack_table_generation(result->stacks);
+        if ((writer->has_stack_generation && stack_generation != writer->stack_generation)
+            || stack_count < writer->stack_count) {
+            writer->buffer_size = chunk_start;
+            return false;
+        }
+        writer->stack_generation = stack_generation;
+        writer->has_stack_generation = true;
+    }
+    uint32_t first_new_stack = writer->stack_count;
+    uint64_t stack_bytes = 2 * MAX_VARINT_SIZE;
+    for (stack_id_t stack_id = first_new_stack; stack_id < stack_count; stack_id++) {
+        uint32_t length;
+        stack_table_stack(result->stacks, stack_id, &length);
+        stack_bytes += MAX_VARINT_SIZE + (uint64_t) length * MAX_VARINT_SIZE;
+    }
+    if (stack_count > first_new_stack
+        && !grow32((void **) &writer->stack_offsets, &writer->stack_capacity, stack_count, sizeof(uint64_t))) {
+        writer->buffer_size = chunk_start;
+        return false;
+    }
+    cursor = reserve_bytes(writer, stack_bytes);
+    if (cursor == NULL) {
+        writer->buffer_size = chunk_start;
+        return false;
+    }
+    cursor = put_varint(cursor, first_new_stack);
+    cursor = put_varint(cursor, stack_count - first_new_stack);
+    for (stack_id_t stack_id = first_new_stack; stack_id < stack_count; stack_id++) {
+        uint32_t length;
+        const backtrace_address_t *addresses = stack_table_stack(result->stacks, stack_id, &length);
+        writer->stack_offsets[stack_id] = buffer_offset(writer, cursor);
+        cursor = put_varint(cursor, length);
+        uint64_t previous_address = 0;
+        for (uint32_t i = 0; i < length; i++) {
+            cursor = put_varint(cursor, zigzag_encode((int64_t) (addresses[i].address - previous_address)));
+            previous_address = addresses[i].address;
+        }
+    }
+    writer->buffer_size = (size_t) (cursor - writer->buffer);
+
+    // The names first used by this sample.
+    uint64_t name_bytes = 2 * MAX_VARINT_SIZE;
+    uint32_t name_count = writer->names.count;
+    for (capture_name_id_t name_id = first_new_name; name_id < name_count; name_id++) {
+        name_bytes += MAX_VARINT_SIZE + writer->names.keys[name_id].size;
+    }
+    if (name_count > first_new_name
+        && !grow32((void **) &writer->name_offsets, &writer->name_offset_capacity, name_count, sizeof(uint64_t))) {
+        writer->buffer_size = chunk_start;
+        return false;
+    }
+    cursor = reserve_bytes(writer, name_bytes);
+    if (cursor == NULL) {
+        writer->buffer_size = chunk_start;
+        return false;
+    }
+    cursor = put_varint(cursor, first_new_name);
+    cursor = put_varint(cursor, name_count - first_new_name);
+    for (capture_name_id_t name_id = first_new_name; name_id < name_count; name_id++) {
+        uint32_t length;
+        const void *characters = intern_table_key(&writer->names, name_id, &length);
+        writer->name_offsets[name_id] = buffer_offset(writer, cursor);
+        cursor = put_varint(cursor, length);
+        memcpy(cursor, characters, length);
+        cursor += length;
+    }
+    writer->buffer_size = (size_t) (cursor - writer->buffer);
+
+    uint8_t *chunk = writer->buffer + chunk_start;
+    uint32_t payload_size = (uint32_t) (writer->buffer_size - chunk_start - CHUNK_HEADER_SIZE);
+    put_u32(chunk, CHUNK_MAGIC);
+    put_u32(chunk + 4, payload_size);
+    writer->chunks[writer->chunk_count++] = (chunk_entry_t) {
+        .time_ns = time_ns,
+        .offset = writer->file_size + chunk_start,
+        .size = payload_size,
+        .thread_count = (uint32_t) thread_count
+    };
+    writer->stack_count = stack_count;
+    writer->written_name_count = name_count;
+    writer->last_time_ns = time_ns;
+
+    if (writer->buffer_size >= FLUSH_THRESHOLD) {
+        return flush_buffer(writer);
+    }
+    return true;
+}
+
+bool capture_writer_close(capture_writer_t *writer) {
+    bool success = !writer->failed;
+    uint64_t index_size = writer->chunk_count * CHUNK_INDEX_ENTRY_SIZE
+        + ((uint64_t) writer->stack_count + writer->written_name_count) * 8
+        + TRAILER_SIZE;
+    uint8_t *cursor = success ? reserve_bytes(writer, index_size) : NULL;
+    if (cursor != NULL) {
+        uint64_t chunk_index_offset = buffer_offset(writer, cursor);
+        for (uint64_t i = 0; i < writer->chunk_count; i++) {
+            const chunk_entry_t *entry = &writer->chunks[i];
+            put_u64(cursor, entry->time_ns);
+            put_u64(cursor + 8, entry->offset);
+            put_u32(cursor + 16, entry->size);
+            put_u32(cursor + 20, entry->thread_count);
+            cursor += CHUNK_INDEX_ENTRY_SIZE;
+        }
+        uint64_t stack_index_offset = buffer_offset(writer, cursor);
+        for (uint32_t i = 0; i < writer->stack_count; i++) {
+            put_u64(cursor, writer->stack_offsets[i]);
+            cursor += 8;
+        }
+        uint64_t name_index_offset = buffer_offset(writer, cursor);
+        for (uint32_t i = 0; i < writer->written_name_count; i++) {
+            put_u64(cursor, writer->name_offsets[i]);
+            cursor += 8;
+        }
+        put_u64(cursor, chunk_index_offset);
+        put_u64(cursor + 8, writer->chunk_count);
+        put_u64(cursor + 16, stack_index_offset);
+        put_u64(cursor + 24, writer->stack_count);
+        put_u64(cursor + 32, name_index_offset);
+        put_u64(cursor + 40, writer->written_name_count);
+        memcpy(cursor + 48, TRAILER_MAGIC, 8);
+        cursor += TRAILER_SIZE;
+        writer->buffer_size = (size_t) (cursor - writer->buffer);
+        success = flush_buffer(writer);
+    } else {
+        // Still write the complete chunks, which can be read without the index.
+        flush_buffer(writer);
+        success = false;
+    }
+    if (close(writer->fd) != 0) {
+        success = false;
+    }
+    free(writer->buffer);
+    free(writer->chunks);
+    free(writer->stack_offsets);
+    intern_table_free(&writer->names);
+    free(writer->name_offsets);
+    free(writer);
+    return success;
+}
+
+// MARK: - Reader
+
+struct capture_reader {
+    /// The mapped file.
+    const uint8_t *data;
+    uint64_t size;
+    /// Format version of the file.
+    uint32_t version;
+
+    // The indices, encoded as in the file. They point either into the mapped file or, if the
+    // capture has no index, to the `recovered_*` arrays.
+    const uint8_t *chunk_index;
+    uint64_t chunk_count;
+    const uint8_t *stack_index;
+    uint32_t stack_count;
+    const uint8_t *name_index;
+    uint32_t name_count;
+    uint8_t *recovered_chunk_index;
+    uint8_t *recovered_stack_index;
+    uint8_t *recovered_name_index;
+
+    /// The threads of the latest decoded tick.
+    capture_thread_t *threads;
+    uint32_t thread_capacity;
+};
+
+/// Whether the range `[offset, offset + count * element_size)` is inside the file.
+static bool range_is_valid(const capture_reader_t *reader, uint64_t offset, uint64_t count, uint64_t element_size) {
+    if (offset > reader->size || (element_size != 0 && count > (reader->size - offset) / element_size)) {
+        return false;
+    }
+    return true;
+}
+
+static bool read_trailer(capture_reader_t *reader) {
+    if (reader->size < HEADER_SIZE + TRAILER_SIZE) {
+        return false;
+    }
+    const uint8_t *trailer = reader->data + reader->size - TRAILER_SIZE;
+    if (memcmp(trailer + 48, TRAILER_MAGIC, 8) != 0) {
+        return false;
+    }
+    uint64_t chunk_index_offset = get_u64(trailer);
+    uint64_t chunk_count = get_u64(trailer + 8);
+    uint64_t stack_index_offset = get_u64(trailer + 16);
+    uint64_t stack_count = get_u64(trailer + 24);
+    uint64_t name_index_offset = get_u64(trailer + 32);
+    uint64_t name_count = get_u64(trailer + 40);
+    if (!range_is_valid(reader, chunk_index_offset, chunk_count, CHUNK_INDEX_ENTRY_SIZE)
+        || stack_count > UINT32_MAX
+        || !range_is_valid(reader, stack_index_offset, stack_count, 8)
+        || name_count > UINT32_MAX
+        || !range_is_valid(reader, name_index_offset, name_count, 8)) {
+        return false;
+    }
+    reader->chunk_index = reader->data + chunk_index_offset;
+    reader->chunk_count = chunk_count;
+    reader->stack_index = reader->data + stack_index_offset;
+    reader->stack_count = (uint32_t) stack_count;
+    reader->name_index = reader->data + name_index_offset;
+    reader->name_count = (uint32_t) name_count;
+    return true;
+}
+
+/// Appends the offsets of the definitions in a chunk's stack or name section to an index.
+/// - Returns: `false` if the section is corrupt, or doesn't follow the previous one.
+static bool recover_definitions(decoder_t *decoder,
+                                const uint8_t *data,
+                                bool are_stacks,
+                                uint8_t **index,
+                                uint32_t *count,
+                                uint64_t *capacity) {
+    uint64_t first_id = get_varint(decoder);
+    uint64_t new_count = get_varint(decoder);
+    if (decoder->failed || first_id != *count || new_count > UINT32_MAX - *count) {
+        return false;
+    }
+    if (!grow((void **) index, capacity, *count + new_count, 8)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < new_count; i++) {
+        put_u64(*index + (*count + i) * 8, (uint64_t) (decoder->cursor - data));
+        uint64_t length = get_varint(decoder);
+        if (are_stacks) {
+            for (uint64_t frame = 0; frame < length && !decoder->failed; frame++) {
+                get_varint(decoder);
+            }
+        } else if (length <= (uint64_t) (decoder->end - decoder->cursor)) {
+            decoder->cursor += length;
+        } else {
+            decoder->failed = true;
+        }
+        if (decoder->failed) {
+            return false;
+        }
+    }
+    *count += (uint32_t) new_count;
+    return true;
+}
+
+/// Reads the number of core clusters of a chunk, right after its thread count.
+/// - Returns: The number of clusters, or 0 if the chunk is corrupt.
+static uint32_t get_cluster_count(const capture_reader_t *reader, decoder_t *decoder) {
+    if (reader->version == 1) {
+        return 2;
+    }
+    uint64_t cluster_count = get_varint(decoder);
+    if (decoder->failed || cluster_count == 0 || cluster_count > SAMPLE_MAX_CLUSTERS) {
+        return 0;
+    }
+    return (uint32_t) cluster_count;
+}
+
+/// Rebuilds the index of a capture whose writer was never closed, by reading all its
+/// complete chunks. A chunk that was being written when the capture stopped is ignored.
+static bool recover_index(capture_reader_t *reader) {
+    uint64_t chunk_capacity = 0;
+    uint64_t stack_capacity = 0;
+    uint64_t name_capacity = 0;
+    uint64_t offset = HEADER_SIZE;
+    while (offset + CHUNK_HEADER_SIZE <= reader->size) {
+        const uint8_t *chunk = reader->data + offset;
+        uint32_t payload_size = get_u32(chunk + 4);
+        if (get_u32(chunk) != CHUNK_MAGIC
+            || payload_size > reader->size - offset - CHUNK_HEADER_SIZE
+            || !grow((void **) &reader->recovered_chunk_index, &chunk_capacity, reader->chunk_count + 1, CHUNK_INDEX_ENTRY_SIZE)) {
+            break;
+        }
+        decoder_t decoder = {
+            .cursor = chunk + CHUNK_HEADER_SIZE,
+            .end = chunk + CHUNK_HEADER_SIZE + payload_size
+        };
+        uint64_t time_ns = get_varint(&decoder);
+        get_varint(&decoder);
+        uint64_t thread_count = get_varint(&decoder);
+        uint32_t cluster_count = get_cluster_count(reader, &decoder);
+        if (cluster_count == 0 || thread_count > UINT32_MAX) {
+            break;
+        }
+        uint64_t column_count = THREAD_COLUMN_COUNT + (uint64_t) cluster_count * CLUSTER_COLUMN_COUNT;
+        for (uint64_t i = 0; i < thread_count * column_count && !decoder.failed; i++) {
+            get_varint(&decoder);
+        }
+        if (decoder.failed) {
+            break;
+        }
+        uint32_t stack_count = reader->stack_count;
+        uint32_t name_count = reader->name_count;
+        if (!recover_definitions(&decoder, reader->data, true, &reader->recovered_stack_index, &stack_count, &stack_capacity)
+            || !recover_definitions(&decoder, reader->data, false, &reader->recovered_name_index, &name_count, &name_capacity)) {
+            break;
+        }
+        // Only keep the definitions of chunks that could be read completely.
+        reader->stack_count = stack_count;
+        reader->name_count = name_count;
+        uint8_t *entry = reader->recovered_chunk_index + reader->chunk_count * CHUNK_INDEX_ENTRY_SIZE;
+        put_u64(entry, time_ns);
+        put_u64(entry + 8, offset);
+        put_u32(entry + 16, payload_size);
+        put_u32(entry + 20, (uint32_t) thread_count);
+        reader->chunk_count += 1;
+        offset += CHUNK_HEADER_SIZE + payload_size;
+    }
+    reader->chunk_index = reader->recovered_chunk_index;
+    reader->stack_index = reader->recovered_stack_index;
+    reader->name_index = reader->recovered_name_index;
+    return true;
+}
+
+capture_reader_t *capture_reader_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t) file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive, so the descriptor is not needed anymore.
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    capture_reader_t *reader = calloc(1, sizeof(capture_reader_t));
+    if (reader == NULL) {
+        munmap(data, (size_t) file_stat.st_size);
+        return NULL;
+    }
+    reader->data = data;
+    reader->size = (uint64_t) file_stat.st_size;
+    reader->version = get_u32(reader->data + 8);
+    if (memcmp(reader->data, HEADER_MAGIC, 8) != 0
+        || reader->version < MIN_FORMAT_VERSION
+        || reader->version > FORMAT_VERSION
+        || !(read_trailer(reader) || recover_index(reader))) {
+        capture_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+void capture_reader_close(capture_reader_t *reader) {
+    if (reader == NULL) {
+        return;
+    }
+    munmap((void *) reader->data, (size_t) reader->size);
+    free(reader->recovered_chunk_index);
+    free(reader->recovered_stack_index);
+    free(reader->recovered_name_index);
+    free(reader->threads);
+    free(reader);
+}
+
+uint64_t capture_reader_tick_count(const capture_reader_t *reader) {
+    return reader->chunk_count;
+}
+
+uint64_t capture_reader_tick_time(const capture_reader_t *reader, uint64_t index) {
+    if (index >= reader->chunk_count) {
+        return 0;
+    }
+    return get_u64(reader->chunk_index + index * CHUNK_INDEX_ENTRY_SIZE);
+}
+
+uint64_t capture_reader_find_tick(const capture_reader_t *reader, uint64_t time_ns) {
+    uint64_t low = 0;
+    uint64_t high = reader->chunk_count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (capture_reader_tick_time(reader, middle) < time_ns) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+bool capture_reader_read_tick(capture_reader_t *reader, uint64_t index, capture_tick_t *tick) {
+    if (index >= reader->chunk_count) {
+        return false;
+    }
+    const uint8_t *entry = reader->chunk_index + index * CHUNK_INDEX_ENTRY_SIZE;
+    uint64_t offset = get_u64(entry + 8);
+    uint32_t payload_size = get_u32(entry + 16);
+    uint32_t thread_count = get_u32(entry + 20);
+    if (!range_is_valid(reader, offset, CHUNK_HEADER_SIZE + (uint64_t) payload_size, 1)) {
+        return false;
+    }
+    if (thread_count > reader->thread_capacity) {
+        capture_thread_t *new_threads = realloc(reader->threads, thread_count * sizeof(capture_thread_t));
+        if (new_threads == NULL) {
+            return false;
+        }
+        reader->threads = new_threads;
+        reader->thread_capacity = thread_count;
+    }
+    decoder_t decoder = {
+        .cursor = reader->data + offset + CHUNK_HEADER_SIZE,
+        .end = reader->data + offset + CHUNK_HEADER_SIZE + payload_size
+    };
+    tick->time_ns = get_varint(&decoder);
+    tick->interval = decode_billionths(get_varint(&decoder));
+    if (get_varint(&decoder) != thread_count) {
+        return false;
+    }
+    uint32_t cluster_count = get_cluster_count(reader, &decoder);
+    if (cluster_count == 0) {
+        return false;
+    }
+
+    capture_thread_t *threads = reader->threads;
+    uint64_t thread_id = 0;
+    for (uint32_t i = 0; i < thread_count; i++) {
+        thread_id += (uint64_t) zigzag_decode(get_varint(&decoder));
+        threads[i].thread_id = thread_id;
+    }
+    for (uint32_t i = 0; i < thread_count; i++) {
+        threads[i].pthread_name = (capture_name_id_t) get_varint(&decoder) - 1;
+    }
+    for (uint32_t i = 0; i < thread_count; i++) {
+        threads[i].dispatch_queue_name = (capture_name_id_t) get_varint(&decoder) - 1;
+    }
+    for (uint32_t i = 0; i < thread_count; i++) {
+        threads[i].stack_id = (stack_id_t) get_varint(&decoder) - 1;
+    }
+    for (uint32_t cluster = 0; cluster < cluster_count; cluster++) {
+        for (uint32_t i = 0; i < thread_count; i++) {
+            threads[i].clusters[cluster].cycles = get_varint(&decoder);
+        }
+        for (uint32_t i = 0; i < thread_count; i++) {
+            threads[i].clusters[cluster].instructions = get_varint(&decoder);
+        }
+        for (uint32_t i = 0; i < thread_count; i++) {
+            threads[i].clusters[cluster].time = decode_billionths(get_varint(&decoder));
+        }
+        for (uint32_t i = 0; i < thread_count; i++) {
+            threads[i].clusters[cluster].energy = decode_billionths(get_varint(&decoder));
+        }
+    }
+    if (decoder.failed) {
+        return false;
+    }
+    for (uint32_t i = 0; i < thread_count; i++) {
+        memset(&threads[i].clusters[cluster_count], 0, (SAMPLE_MAX_CLUSTERS - cluster_count) * sizeof(cpu_counters_t));
+    }
+    tick->cluster_count = cluster_count;
+    tick->thread_count = thread_count;
+    tick->threads = threads;
+    return true;
+}
+
+uint32_t capture_reader_stack_count(const capture_reader_t *reader) {
+    return reader->stack_count;
+}
+
+uint32_t capture_reader_stack(const capture_reader_t *reader,
+                              stack_id_t stack_id,
+                              backtrace_address_t *addresses,
+                              uint32_t capacity) {
+    if (stack_id >= reader->stack_count) {
+        return 0;
+    }
+    uint64_t offset = get_u64(reader->stack_index + (uint64_t) stack_id * 8);
+    if (offset >= reader->size) {
+        return 0;
+    }
+    decoder_t decoder = {
+        .cursor = reader->data + offset,
+        .end = reader->data + reader->size
+    };
+    uint64_t length = get_varint(&decoder);
+    if (decoder.failed || length > UINT32_MAX) {
+        return 0;
+    }
+    uint64_t address = 0;
+    for (uint32_t i = 0; i < length && i < capacity; i++) {
+        address += (uint64_t) zigzag_decode(get_varint(&decoder));
+        addresses[i].address = address;
+    }
+    return decoder.failed ? 0 : (uint32_t) length;
+}
+
+uint32_t capture_reader_name_count(const capture_reader_t *reader) {
+    return reader->name_count;
+}
+
+const char *capture_reader_name(const capture_reader_t *reader, capture_name_id_t name_id, uint32_t *length) {
+    *length = 0;
+    if (name_id >= reader->name_count) {
+        return NULL;
+    }
+    uint64_t offset = get_u64(reader->name_index + (uint64_t) name_id * 8);
+    if (offset >= reader->size) {
+        return NULL;
+    }
+    decoder_t decoder = {
+        .cursor = reader->data + offset,
+        .end = reader->data + reader->size
+    };
+    uint64_t name_length = get_varint(&decoder);
+    if (decoder.failed || name_length > (uint64_t) (decoder.end - decoder.cursor)) {
+        return NULL;
+    }
+    *length = (uint32_t) name_length;
+    return (const char *) decoder.cursor;
+}
@@ -0,0 +1,47 @@
+//
+//  core_topology.c
+//
+
+#include "core_topology.h"
+
+#if defined(__APPLE__)
+#include <stdio.h>
+#include <string.h>
+#include <sys/sysctl.h>
+
+void core_topology_discover(core_topology_t *topology) {
+    memset(topology, 0, sizeof(core_topology_t));
+    // Perf levels are already sorted from the fastest (0, performance) to the most efficient
+    // cores, which is also the order of the counters returned by PROC_PIDTHREADCOUNTS.
+    uint32_t level_count = 0;
+    size_t size = sizeof(level_count);
+    if (sysctlbyname("hw.nperflevels", &level_count, &size, NULL, 0) != 0 || level_count == 0) {
+        level_count = 1;
+    }
+    // Levels past SAMPLE_MAX_CLUSTERS are merged into the last cluster, as their counters are.
+    topology->cluster_count = level_count < SAMPLE_MAX_CLUSTERS ? level_count : SAMPLE_MAX_CLUSTERS;
+    for (uint32_t level = 0; level < level_count; level++) {
+        char name[64];
+        snprintf(name, sizeof(name), "hw.perflevel%u.logicalcpu", level);
+        int32_t cpu_count = 0;
+        size = sizeof(cpu_count);
+        if (sysctlbyname(name, &cpu_count, &size, NULL, 0) != 0 || cpu_count < 0) {
+            cpu_count = 0;
+        }
+        if (level >= SAMPLE_MAX_CLUSTERS) {
+            topology->clusters[SAMPLE_MAX_CLUSTERS - 1].cpu_count += (uint32_t) cpu_count;
+            continue;
+        }
+        core_cluster_t *cluster = &topology->clusters[level];
+        cluster->cpu_count = (uint32_t) cpu_count;
+        snprintf(name, sizeof(name), "hw.perflevel%u.name", level);
+        size = sizeof(cluster->name);
+        if (sysctlbyname(name, cluster->name, &size, NULL, 0) != 0) {
+            snprintf(cluster->name, sizeof(cluster->name), "Level %u", level);
+        }
+        // The CLPC splits the counters of every thread by perf level.
+        cluster->has_pmu = true;
+    }
+}
+
+#endif /* defined(__APPLE__) */
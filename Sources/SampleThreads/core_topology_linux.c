@@ -0,0 +1,227 @@
+//
+//  core_topology_linux.c
+//
+
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include "core_topology.h"
+#include "linux_procfs.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+// Topology is only discovered once per session, so sysfs is read with one-off opens and
+// nothing is kept open.
+//
+// Core PMUs are the ones with a `cpus` file listing the CPUs they count on: uncore and
+// software PMUs have a `cpumask` file (or nothing) instead. Homogeneous systems have a single
+// core PMU (`cpu` on x86, `armv8_pmuv3_0` on most ARM servers) covering every CPU.
+
+/// CPUs beyond this are ignored, same as glibc's `CPU_SETSIZE`.
+#define MAX_TOPOLOGY_CPUS 1024
+
+typedef struct {
+    uint64_t words[MAX_TOPOLOGY_CPUS / 64];
+} cpu_bitmap_t;
+
+static inline void bitmap_set(cpu_bitmap_t *bitmap, unsigned cpu) {
+    bitmap->words[cpu / 64] |= 1ull << (cpu % 64);
+}
+
+static inline bool bitmap_test(const cpu_bitmap_t *bitmap, unsigned cpu) {
+    return (bitmap->words[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+/// Parses a CPU list as used all over sysfs (ie: "0-7,16-23").
+/// - Returns: The number of CPUs in the list.
+static uint32_t parse_cpu_list(const char *text, cpu_bitmap_t *bitmap) {
+    memset(bitmap, 0, sizeof(cpu_bitmap_t));
+    uint32_t count = 0;
+    const char *c = text;
+    while (*c >= '0' && *c <= '9') {
+        char *end;
+        unsigned long first = strtoul(c, &end, 10);
+        unsigned long last = first;
+        if (*end == '-') {
+            last = strtoul(end + 1, &end, 10);
+        }
+        for (unsigned long cpu = first; cpu <= last && cpu < MAX_TOPOLOGY_CPUS; cpu++) {
+            if (!bitmap_test(bitmap, (unsigned) cpu)) {
+                bitmap_set(bitmap, (unsigned) cpu);
+                count += 1;
+            }
+        }
+        c = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+static bool read_text_file(const char *path, char *buffer, size_t buffer_size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool success = read_file_at(fd, buffer, buffer_size);
+    close(fd);
+    return success;
+}
+
+/// Reads a number from a file of the CPU's sysfs directory, or returns 0.
+static uint64_t read_cpu_value(const char *sysfs_root, unsigned cpu, const char *file) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%u/%s", sysfs_root, cpu, file);
+    uint64_t value = 0;
+    if (!read_uint64_file(path, &value)) {
+        return 0;
+    }
+    return value;
+}
+
+/// Fills the capacity and maximum frequency of a cluster, from the fastest of its CPUs.
+static void measure_cluster(core_cluster_t *cluster, const cpu_bitmap_t *cpus, const char *sysfs_root) {
+    for (unsigned cpu = 0; cpu < MAX_TOPOLOGY_CPUS; cpu++) {
+        if (!bitmap_test(cpus, cpu)) {
+            continue;
+        }
+        uint64_t capacity = read_cpu_value(sysfs_root, cpu, "cpu_capacity");
+        uint64_t max_frequency_khz = read_cpu_value(sysfs_root, cpu, "cpufreq/cpuinfo_max_freq");
+        if (capacity > cluster->capacity) {
+            cluster->capacity = (uint32_t) capacity;
+        }
+        if (max_frequency_khz / 1000 > cluster->max_frequency_mhz) {
+            cluster->max_frequency_mhz = (uint32_t) (max_frequency_khz / 1000);
+        }
+    }
+}
+
+/// Whether cluster `a` has faster cores than cluster `b`. Capacity is the kernel's own
+/// ranking, so frequency is only used when capacity is unknown (ie: older x86 kernels).
+static bool is_faster(const core_cluster_t *a, const core_cluster_t *b) {
+    if (a->capacity != b->capacity) {
+        return a->capacity > b->capacity;
+    }
+    return a->max_frequency_mhz > b->max_frequency_mhz;
+}
+
+/// Adds a cluster, merging it into the last one if there's no room for more.
+static void add_cluster(core_topology_t *topology, const core_cluster_t *cluster) {
+    if (topology->cluster_count < SAMPLE_MAX_CLUSTERS) {
+        topology->clusters[topology->cluster_count++] = *cluster;
+        return;
+    }
+    core_cluster_t *last = &topology->clusters[SAMPLE_MAX_CLUSTERS - 1];
+    last->cpu_count += cluster->cpu_count;
+    // The merged cluster's counters can't be bound to a single PMU anymore.
+    last->has_pmu = false;
+}
+
+/// Finds the clusters with their own core PMU.
+static void discover_pmu_clusters(core_topology_t *topology, const char *sysfs_root) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/bus/event_source/devices", sysfs_root);
+    DIR *directory = opendir(path);
+    if (directory == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char text[512];
+        snprintf(path, sizeof(path), "%s/bus/event_source/devices/%s/cpus", sysfs_root, entry->d_name);
+        if (!read_text_file(path, text, sizeof(text))) {
+            continue;
+        }
+        cpu_bitmap_t cpus;
+        core_cluster_t cluster;
+        memset(&cluster, 0, sizeof(cluster));
+        cluster.cpu_count = parse_cpu_list(text, &cpus);
+        snprintf(path, sizeof(path), "%s/bus/event_source/devices/%s/type", sysfs_root, entry->d_name);
+        uint64_t type;
+        if (cluster.cpu_count == 0 || !read_uint64_file(path, &type)) {
+            continue;
+        }
+        snprintf(cluster.name, sizeof(cluster.name), "%.31s", entry->d_name);
+        cluster.has_pmu = true;
+        cluster.pmu_type = (uint32_t) type;
+        measure_cluster(&cluster, &cpus, sysfs_root);
+        add_cluster(topology, &cluster);
+    }
+    closedir(directory);
+}
+
+/// Splits the possible CPUs in clusters of the same capacity.
+static void discover_capacity_clusters(core_topology_t *topology, const char *sysfs_root) {
+    char path[256];
+    char text[512];
+    snprintf(path, sizeof(path), "%s/devices/system/cpu/possible", sysfs_root);
+    cpu_bitmap_t possible;
+    if (!read_text_file(path, text, sizeof(text)) || parse_cpu_list(text, &possible) == 0) {
+        return;
+    }
+    for (unsigned cpu = 0; cpu < MAX_TOPOLOGY_CPUS; cpu++) {
+        if (!bitmap_test(&possible, cpu)) {
+            continue;
+        }
+        core_cluster_t cpu_cluster;
+        memset(&cpu_cluster, 0, sizeof(cpu_cluster));
+        cpu_cluster.cpu_count = 1;
+        cpu_cluster.capacity = (uint32_t) read_cpu_value(sysfs_root, cpu, "cpu_capacity");
+        cpu_cluster.max_frequency_mhz = (uint32_t) (read_cpu_value(sysfs_root, cpu, "cpufreq/cpuinfo_max_freq") / 1000);
+        // Only capacity splits clusters: frequencies also differ between identical cores
+        // (ie: favored cores with Turbo Boost Max).
+        uint32_t c = 0;
+        while (c < topology->cluster_count && topology->clusters[c].capacity != cpu_cluster.capacity) {
+            c++;
+        }
+        if (c < topology->cluster_count) {
+            core_cluster_t *cluster = &topology->clusters[c];
+            cluster->cpu_count += 1;
+            if (cpu_cluster.max_frequency_mhz > cluster->max_frequency_mhz) {
+                cluster->max_frequency_mhz = cpu_cluster.max_frequency_mhz;
+            }
+        } else {
+            snprintf(cpu_cluster.name, sizeof(cpu_cluster.name), "capacity %u", cpu_cluster.capacity);
+            add_cluster(topology, &cpu_cluster);
+        }
+    }
+    if (topology->cluster_count == 1) {
+        snprintf(topology->clusters[0].name, sizeof(topology->clusters[0].name), "cpu");
+    }
+}
+
+void core_topology_discover_at(core_topology_t *topology, const char *sysfs_root) {
+    memset(topology, 0, sizeof(core_topology_t));
+    discover_pmu_clusters(topology, sysfs_root);
+    if (topology->cluster_count < 2) {
+        // A single core PMU counts on every CPU, so it doesn't split anything.
+        memset(topology, 0, sizeof(core_topology_t));
+        discover_capacity_clusters(topology, sysfs_root);
+    }
+    if (topology->cluster_count == 0) {
+        long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+        topology->cluster_count = 1;
+        topology->clusters[0].cpu_count = cpu_count > 0 ? (uint32_t) cpu_count : 1;
+        snprintf(topology->clusters[0].name, sizeof(topology->clusters[0].name), "cpu");
+    }
+
+    // Insertion sort, fastest first. There are only a handful of clusters.
+    for (uint32_t i = 1; i < topology->cluster_count; i++) {
+        core_cluster_t cluster = topology->clusters[i];
+        uint32_t j = i;
+        while (j > 0 && is_faster(&cluster, &topology->clusters[j - 1])) {
+            topology->clusters[j] = topology->clusters[j - 1];
+            j--;
+        }
+        topology->clusters[j] = cluster;
+    }
+}
+
+void core_topology_discover(core_topology_t *topology) {
+    core_topology_discover_at(topology, "/sys");
+}
+
+#endif /* defined(__linux__) */
@@ -0,0 +1,130 @@
+//
+//  energy_model.c
+//
+
+#include "energy_model.h"
+#include <math.h>
+#include <string.h>
+
+/// How much the previous observations are discounted with every new one. Observations are
+/// forgotten after about 1 / (1 - factor) intervals.
+#define FORGETTING_FACTOR 0.99
+/// Ridge regularization, relative to the average of the diagonal of XᵀX. Cycles and
+/// instructions are strongly correlated, which would otherwise make the fit unstable.
+#define RIDGE_FACTOR 1e-4
+
+void energy_model_init(energy_model_t *model, energy_model_kind_t kind, uint32_t cluster_count) {
+    memset(model, 0, sizeof(energy_model_t));
+    model->kind = kind;
+    model->cluster_count = cluster_count < SAMPLE_MAX_CLUSTERS ? cluster_count : SAMPLE_MAX_CLUSTERS;
+    model->feature_count = 1 + 2 * model->cluster_count;
+}
+
+/// Solves `a * x = b` for a symmetric positive definite `a` with a Cholesky decomposition,
+/// overwriting `a` with its factor.
+/// - Returns: `false` if `a` is not positive definite.
+static bool solve_cholesky(double a[ENERGY_MODEL_MAX_FEATURES][ENERGY_MODEL_MAX_FEATURES],
+                           const double *b,
+                           double *x,
+                           uint32_t n) {
+    for (uint32_t j = 0; j < n; j++) {
+        double diagonal = a[j][j];
+        for (uint32_t k = 0; k < j; k++) {
+            diagonal -= a[j][k] * a[j][k];
+        }
+        if (diagonal <= 0) {
+            return false;
+        }
+        a[j][j] = sqrt(diagonal);
+        for (uint32_t i = j + 1; i < n; i++) {
+            double value = a[i][j];
+            for (uint32_t k = 0; k < j; k++) {
+                value -= a[i][k] * a[j][k];
+            }
+            a[i][j] = value / a[j][j];
+        }
+    }
+    // Forward substitution (L * y = b), then back substitution (Lᵀ * x = y).
+    for (uint32_t i = 0; i < n; i++) {
+        double value = b[i];
+        for (uint32_t k = 0; k < i; k++) {
+            value -= a[i][k] * x[k];
+        }
+        x[i] = value / a[i][i];
+    }
+    for (uint32_t i = n; i-- > 0;) {
+        double value = x[i];
+        for (uint32_t k = i + 1; k < n; k++) {
+            value -= a[k][i] * x[k];
+        }
+        x[i] = value / a[i][i];
+    }
+    return true;
+}
+
+/// Fits the weights to the observations so far, keeping the previous weights if the
+/// system can't be solved.
+static void refit(energy_model_t *model) {
+    uint32_t n = model->feature_count;
+    if (model->observation_count < 2 * n) {
+        return;
+    }
+    double a[ENERGY_MODEL_MAX_FEATURES][ENERGY_MODEL_MAX_FEATURES];
+    double trace = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        memcpy(a[i], model->xtx[i], n * sizeof(double));
+        trace += a[i][i];
+    }
+    double ridge = RIDGE_FACTOR * trace / n;
+    if (ridge == 0) {
+        // Nothing was measured yet (ie: perf events are not available).
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        a[i][i] += ridge;
+    }
+    double weights[ENERGY_MODEL_MAX_FEATURES];
+    if (solve_cholesky(a, model->xty, weights, n)) {
+        memcpy(model->weights, weights, n * sizeof(double));
+        model->fitted = true;
+    }
+}
+
+void energy_model_observe(energy_model_t *model, const cpu_counters_t *totals, double interval, double energy) {
+    if (model->kind != ENERGY_MODEL_LINEAR || model->calibrated || !(interval > 0)) {
+        return;
+    }
+    uint32_t n = model->feature_count;
+    double features[ENERGY_MODEL_MAX_FEATURES];
+    features[0] = interval;
+    for (uint32_t cluster = 0; cluster < model->cluster_count; cluster++) {
+        // Counted in billions, so all features are in the same order of magnitude.
+        features[1 + 2 * cluster] = totals[cluster].cycles / 1e9;
+        features[2 + 2 * cluster] = totals[cluster].instructions / 1e9;
+    }
+    // Only the lower triangle of XᵀX is kept up to date, it's symmetric.
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t j = 0; j <= i; j++) {
+            model->xtx[i][j] = FORGETTING_FACTOR * model->xtx[i][j] + features[i] * features[j];
+        }
+        model->xty[i] = FORGETTING_FACTOR * model->xty[i] + features[i] * energy;
+    }
+    model->observation_count = FORGETTING_FACTOR * model->observation_count + 1;
+    refit(model);
+}
+
+void energy_model_set_weights(energy_model_t *model, const double *weights, uint32_t weight_count) {
+    memset(model->weights, 0, sizeof(model->weights));
+    uint32_t count = weight_count < model->feature_count ? weight_count : model->feature_count;
+    memcpy(model->weights, weights, count * sizeof(double));
+    model->fitted = true;
+    model->calibrated = true;
+}
+
+uint32_t energy_model_weights(const energy_model_t *model, double *weights) {
+    if (!model->fitted) {
+        return 0;
+    }
+    memcpy(weights, model->weights, model->feature_count * sizeof(double));
+    return model->feature_count;
+}
@@ -0,0 +1,145 @@
+//
+//  export_sink.c
+//
+
+#include "export_sink.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/// Size of the blocks written to the file.
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+struct export_sink {
+    int fd;
+    bool gzip;
+    /// Set if a write failed, as the file can't be completed after that.
+    bool failed;
+    z_stream stream;
+    /// Output not written to the file yet.
+    uint8_t output[OUTPUT_BUFFER_SIZE];
+    size_t output_size;
+};
+
+static bool write_all(int fd, const uint8_t *bytes, size_t count) {
+    while (count > 0) {
+        ssize_t written = write(fd, bytes, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        count -= (size_t) written;
+    }
+    return true;
+}
+
+static bool flush_output(export_sink_t *sink) {
+    if (!write_all(sink->fd, sink->output, sink->output_size)) {
+        sink->failed = true;
+        return false;
+    }
+    sink->output_size = 0;
+    return true;
+}
+
+/// Feeds bytes to the compressor, writing the compressed output every time the output
+/// buffer fills up.
+static bool deflate_bytes(export_sink_t *sink, const uint8_t *bytes, size_t count, int flush) {
+    z_stream *stream = &sink->stream;
+    stream->next_in = (Bytef *) bytes;
+    stream->avail_in = (uInt) count;
+    while (true) {
+        stream->next_out = sink->output + sink->output_size;
+        stream->avail_out = (uInt) (OUTPUT_BUFFER_SIZE - sink->output_size);
+        int status = deflate(stream, flush);
+        sink->output_size = OUTPUT_BUFFER_SIZE - stream->avail_out;
+        if (status == Z_STREAM_ERROR) {
+            sink->failed = true;
+            return false;
+        }
+        if (sink->output_size == OUTPUT_BUFFER_SIZE && !flush_output(sink)) {
+            return false;
+        }
+        // Without flushing, deflate is done once all the input was consumed. When finishing,
+        // it's done once it reports the end of the stream.
+        if (flush == Z_FINISH ? status == Z_STREAM_END : stream->avail_in == 0 && stream->avail_out != 0) {
+            return true;
+        }
+    }
+}
+
+export_sink_t *export_sink_create(const char *path, bool gzip) {
+    export_sink_t *sink = calloc(1, sizeof(export_sink_t));
+    if (sink == NULL) {
+        return NULL;
+    }
+    sink->gzip = gzip;
+    // A window of 15 bits, plus 16 to write a gzip header and trailer instead of a zlib one.
+    if (gzip && deflateInit2(&sink->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(sink);
+        return NULL;
+    }
+    sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (sink->fd < 0) {
+        if (gzip) {
+            deflateEnd(&sink->stream);
+        }
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+bool export_sink_write(export_sink_t *sink, const uint8_t *bytes, size_t count) {
+    if (sink->failed) {
+        return false;
+    }
+    if (sink->gzip) {
+        // avail_in is only 32 bits wide.
+        while (count > 0) {
+            size_t chunk_size = count < UINT32_MAX ? count : UINT32_MAX;
+            if (!deflate_bytes(sink, bytes, chunk_size, Z_NO_FLUSH)) {
+                return false;
+            }
+            bytes += chunk_size;
+            count -= chunk_size;
+        }
+        return true;
+    }
+    while (count > 0) {
+        size_t free_size = OUTPUT_BUFFER_SIZE - sink->output_size;
+        size_t copy_size = count < free_size ? count : free_size;
+        memcpy(sink->output + sink->output_size, bytes, copy_size);
+        sink->output_size += copy_size;
+        bytes += copy_size;
+        count -= copy_size;
+        if (sink->output_size == OUTPUT_BUFFER_SIZE && !flush_output(sink)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool export_sink_close(export_sink_t *sink) {
+    if (!sink->failed && sink->gzip) {
+        deflate_bytes(sink, NULL, 0, Z_FINISH);
+    }
+    if (!sink->failed) {
+        flush_output(sink);
+    }
+    bool success = !sink->failed;
+    if (close(sink->fd) != 0) {
+        success = false;
+    }
+    if (sink->gzip) {
+        deflateEnd(&sink->stream);
+    }
+    free(sink);
+    return success;
+}
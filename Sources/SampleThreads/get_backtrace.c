@@ -6,6 +6,9 @@
 //
 
 #include "get_backtrace.h"
+#include "sampler_stats_internal.h"
+
+#if defined(__APPLE__)
 
 #if defined(__aarch64__)
 #include <stdlib.h>
@@ -38,23 +41,19 @@ static void print_backtrace(int line, uint64_t address, intptr_t aslr_slide) {
     }
 }
 
-static backtrace_t build_backtrace(uint64_t *addresses, int length, intptr_t aslr_slide) {
-    
-    backtrace_t backtrace;
-    backtrace.addresses = malloc(length * sizeof(backtrace_address_t));
-    backtrace.length = length;
+static int build_backtrace(uint64_t *addresses, int length, backtrace_address_t *output, int capacity) {
     
-    Dl_info info;
+    if (length > capacity) {
+        length = capacity;
+    }
     for (int i = 0; i < length; i++) {
-        backtrace_address_t address;
-        address.address = addresses[i];
-        backtrace.addresses[i] = address;
+        output[i].address = addresses[i];
     }
         
-    return backtrace;
+    return length;
 }
 
-static backtrace_t backtracer(intptr_t aslr_slide) {
+static int backtracer(intptr_t aslr_slide, backtrace_address_t *output, int capacity) {
     
     void *array[MAX_FRAME_DEPTH];
     int size;
@@ -68,7 +67,7 @@ static backtrace_t backtracer(intptr_t aslr_slide) {
     printf("\n");
     #endif
     
-    return build_backtrace((uint64_t *) array, size, aslr_slide);
+    return build_backtrace((uint64_t *) array, size, output, capacity);
 }
 
 intptr_t get_aslr_slide() {
@@ -126,10 +125,11 @@ kern_return_t task_memcpy(mach_port_t task, mach_vm_address_t address, int64_t o
     }
     
     vm_size_t read_size = length;
+    sampler_count_syscalls(1);
     return vm_read_overwrite(task, target, length, (pointer_t) dest, &read_size);
 }
 
-backtrace_t frame_walk(mach_port_t task, arm_thread_state64_t thread_state, vm_address_t aslr_slide) {
+int frame_walk(mach_port_t task, arm_thread_state64_t thread_state, vm_address_t aslr_slide, backtrace_address_t *output, int capacity) {
     int depth = 0;
     uint64_t frame_pointer_addresses[MAX_FRAME_DEPTH] = { 0 };
     uint64_t caller_addresses[MAX_FRAME_DEPTH] = { 0 };
@@ -206,26 +206,29 @@ backtrace_t frame_walk(mach_port_t task, arm_thread_state64_t thread_state, vm_a
         #if defined(PRINT_BACKTRACES)
         printf("\n");
         #endif
-        return build_backtrace(caller_addresses, valid_address_length, aslr_slide);
+        return build_backtrace(caller_addresses, valid_address_length, output, capacity);
     } else {
         #if defined(PRINT_BACKTRACES)
         printf("Image unknown \n\n");
         #endif
-        backtrace_t backtrace;
-        backtrace.length = 0;
-        return backtrace;
+        return 0;
     }
 }
 #endif
 
-backtrace_t get_backtrace(thread_t thread) {
+int get_backtrace_into(thread_t thread, backtrace_address_t *addresses, int capacity) {
     
     #if defined(__aarch64__)
     thread_t current_thread = mach_thread_self();
+    bool is_current_thread = (current_thread == thread);
+    // mach_thread_self() returns a new send right that must be released.
+    mach_port_deallocate(mach_task_self(), current_thread);
     vm_address_t aslr_slide = get_aslr_slide();
+    // mach_thread_self, mach_port_deallocate and the task_info in get_aslr_slide.
+    sampler_count_syscalls(3);
     
-    if (current_thread == thread) {
-        return backtracer(aslr_slide);
+    if (is_current_thread) {
+        return backtracer(aslr_slide, addresses, capacity);
     } else {
         thread_suspend(thread);
 
@@ -235,15 +238,19 @@ backtrace_t get_backtrace(thread_t thread) {
                                                              ARM_THREAD_STATE64,
                                                              (thread_state_t) &thread_state,
                                                              &state_count);
-        backtrace_t backtrace = frame_walk(mach_task_self(), thread_state, aslr_slide);
+        int length = 0;
+        if (thread_state_result == KERN_SUCCESS) {
+            length = frame_walk(mach_task_self(), thread_state, aslr_slide, addresses, capacity);
+        }
         
         thread_resume(thread);
+        sampler_count_syscalls(3);
         
-        return backtrace;
+        return length;
     }
     #else
-    backtrace_t backtrace;
-    backtrace.length = 0;
-    return backtrace;
+    return 0;
     #endif
 }
+
+#endif /* defined(__APPLE__) */
@@ -0,0 +1,331 @@
+//
+//  get_backtrace_linux.c
+//
+
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include "get_backtrace.h"
+#include "sampler_stats_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// The real-time signal used to ask a thread for its backtrace.
+#define UNWIND_SIGNAL (SIGRTMIN + 4)
+// How long to wait for all the threads to reply, in nanoseconds.
+#define UNWIND_TIMEOUT_NS 10000000ull
+
+// Each slot of the pool below is handed to one thread per round. Its state is a generation
+// number (incremented every round) followed by the phase of the request in the lowest two
+// bits, so replies to requests of previous rounds (ie: signals that were blocked by a
+// thread and delivered late) are told apart and ignored.
+enum {
+    PHASE_IDLE,
+    PHASE_REQUESTED,
+    PHASE_WRITING,
+    PHASE_DONE
+};
+#define PHASE_MASK 3ull
+#define GENERATION_STEP 4ull
+
+typedef struct {
+    _Atomic uint64_t state;
+    /// Thread that must reply to the request.
+    pid_t tid;
+    /// Known stack bounds of the thread, 0 if unknown.
+    uint64_t stack_low;
+    uint64_t stack_high;
+    /// Stack pointer of the thread when it was interrupted.
+    uint64_t stack_pointer;
+    /// Time the thread spent in the signal handler, in nanoseconds.
+    uint64_t handler_ns;
+    int length;
+    uint64_t addresses[MAX_FRAME_DEPTH];
+} unwind_slot_t;
+
+// The slot pool is shared by the whole process, as the signal handler is. Retired pools
+// are never freed: a late reply to an abandoned request could still be writing to them.
+static unwind_slot_t *slots = NULL;
+static uint32_t slot_capacity = 0;
+static uint64_t generation = 0;
+static _Atomic int pending_replies = 0;
+static pthread_mutex_t unwind_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool handler_installed = false;
+static bool signal_unavailable = false;
+
+// MARK: - Signal handler
+
+static void read_context(const ucontext_t *context, uint64_t *pc, uint64_t *sp, uint64_t *fp) {
+    #if defined(__x86_64__)
+    *pc = context->uc_mcontext.gregs[REG_RIP];
+    *sp = context->uc_mcontext.gregs[REG_RSP];
+    *fp = context->uc_mcontext.gregs[REG_RBP];
+    #elif defined(__aarch64__)
+    *pc = context->uc_mcontext.pc;
+    *sp = context->uc_mcontext.sp;
+    *fp = context->uc_mcontext.regs[29];
+    #else
+    *pc = 0;
+    *sp = 0;
+    *fp = 0;
+    #endif
+}
+
+/// Walks the frame pointers of the interrupted context. Every frame record (the saved
+/// frame pointer followed by the return address) must lie between the stack pointer and
+/// the top of the stack, so no unmapped memory is ever read.
+static int frame_walk(unwind_slot_t *slot, uint64_t pc, uint64_t sp, uint64_t fp) {
+    int depth = 0;
+    slot->addresses[depth++] = pc;
+    if (sp < slot->stack_low || sp >= slot->stack_high) {
+        // The stack bounds are unknown, or the thread is running on another stack (ie: an
+        // alternate signal stack). Only the PC is safe to report.
+        return depth;
+    }
+    while (depth < MAX_FRAME_DEPTH) {
+        if (fp < sp || fp > slot->stack_high - 2 * sizeof(uint64_t) || (fp & (sizeof(uint64_t) - 1)) != 0) {
+            break;
+        }
+        const uint64_t *frame_record = (const uint64_t *) fp;
+        uint64_t next_frame_pointer = frame_record[0];
+        uint64_t return_address = frame_record[1];
+        if (return_address == 0) {
+            break;
+        }
+        slot->addresses[depth++] = return_address;
+        // Callers' frames are always higher up in the stack.
+        if (next_frame_pointer <= fp) {
+            break;
+        }
+        fp = next_frame_pointer;
+    }
+    return depth;
+}
+
+static void unwind_signal_handler(int signal, siginfo_t *info, void *context) {
+    (void) signal;
+    // Reading the clock goes through the vDSO, and is async-signal-safe.
+    uint64_t start_ns = sampler_now_ns();
+    int saved_errno = errno;
+    unwind_slot_t *slot = info->si_value.sival_ptr;
+    uint64_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+    if ((state & PHASE_MASK) != PHASE_REQUESTED || slot->tid != (pid_t) syscall(SYS_gettid)) {
+        // A late reply to an abandoned request.
+        errno = saved_errno;
+        return;
+    }
+    uint64_t writing_state = (state & ~PHASE_MASK) | PHASE_WRITING;
+    if (!atomic_compare_exchange_strong_explicit(&slot->state, &state, writing_state,
+                                                 memory_order_acquire, memory_order_relaxed)) {
+        errno = saved_errno;
+        return;
+    }
+
+    uint64_t pc, sp, fp;
+    read_context(context, &pc, &sp, &fp);
+    slot->stack_pointer = sp;
+    slot->length = frame_walk(slot, pc, sp, fp);
+    slot->handler_ns = sampler_now_ns() - start_ns;
+
+    atomic_store_explicit(&slot->state, (state & ~PHASE_MASK) | PHASE_DONE, memory_order_release);
+    atomic_fetch_sub_explicit(&pending_replies, 1, memory_order_release);
+    errno = saved_errno;
+}
+
+static bool install_signal_handler(void) {
+    if (handler_installed) {
+        return true;
+    }
+    if (signal_unavailable) {
+        return false;
+    }
+    struct sigaction previous_action;
+    if (sigaction(UNWIND_SIGNAL, NULL, &previous_action) != 0
+        || (previous_action.sa_flags & SA_SIGINFO)
+        || previous_action.sa_handler != SIG_DFL) {
+        // Never replace a handler installed by someone else.
+        signal_unavailable = true;
+        return false;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = unwind_signal_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(UNWIND_SIGNAL, &action, NULL) != 0) {
+        signal_unavailable = true;
+        return false;
+    }
+    handler_installed = true;
+    return true;
+}
+
+// MARK: - Stack bounds
+
+/// Finds the mappings containing the stack pointers of the threads whose stack bounds are
+/// unknown (or no longer contain their stack pointer), using /proc/self/maps.
+static void update_stack_bounds(backtrace_request_t *requests, const unwind_slot_t *request_slots, uint32_t count) {
+    bool needs_bounds = false;
+    for (uint32_t i = 0; i < count && !needs_bounds; i++) {
+        uint64_t sp = request_slots[i].stack_pointer;
+        needs_bounds = requests[i].length > 0 && (sp < requests[i].stack_low || sp >= requests[i].stack_high);
+    }
+    if (!needs_bounds) {
+        return;
+    }
+    FILE *maps = fopen("/proc/self/maps", "re");
+    sampler_count_allocation();
+    sampler_count_syscalls(1);
+    if (maps == NULL) {
+        return;
+    }
+    unsigned long long start, end;
+    char line[512];
+    while (fgets(line, sizeof(line), maps) != NULL) {
+        if (sscanf(line, "%llx-%llx", &start, &end) != 2) {
+            continue;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t sp = request_slots[i].stack_pointer;
+            if (requests[i].length > 0 && sp >= start && sp < end) {
+                requests[i].stack_low = start;
+                requests[i].stack_high = end;
+            }
+        }
+        if (strchr(line, '\n') == NULL) {
+            // Skip the rest of a line longer than the buffer.
+            int character;
+            while ((character = fgetc(maps)) != EOF && character != '\n') {}
+        }
+    }
+    // Only the opening and closing are counted, as reads are buffered by stdio.
+    fclose(maps);
+    sampler_count_syscalls(1);
+}
+
+// MARK: - Collection
+
+static uint64_t monotonic_time_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000ull + (uint64_t) time.tv_nsec;
+}
+
+static bool reserve_slots(uint32_t count) {
+    if (count <= slot_capacity) {
+        return true;
+    }
+    uint32_t new_capacity = slot_capacity == 0 ? 64 : slot_capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    unwind_slot_t *new_slots = calloc(new_capacity, sizeof(unwind_slot_t));
+    sampler_count_allocation();
+    if (new_slots == NULL) {
+        return false;
+    }
+    // The previous pool is intentionally leaked (see above).
+    slots = new_slots;
+    slot_capacity = new_capacity;
+    return true;
+}
+
+static void clear_requests(backtrace_request_t *requests, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        requests[i].length = 0;
+        requests[i].interrupted_ns = 0;
+        requests[i].addresses = NULL;
+    }
+}
+
+bool get_backtraces_linux(backtrace_request_t *requests, uint32_t count) {
+    pthread_mutex_lock(&unwind_lock);
+    if (!install_signal_handler()) {
+        pthread_mutex_unlock(&unwind_lock);
+        clear_requests(requests, count);
+        return false;
+    }
+    if (!reserve_slots(count)) {
+        pthread_mutex_unlock(&unwind_lock);
+        clear_requests(requests, count);
+        return true;
+    }
+    generation += GENERATION_STEP;
+
+    // Fan out: ask every thread for its backtrace.
+    pid_t pid = getpid();
+    uid_t uid = getuid();
+    sampler_count_syscalls(2);
+    int sent = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        unwind_slot_t *slot = &slots[i];
+        slot->tid = requests[i].tid;
+        slot->stack_low = requests[i].stack_low;
+        slot->stack_high = requests[i].stack_high;
+        slot->stack_pointer = 0;
+        slot->handler_ns = 0;
+        slot->length = 0;
+        atomic_store_explicit(&slot->state, generation | PHASE_REQUESTED, memory_order_release);
+
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        info.si_signo = UNWIND_SIGNAL;
+        info.si_code = SI_QUEUE;
+        info.si_pid = pid;
+        info.si_uid = uid;
+        info.si_value.sival_ptr = slot;
+        atomic_fetch_add_explicit(&pending_replies, 1, memory_order_relaxed);
+        sampler_count_syscalls(1);
+        if (syscall(SYS_rt_tgsigqueueinfo, pid, requests[i].tid, UNWIND_SIGNAL, &info) == 0) {
+            sent++;
+        } else {
+            atomic_store_explicit(&slot->state, generation | PHASE_IDLE, memory_order_relaxed);
+            atomic_fetch_sub_explicit(&pending_replies, 1, memory_order_relaxed);
+        }
+    }
+
+    // Fan in: wait until all threads replied, or until the timeout.
+    uint64_t deadline = monotonic_time_ns() + UNWIND_TIMEOUT_NS;
+    while (sent > 0 && atomic_load_explicit(&pending_replies, memory_order_acquire) > 0) {
+        if (monotonic_time_ns() > deadline) {
+            break;
+        }
+        sched_yield();
+        sampler_count_syscalls(1);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        unwind_slot_t *slot = &slots[i];
+        uint64_t requested = generation | PHASE_REQUESTED;
+        if (atomic_compare_exchange_strong_explicit(&slot->state, &requested, generation | PHASE_IDLE,
+                                                    memory_order_acquire, memory_order_relaxed)) {
+            // The thread didn't reply in time: abandon the request.
+            atomic_fetch_sub_explicit(&pending_replies, 1, memory_order_relaxed);
+        }
+        // A thread that started writing its reply is about to finish.
+        while ((atomic_load_explicit(&slot->state, memory_order_acquire) & PHASE_MASK) == PHASE_WRITING) {
+            sched_yield();
+            sampler_count_syscalls(1);
+        }
+        bool replied = atomic_load_explicit(&slot->state, memory_order_acquire) == (generation | PHASE_DONE);
+        requests[i].length = replied ? slot->length : 0;
+        requests[i].interrupted_ns = replied ? slot->handler_ns : 0;
+        requests[i].addresses = slot->addresses;
+    }
+    update_stack_bounds(requests, slots, count);
+    pthread_mutex_unlock(&unwind_lock);
+    return true;
+}
+
+#endif /* defined(__linux__) */
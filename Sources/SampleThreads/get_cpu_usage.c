@@ -6,6 +6,9 @@
 //
 
 #include "get_cpu_usage.h"
+
+#if defined(__APPLE__)
+#include "sampler_stats_internal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/sysctl.h>
@@ -29,7 +32,7 @@ cpu_usage_t get_cpu_usage() {
     cpu_usage.core_usages = malloc(num_CPUs * sizeof(core_usage_t));
     
     for(int i = 0; i < num_CPUs; ++i) {
-        core_usage_t core_usage;
+        core_usage_t core_usage = {0};
         
         // Here CPU_STATE_MAX is the number of possible CPU states
         core_usage.system_ticks = cpu_info[(CPU_STATE_MAX * i) + CPU_STATE_SYSTEM];
@@ -40,5 +43,83 @@ cpu_usage_t get_cpu_usage() {
         cpu_usage.core_usages[i] = core_usage;
     }
     
+    vm_deallocate(mach_task_self(), (vm_address_t) cpu_info, num_CPUs_info * sizeof(integer_t));
     return cpu_usage;
 }
+
+// MARK: - Reader
+
+struct cpu_usage_reader {
+    host_t host;
+    /// Number of cores configured in the system.
+    int core_count;
+};
+
+cpu_usage_reader_t *cpu_usage_reader_create(void) {
+    int core_count = 0;
+    size_t size = sizeof(core_count);
+    if (sysctlbyname("hw.ncpu", &core_count, &size, NULL, 0) != 0 || core_count <= 0) {
+        return NULL;
+    }
+    cpu_usage_reader_t *reader = malloc(sizeof(cpu_usage_reader_t));
+    if (reader == NULL) {
+        return NULL;
+    }
+    reader->host = mach_host_self();
+    reader->core_count = core_count;
+    return reader;
+}
+
+void cpu_usage_reader_destroy(cpu_usage_reader_t *reader) {
+    if (reader == NULL) {
+        return;
+    }
+    mach_port_deallocate(mach_task_self(), reader->host);
+    free(reader);
+}
+
+int cpu_usage_reader_core_count(const cpu_usage_reader_t *reader) {
+    return reader->core_count;
+}
+
+int cpu_usage_reader_read(cpu_usage_reader_t *reader, core_usage_t *totals, core_usage_t *deltas, int capacity) {
+    processor_info_array_t cpu_info;
+    mach_msg_type_number_t num_CPUs_info;
+    natural_t num_CPUs;
+    sampler_count_syscalls(1);
+    kern_return_t err = host_processor_info(reader->host,
+                                            PROCESSOR_CPU_LOAD_INFO,
+                                            &num_CPUs,
+                                            &cpu_info,
+                                            &num_CPUs_info);
+    if (err != KERN_SUCCESS) {
+        return -1;
+    }
+    int core_count = (int) num_CPUs < capacity ? (int) num_CPUs : capacity;
+    for (int i = 0; i < core_count; i++) {
+        // The tick counters are 32-bit, and wrap around after a few months of uptime. The
+        // wrapped-around delta is still correct as long as the reads are less than that
+        // apart.
+        const integer_t *ticks = &cpu_info[CPU_STATE_MAX * i];
+        core_usage_t *total = &totals[i];
+        if (deltas != NULL) {
+            core_usage_t *delta = &deltas[i];
+            delta->system_ticks = (uint32_t) ((uint32_t) ticks[CPU_STATE_SYSTEM] - (uint32_t) total->system_ticks);
+            delta->user_ticks = (uint32_t) ((uint32_t) ticks[CPU_STATE_USER] - (uint32_t) total->user_ticks);
+            delta->nice_ticks = (uint32_t) ((uint32_t) ticks[CPU_STATE_NICE] - (uint32_t) total->nice_ticks);
+            delta->idle_ticks = (uint32_t) ((uint32_t) ticks[CPU_STATE_IDLE] - (uint32_t) total->idle_ticks);
+            delta->iowait_ticks = 0;
+            delta->irq_ticks = 0;
+            delta->softirq_ticks = 0;
+            delta->steal_ticks = 0;
+        }
+        total->system_ticks = (uint32_t) ticks[CPU_STATE_SYSTEM];
+        total->user_ticks = (uint32_t) ticks[CPU_STATE_USER];
+        total->nice_ticks = (uint32_t) ticks[CPU_STATE_NICE];
+        total->idle_ticks = (uint32_t) ticks[CPU_STATE_IDLE];
+    }
+    vm_deallocate(mach_task_self(), (vm_address_t) cpu_info, num_CPUs_info * sizeof(integer_t));
+    return core_count;
+}
+
+#endif /* defined(__APPLE__) */
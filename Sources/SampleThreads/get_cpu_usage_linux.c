@@ -0,0 +1,172 @@
+//
+//  get_cpu_usage_linux.c
+//
+
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include "get_cpu_usage.h"
+#include "linux_procfs.h"
+#include "sampler_stats_internal.h"
+#include <string.h>
+
+/// Generous upper bound of the length of a `cpuN` line of `/proc/stat`: the name, and ten
+/// 20-digit counters with their separators.
+#define PROC_STAT_LINE_SIZE 256
+
+struct cpu_usage_reader {
+    /// `/proc/stat`, kept open to be re-read with `pread`.
+    int fd;
+    /// Number of cores configured in the system, online or not.
+    int core_count;
+    /// Room for the aggregate line and one line per core. The rest of the file (interrupt
+    /// counts, context switches...) is never read.
+    char *buffer;
+    size_t buffer_size;
+};
+
+cpu_usage_reader_t *cpu_usage_reader_create(void) {
+    long core_count = sysconf(_SC_NPROCESSORS_CONF);
+    if (core_count <= 0) {
+        return NULL;
+    }
+    int fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    cpu_usage_reader_t *reader = malloc(sizeof(cpu_usage_reader_t));
+    size_t buffer_size = (size_t) (core_count + 1) * PROC_STAT_LINE_SIZE + PROC_STAT_LINE_SIZE;
+    char *buffer = malloc(buffer_size);
+    if (reader == NULL || buffer == NULL) {
+        free(reader);
+        free(buffer);
+        close(fd);
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->core_count = (int) core_count;
+    reader->buffer = buffer;
+    reader->buffer_size = buffer_size;
+    return reader;
+}
+
+void cpu_usage_reader_destroy(cpu_usage_reader_t *reader) {
+    if (reader == NULL) {
+        return;
+    }
+    close(reader->fd);
+    free(reader->buffer);
+    free(reader);
+}
+
+int cpu_usage_reader_core_count(const cpu_usage_reader_t *reader) {
+    return reader->core_count;
+}
+
+int cpu_usage_reader_read(cpu_usage_reader_t *reader, core_usage_t *totals, core_usage_t *deltas, int capacity) {
+    sampler_count_syscalls(1);
+    if (!read_file_at(reader->fd, reader->buffer, reader->buffer_size)) {
+        return -1;
+    }
+    return cpu_usage_parse_proc_stat(reader->buffer, totals, deltas, capacity);
+}
+
+// MARK: - Parsing
+
+/// Parses a run of decimal digits, after skipping the spaces before it. Stops at the first
+/// non-digit, so a missing field (on older kernels) or the end of the text parses as 0.
+static inline const char *parse_field(const char *c, uint64_t *value) {
+    while (*c == ' ') {
+        c++;
+    }
+    uint64_t result = 0;
+    unsigned digit;
+    // Any character below '0' wraps around to a large unsigned value, so this is a single
+    // comparison per character.
+    while ((digit = (unsigned) (*c - '0')) < 10) {
+        result = result * 10 + digit;
+        c++;
+    }
+    *value = result;
+    return c;
+}
+
+/// The difference between two readings of a counter, or 0 if it went backwards.
+static inline uint64_t counter_delta(uint64_t current, uint64_t previous) {
+    return (current - previous) & -(uint64_t) (current >= previous);
+}
+
+/// Writes zero deltas for the cores in `[first, end)`, which have no line in `/proc/stat`
+/// (they are offline).
+static inline void clear_deltas(core_usage_t *deltas, int first, int end) {
+    if (deltas != NULL && end > first) {
+        memset(&deltas[first], 0, (size_t) (end - first) * sizeof(core_usage_t));
+    }
+}
+
+int cpu_usage_parse_proc_stat(const char *text, core_usage_t *totals, core_usage_t *deltas, int capacity) {
+    const char *c = text;
+    // The next core index that hasn't been written.
+    int next_core = 0;
+    while (c[0] == 'c' && c[1] == 'p' && c[2] == 'u') {
+        c += 3;
+        if (*c == ' ') {
+            // The aggregate of all cores.
+            c = strchr(c, '\n');
+            if (c == NULL) {
+                break;
+            }
+            c += 1;
+            continue;
+        }
+        uint64_t index;
+        c = parse_field(c, &index);
+
+        core_usage_t usage;
+        c = parse_field(c, &usage.user_ticks);
+        c = parse_field(c, &usage.nice_ticks);
+        c = parse_field(c, &usage.system_ticks);
+        c = parse_field(c, &usage.idle_ticks);
+        c = parse_field(c, &usage.iowait_ticks);
+        c = parse_field(c, &usage.irq_ticks);
+        c = parse_field(c, &usage.softirq_ticks);
+        c = parse_field(c, &usage.steal_ticks);
+        // Guest time is already accounted as user and nice time, skip it.
+        while (*c != '\n' && *c != '\0') {
+            c++;
+        }
+        if (*c == '\0') {
+            // The line was cut short, the counters may be incomplete.
+            break;
+        }
+        c += 1;
+
+        if (index >= (uint64_t) capacity || (int) index < next_core) {
+            continue;
+        }
+        int core = (int) index;
+        clear_deltas(deltas, next_core, core);
+        core_usage_t *total = &totals[core];
+        if (deltas != NULL) {
+            core_usage_t *delta = &deltas[core];
+            delta->user_ticks = counter_delta(usage.user_ticks, total->user_ticks);
+            delta->nice_ticks = counter_delta(usage.nice_ticks, total->nice_ticks);
+            delta->system_ticks = counter_delta(usage.system_ticks, total->system_ticks);
+            delta->idle_ticks = counter_delta(usage.idle_ticks, total->idle_ticks);
+            delta->iowait_ticks = counter_delta(usage.iowait_ticks, total->iowait_ticks);
+            delta->irq_ticks = counter_delta(usage.irq_ticks, total->irq_ticks);
+            delta->softirq_ticks = counter_delta(usage.softirq_ticks, total->softirq_ticks);
+            delta->steal_ticks = counter_delta(usage.steal_ticks, total->steal_ticks);
+        }
+        *total = usage;
+        next_core = core + 1;
+    }
+    if (next_core == 0) {
+        return -1;
+    }
+    clear_deltas(deltas, next_core, capacity);
+    return next_core;
+}
+
+#endif /* defined(__linux__) */
@@ -0,0 +1,309 @@
+//
+//  image_map.c
+//
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "image_map.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#include <pthread.h>
+#include <stdatomic.h>
+#include <mach-o/dyld.h>
+#include <mach-o/loader.h>
+#elif defined(__linux__)
+#include <link.h>
+#include <stddef.h>
+#endif
+
+typedef struct {
+    /// Load address of the image.
+    uint64_t base;
+    /// Path of the image, owned by the map.
+    char *path;
+} image_t;
+
+struct image_map {
+    /// Executable ranges of all images, sorted by start address.
+    image_range_t *ranges;
+    uint32_t range_count;
+    uint32_t range_capacity;
+    image_t *images;
+    uint32_t image_count;
+    uint32_t image_capacity;
+    /// Number of times the snapshot was rebuilt.
+    uint64_t generation;
+    /// The loader's count of load/unload events when the snapshot was taken.
+    uint64_t loader_generation;
+};
+
+// MARK: - Building the snapshot
+
+static bool add_image(image_map_t *map, uint64_t base, const char *path) {
+    if (map->image_count == map->image_capacity) {
+        uint32_t new_capacity = map->image_capacity == 0 ? 64 : map->image_capacity * 2;
+        image_t *new_images = realloc(map->images, new_capacity * sizeof(image_t));
+        if (new_images == NULL) {
+            return false;
+        }
+        map->images = new_images;
+        map->image_capacity = new_capacity;
+    }
+    char *path_copy = strdup(path != NULL ? path : "");
+    if (path_copy == NULL) {
+        return false;
+    }
+    map->images[map->image_count].base = base;
+    map->images[map->image_count].path = path_copy;
+    map->image_count++;
+    return true;
+}
+
+static bool add_range(image_map_t *map, uint64_t start, uint64_t end) {
+    if (map->range_count == map->range_capacity) {
+        uint32_t new_capacity = map->range_capacity == 0 ? 64 : map->range_capacity * 2;
+        image_range_t *new_ranges = realloc(map->ranges, new_capacity * sizeof(image_range_t));
+        if (new_ranges == NULL) {
+            return false;
+        }
+        map->ranges = new_ranges;
+        map->range_capacity = new_capacity;
+    }
+    image_range_t *range = &map->ranges[map->range_count++];
+    range->start = start;
+    range->end = end;
+    range->base = map->images[map->image_count - 1].base;
+    range->image_index = map->image_count - 1;
+    return true;
+}
+
+static void clear_images(image_map_t *map) {
+    for (uint32_t i = 0; i < map->image_count; i++) {
+        free(map->images[i].path);
+    }
+    map->image_count = 0;
+    map->range_count = 0;
+}
+
+static int compare_ranges(const void *lhs, const void *rhs) {
+    const image_range_t *lhs_range = lhs;
+    const image_range_t *rhs_range = rhs;
+    if (lhs_range->start < rhs_range->start) {
+        return -1;
+    }
+    return lhs_range->start > rhs_range->start;
+}
+
+#if defined(__APPLE__)
+
+/// Incremented by dyld every time an image is added or removed.
+static _Atomic uint64_t dyld_generation = 0;
+static pthread_once_t dyld_callbacks_once = PTHREAD_ONCE_INIT;
+
+static void dyld_image_changed(const struct mach_header *header, intptr_t slide) {
+    atomic_fetch_add_explicit(&dyld_generation, 1, memory_order_relaxed);
+}
+
+static void register_dyld_callbacks(void) {
+    _dyld_register_func_for_add_image(dyld_image_changed);
+    _dyld_register_func_for_remove_image(dyld_image_changed);
+}
+
+static uint64_t current_loader_generation(void) {
+    pthread_once(&dyld_callbacks_once, register_dyld_callbacks);
+    return atomic_load_explicit(&dyld_generation, memory_order_relaxed);
+}
+
+static bool build_snapshot(image_map_t *map) {
+    uint32_t image_count = _dyld_image_count();
+    for (uint32_t i = 0; i < image_count; i++) {
+        const struct mach_header_64 *header = (const struct mach_header_64 *) _dyld_get_image_header(i);
+        if (header == NULL || header->magic != MH_MAGIC_64) {
+            continue;
+        }
+        intptr_t slide = _dyld_get_image_vmaddr_slide(i);
+        if (!add_image(map, (uint64_t) header, _dyld_get_image_name(i))) {
+            return false;
+        }
+        // Only the __TEXT segment contains code.
+        const struct load_command *command = (const struct load_command *) (header + 1);
+        for (uint32_t c = 0; c < header->ncmds; c++) {
+            if (command->cmd == LC_SEGMENT_64) {
+                const struct segment_command_64 *segment = (const struct segment_command_64 *) command;
+                if (strcmp(segment->segname, SEG_TEXT) == 0) {
+                    uint64_t start = segment->vmaddr + slide;
+                    if (!add_range(map, start, start + segment->vmsize)) {
+                        return false;
+                    }
+                }
+            }
+            command = (const struct load_command *) ((const char *) command + command->cmdsize);
+        }
+    }
+    return true;
+}
+
+#elif defined(__linux__)
+
+static int read_loader_generation(struct dl_phdr_info *info, size_t size, void *data) {
+    uint64_t *generation = data;
+    // dlpi_adds and dlpi_subs are only provided by newer loaders.
+    if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+        *generation = info->dlpi_adds + info->dlpi_subs;
+    }
+    // The counters are the same for every image, so there's no need to visit the rest.
+    return 1;
+}
+
+static uint64_t current_loader_generation(void) {
+    uint64_t generation = 0;
+    dl_iterate_phdr(read_loader_generation, &generation);
+    return generation;
+}
+
+static int add_phdr_image(struct dl_phdr_info *info, size_t size, void *data) {
+    (void) size;
+    image_map_t *map = data;
+    if (!add_image(map, info->dlpi_addr, info->dlpi_name)) {
+        return 1;
+    }
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *header = &info->dlpi_phdr[i];
+        if (header->p_type == PT_LOAD && (header->p_flags & PF_X)) {
+            uint64_t start = info->dlpi_addr + header->p_vaddr;
+            if (!add_range(map, start, start + header->p_memsz)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static bool build_snapshot(image_map_t *map) {
+    return dl_iterate_phdr(add_phdr_image, map) == 0;
+}
+
+#else
+
+static uint64_t current_loader_generation(void) {
+    return 0;
+}
+
+static bool build_snapshot(image_map_t *map) {
+    return true;
+}
+
+#endif
+
+/// Rebuilds the snapshot of the loaded images.
+static bool rebuild(image_map_t *map, uint64_t loader_generation) {
+    clear_images(map);
+    bool succeeded = build_snapshot(map);
+    if (!succeeded) {
+        clear_images(map);
+    }
+    qsort(map->ranges, map->range_count, sizeof(image_range_t), compare_ranges);
+    map->loader_generation = loader_generation;
+    map->generation++;
+    return succeeded;
+}
+
+// MARK: - Public API
+
+image_map_t *image_map_create(void) {
+    image_map_t *map = calloc(1, sizeof(image_map_t));
+    if (map == NULL) {
+        return NULL;
+    }
+    rebuild(map, current_loader_generation());
+    return map;
+}
+
+void image_map_destroy(image_map_t *map) {
+    if (map == NULL) {
+        return;
+    }
+    clear_images(map);
+    free(map->images);
+    free(map->ranges);
+    free(map);
+}
+
+bool image_map_refresh(image_map_t *map) {
+    uint64_t loader_generation = current_loader_generation();
+    if (loader_generation == map->loader_generation && map->image_count != 0) {
+        return false;
+    }
+    rebuild(map, loader_generation);
+    return true;
+}
+
+uint64_t image_map_generation(const image_map_t *map) {
+    return map->generation;
+}
+
+uint32_t image_map_image_count(const image_map_t *map) {
+    return map->image_count;
+}
+
+const char *image_map_image_path(const image_map_t *map, uint32_t image_index) {
+    if (image_index >= map->image_count) {
+        return "";
+    }
+    return map->images[image_index].path;
+}
+
+uint64_t image_map_image_base(const image_map_t *map, uint32_t image_index) {
+    if (image_index >= map->image_count) {
+        return 0;
+    }
+    return map->images[image_index].base;
+}
+
+const image_range_t *image_map_find(const image_map_t *map, uint64_t address) {
+    // Find the last range starting at or before the address.
+    uint32_t low = 0;
+    uint32_t high = map->range_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (map->ranges[middle].start <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) {
+        return NULL;
+    }
+    const image_range_t *range = &map->ranges[low - 1];
+    return address < range->end ? range : NULL;
+}
+
+void image_map_resolve(const image_map_t *map,
+                       const uint64_t *addresses,
+                       uint32_t count,
+                       int32_t *image_indices,
+                       uint64_t *offsets) {
+    // Consecutive addresses of a batch (ie: frames of the same backtrace) are often in the
+    // same image, so the last range found is checked before searching.
+    const image_range_t *last_range = NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t address = addresses[i];
+        const image_range_t *range = last_range;
+        if (range == NULL || address < range->start || address >= range->end) {
+            range = image_map_find(map, address);
+        }
+        if (range != NULL) {
+            image_indices[i] = (int32_t) range->image_index;
+            offsets[i] = address - range->base;
+            last_range = range;
+        } else {
+            image_indices[i] = -1;
+            offsets[i] = address;
+        }
+    }
+}
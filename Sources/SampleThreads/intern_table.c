@@ -0,0 +1,172 @@
+//
+//  intern_table.c
+//
+
+#include "intern_table.h"
+#include "sampler_stats_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// MARK: - Memory
+
+static bool index_resize(intern_table_t *table, uint32_t new_capacity) {
+    uint32_t *new_index = malloc(new_capacity * sizeof(uint32_t));
+    sampler_count_allocation();
+    if (new_index == NULL) {
+        return false;
+    }
+    memset(new_index, 0xFF, new_capacity * sizeof(uint32_t));
+    uint32_t mask = new_capacity - 1;
+    for (uint32_t id = 0; id < table->count; id++) {
+        uint32_t i = (uint32_t) table->keys[id].hash & mask;
+        while (new_index[i] != INTERN_ID_NONE) {
+            i = (i + 1) & mask;
+        }
+        new_index[i] = id;
+    }
+    free(table->index);
+    table->index = new_index;
+    table->index_capacity = new_capacity;
+    return true;
+}
+
+static bool reserve_keys(intern_table_t *table, uint32_t count) {
+    if (count <= table->key_capacity) {
+        return true;
+    }
+    uint32_t new_capacity = table->key_capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    interned_key_t *new_keys = realloc(table->keys, new_capacity * sizeof(interned_key_t));
+    sampler_count_allocation();
+    if (new_keys == NULL) {
+        return false;
+    }
+    table->keys = new_keys;
+    table->key_capacity = new_capacity;
+    return true;
+}
+
+static bool reserve_arena(intern_table_t *table, uint64_t size) {
+    uint64_t required_capacity = table->arena_size + size;
+    if (required_capacity <= table->arena_capacity) {
+        return true;
+    }
+    uint64_t new_capacity = table->arena_capacity;
+    while (new_capacity < required_capacity) {
+        new_capacity *= 2;
+    }
+    uint8_t *new_arena = realloc(table->arena, new_capacity);
+    sampler_count_allocation();
+    if (new_arena == NULL) {
+        return false;
+    }
+    table->arena = new_arena;
+    table->arena_capacity = new_capacity;
+    return true;
+}
+
+// MARK: - Public API
+
+bool intern_table_init(intern_table_t *table, uint32_t key_capacity, uint64_t arena_capacity) {
+    memset(table, 0, sizeof(intern_table_t));
+    table->initial_key_capacity = key_capacity;
+    table->initial_arena_capacity = arena_capacity;
+    table->keys = malloc(key_capacity * sizeof(interned_key_t));
+    table->key_capacity = key_capacity;
+    table->arena = malloc(arena_capacity);
+    table->arena_capacity = arena_capacity;
+    if (table->keys == NULL
+        || table->arena == NULL
+        || !index_resize(table, 2 * key_capacity)) {
+        intern_table_free(table);
+        return false;
+    }
+    return true;
+}
+
+void intern_table_free(intern_table_t *table) {
+    free(table->index);
+    free(table->keys);
+    free(table->arena);
+    table->index = NULL;
+    table->keys = NULL;
+    table->arena = NULL;
+    table->count = 0;
+}
+
+uint32_t intern_table_intern(intern_table_t *table, uint64_t hash, const void *key, uint32_t size, uint32_t padding) {
+    uint32_t mask = table->index_capacity - 1;
+    uint32_t i = (uint32_t) hash & mask;
+    while (table->index[i] != INTERN_ID_NONE) {
+        const interned_key_t *interned = &table->keys[table->index[i]];
+        if (interned->hash == hash
+            && interned->size == size
+            && memcmp(&table->arena[interned->offset], key, size) == 0) {
+            return table->index[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    // A key that wasn't seen before. IDs are dense, so the last valid ID must stay below
+    // INTERN_ID_NONE.
+    if (table->count == INTERN_ID_NONE
+        || !reserve_keys(table, table->count + 1)
+        || !reserve_arena(table, (uint64_t) size + padding)) {
+        return INTERN_ID_NONE;
+    }
+    if ((table->count + 1) * 2 > table->index_capacity) {
+        if (index_resize(table, table->index_capacity * 2)) {
+            mask = table->index_capacity - 1;
+            i = (uint32_t) hash & mask;
+            while (table->index[i] != INTERN_ID_NONE) {
+                i = (i + 1) & mask;
+            }
+        } else if (table->count + 1 == table->index_capacity) {
+            // At least one entry must stay empty for lookups to end.
+            return INTERN_ID_NONE;
+        }
+    }
+    uint32_t id = table->count;
+    interned_key_t *interned = &table->keys[id];
+    interned->hash = hash;
+    interned->offset = table->arena_size;
+    interned->size = size;
+    memcpy(&table->arena[table->arena_size], key, size);
+    memset(&table->arena[table->arena_size + size], 0, padding);
+    table->arena_size += (uint64_t) size + padding;
+    table->count++;
+    table->index[i] = id;
+    return id;
+}
+
+void intern_table_reset(intern_table_t *table) {
+    table->count = 0;
+    table->arena_size = 0;
+    table->generation += 1;
+    // Give back the memory the table grew to. If the smaller buffers can't be allocated, the
+    // larger ones are kept (and emptied).
+    if (table->key_capacity > table->initial_key_capacity) {
+        interned_key_t *keys = malloc(table->initial_key_capacity * sizeof(interned_key_t));
+        sampler_count_allocation();
+        if (keys != NULL) {
+            free(table->keys);
+            table->keys = keys;
+            table->key_capacity = table->initial_key_capacity;
+        }
+    }
+    if (table->arena_capacity > table->initial_arena_capacity) {
+        uint8_t *arena = malloc(table->initial_arena_capacity);
+        sampler_count_allocation();
+        if (arena != NULL) {
+            free(table->arena);
+            table->arena = arena;
+            table->arena_capacity = table->initial_arena_capacity;
+        }
+    }
+    if (table->index_capacity <= 2 * table->initial_key_capacity
+        || !index_resize(table, 2 * table->initial_key_capacity)) {
+        memset(table->index, 0xFF, table->index_capacity * sizeof(uint32_t));
+    }
+}
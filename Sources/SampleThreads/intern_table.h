@@ -0,0 +1,88 @@
+//
+//  intern_table.h
+//
+
+#ifndef intern_table_h
+#define intern_table_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Marks the absence of a key.
+#define INTERN_ID_NONE 0xFFFFFFFF
+
+typedef struct {
+    /// Hash of the key, kept to avoid comparing keys that don't match and to grow the index
+    /// without hashing the keys again.
+    uint64_t hash;
+    /// Offset of the first byte of the key in the arena.
+    uint64_t offset;
+    /// Number of bytes of the key, without its padding.
+    uint32_t size;
+} interned_key_t;
+
+/// A deduplicated store of byte strings (keys), shared by the stack and name tables.
+///
+/// Each distinct key is stored once, in a single arena, and is identified by a dense 32-bit
+/// ID. Keys are found by their hash (computed by the caller, so each kind of key can use a
+/// hash that suits it) in an open-addressed index, kept at most half full. Interning a key
+/// that was already seen doesn't allocate any memory.
+///
+/// Keys are never removed one by one: `intern_table_reset` forgets all of them at once and
+/// starts a new generation, so memory stays bounded for long-running sessions as long as
+/// they are reset from time to time.
+typedef struct {
+    /// Open-addressed (linear probing) hash → ID index. Empty entries are INTERN_ID_NONE.
+    uint32_t *index;
+    uint32_t index_capacity;
+    /// The unique keys, indexed by ID.
+    interned_key_t *keys;
+    uint32_t count;
+    uint32_t key_capacity;
+    /// The bytes of all the unique keys, one after another, each one followed by its padding.
+    uint8_t *arena;
+    uint64_t arena_size;
+    uint64_t arena_capacity;
+    /// Capacities the table was created with, and goes back to when reset.
+    uint32_t initial_key_capacity;
+    uint64_t initial_arena_capacity;
+    /// Incremented every time the table is reset. Starts at 0.
+    uint32_t generation;
+} intern_table_t;
+
+/// Initializes an empty table with room for `key_capacity` keys and `arena_capacity` bytes.
+/// - Returns: `false` if there was no memory for the table.
+bool intern_table_init(intern_table_t *table, uint32_t key_capacity, uint64_t arena_capacity);
+
+/// Releases all the memory of the table.
+void intern_table_free(intern_table_t *table);
+
+/// Finds the ID of a key, adding the key to the table if it wasn't seen before.
+/// - Parameters:
+///   - hash: The hash of the key. Equal keys must have equal hashes.
+///   - key: The bytes of the key.
+///   - size: The number of bytes of the key.
+///   - padding: Number of zero bytes stored after a new key (ie: 1 for a NUL terminator).
+/// - Returns: The ID of the key, or `INTERN_ID_NONE` if there was no memory to add it.
+uint32_t intern_table_intern(intern_table_t *table, uint64_t hash, const void *key, uint32_t size, uint32_t padding);
+
+/// The bytes of the key with the given ID, followed by its padding.
+///
+/// The returned pointer is owned by the table, and is only valid until the next call to
+/// `intern_table_intern` or `intern_table_reset`, as the arena may be reallocated to grow.
+/// - Returns: The bytes of the key, or `NULL` (with a size of 0) if the ID is not valid.
+static inline const void *intern_table_key(const intern_table_t *table, uint32_t id, uint32_t *size) {
+    if (id >= table->count) {
+        *size = 0;
+        return NULL;
+    }
+    *size = table->keys[id].size;
+    return &table->arena[table->keys[id].offset];
+}
+
+/// Forgets all the keys, so their IDs are reused by the keys interned from then on, and
+/// shrinks the table back to its initial capacities.
+void intern_table_reset(intern_table_t *table);
+
+#endif /* intern_table_h */
@@ -0,0 +1,79 @@
+//
+//  linux_procfs.h
+//
+
+#ifndef linux_procfs_h
+#define linux_procfs_h
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Helpers to read the small text files of procfs and sysfs, shared by the Linux backends.
+// Files that are read periodically are kept open and re-read from the start with pread(),
+// which is a single syscall per read.
+
+// The records returned by the getdents64 syscall.
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/// Reads the whole file (up to `buffer_size - 1` bytes) into `buffer`, as a C string.
+static inline bool read_file_at(int fd, char *buffer, size_t buffer_size) {
+    ssize_t length = pread(fd, buffer, buffer_size - 1, 0);
+    if (length <= 0) {
+        return false;
+    }
+    buffer[length] = '\0';
+    return true;
+}
+
+/// Reads a file containing a single decimal number.
+static inline bool read_uint64_at(int fd, uint64_t *value) {
+    char buffer[32];
+    if (!read_file_at(fd, buffer, sizeof(buffer))) {
+        return false;
+    }
+    *value = strtoull(buffer, NULL, 10);
+    return true;
+}
+
+static inline bool read_uint64_file(const char *path, uint64_t *value) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool success = read_uint64_at(fd, value);
+    close(fd);
+    return success;
+}
+
+/// Reads a batch of entries of an open directory, starting where the previous read ended
+/// (`lseek` the directory to 0 to read it again).
+/// - Returns: The number of bytes written to `buffer`, 0 at the end of the directory or -1
+/// on error. `buffer` must be 8-byte aligned.
+static inline long read_directory_entries(int fd, char *buffer, size_t buffer_size) {
+    return syscall(SYS_getdents64, fd, buffer, buffer_size);
+}
+
+/// Parses a directory entry name made only of digits (ie: a PID or thread ID).
+/// - Returns: The number, or -1 if the name is not a number (ie: "." or "..").
+static inline long parse_numeric_entry(const char *name) {
+    if (name[0] < '0' || name[0] > '9') {
+        return -1;
+    }
+    return strtol(name, NULL, 10);
+}
+
+#endif /* defined(__linux__) */
+
+#endif /* linux_procfs_h */
@@ -0,0 +1,127 @@
+//
+//  linux_rapl.c
+//
+
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include "linux_rapl.h"
+#include "linux_procfs.h"
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Every RAPL zone shows up in /sys/class/powercap as an `intel-rapl:<package>` directory,
+// and its subzones as `intel-rapl:<package>:<subzone>` (AMD processors use the same
+// names). The kind of a zone is given by its `name` file: "package-N", "core", "uncore" or
+// "dram". The "psys" zone of some laptops measures the whole platform, overlapping with the
+// rest of zones, so it's skipped.
+
+/// The kind of domain with the given name.
+/// - Returns: `false` if the domain is not one of the known kinds.
+static bool domain_kind(const char *name, rapl_domain_kind_t *kind) {
+    if (strncmp(name, "package", strlen("package")) == 0) {
+        *kind = RAPL_DOMAIN_PACKAGE;
+    } else if (strcmp(name, "core") == 0) {
+        *kind = RAPL_DOMAIN_CORE;
+    } else if (strcmp(name, "uncore") == 0) {
+        *kind = RAPL_DOMAIN_UNCORE;
+    } else if (strcmp(name, "dram") == 0) {
+        *kind = RAPL_DOMAIN_DRAM;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/// Opens the energy counter of a zone, adding it to the reader.
+static void open_domain(rapl_reader_t *reader, const char *powercap_root, const char *zone) {
+    char path[512];
+    char name[64];
+    snprintf(path, sizeof(path), "%s/%s/name", powercap_root, zone);
+    int name_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (name_fd < 0) {
+        return;
+    }
+    bool has_name = read_file_at(name_fd, name, sizeof(name));
+    close(name_fd);
+    rapl_domain_t *domain = &reader->domains[reader->domain_count];
+    name[strcspn(name, "\n")] = '\0';
+    if (!has_name || !domain_kind(name, &domain->kind)) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/%s/energy_uj", powercap_root, zone);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        // energy_uj is not readable (it is root-only on most distributions).
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", powercap_root, zone);
+    if (!read_uint64_file(path, &domain->max_energy_range_uj)
+        || !read_uint64_at(fd, &domain->previous_energy_uj)) {
+        close(fd);
+        return;
+    }
+    domain->fd = fd;
+    reader->domain_count += 1;
+}
+
+void rapl_reader_open_at(rapl_reader_t *reader, const char *powercap_root) {
+    reader->domain_count = 0;
+    DIR *directory = opendir(powercap_root);
+    if (directory == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL && reader->domain_count < MAX_RAPL_DOMAINS) {
+        // Skips the `intel-rapl` control type, and the `intel-rapl-mmio` zones, which
+        // duplicate the MSR package zones on some Intel processors.
+        if (strncmp(entry->d_name, "intel-rapl:", strlen("intel-rapl:")) == 0) {
+            open_domain(reader, powercap_root, entry->d_name);
+        }
+    }
+    closedir(directory);
+}
+
+void rapl_reader_open(rapl_reader_t *reader) {
+    rapl_reader_open_at(reader, "/sys/class/powercap");
+}
+
+void rapl_reader_close(rapl_reader_t *reader) {
+    for (int i = 0; i < reader->domain_count; i++) {
+        close(reader->domains[i].fd);
+    }
+    reader->domain_count = 0;
+}
+
+void rapl_reader_read(rapl_reader_t *reader, rapl_energy_t *energy) {
+    uint64_t energy_uj[RAPL_DOMAIN_DRAM + 1] = { 0 };
+    for (int i = 0; i < reader->domain_count; i++) {
+        rapl_domain_t *domain = &reader->domains[i];
+        uint64_t current_uj;
+        if (!read_uint64_at(domain->fd, &current_uj)) {
+            continue;
+        }
+        if (current_uj >= domain->previous_energy_uj) {
+            energy_uj[domain->kind] += current_uj - domain->previous_energy_uj;
+        } else {
+            // The counter wrapped around.
+            energy_uj[domain->kind] += (domain->max_energy_range_uj - domain->previous_energy_uj) + current_uj;
+        }
+        domain->previous_energy_uj = current_uj;
+    }
+    energy->package = energy_uj[RAPL_DOMAIN_PACKAGE] / 1e6;
+    energy->core = energy_uj[RAPL_DOMAIN_CORE] / 1e6;
+    energy->uncore = energy_uj[RAPL_DOMAIN_UNCORE] / 1e6;
+    energy->dram = energy_uj[RAPL_DOMAIN_DRAM] / 1e6;
+}
+
+double rapl_reader_read_energy(rapl_reader_t *reader) {
+    rapl_energy_t energy;
+    rapl_reader_read(reader, &energy);
+    return energy.package;
+}
+
+#endif /* defined(__linux__) */
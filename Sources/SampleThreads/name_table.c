@@ -0,0 +1,79 @@
+//
+//  name_table.c
+//
+
+#include "name_table.h"
+#include "intern_table.h"
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(NAME_ID_NONE == INTERN_ID_NONE, "Name IDs are the IDs of the intern table");
+
+// Initial capacities.
+#define INITIAL_NAME_CAPACITY 64
+#define INITIAL_CHARACTER_CAPACITY (INITIAL_NAME_CAPACITY * 32)
+
+struct name_table {
+    /// The characters of each unique name, each one stored with a terminating NUL.
+    intern_table_t names;
+};
+
+// MARK: - Hashing
+
+static uint64_t hash_name(const char *name, uint32_t length) {
+    // FNV-1a. Names are short, so a simple byte-wise hash is enough.
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (uint32_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// MARK: - Public API
+
+name_table_t *name_table_create(void) {
+    name_table_t *table = malloc(sizeof(name_table_t));
+    if (table == NULL) {
+        return NULL;
+    }
+    if (!intern_table_init(&table->names, INITIAL_NAME_CAPACITY, INITIAL_CHARACTER_CAPACITY)) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+void name_table_destroy(name_table_t *table) {
+    if (table == NULL) {
+        return;
+    }
+    intern_table_free(&table->names);
+    free(table);
+}
+
+name_id_t name_table_intern(name_table_t *table, const char *name, size_t length) {
+    uint32_t name_length = (uint32_t) strnlen(name, length);
+    if (name_length == 0) {
+        return NAME_ID_NONE;
+    }
+    return intern_table_intern(&table->names, hash_name(name, name_length), name, name_length, 1);
+}
+
+uint32_t name_table_count(const name_table_t *table) {
+    return table->names.count;
+}
+
+const char *name_table_name(const name_table_t *table, name_id_t name_id) {
+    uint32_t length;
+    const char *name = intern_table_key(&table->names, name_id, &length);
+    return name != NULL ? name : "";
+}
+
+void name_table_reset(name_table_t *table) {
+    intern_table_reset(&table->names);
+}
+
+uint32_t name_table_generation(const name_table_t *table) {
+    return table->names.generation;
+}
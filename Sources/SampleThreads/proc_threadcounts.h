@@ -0,0 +1,67 @@
+//
+//  proc_threadcounts.h
+//
+
+#ifndef proc_threadcounts_h
+#define proc_threadcounts_h
+
+#if defined(__APPLE__)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mach/mach_time.h>
+#include <sys/sysctl.h>
+
+// Technically private structs, from:
+// https://github.com/apple-oss-distributions/xnu/blob/aca3beaa3dfbd42498b42c5e5ce20a938e6554e5/bsd/sys/proc_info.h#L153
+struct proc_threadcounts_data {
+    uint64_t ptcd_instructions;
+    uint64_t ptcd_cycles;
+    uint64_t ptcd_user_time_mach;
+    uint64_t ptcd_system_time_mach;
+    uint64_t ptcd_energy_nj;
+};
+
+/// Number of perf levels `struct proc_threadcounts` has room for.
+#define PROC_THREADCOUNTS_MAX_LEVELS 20
+
+struct proc_threadcounts {
+    uint16_t ptc_len;
+    uint16_t ptc_reserved0;
+    uint32_t ptc_reserved1;
+    struct proc_threadcounts_data ptc_counts[PROC_THREADCOUNTS_MAX_LEVELS];
+};
+
+// PROC_PIDTHREADCOUNTS is also private, see:
+// https://github.com/apple-oss-distributions/xnu/blob/aca3beaa3dfbd42498b42c5e5ce20a938e6554e5/bsd/sys/proc_info.h#L927
+#define PROC_PIDTHREADCOUNTS 34
+
+// On macOS, proc_pidinfo is available as part of the libproc headers. On iOS, those
+// headers are not available.
+int proc_pidinfo(int pid, int flavor, uint64_t arg, void *buffer, int buffersize);
+
+/// Number of perf levels the counters of PROC_PIDTHREADCOUNTS are split by (at least 1, and
+/// at most `PROC_THREADCOUNTS_MAX_LEVELS`). This may be more than the clusters of
+/// `core_topology_discover`, which merges the levels past `SAMPLE_MAX_CLUSTERS`.
+static inline uint32_t proc_threadcounts_level_count(void) {
+    uint32_t level_count = 0;
+    size_t size = sizeof(level_count);
+    if (sysctlbyname("hw.nperflevels", &level_count, &size, NULL, 0) != 0 || level_count == 0) {
+        return 1;
+    }
+    return level_count < PROC_THREADCOUNTS_MAX_LEVELS ? level_count : PROC_THREADCOUNTS_MAX_LEVELS;
+}
+
+// Convert mach_time (monotonous clock ticks) to seconds.
+static inline double convert_mach_time(uint64_t mach_time) {
+    static mach_timebase_info_data_t base = { .numer = 0 };
+    if (base.numer == 0) {
+        mach_timebase_info(&base);
+    }
+    double elapsed = (mach_time * base.numer) / base.denom;
+    return elapsed / 1e9;
+}
+
+#endif /* defined(__APPLE__) */
+
+#endif /* proc_threadcounts_h */
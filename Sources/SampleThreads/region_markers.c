@@ -0,0 +1,132 @@
+//
+//  region_markers.c
+//
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "region_markers_internal.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Every thread that ever began a region owns a slot in a process-wide list, which only grows:
+// slots of threads that exited are released, and reused by the next thread that needs one.
+// Only the owner thread writes to the region of a slot, so beginning and ending a region is
+// a plain store, and the sampler reads the slots without stopping the threads.
+typedef struct region_slot {
+    _Atomic(sample_region_t) region;
+    _Atomic uint64_t thread_id;
+    _Atomic bool in_use;
+    struct region_slot *next;
+} region_slot_t;
+
+static _Atomic(region_slot_t *) region_slots = NULL;
+static _Thread_local region_slot_t *current_slot = NULL;
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+/// The ID of the calling thread, as reported by the sampling backend.
+static uint64_t current_thread_id(void) {
+    #if defined(__APPLE__)
+    uint64_t thread_id = 0;
+    pthread_threadid_np(NULL, &thread_id);
+    return thread_id;
+    #elif defined(__linux__)
+    return (uint64_t) syscall(SYS_gettid);
+    #else
+    return 0;
+    #endif
+}
+
+/// Releases the slot of an exiting thread.
+static void release_slot(void *value) {
+    region_slot_t *slot = value;
+    atomic_store_explicit(&slot->region, SAMPLE_REGION_NONE, memory_order_relaxed);
+    atomic_store_explicit(&slot->in_use, false, memory_order_release);
+}
+
+static void create_slot_key(void) {
+    pthread_key_create(&slot_key, release_slot);
+}
+
+/// Finds a slot for the calling thread, reusing a released one if possible.
+static region_slot_t *acquire_slot(void) {
+    pthread_once(&slot_key_once, create_slot_key);
+    region_slot_t *slot = atomic_load_explicit(&region_slots, memory_order_acquire);
+    for (; slot != NULL; slot = slot->next) {
+        bool in_use = false;
+        if (!atomic_load_explicit(&slot->in_use, memory_order_relaxed)
+            && atomic_compare_exchange_strong_explicit(&slot->in_use, &in_use, true,
+                                                       memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+    }
+    if (slot == NULL) {
+        slot = calloc(1, sizeof(region_slot_t));
+        if (slot == NULL) {
+            return NULL;
+        }
+        atomic_init(&slot->in_use, true);
+        region_slot_t *head = atomic_load_explicit(&region_slots, memory_order_relaxed);
+        do {
+            slot->next = head;
+        } while (!atomic_compare_exchange_weak_explicit(&region_slots, &head, slot,
+                                                        memory_order_release, memory_order_relaxed));
+    }
+    atomic_store_explicit(&slot->thread_id, current_thread_id(), memory_order_relaxed);
+    pthread_setspecific(slot_key, slot);
+    current_slot = slot;
+    return slot;
+}
+
+sample_region_t sample_region_begin(sample_region_t region) {
+    region_slot_t *slot = current_slot;
+    if (__builtin_expect(slot == NULL, 0)) {
+        slot = acquire_slot();
+        if (slot == NULL) {
+            return SAMPLE_REGION_NONE;
+        }
+    }
+    sample_region_t previous = atomic_load_explicit(&slot->region, memory_order_relaxed);
+    atomic_store_explicit(&slot->region, region, memory_order_release);
+    return previous;
+}
+
+void sample_region_end(sample_region_t previous) {
+    region_slot_t *slot = current_slot;
+    if (slot != NULL) {
+        atomic_store_explicit(&slot->region, previous, memory_order_release);
+    }
+}
+
+sample_region_t sample_region_current(void) {
+    region_slot_t *slot = current_slot;
+    if (slot == NULL) {
+        return SAMPLE_REGION_NONE;
+    }
+    return atomic_load_explicit(&slot->region, memory_order_relaxed);
+}
+
+uint32_t region_markers_read(region_marker_t *markers, uint32_t capacity) {
+    uint32_t count = 0;
+    region_slot_t *slot = atomic_load_explicit(&region_slots, memory_order_acquire);
+    for (; slot != NULL; slot = slot->next) {
+        sample_region_t region = atomic_load_explicit(&slot->region, memory_order_acquire);
+        if (region == SAMPLE_REGION_NONE || !atomic_load_explicit(&slot->in_use, memory_order_acquire)) {
+            continue;
+        }
+        if (count < capacity) {
+            markers[count].thread_id = atomic_load_explicit(&slot->thread_id, memory_order_relaxed);
+            markers[count].region = region;
+        }
+        count += 1;
+    }
+    return count;
+}
@@ -0,0 +1,23 @@
+//
+//  region_markers_internal.h
+//
+
+#ifndef region_markers_internal_h
+#define region_markers_internal_h
+
+#include "region_markers.h"
+
+typedef struct {
+    /// The thread ID, as in `sampled_thread_info_t.thread_id`.
+    uint64_t thread_id;
+    /// The current region of the thread.
+    sample_region_t region;
+} region_marker_t;
+
+/// Copies the threads of the current process that are in a region into `markers`, up to
+/// `capacity` threads. Threads may begin and end regions while they're read: each marker is
+/// the region its thread was in at some point during the call.
+/// - Returns: The number of threads in a region, which may be more than `capacity`.
+uint32_t region_markers_read(region_marker_t *markers, uint32_t capacity);
+
+#endif /* region_markers_internal_h */
@@ -0,0 +1,162 @@
+//
+//  sample_ring.c
+//
+
+#include "sample_ring.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// Records are copied in and out of the ring one 64-bit word at a time, using relaxed
+// atomics, so that a reader racing with the writer sees torn data (which the slot version
+// then rejects) instead of triggering undefined behavior.
+#define RECORD_WORD_COUNT (sizeof(sampled_thread_info_t) / sizeof(uint64_t))
+_Static_assert(sizeof(sampled_thread_info_t) % sizeof(uint64_t) == 0,
+               "sampled_thread_info_t must be a whole number of 64-bit words");
+
+// Size of a cache line, used to keep the writer's head away from the readers' data.
+#define CACHE_LINE_SIZE 64
+
+typedef struct {
+    /// `2 * sequence + 1` while the record with that sequence number is being written,
+    /// `2 * sequence + 2` once it's complete, and 0 if the slot was never written.
+    _Atomic uint64_t version;
+    _Atomic uint64_t words[RECORD_WORD_COUNT];
+} ring_slot_t;
+
+struct sample_ring {
+    /// Sequence number of the next record to be pushed.
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t head;
+    _Alignas(CACHE_LINE_SIZE) uint32_t capacity;
+    uint32_t mask;
+    ring_slot_t slots[];
+};
+
+sample_ring_t *sample_ring_create(uint32_t capacity) {
+    if (capacity == 0 || capacity > (UINT32_C(1) << 31)) {
+        return NULL;
+    }
+    uint32_t rounded_capacity = 1;
+    while (rounded_capacity < capacity) {
+        rounded_capacity <<= 1;
+    }
+    // calloc zeroes every slot version, marking them as never written.
+    sample_ring_t *ring = calloc(1, sizeof(sample_ring_t) + rounded_capacity * sizeof(ring_slot_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->capacity = rounded_capacity;
+    ring->mask = rounded_capacity - 1;
+    return ring;
+}
+
+void sample_ring_destroy(sample_ring_t *ring) {
+    free(ring);
+}
+
+uint32_t sample_ring_capacity(const sample_ring_t *ring) {
+    return ring->capacity;
+}
+
+uint64_t sample_ring_head(const sample_ring_t *ring) {
+    return atomic_load_explicit(&((sample_ring_t *) ring)->head, memory_order_acquire);
+}
+
+// MARK: - Writer
+
+void sample_ring_push(sample_ring_t *ring, const sampled_thread_info_t *records, uint32_t count) {
+    // Only this thread writes the head, so it can be read without synchronization.
+    uint64_t sequence = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (uint32_t i = 0; i < count; i++, sequence++) {
+        ring_slot_t *slot = &ring->slots[sequence & ring->mask];
+        const uint64_t *words = (const uint64_t *) &records[i];
+
+        atomic_store_explicit(&slot->version, 2 * sequence + 1, memory_order_relaxed);
+        // Readers that see any of the new words must also see the odd version.
+        atomic_thread_fence(memory_order_release);
+        for (size_t w = 0; w < RECORD_WORD_COUNT; w++) {
+            atomic_store_explicit(&slot->words[w], words[w], memory_order_relaxed);
+        }
+        atomic_store_explicit(&slot->version, 2 * sequence + 2, memory_order_release);
+    }
+    atomic_store_explicit(&ring->head, sequence, memory_order_release);
+}
+
+// MARK: - Readers
+
+/// Copies the record with the given sequence number into `out`.
+/// - Returns: `false` if the record was overwritten (or was being overwritten).
+static bool read_record(const sample_ring_t *ring, uint64_t sequence, sampled_thread_info_t *out) {
+    ring_slot_t *slot = (ring_slot_t *) &ring->slots[sequence & ring->mask];
+    uint64_t expected_version = 2 * sequence + 2;
+    if (atomic_load_explicit(&slot->version, memory_order_acquire) != expected_version) {
+        return false;
+    }
+    uint64_t *words = (uint64_t *) out;
+    for (size_t w = 0; w < RECORD_WORD_COUNT; w++) {
+        words[w] = atomic_load_explicit(&slot->words[w], memory_order_relaxed);
+    }
+    // The version must be read again after all the words: if the writer started to
+    // overwrite the slot meanwhile, the version changed.
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->version, memory_order_relaxed) == expected_version;
+}
+
+uint32_t sample_ring_read_from(const sample_ring_t *ring,
+                               uint64_t *cursor,
+                               sampled_thread_info_t *out,
+                               uint32_t max_count,
+                               uint64_t *dropped) {
+    uint64_t head = sample_ring_head(ring);
+    uint64_t sequence = *cursor;
+    uint64_t skipped = 0;
+    if (sequence > head) {
+        sequence = head;
+    }
+    if (head - sequence > ring->capacity) {
+        skipped += head - ring->capacity - sequence;
+        sequence = head - ring->capacity;
+    }
+
+    uint32_t count = 0;
+    while (sequence < head && count < max_count) {
+        if (read_record(ring, sequence, &out[count])) {
+            count++;
+        } else {
+            skipped++;
+        }
+        sequence++;
+    }
+    *cursor = sequence;
+    if (dropped != NULL) {
+        *dropped += skipped;
+    }
+    return count;
+}
+
+uint32_t sample_ring_snapshot(const sample_ring_t *ring,
+                              sampled_thread_info_t *out,
+                              uint32_t max_count,
+                              uint64_t *first_sequence) {
+    uint64_t head = sample_ring_head(ring);
+    uint64_t available = head < ring->capacity ? head : ring->capacity;
+    if (available > max_count) {
+        available = max_count;
+    }
+
+    uint64_t first = head - available;
+    uint32_t count = 0;
+    for (uint64_t sequence = first; sequence < head; sequence++) {
+        if (read_record(ring, sequence, &out[count])) {
+            count++;
+        } else {
+            // Everything copied so far is older than the overwritten record, so the
+            // snapshot would not be contiguous: start over from the next record.
+            first = sequence + 1;
+            count = 0;
+        }
+    }
+    if (first_sequence != NULL) {
+        *first_sequence = first;
+    }
+    return count;
+}
@@ -0,0 +1,305 @@
+//
+//  sample_scheduler.c
+//
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "sample_scheduler.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+/// Minimum number of ticks the usage is measured over before each adaptation step. Windows
+/// also span at least one tick with backtraces.
+#define ADAPTATION_WINDOW_TICKS 8
+/// The latest step is undone once the usage is under this fraction of the budget, so that
+/// undoing it (which at most doubles the cost) doesn't go over the budget again.
+#define RECOVERY_FRACTION 0.5
+/// Backtraces are retrieved at least once every this many ticks.
+#define MAX_BACKTRACE_STRIDE 16
+/// The period is never stretched beyond this many times the configured one.
+#define MAX_PERIOD_STRETCH 8
+
+struct sample_scheduler {
+    sample_scheduler_config_t config;
+    uint64_t base_period_ns;
+    uint64_t period_ns;
+
+    /// Deadline of the latest tick, 0 before the first tick.
+    uint64_t previous_deadline_ns;
+    /// Start time of the latest tick.
+    uint64_t tick_start_ns;
+    uint64_t sequence;
+
+    // Adaptation state.
+    /// Backtraces are retrieved once every `backtrace_stride` ticks.
+    uint32_t backtrace_stride;
+    bool skip_dispatch_queue_names;
+    /// Start of the window the usage is being measured over.
+    uint64_t window_start_ns;
+    /// CPU time used by the ticks of the current window, in seconds.
+    double window_cpu_time;
+    uint32_t window_tick_count;
+    /// Fraction of one core used during the latest complete window.
+    double cpu_usage;
+
+    atomic_bool stopped;
+#if defined(__linux__)
+    /// Armed with the next deadline.
+    int timer_fd;
+    /// Written to by `sample_scheduler_stop` to wake up the waiting thread.
+    int event_fd;
+#elif defined(__APPLE__)
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+#endif
+};
+
+// MARK: - Time
+
+static uint64_t monotonic_time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+double sample_thread_cpu_time(void) {
+    struct timespec cpu_time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time) != 0) {
+        return 0.0;
+    }
+    return (double) cpu_time.tv_sec + (double) cpu_time.tv_nsec / 1e9;
+}
+
+/// Blocks until the given time of `CLOCK_MONOTONIC`.
+/// - Returns: `false` if the scheduler was stopped while waiting.
+static bool wait_until(sample_scheduler_t *scheduler, uint64_t deadline_ns) {
+#if defined(__linux__)
+    struct itimerspec timer = {
+        .it_value = {
+            .tv_sec = (time_t) (deadline_ns / 1000000000ull),
+            .tv_nsec = (long) (deadline_ns % 1000000000ull)
+        }
+    };
+    if (timerfd_settime(scheduler->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL) != 0) {
+        return false;
+    }
+    struct pollfd fds[2] = {
+        { .fd = scheduler->timer_fd, .events = POLLIN },
+        { .fd = scheduler->event_fd, .events = POLLIN }
+    };
+    while (!atomic_load_explicit(&scheduler->stopped, memory_order_acquire)) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (fds[1].revents & POLLIN) {
+            return false;
+        }
+        if (fds[0].revents & POLLIN) {
+            uint64_t expirations;
+            // Reading clears the expiration, so the timer can be armed again.
+            if (read(scheduler->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+                return false;
+            }
+            return !atomic_load_explicit(&scheduler->stopped, memory_order_acquire);
+        }
+    }
+    return false;
+#elif defined(__APPLE__)
+    // Waiting is relative, but the remaining time is computed from the absolute deadline
+    // every time the wait ends, so early wake-ups don't shift the deadline.
+    pthread_mutex_lock(&scheduler->mutex);
+    while (!atomic_load_explicit(&scheduler->stopped, memory_order_acquire)) {
+        uint64_t now_ns = monotonic_time_ns();
+        if (now_ns >= deadline_ns) {
+            break;
+        }
+        uint64_t remaining_ns = deadline_ns - now_ns;
+        struct timespec remaining = {
+            .tv_sec = (time_t) (remaining_ns / 1000000000ull),
+            .tv_nsec = (long) (remaining_ns % 1000000000ull)
+        };
+        pthread_cond_timedwait_relative_np(&scheduler->condition, &scheduler->mutex, &remaining);
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+    return !atomic_load_explicit(&scheduler->stopped, memory_order_acquire);
+#else
+    return false;
+#endif
+}
+
+// MARK: - Adaptation
+
+/// Takes the next step to reduce the cost of sampling.
+static void degrade(sample_scheduler_t *scheduler) {
+    uint64_t max_period_ns = scheduler->base_period_ns * MAX_PERIOD_STRETCH;
+    if (scheduler->config.retrieve_backtraces && scheduler->backtrace_stride < MAX_BACKTRACE_STRIDE) {
+        scheduler->backtrace_stride *= 2;
+    } else if (scheduler->config.retrieve_dispatch_queue_names && !scheduler->skip_dispatch_queue_names) {
+        scheduler->skip_dispatch_queue_names = true;
+    } else if (scheduler->period_ns < max_period_ns) {
+        uint64_t period_ns = scheduler->period_ns * 3 / 2;
+        scheduler->period_ns = period_ns < max_period_ns ? period_ns : max_period_ns;
+    }
+}
+
+/// Undoes the latest step taken by `degrade`.
+static void recover(sample_scheduler_t *scheduler) {
+    if (scheduler->period_ns > scheduler->base_period_ns) {
+        uint64_t period_ns = scheduler->period_ns * 2 / 3;
+        scheduler->period_ns = period_ns > scheduler->base_period_ns ? period_ns : scheduler->base_period_ns;
+    } else if (scheduler->skip_dispatch_queue_names) {
+        scheduler->skip_dispatch_queue_names = false;
+    } else if (scheduler->backtrace_stride > 1) {
+        scheduler->backtrace_stride /= 2;
+    }
+}
+
+// MARK: - Public API
+
+sample_scheduler_t *sample_scheduler_create(sample_scheduler_config_t config) {
+    if (!(config.period > 0)) {
+        return NULL;
+    }
+    sample_scheduler_t *scheduler = calloc(1, sizeof(sample_scheduler_t));
+    if (scheduler == NULL) {
+        return NULL;
+    }
+    scheduler->config = config;
+    scheduler->base_period_ns = (uint64_t) (config.period * 1e9);
+    if (scheduler->base_period_ns == 0) {
+        scheduler->base_period_ns = 1;
+    }
+    scheduler->period_ns = scheduler->base_period_ns;
+    scheduler->backtrace_stride = 1;
+    atomic_init(&scheduler->stopped, false);
+#if defined(__linux__)
+    scheduler->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    scheduler->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (scheduler->timer_fd < 0 || scheduler->event_fd < 0) {
+        if (scheduler->timer_fd >= 0) {
+            close(scheduler->timer_fd);
+        }
+        if (scheduler->event_fd >= 0) {
+            close(scheduler->event_fd);
+        }
+        free(scheduler);
+        return NULL;
+    }
+#elif defined(__APPLE__)
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    pthread_cond_init(&scheduler->condition, NULL);
+#endif
+    return scheduler;
+}
+
+void sample_scheduler_destroy(sample_scheduler_t *scheduler) {
+    if (scheduler == NULL) {
+        return;
+    }
+#if defined(__linux__)
+    close(scheduler->timer_fd);
+    close(scheduler->event_fd);
+#elif defined(__APPLE__)
+    pthread_mutex_destroy(&scheduler->mutex);
+    pthread_cond_destroy(&scheduler->condition);
+#endif
+    free(scheduler);
+}
+
+bool sample_scheduler_wait(sample_scheduler_t *scheduler, sample_tick_plan_t *plan) {
+    uint64_t now_ns = monotonic_time_ns();
+    uint64_t deadline_ns;
+    uint64_t missed_deadlines = 0;
+    if (scheduler->previous_deadline_ns == 0) {
+        deadline_ns = now_ns;
+    } else {
+        deadline_ns = scheduler->previous_deadline_ns + scheduler->period_ns;
+        if (now_ns >= deadline_ns + scheduler->period_ns) {
+            // The previous tick overran more than a period: skip the deadlines already
+            // missed, keeping the schedule's phase, and start right away.
+            missed_deadlines = (now_ns - deadline_ns) / scheduler->period_ns;
+            deadline_ns += missed_deadlines * scheduler->period_ns;
+        }
+    }
+    if (!wait_until(scheduler, deadline_ns)) {
+        return false;
+    }
+
+    uint64_t start_ns = monotonic_time_ns();
+    plan->sequence = scheduler->sequence;
+    plan->interval = scheduler->sequence == 0 ? 0.0 : (double) (start_ns - scheduler->tick_start_ns) / 1e9;
+    plan->missed_deadlines = missed_deadlines;
+    plan->period = (double) scheduler->period_ns / 1e9;
+    plan->retrieve_backtraces = scheduler->config.retrieve_backtraces
+        && scheduler->sequence % scheduler->backtrace_stride == 0;
+    plan->retrieve_dispatch_queue_names = scheduler->config.retrieve_dispatch_queue_names
+        && !scheduler->skip_dispatch_queue_names;
+
+    scheduler->previous_deadline_ns = deadline_ns;
+    scheduler->tick_start_ns = start_ns;
+    scheduler->sequence += 1;
+    return true;
+}
+
+void sample_scheduler_end_tick(sample_scheduler_t *scheduler, double cpu_time, sample_tick_cost_t *cost) {
+    uint64_t now_ns = monotonic_time_ns();
+    if (scheduler->window_start_ns == 0) {
+        scheduler->window_start_ns = scheduler->tick_start_ns;
+    }
+    scheduler->window_cpu_time += cpu_time;
+    scheduler->window_tick_count += 1;
+
+    // The usage is the CPU time used over the time elapsed, measured over several ticks, so
+    // ticks that are more expensive than others (ie: those retrieving backtraces) are
+    // averaged with the rest.
+    if (scheduler->window_tick_count >= ADAPTATION_WINDOW_TICKS
+        && scheduler->window_tick_count >= scheduler->backtrace_stride
+        && now_ns > scheduler->window_start_ns) {
+        scheduler->cpu_usage = scheduler->window_cpu_time / ((double) (now_ns - scheduler->window_start_ns) / 1e9);
+        scheduler->window_start_ns = now_ns;
+        scheduler->window_cpu_time = 0.0;
+        scheduler->window_tick_count = 0;
+
+        double budget = scheduler->config.cpu_budget;
+        if (budget > 0 && scheduler->cpu_usage > budget) {
+            degrade(scheduler);
+        } else if (budget > 0 && scheduler->cpu_usage < budget * RECOVERY_FRACTION) {
+            recover(scheduler);
+        }
+    }
+
+    if (cost != NULL) {
+        cost->cpu_time = cpu_time;
+        cost->wall_time = (double) (now_ns - scheduler->tick_start_ns) / 1e9;
+        cost->cpu_usage = scheduler->cpu_usage;
+    }
+}
+
+void sample_scheduler_stop(sample_scheduler_t *scheduler) {
+    atomic_store_explicit(&scheduler->stopped, true, memory_order_release);
+#if defined(__linux__)
+    uint64_t value = 1;
+    // Can only fail if the counter would overflow, in which case it's already readable.
+    (void) !write(scheduler->event_fd, &value, sizeof(value));
+#elif defined(__APPLE__)
+    pthread_mutex_lock(&scheduler->mutex);
+    pthread_cond_signal(&scheduler->condition);
+    pthread_mutex_unlock(&scheduler->mutex);
+#endif
+}
@@ -0,0 +1,446 @@
+//
+//  sample_session.c
+//
+
+#include "sample_session_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Initial capacity of the session slabs. Enough for most apps to never grow them.
+#define INITIAL_THREAD_CAPACITY 64
+#define INITIAL_FRAME_CAPACITY MAX_FRAME_DEPTH
+#define INITIAL_MARKER_CAPACITY 16
+
+/// Current time of a clock that keeps running while the system is asleep, in nanoseconds.
+static uint64_t continuous_time_ns(void) {
+    struct timespec time;
+    #if defined(__linux__)
+    clock_gettime(CLOCK_BOOTTIME, &time);
+    #else
+    // On Apple platforms, CLOCK_MONOTONIC keeps running while asleep.
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    #endif
+    return (uint64_t) time.tv_sec * 1000000000ull + (uint64_t) time.tv_nsec;
+}
+
+static void attribute_regions(sample_session_t *session);
+
+sample_session_t *sample_session_create(int pid) {
+    sample_session_config_t config;
+    memset(&config, 0, sizeof(config));
+    return sample_session_create_with_config(pid, config);
+}
+
+sample_session_t *sample_session_create_with_config(int pid, sample_session_config_t config) {
+    sample_session_t *session = calloc(1, sizeof(sample_session_t));
+    if (session == NULL) {
+        return NULL;
+    }
+    if (config.worker_count > 0) {
+        session->pool = worker_pool_create_pinned(config.worker_count);
+        session->worker_counters = aligned_alloc(_Alignof(sample_worker_counters_t),
+                                                 (config.worker_count + 1) * sizeof(sample_worker_counters_t));
+        if (session->pool == NULL || session->worker_counters == NULL) {
+            worker_pool_destroy(session->pool);
+            free(session->worker_counters);
+            free(session);
+            return NULL;
+        }
+        memset(session->worker_counters, 0, (config.worker_count + 1) * sizeof(sample_worker_counters_t));
+    }
+    session->pid = pid;
+    session->is_current_process = pid == getpid();
+    session->threads = malloc(INITIAL_THREAD_CAPACITY * sizeof(sampled_thread_record_t));
+    session->thread_capacity = INITIAL_THREAD_CAPACITY;
+    session->frames = malloc(INITIAL_FRAME_CAPACITY * sizeof(backtrace_address_t));
+    session->frame_capacity = INITIAL_FRAME_CAPACITY;
+    session->stacks = stack_table_create();
+    session->names = name_table_create();
+    session->name_generation = 1;
+    session->stats = sampler_stats_create();
+    if (session->threads == NULL
+        || session->frames == NULL
+        || session->stacks == NULL
+        || session->names == NULL
+        || session->stats == NULL
+        || !sample_backend_create(session)) {
+        free(session->threads);
+        free(session->frames);
+        stack_table_destroy(session->stacks);
+        name_table_destroy(session->names);
+        sampler_stats_destroy(session->stats);
+        worker_pool_destroy(session->pool);
+        free(session->worker_counters);
+        free(session);
+        return NULL;
+    }
+    energy_model_init(&session->energy_model, config.energy_model, session->topology.cluster_count);
+    if (config.energy_model_weights != NULL && config.energy_model_weight_count > 0) {
+        energy_model_set_weights(&session->energy_model, config.energy_model_weights, config.energy_model_weight_count);
+    }
+    // The delta engine only keeps columns for the clusters the backend samples.
+    session->deltas = thread_delta_engine_create(session->topology.cluster_count);
+    if (session->deltas == NULL) {
+        sample_session_destroy(session);
+        return NULL;
+    }
+    return session;
+}
+
+void sample_session_destroy(sample_session_t *session) {
+    if (session == NULL) {
+        return;
+    }
+    sample_backend_destroy(session);
+    worker_pool_destroy(session->pool);
+    free(session->worker_counters);
+    thread_delta_engine_destroy(session->deltas);
+    stack_table_destroy(session->stacks);
+    name_table_destroy(session->names);
+    sampler_stats_destroy(session->stats);
+    free(session->threads);
+    free(session->frames);
+    free(session->markers);
+    free(session->marker_regions);
+    free(session->regions);
+    free(session);
+}
+
+sample_session_result_t sample_session_sample_into(sample_session_t *session, bool retrieve_dispatch_queue_names, bool retrieve_backtraces) {
+    sampler_stats_begin_tick(session->stats);
+    session->thread_count = 0;
+    if (session->sample_count > 0 && session->sample_count % SAMPLE_NAME_REFRESH_INTERVAL == 0) {
+        session->name_generation += 1;
+    }
+    session->sample_count += 1;
+    uint64_t sample_time_ns = continuous_time_ns();
+    sample_backend_sample(session, retrieve_dispatch_queue_names, retrieve_backtraces);
+
+    sample_session_result_t result;
+    memset(&result, 0, sizeof(result));
+    uint64_t deltas_start_ns = sampler_now_ns();
+    if (!thread_delta_engine_update(session->deltas,
+                                    session->threads,
+                                    session->thread_count,
+                                    result.deltas)) {
+        session->thread_count = 0;
+    }
+    uint32_t event_count = 0;
+    result.events = thread_delta_engine_events(session->deltas, &event_count);
+    result.event_count = event_count;
+    attribute_regions(session);
+    sampler_stats_lap(session->stats, SAMPLER_PHASE_DELTAS, deltas_start_ns);
+    if (session->previous_sample_time_ns != 0) {
+        result.interval = (sample_time_ns - session->previous_sample_time_ns) / 1e9;
+    }
+    session->previous_sample_time_ns = sample_time_ns;
+
+    result.cluster_count = session->topology.cluster_count;
+    result.thread_count = session->thread_count;
+    result.threads = session->threads;
+    result.stacks = session->stacks;
+    result.names = session->names;
+    result.region_count = session->region_count;
+    result.regions = session->regions;
+    sampler_stats_end_tick(session->stats);
+    return result;
+}
+
+void sample_session_invalidate_names(sample_session_t *session) {
+    session->name_generation += 1;
+}
+
+void sample_session_reset_tables(sample_session_t *session) {
+    stack_table_reset(session->stacks);
+    name_table_reset(session->names);
+    // The backends cache the name IDs of each thread until the generation changes.
+    session->name_generation += 1;
+}
+
+uint32_t sample_session_energy_model_weights(const sample_session_t *session, double *weights) {
+    if (session->energy_model.kind != ENERGY_MODEL_LINEAR) {
+        return 0;
+    }
+    return energy_model_weights(&session->energy_model, weights);
+}
+
+const core_topology_t *sample_session_topology(const sample_session_t *session) {
+    return &session->topology;
+}
+
+sampler_stats_t *sample_session_stats(sample_session_t *session) {
+    return session->stats;
+}
+
+double sample_session_worker_cpu_time(const sample_session_t *session) {
+    if (session->pool == NULL) {
+        return 0.0;
+    }
+    return worker_pool_cpu_time(session->pool);
+}
+
+uint32_t sample_session_pinned_worker_count(const sample_session_t *session) {
+    if (session->pool == NULL) {
+        return 0;
+    }
+    return worker_pool_pinned_count(session->pool);
+}
+
+// MARK: - Slabs
+
+bool sample_session_reserve_threads(sample_session_t *session, uint32_t count) {
+    if (count <= session->thread_capacity) {
+        return true;
+    }
+    uint32_t new_capacity = session->thread_capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    sampled_thread_record_t *new_threads = realloc(session->threads, new_capacity * sizeof(sampled_thread_record_t));
+    sampler_count_allocation();
+    if (new_threads == NULL) {
+        return false;
+    }
+    session->threads = new_threads;
+    session->thread_capacity = new_capacity;
+    return true;
+}
+
+backtrace_address_t *sample_session_reserve_frames(sample_session_t *session, uint32_t count) {
+    if (count > session->frame_capacity) {
+        uint32_t new_capacity = session->frame_capacity;
+        while (new_capacity < count) {
+            new_capacity *= 2;
+        }
+        backtrace_address_t *new_frames = realloc(session->frames, new_capacity * sizeof(backtrace_address_t));
+        sampler_count_allocation();
+        if (new_frames == NULL) {
+            return NULL;
+        }
+        session->frames = new_frames;
+        session->frame_capacity = new_capacity;
+    }
+    return session->frames;
+}
+
+// MARK: - Workers
+
+typedef struct {
+    sample_session_t *session;
+    worker_pool_task_t task;
+    void *context;
+} session_batch_t;
+
+static void run_session_task(void *context, uint32_t task_index, uint32_t worker_index) {
+    session_batch_t *batch = context;
+    batch->task(batch->context, task_index, worker_index);
+    if (worker_index != 0) {
+        // Move what the pool's thread counted to its worker's counters, which the calling
+        // thread reads once the batch is finished.
+        sampler_thread_counters_t *counters = &batch->session->worker_counters[worker_index].counters;
+        counters->allocations += sampler_thread_counters.allocations;
+        counters->syscalls += sampler_thread_counters.syscalls;
+        sampler_thread_counters.allocations = 0;
+        sampler_thread_counters.syscalls = 0;
+    }
+}
+
+uint32_t sample_session_worker_count(const sample_session_t *session) {
+    if (session->pool == NULL) {
+        return 1;
+    }
+    return worker_pool_worker_count(session->pool);
+}
+
+void sample_session_for_each_thread(sample_session_t *session, uint32_t count, worker_pool_task_t task, void *context) {
+    if (session->pool == NULL) {
+        for (uint32_t i = 0; i < count; i++) {
+            task(context, i, 0);
+        }
+        return;
+    }
+    session_batch_t batch = {
+        .session = session,
+        .task = task,
+        .context = context
+    };
+    worker_pool_run(session->pool, count, run_session_task, &batch);
+    for (uint32_t i = 1; i < worker_pool_worker_count(session->pool); i++) {
+        sampler_thread_counters_t *counters = &session->worker_counters[i].counters;
+        sampler_thread_counters.allocations += counters->allocations;
+        sampler_thread_counters.syscalls += counters->syscalls;
+        counters->allocations = 0;
+        counters->syscalls = 0;
+    }
+}
+
+// MARK: - Regions
+
+static int compare_markers(const void *lhs, const void *rhs) {
+    uint64_t lhs_id = ((const region_marker_t *) lhs)->thread_id;
+    uint64_t rhs_id = ((const region_marker_t *) rhs)->thread_id;
+    return (lhs_id > rhs_id) - (lhs_id < rhs_id);
+}
+
+/// Reads the region markers, growing the scratch space if they don't fit.
+/// - Returns: The number of markers read.
+static uint32_t read_region_markers(sample_session_t *session) {
+    uint32_t count = region_markers_read(session->markers, session->marker_capacity);
+    while (count > session->marker_capacity) {
+        uint32_t new_capacity = session->marker_capacity > 0 ? session->marker_capacity : INITIAL_MARKER_CAPACITY;
+        while (new_capacity < count) {
+            new_capacity *= 2;
+        }
+        region_marker_t *new_markers = realloc(session->markers, new_capacity * sizeof(region_marker_t));
+        sampler_count_allocation();
+        if (new_markers == NULL) {
+            return 0;
+        }
+        session->markers = new_markers;
+        uint32_t *new_marker_regions = realloc(session->marker_regions, new_capacity * sizeof(uint32_t));
+        sampler_count_allocation();
+        if (new_marker_regions == NULL) {
+            return 0;
+        }
+        session->marker_regions = new_marker_regions;
+        session->marker_capacity = new_capacity;
+        // Threads may have begun regions in the meantime.
+        count = region_markers_read(session->markers, session->marker_capacity);
+    }
+    return count;
+}
+
+/// The index in `session->regions` of the region of a marker, adding the region if no
+/// sampled thread was found in it yet.
+/// - Returns: The index of the region, or `UINT32_MAX` if its name is empty or there's no
+/// room for it.
+static uint32_t marker_region(sample_session_t *session, uint32_t marker) {
+    if (session->marker_regions[marker] != UINT32_MAX) {
+        return session->marker_regions[marker];
+    }
+    // Regions are told apart by name, and there are usually only a few of them, so they're
+    // found with a linear search.
+    const char *name = session->markers[marker].region;
+    name_id_t name_id = name_table_intern(session->names, name, strlen(name));
+    if (name_id == NAME_ID_NONE) {
+        return UINT32_MAX;
+    }
+    uint32_t region = 0;
+    while (region < session->region_count && session->regions[region].name_id != name_id) {
+        region += 1;
+    }
+    if (region == session->region_count) {
+        if (session->region_count == session->region_capacity) {
+            uint32_t new_capacity = session->region_capacity > 0 ? 2 * session->region_capacity : INITIAL_MARKER_CAPACITY;
+            sampled_region_t *new_regions = realloc(session->regions, new_capacity * sizeof(sampled_region_t));
+            sampler_count_allocation();
+            if (new_regions == NULL) {
+                return UINT32_MAX;
+            }
+            session->regions = new_regions;
+            session->region_capacity = new_capacity;
+        }
+        memset(&session->regions[region], 0, sizeof(sampled_region_t));
+        session->regions[region].name_id = name_id;
+        session->region_count += 1;
+    }
+    session->marker_regions[marker] = region;
+    return region;
+}
+
+/// Sets the region of each sampled thread, and adds up the deltas of the threads in each
+/// region.
+///
+/// The markers are sorted by thread ID, so each thread's region is found with a binary
+/// search, and a region's name is only interned once per sample, when the first thread in
+/// it is found.
+static void attribute_regions(sample_session_t *session) {
+    session->region_count = 0;
+    uint32_t marker_count = 0;
+    if (session->is_current_process) {
+        marker_count = read_region_markers(session);
+    }
+    for (uint32_t i = 0; i < session->thread_count; i++) {
+        session->threads[i].region_name_id = NAME_ID_NONE;
+    }
+    if (marker_count == 0) {
+        return;
+    }
+    qsort(session->markers, marker_count, sizeof(region_marker_t), compare_markers);
+    memset(session->marker_regions, 0xFF, marker_count * sizeof(uint32_t));
+
+    uint32_t cluster_count = session->topology.cluster_count;
+    for (uint32_t i = 0; i < session->thread_count; i++) {
+        sampled_thread_record_t *record = &session->threads[i];
+        region_marker_t key = { .thread_id = record->info.thread_id };
+        const region_marker_t *marker = bsearch(&key, session->markers, marker_count, sizeof(region_marker_t), compare_markers);
+        if (marker == NULL) {
+            continue;
+        }
+        uint32_t region_index = marker_region(session, (uint32_t) (marker - session->markers));
+        if (region_index == UINT32_MAX) {
+            continue;
+        }
+        sampled_region_t *region = &session->regions[region_index];
+        record->region_name_id = region->name_id;
+        region->thread_count += 1;
+        for (uint32_t cluster = 0; cluster < cluster_count; cluster++) {
+            region->deltas[cluster].cycles += record->deltas[cluster].cycles;
+            region->deltas[cluster].instructions += record->deltas[cluster].instructions;
+            region->deltas[cluster].energy += record->deltas[cluster].energy;
+            region->deltas[cluster].time += record->deltas[cluster].time;
+        }
+    }
+}
+
+// MARK: - Legacy API
+
+sample_threads_result sample_threads(int pid, bool retrieve_dispatch_queue_names, bool retrieve_backtraces) {
+    // A session is kept alive between calls so platform-specific state (like the perf event
+    // file descriptors on Linux) is reused.
+    static sample_session_t *session = NULL;
+    if (session != NULL && session->pid != pid) {
+        sample_session_destroy(session);
+        session = NULL;
+    }
+    if (session == NULL) {
+        session = sample_session_create(pid);
+    }
+
+    sample_threads_result result;
+    result.thread_count = 0;
+    result.cpu_counters = NULL;
+    if (session == NULL) {
+        return result;
+    }
+
+    sample_session_result_t session_result = sample_session_sample_into(session,
+                                                                        retrieve_dispatch_queue_names,
+                                                                        retrieve_backtraces);
+    result.cpu_counters = malloc(sizeof(sampled_thread_info_w_backtrace_t) * session_result.thread_count);
+    if (result.cpu_counters == NULL) {
+        return result;
+    }
+    result.thread_count = session_result.thread_count;
+    for (uint64_t i = 0; i < session_result.thread_count; i++) {
+        const sampled_thread_record_t *record = &session_result.threads[i];
+        uint32_t length = 0;
+        const backtrace_address_t *addresses = stack_table_stack(session_result.stacks, record->stack_id, &length);
+        backtrace_t backtrace;
+        backtrace.length = length;
+        backtrace.addresses = NULL;
+        if (length != 0) {
+            backtrace.addresses = malloc(length * sizeof(backtrace_address_t));
+            if (backtrace.addresses != NULL) {
+                memcpy(backtrace.addresses, addresses, length * sizeof(backtrace_address_t));
+            } else {
+                backtrace.length = 0;
+            }
+        }
+        result.cpu_counters[i].info = record->info;
+        result.cpu_counters[i].backtrace = backtrace;
+    }
+    return result;
+}
@@ -0,0 +1,110 @@
+//
+//  sample_session_internal.h
+//
+
+#ifndef sample_session_internal_h
+#define sample_session_internal_h
+
+#include "sample_session.h"
+#include "thread_delta.h"
+#include "sampler_stats_internal.h"
+#include "region_markers_internal.h"
+#include "worker_pool.h"
+
+/// The counters of a worker of the session, on a cache line of its own.
+typedef struct {
+    _Alignas(64) sampler_thread_counters_t counters;
+} sample_worker_counters_t;
+
+struct sample_session {
+    /// PID of the sampled process.
+    int pid;
+    /// Slab of thread records, with room for `thread_capacity` records.
+    sampled_thread_record_t *threads;
+    uint32_t thread_count;
+    uint32_t thread_capacity;
+    /// Scratch space where backends write a backtrace before interning it, with room for
+    /// `frame_capacity` addresses.
+    backtrace_address_t *frames;
+    uint32_t frame_capacity;
+    /// The unique backtraces seen by the session.
+    stack_table_t *stacks;
+    /// The unique thread and dispatch queue names seen by the session.
+    name_table_t *names;
+    /// Incremented whenever the names cached by the backend must be read again. Backends
+    /// keep the generation each name was read at, and re-read it if it's not this one.
+    uint32_t name_generation;
+    /// Number of samples taken, used to refresh the cached names periodically.
+    uint64_t sample_count;
+    /// Whether the sampled process is the current process, whose region markers can be read.
+    bool is_current_process;
+    /// Scratch space where the region markers are read, with room for `marker_capacity`
+    /// markers, and the index in `regions` of each marker's region (`UINT32_MAX` until a
+    /// sampled thread is found in it).
+    region_marker_t *markers;
+    uint32_t *marker_regions;
+    uint32_t marker_capacity;
+    /// The regions of the current sample, with room for `region_capacity` regions.
+    sampled_region_t *regions;
+    uint32_t region_count;
+    uint32_t region_capacity;
+    /// The core clusters sampled by the backend.
+    core_topology_t topology;
+    /// Computes the counter deltas between samples.
+    thread_delta_engine_t *deltas;
+    /// Attributes the energy measured by the backend to the threads, if the backend doesn't
+    /// measure the energy of each thread.
+    energy_model_t energy_model;
+    /// The cost of sampling, which backends add their phases to.
+    sampler_stats_t *stats;
+    /// Time of the previous sample in nanoseconds, 0 if there's no previous sample.
+    uint64_t previous_sample_time_ns;
+    /// Samples the threads in parallel, `NULL` if the session samples on the calling thread.
+    worker_pool_t *pool;
+    /// The counters of each worker of `pool`, added to the calling thread's counters after
+    /// every batch, so the work of the pool's threads counts towards the sample.
+    sample_worker_counters_t *worker_counters;
+    /// Platform-specific state, owned by the backend.
+    void *backend;
+};
+
+/// Ensures there's room for at least `count` thread records in the session.
+bool sample_session_reserve_threads(sample_session_t *session, uint32_t count);
+
+/// Ensures there's room for at least `count` addresses in the session's scratch frame space.
+/// Its contents are only kept until the next call.
+/// - Returns: A pointer to the scratch space, or `NULL` if there's no room.
+backtrace_address_t *sample_session_reserve_frames(sample_session_t *session, uint32_t count);
+
+/// The number of workers `sample_session_for_each_thread` may run tasks on. Worker indices
+/// passed to tasks are always below this number.
+uint32_t sample_session_worker_count(const sample_session_t *session);
+
+/// Runs `task` for every index in `[0, count)`, sharded over the session's workers (or on
+/// the calling thread if it has none), returning once all of them finished.
+///
+/// Tasks must only write to memory of their own index or their own worker, and must not
+/// intern stacks or names nor record phases in the session's stats: those are done
+/// afterwards, on the calling thread. Allocations and syscalls are counted as usual.
+void sample_session_for_each_thread(sample_session_t *session, uint32_t count, worker_pool_task_t task, void *context);
+
+// MARK: - Backend
+
+// Each platform (sample_threads.c on Apple platforms, sample_threads_linux.c on Linux)
+// implements the functions below.
+
+/// Creates the platform-specific state of the session, storing it in `session->backend`,
+/// and fills `session->topology` with the clusters the backend can sample. The session's
+/// workers are already created.
+bool sample_backend_create(sample_session_t *session);
+
+/// Destroys the platform-specific state of the session.
+void sample_backend_destroy(sample_session_t *session);
+
+/// Fills the session's thread records, updating `thread_count` (0 on entry). Backtraces are
+/// written to the scratch frame space and interned in `session->stacks`. Thread names are
+/// interned in `session->names`, and only read again when `session->name_generation`
+/// changes.
+void sample_backend_sample(sample_session_t *session, bool retrieve_dispatch_queue_names, bool retrieve_backtraces);
+
+#endif /* sample_session_internal_h */
@@ -6,55 +6,343 @@
 //
 
 #include "sample_threads.h"
+
+#if defined(__APPLE__)
+#include "sample_session_internal.h"
+#include "sampler_stats_internal.h"
+#include "proc_threadcounts.h"
 #include "get_backtrace.h"
-#include <dispatch/dispatch.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mach/mach_init.h>
 #include <mach/mach_port.h>
 #include <mach/task_info.h>
 #include <mach/thread_act.h>
 #include <mach/vm_map.h>
+#include <mach/vm_page_size.h>
 #include <mach/task.h>
 #include <mach/mach_time.h>
 #include <stdio.h>
 
-// Technically private structs, from:
-// https://github.com/apple-oss-distributions/xnu/blob/aca3beaa3dfbd42498b42c5e5ce20a938e6554e5/bsd/sys/proc_info.h#L153
-struct proc_threadcounts_data {
-    uint64_t ptcd_instructions;
-    uint64_t ptcd_cycles;
-    uint64_t ptcd_user_time_mach;
-    uint64_t ptcd_system_time_mach;
-    uint64_t ptcd_energy_nj;
-};
-
-struct proc_threadcounts {
-    uint16_t ptc_len;
-    uint16_t ptc_reserved0;
-    uint32_t ptc_reserved1;
-    struct proc_threadcounts_data ptc_counts[20];
-};
-
-// PROC_PIDTHREADCOUNTS is also private, see:
-// https://github.com/apple-oss-distributions/xnu/blob/aca3beaa3dfbd42498b42c5e5ce20a938e6554e5/bsd/sys/proc_info.h#L927
-#define PROC_PIDTHREADCOUNTS 34
-
-// On macOS, proc_pidinfo is available as part of the libproc headers. On iOS, those
-// headers are not available.
-int proc_pidinfo(int pid, int flavor, uint64_t arg, void *buffer, int buffersize);
-
-// Convert mach_time (monotonous clock ticks) to seconds.
-static double convert_mach_time(uint64_t mach_time) {
-    static mach_timebase_info_data_t base = { .numer = 0 };
-    if (base.numer == 0) {
-        mach_timebase_info(&base);
-    }
-    double elapsed = (mach_time * base.numer) / base.denom;
-    return elapsed / 1e9;
+// MARK: - Name cache
+
+// Reading the name of a thread costs a thread_info call, so names are cached by Mach thread
+// ID and only read again when the session's name generation changes. Entries are kept in
+// an open-addressed (linear probing) table, which is rebuilt without the threads that
+// exited when it's more than half full.
+//
+// The dispatch queue a thread is running can change at any time, so the queue itself is
+// checked on every sample, but its label is only read when the queue is not the one the
+// thread was running in the previous sample.
+
+#define INITIAL_NAME_CACHE_CAPACITY 128
+
+// Technically private, from libdispatch's private/queue_private.h. libdispatch exports the
+// offsets of some fields of its queue objects for debuggers and crash reporters, which read
+// queues of other (or crashed) tasks without calling into libdispatch. New fields are only
+// ever added at the end, so only the ones used here are declared. Weakly imported, in case
+// a future libdispatch stops exporting it.
+extern const struct dispatch_queue_offsets_s {
+    const uint16_t dqo_version;
+    /// Offset of the queue's label pointer in the queue object.
+    const uint16_t dqo_label;
+    const uint16_t dqo_label_size;
+} dispatch_queue_offsets __attribute__((weak_import));
+
+typedef struct {
+    /// Mach thread ID, 0 if the entry is empty.
+    uint64_t thread_id;
+    /// The session's name generation when the pthread name was read.
+    uint32_t name_generation;
+    /// ID of the pthread name in the session's name table.
+    name_id_t pthread_name_id;
+    /// The dispatch queue the thread was running when its label was read, 0 if none.
+    uint64_t dispatch_queue;
+    /// ID of the label of `dispatch_queue` in the session's name table.
+    name_id_t dispatch_queue_name_id;
+    /// Number of the latest sample the thread was seen in.
+    uint64_t last_seen;
+} cached_thread_names_t;
+
+/// What the workers of the session read of a thread, before the calling thread reads its
+/// names and backtrace.
+typedef struct {
+    /// Result of the THREAD_IDENTIFIER_INFO call.
+    kern_return_t info_result;
+    /// Address of the thread's dispatch queue pointer, from THREAD_IDENTIFIER_INFO.
+    uint64_t dispatch_qaddr;
+} apple_thread_scan_t;
+
+typedef struct {
+    cached_thread_names_t *entries;
+    uint32_t capacity;
+    uint32_t count;
+    /// What was read of each thread in the current sample, with room for `scan_capacity`
+    /// threads.
+    apple_thread_scan_t *scans;
+    uint32_t scan_capacity;
+    /// Number of perf levels the counters of PROC_PIDTHREADCOUNTS are split by. May be more
+    /// than the session's clusters, in which case the extra levels go to the last cluster.
+    uint32_t perf_level_count;
+} apple_backend_t;
+
+/// The threads of the current sample, shared by the workers of the session.
+typedef struct {
+    sample_session_t *session;
+    thread_array_t threads;
+} apple_sample_t;
+
+static inline uint32_t thread_id_hash(uint64_t thread_id) {
+    // Finalizer of MurmurHash3, as thread IDs are sequential.
+    thread_id ^= thread_id >> 33;
+    thread_id *= 0xFF51AFD7ED558CCDull;
+    thread_id ^= thread_id >> 33;
+    return (uint32_t) thread_id;
 }
 
-sample_threads_result sample_threads(int pid, bool retrieve_dispatch_queue_names, bool retrieve_backtraces) {
+/// Rebuilds the cache with room for `live_count` more threads than the ones seen in the
+/// current or previous sample, dropping the rest.
+static bool rebuild_name_cache(apple_backend_t *backend, uint64_t sample_count) {
+    uint32_t live_count = 0;
+    for (uint32_t i = 0; i < backend->capacity; i++) {
+        const cached_thread_names_t *entry = &backend->entries[i];
+        live_count += entry->thread_id != 0 && entry->last_seen + 1 >= sample_count;
+    }
+    uint32_t new_capacity = backend->capacity == 0 ? INITIAL_NAME_CACHE_CAPACITY : backend->capacity;
+    while ((live_count + 1) * 2 > new_capacity) {
+        new_capacity *= 2;
+    }
+    cached_thread_names_t *new_entries = calloc(new_capacity, sizeof(cached_thread_names_t));
+    sampler_count_allocation();
+    if (new_entries == NULL) {
+        return false;
+    }
+    uint32_t mask = new_capacity - 1;
+    for (uint32_t i = 0; i < backend->capacity; i++) {
+        const cached_thread_names_t *entry = &backend->entries[i];
+        if (entry->thread_id == 0 || entry->last_seen + 1 < sample_count) {
+            continue;
+        }
+        uint32_t j = thread_id_hash(entry->thread_id) & mask;
+        while (new_entries[j].thread_id != 0) {
+            j = (j + 1) & mask;
+        }
+        new_entries[j] = *entry;
+    }
+    free(backend->entries);
+    backend->entries = new_entries;
+    backend->capacity = new_capacity;
+    backend->count = live_count;
+    return true;
+}
+
+/// Finds the cache entry of a thread, adding an empty entry if the thread is new.
+/// - Returns: The entry, or `NULL` if there was no memory to add it.
+static cached_thread_names_t *find_cached_names(apple_backend_t *backend, uint64_t thread_id, uint64_t sample_count) {
+    uint32_t mask = backend->capacity - 1;
+    uint32_t i = thread_id_hash(thread_id) & mask;
+    while (backend->entries[i].thread_id != 0) {
+        if (backend->entries[i].thread_id == thread_id) {
+            return &backend->entries[i];
+        }
+        i = (i + 1) & mask;
+    }
+    if ((backend->count + 1) * 2 > backend->capacity) {
+        if (!rebuild_name_cache(backend, sample_count)) {
+            return NULL;
+        }
+        mask = backend->capacity - 1;
+        i = thread_id_hash(thread_id) & mask;
+        while (backend->entries[i].thread_id != 0) {
+            i = (i + 1) & mask;
+        }
+    }
+    cached_thread_names_t *entry = &backend->entries[i];
+    memset(entry, 0, sizeof(cached_thread_names_t));
+    entry->thread_id = thread_id;
+    entry->pthread_name_id = NAME_ID_NONE;
+    entry->dispatch_queue_name_id = NAME_ID_NONE;
+    backend->count += 1;
+    return entry;
+}
+
+/// Copies memory of the task, failing instead of crashing if it's not mapped.
+static bool read_task_memory(mach_port_t task, uint64_t address, void *buffer, vm_size_t size) {
+    vm_size_t read_size = 0;
+    kern_return_t result = vm_read_overwrite(task,
+                                             (vm_address_t) address,
+                                             size,
+                                             (vm_address_t) buffer,
+                                             &read_size);
+    sampler_count_syscalls(1);
+    return result == KERN_SUCCESS && read_size == size;
+}
+
+/// Finds the label of the dispatch queue a thread is running.
+///
+/// `dispatch_qaddr` points to thread-specific data of libdispatch that can be freed or
+/// reused at any time (ie: when the thread finishes running the queue), and so can the queue
+/// itself, so neither can be dereferenced (nor passed to `dispatch_queue_get_label`). The
+/// queue pointer, the queue's label pointer (at the offset libdispatch exports in
+/// `dispatch_queue_offsets`) and the label are all copied with `vm_read_overwrite`, which
+/// fails instead of crashing if they're not mapped anymore.
+/// - Returns: The ID of the label in the session's name table, or `NAME_ID_NONE`.
+static name_id_t read_dispatch_queue_name(sample_session_t *session,
+                                          mach_port_t task,
+                                          uint64_t dispatch_qaddr,
+                                          cached_thread_names_t *entry) {
+    uint64_t queue = 0;
+    if (dispatch_qaddr == 0 || !read_task_memory(task, dispatch_qaddr, &queue, sizeof(queue)) || queue == 0) {
+        return NAME_ID_NONE;
+    }
+    if (queue == entry->dispatch_queue) {
+        return entry->dispatch_queue_name_id;
+    }
+    uint64_t address = 0;
+    if (&dispatch_queue_offsets == NULL
+        || dispatch_queue_offsets.dqo_label_size != sizeof(address)
+        || !read_task_memory(task, queue + dispatch_queue_offsets.dqo_label, &address, sizeof(address))
+        || address == 0) {
+        return NAME_ID_NONE;
+    }
+    // Labels are usually short, so only read up to the end of the label's page, in case
+    // the next page is not mapped.
+    char buffer[sizeof(((sampled_thread_info_t *) NULL)->dispatch_queue_name)];
+    vm_size_t size = vm_page_size - (vm_size_t) (address % vm_page_size);
+    if (size > sizeof(buffer) - 1) {
+        size = sizeof(buffer) - 1;
+    }
+    if (!read_task_memory(task, address, buffer, size)) {
+        return NAME_ID_NONE;
+    }
+    buffer[size] = '\0';
+    entry->dispatch_queue = queue;
+    entry->dispatch_queue_name_id = name_table_intern(session->names, buffer, size);
+    return entry->dispatch_queue_name_id;
+}
+
+// MARK: - Workers
+
+/// Reads the counters of a thread. These are the syscalls made for every thread on every
+/// sample, so threads are read in parallel by the session's workers, each one writing only
+/// to the thread's record and scan.
+///
+/// Backtraces are not retrieved here: unwinding suspends the thread, and a worker could
+/// suspend the calling thread (or another worker) while it holds a lock the worker then
+/// needs, ie: the dyld lock taken by `dladdr`. They are retrieved afterwards, one thread
+/// after another, from the calling thread.
+static void read_thread_task(void *context, uint32_t task_index, uint32_t worker_index) {
+    (void) worker_index;
+    apple_sample_t *sample = context;
+    sample_session_t *session = sample->session;
+    apple_backend_t *backend = session->backend;
+    thread_t thread = sample->threads[task_index];
+    sampled_thread_record_t *record = &session->threads[task_index];
+    apple_thread_scan_t *scan = &backend->scans[task_index];
+    
+    // We use thread_info to retrieve the Mach thread id of the thread we want to
+    // retrieve power counters from.
+    struct thread_identifier_info th_info;
+    mach_msg_type_number_t th_info_count = THREAD_IDENTIFIER_INFO_COUNT;
+    scan->info_result = thread_info(thread,
+                                    THREAD_IDENTIFIER_INFO,
+                                    (thread_info_t)&th_info,
+                                    &th_info_count);
+    sampler_count_syscalls(1);
+    
+    // As before, we expect thread_info to succeed as the thread being inspected
+    // has the same parent process.
+    if (scan->info_result != KERN_SUCCESS) {
+        memset(&th_info, 0, sizeof(th_info));
+    }
+    record->info.thread_id = th_info.thread_id;
+    scan->dispatch_qaddr = th_info.dispatch_qaddr;
+    
+    // Retrieve power counters info
+    
+    struct proc_threadcounts current_counters;
+    
+    // This flavor of proc_pidinfo using PROC_PIDTHREADCOUNTS is technically private, see:
+    // https://github.com/apple-oss-distributions/xnu/blob/aca3beaa3dfbd42498b42c5e5ce20a938e6554e5/bsd/sys/proc_info.h#L898
+    // Reproduced below in case link is not available in the future:
+    //
+    // PROC_PIDTHREADCOUNTS returns a list of counters for the given thread,
+    // separated out by the "perf-level" it was running on (typically either
+    // "performance" or "efficiency").
+    //
+    // This interface works a bit differently from the other proc_info(3) flavors.
+    // It copies out a structure with a variable-length array at the end of it.
+    // The start of the `proc_threadcounts` structure contains a header indicating
+    // the length of the subsequent array of `proc_threadcounts_data` elements.
+    //
+    // To use this interface, first read the `hw.nperflevels` sysctl to find out how
+    // large to make the allocation that receives the counter data:
+    //
+    //     sizeof(proc_threadcounts) + nperflevels * sizeof(proc_threadcounts_data)
+    //
+    // Use the `hw.perflevel[0-9].name` sysctl to find out which perf-level maps to
+    // each entry in the array.
+    //
+    // The complete usage would be (omitting error reporting):
+    //
+    //     uint32_t len = 0;
+    //     int ret = sysctlbyname("hw.nperflevels", &len, &len_sz, NULL, 0);
+    //     size_t size = sizeof(struct proc_threadcounts) +
+    //             len * sizeof(struct proc_threadcounts_data);
+    //     struct proc_threadcounts *counts = malloc(size);
+    //     // Fill this in with a thread ID, like from `PROC_PIDLISTTHREADS`.
+    //     uint64_t tid = 0;
+    //     int size_copied = proc_info(getpid(), PROC_PIDTHREADCOUNTS, tid, counts,
+    //             size);
+    proc_pidinfo(session->pid, // pid of the process
+                 PROC_PIDTHREADCOUNTS, // The proc_pidinfo "flavor": different flavors have different return structures.
+                 th_info.thread_id, // The mach thread id of the thread we're retrieving the counters from.
+                 &current_counters, // The address of the result structure.
+                 sizeof(struct proc_threadcounts)); // The size of the result structure.
+    sampler_count_syscalls(1);
+    
+    // Thread counters when running on each perf level, from the fastest (Performance)
+    // to the most efficient cores.
+    memset(record->info.clusters, 0, sizeof(record->info.clusters));
+    for (uint32_t level = 0; level < backend->perf_level_count; level++) {
+        const struct proc_threadcounts_data *data = &current_counters.ptc_counts[level];
+        uint32_t cluster = level < SAMPLE_MAX_CLUSTERS ? level : SAMPLE_MAX_CLUSTERS - 1;
+        cpu_counters_t *counters = &record->info.clusters[cluster];
+        counters->cycles += data->ptcd_cycles;
+        counters->instructions += data->ptcd_instructions;
+        counters->energy += data->ptcd_energy_nj / 1e9;
+        counters->time += convert_mach_time(data->ptcd_user_time_mach + data->ptcd_system_time_mach);
+    }
+}
+
+// MARK: - Backend
+
+bool sample_backend_create(sample_session_t *session) {
+    // Only thread names are kept between samples: task_threads is cheap enough to call every
+    // time.
+    apple_backend_t *backend = calloc(1, sizeof(apple_backend_t));
+    if (backend == NULL || !rebuild_name_cache(backend, 0)) {
+        free(backend);
+        return false;
+    }
+    session->backend = backend;
+    // PROC_PIDTHREADCOUNTS splits the counters by perf level, which are the clusters.
+    core_topology_discover(&session->topology);
+    backend->perf_level_count = proc_threadcounts_level_count();
+    return true;
+}
+
+void sample_backend_destroy(sample_session_t *session) {
+    apple_backend_t *backend = session->backend;
+    free(backend->entries);
+    free(backend->scans);
+    free(backend);
+}
+
+void sample_backend_sample(sample_session_t *session, bool retrieve_dispatch_queue_names, bool retrieve_backtraces) {
  
+    sampler_stats_t *stats = session->stats;
+    apple_backend_t *backend = session->backend;
     mach_port_t me = mach_task_self();
     kern_return_t res;
     thread_array_t threads;
@@ -67,140 +355,138 @@ sample_threads_result sample_threads(int pid, bool retrieve_dispatch_queue_names
     // task_threads(me, &threads, &n_threads) retrieves all the threads for the current
     // process.
     //
-    // TODO/Note: I believe that with very few extra steps just before this code (using
-    // proc_listpids to get the pids of all running processes on the system and using
-    // task_for_pid to get the task from the pid), one could easily build macOS's
-    // powermetrics utility.
-    // Of course, the same limitations would apply (needing to run as root) as both
-    // proc_listpids and task_for_pid return KERN_FAILURE if not running as root.
+    // Note: sampling all the processes of the system, like macOS's powermetrics utility,
+    // is done by system_sampler_t instead (see system_sampler.h), which only needs
+    // proc_listallpids and proc_pidinfo. The same limitations apply: it needs to run as root
+    // to read the counters of other users' processes.
+    uint64_t phase_start_ns = sampler_now_ns();
     res = task_threads(me, &threads, &n_threads);
+    sampler_count_syscalls(1);
+    phase_start_ns = sampler_stats_lap(stats, SAMPLER_PHASE_ENUMERATE_THREADS, phase_start_ns);
     if (res != KERN_SUCCESS) {
         // TODO: Handle error...
+        return;
+    }
+    
+    // The thread records are written directly into the session's slab, which only grows
+    // if the process has more threads than ever before.
+    if (!sample_session_reserve_threads(session, n_threads)) {
+        for (int i = 0; i < n_threads; i++) {
+            mach_port_deallocate(me, threads[i]);
+        }
+        vm_deallocate(me, (vm_address_t) threads, n_threads * sizeof(thread_t));
+        sampler_count_syscalls(n_threads + 1);
+        return;
+    }
+    
+    // Each thread's scan is reused between samples, and only grows along with the number of
+    // threads.
+    if (backend->scan_capacity < n_threads) {
+        apple_thread_scan_t *new_scans = realloc(backend->scans, n_threads * sizeof(apple_thread_scan_t));
+        sampler_count_allocation();
+        if (new_scans == NULL) {
+            for (int i = 0; i < n_threads; i++) {
+                mach_port_deallocate(me, threads[i]);
+            }
+            vm_deallocate(me, (vm_address_t) threads, n_threads * sizeof(thread_t));
+            sampler_count_syscalls(n_threads + 1);
+            return;
+        }
+        backend->scans = new_scans;
+        backend->scan_capacity = n_threads;
+    }
+    apple_sample_t sample = {
+        .session = session,
+        .threads = threads
+    };
+    backtrace_address_t *frames = NULL;
+    if (retrieve_backtraces) {
+        frames = sample_session_reserve_frames(session, MAX_FRAME_DEPTH);
     }
     
-    sampled_thread_info_w_backtrace_t *counters_array = malloc(sizeof(sampled_thread_info_w_backtrace_t) * n_threads);
+    // Read the counters of all the threads of the current process, in parallel if the
+    // session has workers.
+    sample_session_for_each_thread(session, n_threads, read_thread_task, &sample);
+    phase_start_ns = sampler_stats_lap(stats, SAMPLER_PHASE_READ_COUNTERS, phase_start_ns);
     
-    // Loop over all the threads of the current process.
+    // Names and backtraces are read from the calling thread, and interned in the session's
+    // tables, which are only written from the calling thread.
     for (int i = 0; i < n_threads; i++) {
-        struct thread_identifier_info th_info;
-        mach_msg_type_number_t th_info_count = THREAD_IDENTIFIER_INFO_COUNT;
         thread_t thread = threads[i];
+        sampled_thread_record_t *record = &session->threads[i];
+        const apple_thread_scan_t *scan = &backend->scans[i];
         
-        // We use thread_info to retrieve the Mach thread id of the thread we want to
-        // retrieve power counters from.
-        kern_return_t info_result = thread_info(thread,
-                                                THREAD_IDENTIFIER_INFO,
-                                                (thread_info_t)&th_info,
-                                                &th_info_count);
-        
-        // As before, we expect thread_info to succeed as the thread being inspected
-        // has the same parent process.
-        if (info_result != KERN_SUCCESS) {
-            // TODO: Handle error...
-        }
-        
-        counters_array[i].info.thread_id = th_info.thread_id;
-        
-        // Attempt to retrieve the thread name
-        struct thread_extended_info th_extended_info;
-        mach_msg_type_number_t th_extended_info_count = THREAD_EXTENDED_INFO_COUNT;
-        kern_return_t extended_info_result = thread_info(thread,
-                                                         THREAD_EXTENDED_INFO,
-                                                         (thread_info_t)&th_extended_info,
-                                                         &th_extended_info_count);
-        if (extended_info_result == KERN_SUCCESS) {
-            strcpy(counters_array[i].info.pthread_name, th_extended_info.pth_name);
-        } else {
-            strcpy(counters_array[i].info.pthread_name, "");
+        record->pthread_name_id = NAME_ID_NONE;
+        record->dispatch_queue_name_id = NAME_ID_NONE;
+        cached_thread_names_t *names = NULL;
+        if (scan->info_result == KERN_SUCCESS) {
+            names = find_cached_names(backend, record->info.thread_id, session->sample_count);
         }
         
-        // Attempt to retrieve the libdispatch queue
-        if (retrieve_dispatch_queue_names) {
-            struct thread_identifier_info th_id_info;
-            mach_msg_type_number_t th_id_count = THREAD_IDENTIFIER_INFO_COUNT;
-            kern_return_t id_info_result = thread_info(thread,
-                                                       THREAD_IDENTIFIER_INFO,
-                                                       (thread_info_t)&th_id_info,
-                                                       &th_id_count);
-            
-            dispatch_queue_t * _Nullable thread_queue = (dispatch_queue_t *) th_id_info.dispatch_qaddr;
-            if (id_info_result == KERN_SUCCESS && thread_queue != NULL) {
-                // TODO: This crashes sometimes, need to investigate why
-                const char  * _Nullable queue_label = dispatch_queue_get_label(*thread_queue);
-                strcpy(counters_array[i].info.dispatch_queue_name, queue_label);
-            } else {
-                strcpy(counters_array[i].info.dispatch_queue_name, "");
+        // Attempt to retrieve the thread name, if it's not cached already
+        if (names != NULL && names->name_generation != session->name_generation) {
+            struct thread_extended_info th_extended_info;
+            mach_msg_type_number_t th_extended_info_count = THREAD_EXTENDED_INFO_COUNT;
+            kern_return_t extended_info_result = thread_info(thread,
+                                                             THREAD_EXTENDED_INFO,
+                                                             (thread_info_t)&th_extended_info,
+                                                             &th_extended_info_count);
+            sampler_count_syscalls(1);
+            // The cached ID may belong to a name table that was reset since.
+            names->pthread_name_id = NAME_ID_NONE;
+            if (extended_info_result == KERN_SUCCESS) {
+                names->pthread_name_id = name_table_intern(session->names,
+                                                           th_extended_info.pth_name,
+                                                           sizeof(th_extended_info.pth_name));
             }
+            names->name_generation = session->name_generation;
+            // Also forget the label of the dispatch queue, in case the queue was replaced by
+            // another one at the same address.
+            names->dispatch_queue = 0;
         }
+        if (names != NULL) {
+            names->last_seen = session->sample_count;
+            record->pthread_name_id = names->pthread_name_id;
+        }
+        strlcpy(record->info.pthread_name,
+                name_table_name(session->names, record->pthread_name_id),
+                sizeof(record->info.pthread_name));
         
-        // Retrieve power counters info
-        
-        struct proc_threadcounts current_counters;
-        
-        // This flavor of proc_pidinfo using PROC_PIDTHREADCOUNTS is technically private, see:
-        // https://github.com/apple-oss-distributions/xnu/blob/aca3beaa3dfbd42498b42c5e5ce20a938e6554e5/bsd/sys/proc_info.h#L898
-        // Reproduced below in case link is not available in the future:
-        //
-        // PROC_PIDTHREADCOUNTS returns a list of counters for the given thread,
-        // separated out by the "perf-level" it was running on (typically either
-        // "performance" or "efficiency").
-        //
-        // This interface works a bit differently from the other proc_info(3) flavors.
-        // It copies out a structure with a variable-length array at the end of it.
-        // The start of the `proc_threadcounts` structure contains a header indicating
-        // the length of the subsequent array of `proc_threadcounts_data` elements.
-        //
-        // To use this interface, first read the `hw.nperflevels` sysctl to find out how
-        // large to make the allocation that receives the counter data:
-        //
-        //     sizeof(proc_threadcounts) + nperflevels * sizeof(proc_threadcounts_data)
-        //
-        // Use the `hw.perflevel[0-9].name` sysctl to find out which perf-level maps to
-        // each entry in the array.
-        //
-        // The complete usage would be (omitting error reporting):
-        //
-        //     uint32_t len = 0;
-        //     int ret = sysctlbyname("hw.nperflevels", &len, &len_sz, NULL, 0);
-        //     size_t size = sizeof(struct proc_threadcounts) +
-        //             len * sizeof(struct proc_threadcounts_data);
-        //     struct proc_threadcounts *counts = malloc(size);
-        //     // Fill this in with a thread ID, like from `PROC_PIDLISTTHREADS`.
-        //     uint64_t tid = 0;
-        //     int size_copied = proc_info(getpid(), PROC_PIDTHREADCOUNTS, tid, counts,
-        //             size);
-        proc_pidinfo(pid, // pid of the process
-                     PROC_PIDTHREADCOUNTS, // The proc_pidinfo "flavor": different flavors have different return structures.
-                     th_info.thread_id, // The mach thread id of the thread we're retrieving the counters from.
-                     &current_counters, // The address of the result structure.
-                     sizeof(struct proc_threadcounts)); // The size of the result structure.
-        
-        // Thread counters when running on Performance cores
-        uint64_t p_cycles = current_counters.ptc_counts[0].ptcd_cycles;
-        double p_energy = current_counters.ptc_counts[0].ptcd_energy_nj / 1e9;
-        double p_time = convert_mach_time(current_counters.ptc_counts[0].ptcd_user_time_mach + current_counters.ptc_counts[0].ptcd_system_time_mach);
-        
-        // Thread counters when running on Efficiency cores
-        uint64_t e_cycles = current_counters.ptc_counts[1].ptcd_cycles;
-        double e_energy = current_counters.ptc_counts[1].ptcd_energy_nj / 1e9;
-        double e_time = convert_mach_time(current_counters.ptc_counts[1].ptcd_user_time_mach + current_counters.ptc_counts[1].ptcd_system_time_mach);
-        
-        counters_array[i].info.performance.cycles = p_cycles;
-        counters_array[i].info.performance.energy = p_energy;
-        counters_array[i].info.performance.time = p_time;
-        
-        counters_array[i].info.efficiency.cycles = e_cycles;
-        counters_array[i].info.efficiency.energy = e_energy;
-        counters_array[i].info.efficiency.time = e_time;
+        // Attempt to retrieve the libdispatch queue, which is found through the thread
+        // identifier info retrieved above.
+        if (retrieve_dispatch_queue_names && names != NULL) {
+            record->dispatch_queue_name_id = read_dispatch_queue_name(session, me, scan->dispatch_qaddr, names);
+        }
+        // The record slab is reused between samples, so this also clears any stale name.
+        strlcpy(record->info.dispatch_queue_name,
+                name_table_name(session->names, record->dispatch_queue_name_id),
+                sizeof(record->info.dispatch_queue_name));
+        phase_start_ns = sampler_stats_lap(stats, SAMPLER_PHASE_READ_NAMES, phase_start_ns);
         
-        // Backtrace
-        if (retrieve_backtraces) {
-            counters_array[i].backtrace = get_backtrace(thread);
+        // Only stacks that weren't seen before are stored. The pool's threads are not
+        // unwound, as they're not doing any of the process's work (see
+        // sample_session_config_t). The calling thread unwinds itself without suspending.
+        record->stack_id = STACK_ID_NONE;
+        if (frames != NULL
+            && (session->pool == NULL || !worker_pool_owns_thread(session->pool, pthread_from_mach_thread_np(thread)))) {
+            uint64_t backtrace_start_ns = sampler_now_ns();
+            int frame_count = get_backtrace_into(thread, frames, MAX_FRAME_DEPTH);
+            sampler_stats_record_phase(stats, SAMPLER_PHASE_THREAD_BACKTRACE, sampler_now_ns() - backtrace_start_ns);
+            record->stack_id = stack_table_intern(session->stacks, frames, frame_count);
+            phase_start_ns = sampler_stats_lap(stats, SAMPLER_PHASE_BACKTRACES, phase_start_ns);
         }
+        
+        // task_threads returns a send right for each thread, which must be released.
+        mach_port_deallocate(me, thread);
+        sampler_count_syscalls(1);
+        phase_start_ns = sampler_stats_lap(stats, SAMPLER_PHASE_ENUMERATE_THREADS, phase_start_ns);
     }
     
-    sample_threads_result result;
-    result.thread_count = n_threads;
-    result.cpu_counters = counters_array;
-    return result;
+    // The thread list itself is allocated by the kernel in our address space.
+    vm_deallocate(me, (vm_address_t) threads, n_threads * sizeof(thread_t));
+    sampler_count_syscalls(1);
+    sampler_stats_lap(stats, SAMPLER_PHASE_ENUMERATE_THREADS, phase_start_ns);
+    session->thread_count = n_threads;
 }
+
+#endif /* defined(__APPLE__) */
@@ -0,0 +1,764 @@
+//
+//  sample_threads_linux.c
+//
+
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include "sample_threads.h"
+#include "sample_session_internal.h"
+#include "linux_procfs.h"
+#include "linux_rapl.h"
+#include "energy_model.h"
+#include "get_cpu_usage.h"
+#include "sampler_stats_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Linux has no equivalent to the CLPC per-thread counters returned by proc_pidinfo, so
+// this backend builds them from three different sources:
+//
+// - Cycles and instructions come from perf_event_open. Each thread gets a counter group
+//   (cycles as the leader, instructions as a member) that is opened once, when the thread
+//   is first seen, and read in a single read() call per sample using PERF_FORMAT_GROUP.
+// - CPU time comes from /proc/<pid>/task/<tid>/schedstat, which is kept open and re-read
+//   with pread().
+// - Energy comes from the RAPL package and DRAM domains exposed by the powercap sysfs
+//   interface. RAPL only reports package-wide energy, used by every process of the system,
+//   so the process is first charged its share of it: the fraction of the busy time of all
+//   the cores (from /proc/stat) that was spent running its threads. That energy is then
+//   attributed to the threads with the session's energy model (see energy_model.h). By
+//   default, a linear model of the cycles and instructions of each cluster, fitted online to
+//   the process's energy, predicts the energy of each thread on each cluster. Until the
+//   model is fitted, the process's energy is apportioned by cycles (or by CPU time, if perf
+//   events are not available).
+//
+// If perf events are not allowed (ie: kernel.perf_event_paranoid is too restrictive, or
+// the machine has no PMU, like most VMs), the backend degrades to time-only counters:
+// cycles and instructions are reported as 0 and energy is apportioned by CPU time.
+//
+// On hybrid and big.LITTLE systems, counters are broken down by core cluster (see
+// core_topology.h): each thread gets a counter group per cluster, bound to the cluster's
+// PMU through the extended hardware event type (PERF_PMU_TYPE_SHIFT, Linux 5.13+). An
+// event of a PMU only runs while the thread is on one of the PMU's CPUs, so the group's
+// time_running is the time the thread spent on that cluster. If the events can't be bound
+// to clusters (perf events are not available, the kernel is too old, or some cluster has no
+// PMU of its own), all counters are reported as a single cluster.
+//
+// Backtraces can only be retrieved when sampling the calling process: each thread unwinds
+// its own stack from a signal handler (see get_backtrace_linux.c).
+//
+// The state below is owned by each sample_session_t and persists between samples.
+
+#ifndef PERF_PMU_TYPE_SHIFT
+#define PERF_PMU_TYPE_SHIFT 32
+#endif
+
+// Size of the buffer used to read the /proc/<pid>/task directory entries.
+#define TASK_DIR_BUFFER_SIZE 32768
+
+// Layout of the data returned by read() on a perf event group leader, using
+// PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING.
+struct perf_group_read_format {
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    uint64_t values[2];
+};
+
+typedef struct {
+    /// Linux thread ID.
+    pid_t tid;
+    /// File descriptors of the perf event group leaders (cycles) of each cluster, -1 if not
+    /// available.
+    int perf_fds[SAMPLE_MAX_CLUSTERS];
+    /// File descriptors of the instructions counters of each cluster, -1 if not available.
+    int instructions_fds[SAMPLE_MAX_CLUSTERS];
+    /// File descriptor for /proc/<pid>/task/<tid>/schedstat.
+    int schedstat_fd;
+    /// Whether the thread was found in the latest enumeration of the task directory.
+    bool alive;
+    /// Name of the thread, retrieved from /proc/<pid>/task/<tid>/comm the first time the
+    /// thread is sampled, and again whenever the session's name generation changes.
+    char name[64];
+    /// ID of `name` in the session's name table.
+    name_id_t name_id;
+    /// The session's name generation when `name` was read, 0 if it wasn't read yet.
+    uint32_t name_generation;
+    /// Latest cycles counter value of each cluster.
+    uint64_t cycles[SAMPLE_MAX_CLUSTERS];
+    /// Latest instructions counter value of each cluster.
+    uint64_t instructions[SAMPLE_MAX_CLUSTERS];
+    /// Latest time spent on each cluster in nanoseconds, if the events are bound to clusters.
+    uint64_t cluster_time_ns[SAMPLE_MAX_CLUSTERS];
+    /// Latest CPU time in nanoseconds.
+    uint64_t time_ns;
+    /// Cycles counter value of each cluster at the previous sample.
+    uint64_t previous_cycles[SAMPLE_MAX_CLUSTERS];
+    /// Instructions counter value of each cluster at the previous sample.
+    uint64_t previous_instructions[SAMPLE_MAX_CLUSTERS];
+    /// CPU time at the previous sample, in nanoseconds.
+    uint64_t previous_time_ns;
+    /// Whether the counters were read in a previous sample. Until then, the previous values
+    /// are unknown and are taken from the first read, so a new thread's first delta is 0
+    /// instead of its whole lifetime.
+    bool counters_read;
+    /// Energy attributed to the thread on each cluster since it was first seen, J.
+    double energy[SAMPLE_MAX_CLUSTERS];
+    /// Bounds of the thread's stack, found the first time its backtrace is retrieved.
+    uint64_t stack_low;
+    uint64_t stack_high;
+} linux_thread_t;
+
+/// The sums of the counter deltas of the threads read by a worker of the session, on a cache
+/// line of its own.
+typedef struct {
+    _Alignas(64) cpu_counters_t totals[SAMPLE_MAX_CLUSTERS];
+    /// Sum of the energy model's estimates of the threads.
+    double estimate;
+    /// Sum of the CPU time of the threads, in nanoseconds.
+    uint64_t time_ns;
+} linux_worker_totals_t;
+
+typedef struct {
+    /// File descriptor for /proc/<pid>/task.
+    int task_dir_fd;
+    /// Tracked threads, sorted by thread ID.
+    linux_thread_t *threads;
+    int thread_count;
+    int thread_capacity;
+    /// Set when perf_event_open fails with an error that will affect all threads.
+    bool perf_unavailable;
+    /// Number of clusters sampled, as in the session's topology.
+    uint32_t cluster_count;
+    /// Whether each cluster has its own events, bound to the PMU in `pmu_types`.
+    bool per_cluster_events;
+    uint32_t pmu_types[SAMPLE_MAX_CLUSTERS];
+    /// Whether the sampled process is the calling process, so backtraces can be retrieved.
+    bool is_current_process;
+    /// Backtrace requests for all the threads, with room for `thread_capacity` requests.
+    backtrace_request_t *backtrace_requests;
+    int backtrace_request_capacity;
+    /// RAPL energy counters.
+    rapl_reader_t rapl;
+    /// Splits the energy measured by RAPL between the threads. Owned by the session.
+    energy_model_t *energy_model;
+    /// Reads the busy time of every core, to find the process's share of the energy measured
+    /// by RAPL. `NULL` if /proc/stat can't be read, then the process is charged all of it.
+    cpu_usage_reader_t *cpu_usage;
+    /// Ticks of each core at the previous read of `cpu_usage`, and their deltas since then.
+    core_usage_t *core_usage_totals;
+    core_usage_t *core_usage_deltas;
+    int core_count;
+    /// Length of a tick of /proc/stat, in nanoseconds.
+    double tick_ns;
+    /// Time of the previous RAPL read, 0 before the first sample.
+    uint64_t previous_energy_time_ns;
+    /// The sums of the counters read by each worker of the session.
+    linux_worker_totals_t *worker_totals;
+    uint32_t worker_count;
+    /// Buffer used to read the entries of the task directory. The records returned by
+    /// getdents64 are 8-byte aligned relative to the start of the buffer.
+    _Alignas(8) char task_dir_buffer[TASK_DIR_BUFFER_SIZE];
+} linux_backend_t;
+
+// MARK: - Perf events
+
+static int perf_event_open(struct perf_event_attr *attr, pid_t tid, int group_fd) {
+    return (int) syscall(SYS_perf_event_open, attr, tid, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+/// Opens a hardware counter of a thread. With `pmu_type` other than 0, the counter is bound
+/// to that PMU, and only counts while the thread runs on its CPUs.
+static int open_hardware_counter(pid_t tid, uint64_t config, uint32_t pmu_type, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config | ((uint64_t) pmu_type << PERF_PMU_TYPE_SHIFT);
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // Counting user space only is allowed with kernel.perf_event_paranoid <= 2, which is
+    // the default on most distributions.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return perf_event_open(&attr, tid, group_fd);
+}
+
+/// The PMU type to bind the counters of a cluster to, or 0 if they are not bound.
+static inline uint32_t cluster_pmu_type(const linux_backend_t *backend, uint32_t cluster) {
+    return backend->per_cluster_events ? backend->pmu_types[cluster] : 0;
+}
+
+static void open_perf_counters(linux_backend_t *backend, linux_thread_t *thread) {
+    for (uint32_t cluster = 0; cluster < SAMPLE_MAX_CLUSTERS; cluster++) {
+        thread->perf_fds[cluster] = -1;
+        thread->instructions_fds[cluster] = -1;
+    }
+    for (uint32_t cluster = 0; cluster < backend->cluster_count && !backend->perf_unavailable; cluster++) {
+        uint32_t pmu_type = cluster_pmu_type(backend, cluster);
+        int perf_fd = open_hardware_counter(thread->tid, PERF_COUNT_HW_CPU_CYCLES, pmu_type, -1);
+        sampler_count_syscalls(1);
+        if (perf_fd < 0) {
+            if (errno == EACCES || errno == EPERM || errno == ENOENT || errno == ENODEV || errno == EOPNOTSUPP) {
+                // Not a per-thread error: perf events are forbidden or there's no PMU. Stop
+                // trying for the rest of the threads.
+                backend->perf_unavailable = true;
+            }
+            return;
+        }
+        thread->perf_fds[cluster] = perf_fd;
+        thread->instructions_fds[cluster] = open_hardware_counter(thread->tid, PERF_COUNT_HW_INSTRUCTIONS, pmu_type, perf_fd);
+        sampler_count_syscalls(1);
+    }
+}
+
+static void read_perf_counters(const linux_backend_t *backend, linux_thread_t *thread) {
+    for (uint32_t cluster = 0; cluster < backend->cluster_count; cluster++) {
+        if (thread->perf_fds[cluster] < 0) {
+            continue;
+        }
+        sampler_count_syscalls(1);
+        struct perf_group_read_format group;
+        if (read(thread->perf_fds[cluster], &group, sizeof(group)) < (ssize_t) (3 * sizeof(uint64_t))) {
+            continue;
+        }
+        // Scale the counters if the PMU was multiplexed between several event groups. Events
+        // bound to a cluster are also not running while the thread is on other clusters, so
+        // the difference between the enabled and running times can't be told apart from
+        // multiplexing: they are never scaled.
+        double scale = 1.0;
+        if (!backend->per_cluster_events && group.time_running != 0 && group.time_running < group.time_enabled) {
+            scale = (double) group.time_enabled / (double) group.time_running;
+        }
+        if (group.nr >= 1) {
+            thread->cycles[cluster] = (uint64_t) (group.values[0] * scale);
+        }
+        if (group.nr >= 2) {
+            thread->instructions[cluster] = (uint64_t) (group.values[1] * scale);
+        }
+        thread->cluster_time_ns[cluster] = group.time_running;
+    }
+}
+
+/// Chooses the clusters the backend samples: the system's clusters if counters can be bound
+/// to each of them, or a single cluster with all the cores otherwise.
+static void configure_clusters(linux_backend_t *backend, core_topology_t *topology) {
+    core_topology_discover(topology);
+    bool bindable = topology->cluster_count > 1;
+    for (uint32_t cluster = 0; cluster < topology->cluster_count; cluster++) {
+        bindable = bindable && topology->clusters[cluster].has_pmu;
+        backend->pmu_types[cluster] = topology->clusters[cluster].pmu_type;
+    }
+    if (bindable) {
+        // Probe the extended event type on the calling thread, as it's rejected by kernels
+        // older than 5.13 (or by ARM kernels that don't support it yet).
+        int probe_fd = open_hardware_counter(0, PERF_COUNT_HW_CPU_CYCLES, backend->pmu_types[0], -1);
+        sampler_count_syscalls(1);
+        bindable = probe_fd >= 0;
+        if (probe_fd >= 0) {
+            close(probe_fd);
+            sampler_count_syscalls(1);
+        }
+    }
+    if (!bindable && topology->cluster_count > 1) {
+        core_cluster_t merged = topology->clusters[0];
+        for (uint32_t cluster = 1; cluster < topology->cluster_count; cluster++) {
+            merged.cpu_count += topology->clusters[cluster].cpu_count;
+        }
+        snprintf(merged.name, sizeof(merged.name), "cpu");
+        merged.has_pmu = false;
+        merged.pmu_type = 0;
+        memset(topology, 0, sizeof(core_topology_t));
+        topology->cluster_count = 1;
+        topology->clusters[0] = merged;
+    }
+    backend->cluster_count = topology->cluster_count;
+    backend->per_cluster_events = bindable;
+}
+
+// MARK: - Threads
+
+static void close_thread(linux_thread_t *thread) {
+    for (uint32_t cluster = 0; cluster < SAMPLE_MAX_CLUSTERS; cluster++) {
+        if (thread->instructions_fds[cluster] >= 0) {
+            close(thread->instructions_fds[cluster]);
+            sampler_count_syscalls(1);
+        }
+        if (thread->perf_fds[cluster] >= 0) {
+            close(thread->perf_fds[cluster]);
+            sampler_count_syscalls(1);
+        }
+    }
+    if (thread->schedstat_fd >= 0) {
+        close(thread->schedstat_fd);
+        sampler_count_syscalls(1);
+    }
+}
+
+/// Returns the index of the thread with the given ID, or the index where it should be
+/// inserted (as a negative number, minus one) if it's not tracked yet.
+static int find_thread(linux_backend_t *backend, pid_t tid) {
+    int low = 0;
+    int high = backend->thread_count - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        pid_t middle_tid = backend->threads[middle].tid;
+        if (middle_tid == tid) {
+            return middle;
+        } else if (middle_tid < tid) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -(low + 1);
+}
+
+static void track_thread(linux_backend_t *backend, pid_t tid) {
+    int index = find_thread(backend, tid);
+    if (index >= 0) {
+        backend->threads[index].alive = true;
+        return;
+    }
+    index = -(index + 1);
+
+    if (backend->thread_count == backend->thread_capacity) {
+        int new_capacity = backend->thread_capacity == 0 ? 64 : backend->thread_capacity * 2;
+        linux_thread_t *new_threads = realloc(backend->threads, new_capacity * sizeof(linux_thread_t));
+        sampler_count_allocation();
+        if (new_threads == NULL) {
+            return;
+        }
+        backend->threads = new_threads;
+        backend->thread_capacity = new_capacity;
+    }
+    memmove(&backend->threads[index + 1],
+            &backend->threads[index],
+            (backend->thread_count - index) * sizeof(linux_thread_t));
+    backend->thread_count += 1;
+
+    linux_thread_t *thread = &backend->threads[index];
+    memset(thread, 0, sizeof(linux_thread_t));
+    thread->tid = tid;
+    thread->alive = true;
+
+    char path[64];
+    snprintf(path, sizeof(path), "%d/schedstat", tid);
+    thread->schedstat_fd = openat(backend->task_dir_fd, path, O_RDONLY | O_CLOEXEC);
+    sampler_count_syscalls(1);
+
+    open_perf_counters(backend, thread);
+}
+
+static void read_thread_name(linux_backend_t *backend, linux_thread_t *thread, name_table_t *names) {
+    char path[64];
+    snprintf(path, sizeof(path), "%d/comm", thread->tid);
+    int comm_fd = openat(backend->task_dir_fd, path, O_RDONLY | O_CLOEXEC);
+    sampler_count_syscalls(1);
+    if (comm_fd >= 0) {
+        if (read_file_at(comm_fd, thread->name, sizeof(thread->name))) {
+            thread->name[strcspn(thread->name, "\n")] = '\0';
+        }
+        close(comm_fd);
+        sampler_count_syscalls(2);
+    }
+    thread->name_id = name_table_intern(names, thread->name, sizeof(thread->name));
+}
+
+/// Re-reads the task directory, tracking new threads and dropping the ones that exited.
+static void enumerate_threads(linux_backend_t *backend) {
+    char *buffer = backend->task_dir_buffer;
+
+    for (int i = 0; i < backend->thread_count; i++) {
+        backend->threads[i].alive = false;
+    }
+
+    lseek(backend->task_dir_fd, 0, SEEK_SET);
+    sampler_count_syscalls(1);
+    while (true) {
+        long length = read_directory_entries(backend->task_dir_fd, buffer, TASK_DIR_BUFFER_SIZE);
+        sampler_count_syscalls(1);
+        if (length <= 0) {
+            break;
+        }
+        for (long offset = 0; offset < length;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *) (buffer + offset);
+            offset += entry->d_reclen;
+            long tid = parse_numeric_entry(entry->d_name);
+            if (tid < 0) {
+                // Skip "." and ".."
+                continue;
+            }
+            track_thread(backend, (pid_t) tid);
+        }
+    }
+
+    // Compact the array, closing the counters of the threads that exited.
+    int alive_count = 0;
+    for (int i = 0; i < backend->thread_count; i++) {
+        if (backend->threads[i].alive) {
+            backend->threads[alive_count] = backend->threads[i];
+            alive_count += 1;
+        } else {
+            close_thread(&backend->threads[i]);
+        }
+    }
+    backend->thread_count = alive_count;
+}
+
+static void read_thread_time(linux_thread_t *thread) {
+    char buffer[96];
+    if (thread->schedstat_fd < 0) {
+        return;
+    }
+    sampler_count_syscalls(1);
+    if (!read_file_at(thread->schedstat_fd, buffer, sizeof(buffer))) {
+        return;
+    }
+    // schedstat contains: time spent on the cpu (ns), time spent waiting on a runqueue (ns)
+    // and number of timeslices run on this cpu.
+    thread->time_ns = strtoull(buffer, NULL, 10);
+}
+
+/// Reads the counters of a thread, and adds their deltas to the worker's totals. Each
+/// thread's counters are read with their own syscalls, so threads are read in parallel by the
+/// session's workers.
+static void read_thread_counters_task(void *context, uint32_t task_index, uint32_t worker_index) {
+    linux_backend_t *backend = context;
+    linux_thread_t *thread = &backend->threads[task_index];
+    linux_worker_totals_t *worker = &backend->worker_totals[worker_index];
+    read_perf_counters(backend, thread);
+    read_thread_time(thread);
+    if (!thread->counters_read) {
+        memcpy(thread->previous_cycles, thread->cycles, sizeof(thread->cycles));
+        memcpy(thread->previous_instructions, thread->instructions, sizeof(thread->instructions));
+        thread->previous_time_ns = thread->time_ns;
+        thread->counters_read = true;
+    }
+    for (uint32_t cluster = 0; cluster < backend->cluster_count; cluster++) {
+        uint64_t cycles = thread->cycles[cluster] - thread->previous_cycles[cluster];
+        uint64_t instructions = thread->instructions[cluster] - thread->previous_instructions[cluster];
+        worker->totals[cluster].cycles += cycles;
+        worker->totals[cluster].instructions += instructions;
+        worker->estimate += energy_model_estimate(backend->energy_model, cluster, cycles, instructions);
+    }
+    worker->time_ns += thread->time_ns - thread->previous_time_ns;
+}
+
+// MARK: - Energy
+
+/// Opens the reader of the busy time of every core, and reads it once, so the first sample
+/// gets the deltas since the session was created.
+static void open_cpu_usage(linux_backend_t *backend) {
+    backend->cpu_usage = cpu_usage_reader_create();
+    long ticks_per_second = sysconf(_SC_CLK_TCK);
+    if (backend->cpu_usage == NULL || ticks_per_second <= 0) {
+        cpu_usage_reader_destroy(backend->cpu_usage);
+        backend->cpu_usage = NULL;
+        return;
+    }
+    backend->tick_ns = 1e9 / (double) ticks_per_second;
+    backend->core_count = cpu_usage_reader_core_count(backend->cpu_usage);
+    backend->core_usage_totals = calloc(backend->core_count, sizeof(core_usage_t));
+    backend->core_usage_deltas = calloc(backend->core_count, sizeof(core_usage_t));
+    if (backend->core_usage_totals == NULL
+        || backend->core_usage_deltas == NULL
+        || cpu_usage_reader_read(backend->cpu_usage, backend->core_usage_totals, NULL, backend->core_count) < 0) {
+        cpu_usage_reader_destroy(backend->cpu_usage);
+        backend->cpu_usage = NULL;
+    }
+}
+
+/// The fraction of the busy time of all the cores since the previous sample that was spent
+/// running the sampled process, between 0 and 1.
+///
+/// Busy time is counted in ticks (usually 10ms), so the share of short intervals is only
+/// approximate. If the busy time can't be read, the process is assumed to be the only one
+/// running, and the share is 1.
+static double process_share(linux_backend_t *backend, uint64_t process_time_ns) {
+    if (backend->cpu_usage == NULL) {
+        return 1;
+    }
+    int core_count = cpu_usage_reader_read(backend->cpu_usage,
+                                           backend->core_usage_totals,
+                                           backend->core_usage_deltas,
+                                           backend->core_count);
+    if (core_count < 0) {
+        return 1;
+    }
+    uint64_t busy_ticks = 0;
+    for (int core = 0; core < core_count; core++) {
+        // Idle, iowait and steal ticks are the time the core was not running anything.
+        const core_usage_t *delta = &backend->core_usage_deltas[core];
+        busy_ticks += delta->user_ticks
+            + delta->nice_ticks
+            + delta->system_ticks
+            + delta->irq_ticks
+            + delta->softirq_ticks;
+    }
+    double busy_ns = (double) busy_ticks * backend->tick_ns;
+    if (busy_ns <= (double) process_time_ns) {
+        // Only possible because of the resolution of the ticks.
+        return process_time_ns > 0 ? 1 : 0;
+    }
+    return (double) process_time_ns / busy_ns;
+}
+
+/// Attributes the energy the process used during the interval to one of its threads.
+/// - Parameters:
+///   - process_energy: The process's share of the energy measured during the interval, J.
+///   - dynamic_scale: What the absolute estimates of the model are multiplied by, so they
+///   don't add up to more than `process_energy`.
+///   - static_energy: The energy the model attributes to the process regardless of the work
+///   done by its threads, split by CPU time.
+static void attribute_energy(const linux_backend_t *backend,
+                             linux_thread_t *thread,
+                             double process_energy,
+                             double total_estimate,
+                             uint64_t total_time_ns,
+                             double dynamic_scale,
+                             double static_energy) {
+    const energy_model_t *model = backend->energy_model;
+    uint32_t cluster_count = backend->cluster_count;
+    double estimates[SAMPLE_MAX_CLUSTERS];
+    double thread_estimate = 0;
+    for (uint32_t cluster = 0; cluster < cluster_count; cluster++) {
+        uint64_t cycles = thread->cycles[cluster] - thread->previous_cycles[cluster];
+        uint64_t instructions = thread->instructions[cluster] - thread->previous_instructions[cluster];
+        estimates[cluster] = energy_model_estimate(model, cluster, cycles, instructions);
+        thread_estimate += estimates[cluster];
+    }
+    uint64_t time_ns = thread->time_ns - thread->previous_time_ns;
+
+    if (energy_model_is_absolute(model)) {
+        // The static energy goes to the clusters the thread did its work on.
+        double thread_static = total_time_ns != 0 ? static_energy * ((double) time_ns / (double) total_time_ns) : 0;
+        for (uint32_t cluster = 0; cluster < cluster_count; cluster++) {
+            double static_fraction = thread_estimate > 0 ? estimates[cluster] / thread_estimate : (cluster == 0);
+            thread->energy[cluster] += estimates[cluster] * dynamic_scale + thread_static * static_fraction;
+        }
+    } else if (total_estimate > 0) {
+        for (uint32_t cluster = 0; cluster < cluster_count; cluster++) {
+            thread->energy[cluster] += process_energy * (estimates[cluster] / total_estimate);
+        }
+    } else if (total_time_ns != 0) {
+        thread->energy[0] += process_energy * ((double) time_ns / (double) total_time_ns);
+    }
+}
+
+// MARK: - Backtraces
+
+/// Retrieves the backtraces of all threads in a single round, and interns them in the
+/// session's stack table.
+static void retrieve_thread_backtraces(sample_session_t *session, linux_backend_t *backend) {
+    if (backend->backtrace_request_capacity < backend->thread_capacity) {
+        // The request array grows along with the thread array.
+        backtrace_request_t *new_requests = realloc(backend->backtrace_requests,
+                                                    backend->thread_capacity * sizeof(backtrace_request_t));
+        sampler_count_allocation();
+        if (new_requests == NULL) {
+            return;
+        }
+        backend->backtrace_requests = new_requests;
+        backend->backtrace_request_capacity = backend->thread_capacity;
+    }
+    backtrace_request_t *requests = backend->backtrace_requests;
+    for (int i = 0; i < backend->thread_count; i++) {
+        requests[i].tid = backend->threads[i].tid;
+        requests[i].stack_low = backend->threads[i].stack_low;
+        requests[i].stack_high = backend->threads[i].stack_high;
+    }
+    if (!get_backtraces_linux(requests, backend->thread_count)) {
+        return;
+    }
+    for (int i = 0; i < backend->thread_count; i++) {
+        backend->threads[i].stack_low = requests[i].stack_low;
+        backend->threads[i].stack_high = requests[i].stack_high;
+        if (requests[i].length > 0) {
+            sampler_stats_record_phase(session->stats, SAMPLER_PHASE_THREAD_BACKTRACE, requests[i].interrupted_ns);
+        }
+
+        backtrace_address_t *frames = sample_session_reserve_frames(session, requests[i].length);
+        if (frames == NULL) {
+            continue;
+        }
+        for (int f = 0; f < requests[i].length; f++) {
+            frames[f].address = requests[i].addresses[f];
+        }
+        session->threads[i].stack_id = stack_table_intern(session->stacks, frames, requests[i].length);
+    }
+}
+
+// MARK: - Backend
+
+bool sample_backend_create(sample_session_t *session) {
+    linux_backend_t *backend = calloc(1, sizeof(linux_backend_t));
+    if (backend == NULL) {
+        return false;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", session->pid);
+    backend->task_dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (backend->task_dir_fd < 0) {
+        free(backend);
+        return false;
+    }
+    backend->worker_count = sample_session_worker_count(session);
+    backend->worker_totals = aligned_alloc(_Alignof(linux_worker_totals_t),
+                                           backend->worker_count * sizeof(linux_worker_totals_t));
+    if (backend->worker_totals == NULL) {
+        close(backend->task_dir_fd);
+        free(backend);
+        return false;
+    }
+    rapl_reader_open(&backend->rapl);
+    if (backend->rapl.domain_count > 0) {
+        open_cpu_usage(backend);
+    }
+    configure_clusters(backend, &session->topology);
+    // Initialized by the session once the clusters are known.
+    backend->energy_model = &session->energy_model;
+    backend->is_current_process = session->pid == getpid();
+    session->backend = backend;
+    return true;
+}
+
+void sample_backend_destroy(sample_session_t *session) {
+    linux_backend_t *backend = session->backend;
+    for (int i = 0; i < backend->thread_count; i++) {
+        close_thread(&backend->threads[i]);
+    }
+    free(backend->threads);
+    free(backend->backtrace_requests);
+    free(backend->worker_totals);
+    rapl_reader_close(&backend->rapl);
+    cpu_usage_reader_destroy(backend->cpu_usage);
+    free(backend->core_usage_totals);
+    free(backend->core_usage_deltas);
+    close(backend->task_dir_fd);
+    free(backend);
+}
+
+void sample_backend_sample(sample_session_t *session, bool retrieve_dispatch_queue_names, bool retrieve_backtraces) {
+    // There is no libdispatch on Linux.
+    (void) retrieve_dispatch_queue_names;
+    linux_backend_t *backend = session->backend;
+    sampler_stats_t *stats = session->stats;
+
+    uint64_t phase_start_ns = sampler_now_ns();
+    enumerate_threads(backend);
+    phase_start_ns = sampler_stats_lap(stats, SAMPLER_PHASE_ENUMERATE_THREADS, phase_start_ns);
+
+    // Thread names rarely change, so they're only read for new threads and when the
+    // session's name generation changes (periodically, or after a rename).
+    for (int i = 0; i < backend->thread_count; i++) {
+        linux_thread_t *thread = &backend->threads[i];
+        if (thread->name_generation != session->name_generation) {
+            read_thread_name(backend, thread, session->names);
+            thread->name_generation = session->name_generation;
+        }
+    }
+    phase_start_ns = sampler_stats_lap(stats, SAMPLER_PHASE_READ_NAMES, phase_start_ns);
+
+    uint32_t cluster_count = backend->cluster_count;
+    energy_model_t *model = backend->energy_model;
+    memset(backend->worker_totals, 0, backend->worker_count * sizeof(linux_worker_totals_t));
+    sample_session_for_each_thread(session, (uint32_t) backend->thread_count, read_thread_counters_task, backend);
+    cpu_counters_t totals[SAMPLE_MAX_CLUSTERS];
+    memset(totals, 0, sizeof(totals));
+    double total_estimate = 0;
+    uint64_t total_time_ns = 0;
+    for (uint32_t worker = 0; worker < backend->worker_count; worker++) {
+        const linux_worker_totals_t *worker_totals = &backend->worker_totals[worker];
+        for (uint32_t cluster = 0; cluster < cluster_count; cluster++) {
+            totals[cluster].cycles += worker_totals->totals[cluster].cycles;
+            totals[cluster].instructions += worker_totals->totals[cluster].instructions;
+        }
+        total_estimate += worker_totals->estimate;
+        total_time_ns += worker_totals->time_ns;
+    }
+
+    // Attribute the process's share of the energy of the interval with the energy model,
+    // falling back to CPU time (all of it attributed to the first cluster) if there are no
+    // counters to estimate it from. DRAM energy is not part of the package energy, but it's
+    // also driven by the threads' activity.
+    rapl_energy_t rapl_energy;
+    rapl_reader_read(&backend->rapl, &rapl_energy);
+    sampler_count_syscalls(backend->rapl.domain_count);
+    uint64_t energy_time_ns = sampler_now_ns();
+    double interval = backend->previous_energy_time_ns != 0 ? (energy_time_ns - backend->previous_energy_time_ns) / 1e9 : 0;
+    double process_energy = 0;
+    if (backend->rapl.domain_count > 0) {
+        process_energy = (rapl_energy.package + rapl_energy.dram) * process_share(backend, total_time_ns);
+    }
+    // A fitted linear model predicts the energy of each thread, which is attributed as it is
+    // unless the predictions add up to more than the process's energy. The static term is
+    // capped to what's left.
+    double dynamic_scale = 1;
+    double static_energy = 0;
+    if (energy_model_is_absolute(model)) {
+        if (total_estimate > process_energy) {
+            dynamic_scale = process_energy / total_estimate;
+        }
+        static_energy = fmin(energy_model_static_energy(model, interval), process_energy - total_estimate * dynamic_scale);
+    }
+
+    if (!sample_session_reserve_threads(session, backend->thread_count)) {
+        return;
+    }
+
+    for (int i = 0; i < backend->thread_count; i++) {
+        linux_thread_t *thread = &backend->threads[i];
+        attribute_energy(backend, thread, process_energy, total_estimate, total_time_ns, dynamic_scale, static_energy);
+        memcpy(thread->previous_cycles, thread->cycles, sizeof(thread->cycles));
+        memcpy(thread->previous_instructions, thread->instructions, sizeof(thread->instructions));
+        thread->previous_time_ns = thread->time_ns;
+
+        sampled_thread_record_t *record = &session->threads[i];
+        memset(&record->info, 0, sizeof(sampled_thread_info_t));
+        record->info.thread_id = thread->tid;
+        memcpy(record->info.pthread_name, thread->name, sizeof(thread->name));
+        record->pthread_name_id = thread->name_id;
+        // There is no libdispatch on Linux, so dispatch_queue_name is left empty.
+        record->dispatch_queue_name_id = NAME_ID_NONE;
+        for (uint32_t cluster = 0; cluster < cluster_count; cluster++) {
+            cpu_counters_t *counters = &record->info.clusters[cluster];
+            counters->cycles = thread->cycles[cluster];
+            counters->instructions = thread->instructions[cluster];
+            counters->energy = thread->energy[cluster];
+            counters->time = thread->cluster_time_ns[cluster] / 1e9;
+        }
+        if (!backend->per_cluster_events || thread->perf_fds[0] < 0) {
+            // schedstat is more precise than the counters' time_running, and is still there
+            // without perf events.
+            record->info.clusters[0].time = thread->time_ns / 1e9;
+        }
+
+        record->stack_id = STACK_ID_NONE;
+    }
+    session->thread_count = backend->thread_count;
+
+    // The model is only refitted once this interval's energy is attributed, so all threads
+    // are estimated with the same weights. It's fitted to the process's energy, as the
+    // counters are only those of the process's threads.
+    if (interval > 0 && backend->rapl.domain_count > 0) {
+        energy_model_observe(model, totals, interval, process_energy);
+    }
+    backend->previous_energy_time_ns = energy_time_ns;
+    phase_start_ns = sampler_stats_lap(stats, SAMPLER_PHASE_READ_COUNTERS, phase_start_ns);
+
+    if (retrieve_backtraces && backend->is_current_process) {
+        retrieve_thread_backtraces(session, backend);
+        sampler_stats_lap(stats, SAMPLER_PHASE_BACKTRACES, phase_start_ns);
+    }
+}
+
+#endif /* defined(__linux__) */
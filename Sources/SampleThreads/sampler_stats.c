@@ -0,0 +1,179 @@
+//
+//  sampler_stats.c
+//
+
+#include "sampler_stats_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+_Thread_local sampler_thread_counters_t sampler_thread_counters;
+
+// MARK: - Histogram
+
+static uint32_t histogram_index(uint64_t value) {
+    uint64_t max_value = (1ull << HISTOGRAM_MAX_VALUE_BITS) - 1;
+    if (value > max_value) {
+        value = max_value;
+    }
+    // The highest set bit picks the bucket, and the bits right below it the sub-bucket.
+    uint32_t highest_bit = 63 - (uint32_t) __builtin_clzll(value | (HISTOGRAM_SUB_BUCKET_COUNT - 1));
+    uint32_t bucket = highest_bit - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+    uint32_t sub_bucket = (uint32_t) (value >> bucket);
+    return bucket * HISTOGRAM_SUB_BUCKET_HALF + sub_bucket;
+}
+
+/// The largest value recorded at the given index.
+static uint64_t histogram_highest_value(uint32_t index) {
+    uint32_t bucket = 0;
+    if (index >= HISTOGRAM_SUB_BUCKET_COUNT) {
+        bucket = index / HISTOGRAM_SUB_BUCKET_HALF - 1;
+    }
+    uint64_t sub_bucket = index - bucket * HISTOGRAM_SUB_BUCKET_HALF;
+    return ((sub_bucket + 1) << bucket) - 1;
+}
+
+static void histogram_record(sampler_histogram_t *histogram, uint64_t value) {
+    if (histogram->count == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->count += 1;
+    histogram->sum += value;
+    histogram->latest = value;
+    histogram->counts[histogram_index(value)] += 1;
+}
+
+/// Finds the values at the given percentiles (sorted in ascending order) in a single pass
+/// over the buckets.
+static void histogram_percentiles(const sampler_histogram_t *histogram,
+                                  const double *percentiles,
+                                  uint64_t *values,
+                                  int count) {
+    uint64_t seen = 0;
+    uint32_t index = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t rank = (uint64_t) (percentiles[i] / 100.0 * (double) histogram->count + 0.5);
+        if (rank < 1) {
+            rank = 1;
+        }
+        while (index < HISTOGRAM_INDEX_COUNT && seen + histogram->counts[index] < rank) {
+            seen += histogram->counts[index];
+            index += 1;
+        }
+        uint64_t value = histogram_highest_value(index);
+        // The extremes are known exactly, so never report a value outside of them.
+        if (value > histogram->max) {
+            value = histogram->max;
+        }
+        if (value < histogram->min) {
+            value = histogram->min;
+        }
+        values[i] = value;
+    }
+}
+
+static sampler_summary_t histogram_summary(const sampler_histogram_t *histogram) {
+    sampler_summary_t summary;
+    memset(&summary, 0, sizeof(summary));
+    if (histogram->count == 0) {
+        return summary;
+    }
+    summary.count = histogram->count;
+    summary.min = histogram->min;
+    summary.max = histogram->max;
+    summary.mean = (double) histogram->sum / (double) histogram->count;
+    summary.latest = histogram->latest;
+
+    const double percentiles[4] = { 50.0, 90.0, 99.0, 99.9 };
+    uint64_t values[4];
+    histogram_percentiles(histogram, percentiles, values, 4);
+    summary.p50 = values[0];
+    summary.p90 = values[1];
+    summary.p99 = values[2];
+    summary.p999 = values[3];
+    return summary;
+}
+
+// MARK: - Internal API
+
+sampler_stats_t *sampler_stats_create(void) {
+    return calloc(1, sizeof(sampler_stats_t));
+}
+
+void sampler_stats_destroy(sampler_stats_t *stats) {
+    free(stats);
+}
+
+void sampler_stats_begin_tick(sampler_stats_t *stats) {
+    memset(stats->tick_phase_ns, 0, sizeof(stats->tick_phase_ns));
+    stats->tick_phase_mask = 0;
+    stats->tick_start_counters = sampler_thread_counters;
+    stats->tick_start_ns = sampler_now_ns();
+}
+
+void sampler_stats_end_tick(sampler_stats_t *stats) {
+    uint64_t end_ns = sampler_now_ns();
+    histogram_record(&stats->phases[SAMPLER_PHASE_TICK], end_ns - stats->tick_start_ns);
+    for (int phase = 0; phase < SAMPLER_PHASE_COUNT; phase++) {
+        if (stats->tick_phase_mask & (1u << phase)) {
+            histogram_record(&stats->phases[phase], stats->tick_phase_ns[phase]);
+        }
+    }
+
+    uint64_t counters[SAMPLER_COUNTER_COUNT];
+    counters[SAMPLER_COUNTER_ALLOCATIONS] = sampler_thread_counters.allocations - stats->tick_start_counters.allocations;
+    counters[SAMPLER_COUNTER_SYSCALLS] = sampler_thread_counters.syscalls - stats->tick_start_counters.syscalls;
+    for (int counter = 0; counter < SAMPLER_COUNTER_COUNT; counter++) {
+        histogram_record(&stats->counters[counter], counters[counter]);
+        stats->counter_totals[counter] += counters[counter];
+    }
+    stats->tick_count += 1;
+}
+
+// MARK: - Public API
+
+uint64_t sampler_stats_now_ns(void) {
+    return sampler_now_ns();
+}
+
+void sampler_stats_record_phase(sampler_stats_t *stats, sampler_phase_t phase, uint64_t duration_ns) {
+    if (phase >= SAMPLER_PHASE_COUNT) {
+        return;
+    }
+    histogram_record(&stats->phases[phase], duration_ns);
+}
+
+sampler_summary_t sampler_stats_phase_summary(const sampler_stats_t *stats, sampler_phase_t phase) {
+    if (phase >= SAMPLER_PHASE_COUNT) {
+        sampler_summary_t summary;
+        memset(&summary, 0, sizeof(summary));
+        return summary;
+    }
+    return histogram_summary(&stats->phases[phase]);
+}
+
+sampler_summary_t sampler_stats_counter_summary(const sampler_stats_t *stats, sampler_counter_t counter) {
+    if (counter >= SAMPLER_COUNTER_COUNT) {
+        sampler_summary_t summary;
+        memset(&summary, 0, sizeof(summary));
+        return summary;
+    }
+    return histogram_summary(&stats->counters[counter]);
+}
+
+uint64_t sampler_stats_counter_total(const sampler_stats_t *stats, sampler_counter_t counter) {
+    if (counter >= SAMPLER_COUNTER_COUNT) {
+        return 0;
+    }
+    return stats->counter_totals[counter];
+}
+
+uint64_t sampler_stats_tick_count(const sampler_stats_t *stats) {
+    return stats->tick_count;
+}
+
+void sampler_stats_reset(sampler_stats_t *stats) {
+    memset(stats, 0, sizeof(sampler_stats_t));
+}
@@ -0,0 +1,99 @@
+//
+//  sampler_stats_internal.h
+//
+
+#ifndef sampler_stats_internal_h
+#define sampler_stats_internal_h
+
+#include "sampler_stats.h"
+#include <time.h>
+
+// Each histogram bucket spans a power of two, divided into 32 sub-buckets, so values are
+// recorded with a relative precision of 1/32. Bucket 0 holds the values below 64 exactly.
+#define HISTOGRAM_SUB_BUCKET_BITS 6
+#define HISTOGRAM_SUB_BUCKET_COUNT (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_SUB_BUCKET_HALF (HISTOGRAM_SUB_BUCKET_COUNT / 2)
+/// Values up to 2^40 (~18 minutes, in nanoseconds) are recorded, larger ones are clamped.
+#define HISTOGRAM_MAX_VALUE_BITS 40
+#define HISTOGRAM_INDEX_COUNT ((HISTOGRAM_MAX_VALUE_BITS - HISTOGRAM_SUB_BUCKET_BITS + 2) * HISTOGRAM_SUB_BUCKET_HALF)
+
+typedef struct {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t latest;
+    uint32_t counts[HISTOGRAM_INDEX_COUNT];
+} sampler_histogram_t;
+
+/// Counters incremented by the sampler code running on each thread. They only ever grow:
+/// the values of each sample are the difference between its end and its start.
+typedef struct {
+    uint64_t allocations;
+    uint64_t syscalls;
+} sampler_thread_counters_t;
+
+extern _Thread_local sampler_thread_counters_t sampler_thread_counters;
+
+struct sampler_stats {
+    sampler_histogram_t phases[SAMPLER_PHASE_COUNT];
+    sampler_histogram_t counters[SAMPLER_COUNTER_COUNT];
+    uint64_t counter_totals[SAMPLER_COUNTER_COUNT];
+    uint64_t tick_count;
+
+    // State of the sample being taken.
+    uint64_t tick_start_ns;
+    sampler_thread_counters_t tick_start_counters;
+    /// Time spent in each phase during the current sample, added up as phases may be
+    /// interleaved (ie: when each thread is processed in turn).
+    uint64_t tick_phase_ns[SAMPLER_PHASE_COUNT];
+    /// Bitmask of the phases that ran during the current sample.
+    uint32_t tick_phase_mask;
+};
+
+sampler_stats_t *sampler_stats_create(void);
+
+void sampler_stats_destroy(sampler_stats_t *stats);
+
+/// Starts timing a sample on the calling thread.
+void sampler_stats_begin_tick(sampler_stats_t *stats);
+
+/// Records the phases and counters of the sample started by `sampler_stats_begin_tick`. Must
+/// be called from the same thread.
+void sampler_stats_end_tick(sampler_stats_t *stats);
+
+static inline uint64_t sampler_now_ns(void) {
+    #if defined(__APPLE__)
+    return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    #else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+    return (uint64_t) time.tv_sec * 1000000000ull + (uint64_t) time.tv_nsec;
+    #endif
+}
+
+/// Adds time to a phase of the current sample.
+static inline void sampler_stats_add(sampler_stats_t *stats, sampler_phase_t phase, uint64_t duration_ns) {
+    stats->tick_phase_ns[phase] += duration_ns;
+    stats->tick_phase_mask |= 1u << phase;
+}
+
+/// Adds the time elapsed since `start_ns` to a phase of the current sample.
+/// - Returns: The current time, so the next phase can be timed from it.
+static inline uint64_t sampler_stats_lap(sampler_stats_t *stats, sampler_phase_t phase, uint64_t start_ns) {
+    uint64_t now_ns = sampler_now_ns();
+    sampler_stats_add(stats, phase, now_ns - start_ns);
+    return now_ns;
+}
+
+/// Counts a memory allocation made by the sampler.
+static inline void sampler_count_allocation(void) {
+    sampler_thread_counters.allocations += 1;
+}
+
+/// Counts calls into the kernel made by the sampler.
+static inline void sampler_count_syscalls(uint64_t count) {
+    sampler_thread_counters.syscalls += count;
+}
+
+#endif /* sampler_stats_internal_h */
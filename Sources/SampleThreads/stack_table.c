@@ -0,0 +1,99 @@
+//
+//  stack_table.c
+//
+
+#include "stack_table.h"
+#include "intern_table.h"
+#include <stdlib.h>
+
+_Static_assert(STACK_ID_NONE == INTERN_ID_NONE, "Stack IDs are the IDs of the intern table");
+
+// Initial capacities.
+#define INITIAL_STACK_CAPACITY 128
+#define INITIAL_FRAME_CAPACITY (INITIAL_STACK_CAPACITY * 32)
+
+struct stack_table {
+    /// The addresses of each unique stack, keyed by their bytes.
+    intern_table_t stacks;
+};
+
+// MARK: - Hashing
+
+static inline uint64_t mix(uint64_t value) {
+    // Finalizer of MurmurHash3, so every bit of the input affects every bit of the hash.
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDull;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+static uint64_t hash_stack(const backtrace_address_t *addresses, uint32_t length) {
+    uint64_t hash = length * 0x9E3779B97F4A7C15ull;
+    for (uint32_t i = 0; i < length; i++) {
+        // Rotating before combining makes the hash depend on the order of the addresses.
+        hash = ((hash << 5) | (hash >> 59)) ^ addresses[i].address;
+        hash *= 0x9E3779B97F4A7C15ull;
+    }
+    return mix(hash);
+}
+
+// MARK: - Public API
+
+stack_table_t *stack_table_create(void) {
+    stack_table_t *table = malloc(sizeof(stack_table_t));
+    if (table == NULL) {
+        return NULL;
+    }
+    if (!intern_table_init(&table->stacks,
+                           INITIAL_STACK_CAPACITY,
+                           INITIAL_FRAME_CAPACITY * sizeof(backtrace_address_t))) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+void stack_table_destroy(stack_table_t *table) {
+    if (table == NULL) {
+        return;
+    }
+    intern_table_free(&table->stacks);
+    free(table);
+}
+
+stack_id_t stack_table_intern(stack_table_t *table, const backtrace_address_t *addresses, uint32_t length) {
+    // Longer stacks wouldn't fit the 32-bit size of a key.
+    if (length == 0 || length > UINT32_MAX / sizeof(backtrace_address_t)) {
+        return STACK_ID_NONE;
+    }
+    return intern_table_intern(&table->stacks,
+                               hash_stack(addresses, length),
+                               addresses,
+                               length * (uint32_t) sizeof(backtrace_address_t),
+                               0);
+}
+
+uint32_t stack_table_count(const stack_table_t *table) {
+    return table->stacks.count;
+}
+
+const backtrace_address_t *stack_table_stack(const stack_table_t *table, stack_id_t stack_id, uint32_t *length) {
+    uint32_t size;
+    const backtrace_address_t *addresses = intern_table_key(&table->stacks, stack_id, &size);
+    *length = size / sizeof(backtrace_address_t);
+    return addresses;
+}
+
+uint64_t stack_table_frame_count(const stack_table_t *table) {
+    return table->stacks.arena_size / sizeof(backtrace_address_t);
+}
+
+void stack_table_reset(stack_table_t *table) {
+    intern_table_reset(&table->stacks);
+}
+
+uint32_t stack_table_generation(const stack_table_t *table) {
+    return table->stacks.generation;
+}
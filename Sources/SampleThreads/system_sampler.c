@@ -0,0 +1,372 @@
+//
+//  system_sampler.c
+//
+
+#include "system_sampler_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/// Current time of a clock that keeps running while the system is asleep, in nanoseconds.
+static uint64_t continuous_time_ns(void) {
+    struct timespec time;
+    #if defined(__linux__)
+    clock_gettime(CLOCK_BOOTTIME, &time);
+    #else
+    // On Apple platforms, CLOCK_MONOTONIC keeps running while asleep.
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    #endif
+    return (uint64_t) time.tv_sec * 1000000000ull + (uint64_t) time.tv_nsec;
+}
+
+// MARK: - Memory
+
+static bool grow(void **array, uint32_t *capacity, uint32_t count, size_t element_size) {
+    if (count <= *capacity) {
+        return true;
+    }
+    uint32_t new_capacity = *capacity == 0 ? 64 : *capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    void *new_array = realloc(*array, new_capacity * element_size);
+    if (new_array == NULL) {
+        return false;
+    }
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+bool system_sampler_add_pid(system_sampler_t *sampler, int32_t pid) {
+    if (!grow((void **) &sampler->pids, &sampler->pid_capacity, sampler->pid_count + 1, sizeof(int32_t))) {
+        return false;
+    }
+    sampler->pids[sampler->pid_count++] = pid;
+    return true;
+}
+
+bool system_process_reserve_rows(system_process_t *process, uint32_t count) {
+    return grow((void **) &process->rows, &process->row_capacity, count, sizeof(system_thread_row_t));
+}
+
+#define RESIZE_COLUMN(column, capacity) \
+    do { \
+        void *new_column = realloc((column), (capacity) * sizeof(*(column))); \
+        if (new_column == NULL) { \
+            return false; \
+        } \
+        (column) = new_column; \
+    } while (0)
+
+static bool reserve_process_columns(system_sampler_t *sampler, uint32_t count) {
+    if (count <= sampler->process_column_capacity) {
+        return true;
+    }
+    uint32_t capacity = sampler->process_column_capacity == 0 ? 256 : sampler->process_column_capacity;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    RESIZE_COLUMN(sampler->process_ids, capacity);
+    RESIZE_COLUMN(sampler->process_names, capacity);
+    RESIZE_COLUMN(sampler->process_first_thread, capacity);
+    RESIZE_COLUMN(sampler->process_thread_count, capacity);
+    RESIZE_COLUMN(sampler->process_cycles, capacity);
+    RESIZE_COLUMN(sampler->process_instructions, capacity);
+    RESIZE_COLUMN(sampler->process_cpu_time, capacity);
+    RESIZE_COLUMN(sampler->process_energy, capacity);
+    sampler->process_column_capacity = capacity;
+    return true;
+}
+
+static bool reserve_thread_columns(system_sampler_t *sampler, uint32_t count) {
+    if (count <= sampler->thread_column_capacity) {
+        return true;
+    }
+    uint32_t capacity = sampler->thread_column_capacity == 0 ? 1024 : sampler->thread_column_capacity;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    RESIZE_COLUMN(sampler->thread_ids, capacity);
+    RESIZE_COLUMN(sampler->thread_process_index, capacity);
+    RESIZE_COLUMN(sampler->thread_names, capacity);
+    RESIZE_COLUMN(sampler->thread_cycles, capacity);
+    RESIZE_COLUMN(sampler->thread_instructions, capacity);
+    RESIZE_COLUMN(sampler->thread_cpu_time, capacity);
+    RESIZE_COLUMN(sampler->thread_energy, capacity);
+    sampler->thread_column_capacity = capacity;
+    return true;
+}
+
+static void free_columns(system_sampler_t *sampler) {
+    free(sampler->process_ids);
+    free(sampler->process_names);
+    free(sampler->process_first_thread);
+    free(sampler->process_thread_count);
+    free(sampler->process_cycles);
+    free(sampler->process_instructions);
+    free(sampler->process_cpu_time);
+    free(sampler->process_energy);
+    free(sampler->thread_ids);
+    free(sampler->thread_process_index);
+    free(sampler->thread_names);
+    free(sampler->thread_cycles);
+    free(sampler->thread_instructions);
+    free(sampler->thread_cpu_time);
+    free(sampler->thread_energy);
+}
+
+// MARK: - Processes
+
+static void destroy_process(system_sampler_t *sampler, system_process_t *process) {
+    if (process->backend != NULL) {
+        system_backend_process_destroy(sampler, process);
+        process->backend = NULL;
+    }
+    free(process->rows);
+    process->rows = NULL;
+    process->row_capacity = 0;
+}
+
+static int compare_pids(const void *lhs, const void *rhs) {
+    int32_t lhs_pid = *(const int32_t *) lhs;
+    int32_t rhs_pid = *(const int32_t *) rhs;
+    return (lhs_pid > rhs_pid) - (lhs_pid < rhs_pid);
+}
+
+/// Re-enumerates the processes, keeping the state of the ones that are still alive,
+/// destroying the state of the ones that exited, and adding the new ones (whose state is
+/// created by the worker that samples them for the first time).
+static bool update_processes(system_sampler_t *sampler) {
+    sampler->pid_count = 0;
+    system_backend_list_processes(sampler);
+    qsort(sampler->pids, sampler->pid_count, sizeof(int32_t), compare_pids);
+
+    // The processes are merged into the spare array, which is then swapped with the
+    // current one, so no memory is allocated unless the number of processes grows.
+    if (!grow((void **) &sampler->spare_processes, &sampler->spare_process_capacity,
+              sampler->pid_count, sizeof(system_process_t))) {
+        return false;
+    }
+    system_process_t *merged = sampler->spare_processes;
+    // Both the tracked processes and the PIDs are sorted, so they're merged in a single pass.
+    uint32_t merged_count = 0;
+    uint32_t old_index = 0;
+    for (uint32_t i = 0; i < sampler->pid_count; i++) {
+        int32_t pid = sampler->pids[i];
+        if (i > 0 && pid == sampler->pids[i - 1]) {
+            continue;
+        }
+        while (old_index < sampler->process_count && sampler->processes[old_index].pid < pid) {
+            destroy_process(sampler, &sampler->processes[old_index++]);
+        }
+        if (old_index < sampler->process_count && sampler->processes[old_index].pid == pid) {
+            merged[merged_count++] = sampler->processes[old_index++];
+        } else {
+            system_process_t *process = &merged[merged_count++];
+            memset(process, 0, sizeof(system_process_t));
+            process->pid = pid;
+        }
+    }
+    while (old_index < sampler->process_count) {
+        destroy_process(sampler, &sampler->processes[old_index++]);
+    }
+    uint32_t merged_capacity = sampler->spare_process_capacity;
+    sampler->spare_processes = sampler->processes;
+    sampler->spare_process_capacity = sampler->process_capacity;
+    sampler->processes = merged;
+    sampler->process_count = merged_count;
+    sampler->process_capacity = merged_capacity;
+    return true;
+}
+
+/// Samples a single process. Run by the workers of the pool.
+static void sample_process_task(void *context, uint32_t process_index, uint32_t worker_index) {
+    system_sampler_t *sampler = context;
+    system_process_t *process = &sampler->processes[process_index];
+    process->row_count = 0;
+    process->sampled = false;
+    if (process->backend == NULL) {
+        if (process->unreadable) {
+            return;
+        }
+        if (!system_backend_process_create(sampler, process)) {
+            process->unreadable = true;
+            return;
+        }
+    }
+    if (!system_backend_process_sample(sampler, process, worker_index)) {
+        // The process exited (or its PID was reused by a new process, which is set up
+        // again in the next tick).
+        system_backend_process_destroy(sampler, process);
+        process->backend = NULL;
+        process->row_count = 0;
+        return;
+    }
+    process->sampled = true;
+}
+
+// MARK: - Batch
+
+/// Apportions the energy of the system to the threads proportionally to their CPU time.
+static void apportion_energy(system_sampler_t *sampler, double energy) {
+    double total_cpu_time = 0.0;
+    for (uint32_t p = 0; p < sampler->process_count; p++) {
+        const system_process_t *process = &sampler->processes[p];
+        for (uint32_t t = 0; t < process->row_count; t++) {
+            total_cpu_time += process->rows[t].cpu_time;
+        }
+    }
+    double energy_per_second = total_cpu_time > 0.0 ? energy / total_cpu_time : 0.0;
+    for (uint32_t p = 0; p < sampler->process_count; p++) {
+        system_process_t *process = &sampler->processes[p];
+        for (uint32_t t = 0; t < process->row_count; t++) {
+            process->rows[t].energy = process->rows[t].cpu_time * energy_per_second;
+        }
+    }
+}
+
+/// Gathers the rows of every process into the columns of the batch.
+static bool gather_columns(system_sampler_t *sampler, system_sample_batch_t *batch) {
+    uint32_t process_count = 0;
+    uint32_t thread_count = 0;
+    for (uint32_t p = 0; p < sampler->process_count; p++) {
+        if (sampler->processes[p].sampled) {
+            process_count += 1;
+            thread_count += sampler->processes[p].row_count;
+        }
+    }
+    if (!sampler->config.include_threads) {
+        thread_count = 0;
+    }
+    if (!reserve_process_columns(sampler, process_count) || !reserve_thread_columns(sampler, thread_count)) {
+        return false;
+    }
+
+    uint32_t process_index = 0;
+    uint32_t thread_index = 0;
+    for (uint32_t p = 0; p < sampler->process_count; p++) {
+        const system_process_t *process = &sampler->processes[p];
+        if (!process->sampled) {
+            continue;
+        }
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        double cpu_time = 0.0;
+        double energy = 0.0;
+        for (uint32_t t = 0; t < process->row_count; t++) {
+            const system_thread_row_t *row = &process->rows[t];
+            cycles += row->cycles;
+            instructions += row->instructions;
+            cpu_time += row->cpu_time;
+            energy += row->energy;
+        }
+        sampler->process_ids[process_index] = process->pid;
+        sampler->process_names[process_index] = process->name;
+        sampler->process_first_thread[process_index] = thread_index;
+        sampler->process_thread_count[process_index] = process->row_count;
+        sampler->process_cycles[process_index] = cycles;
+        sampler->process_instructions[process_index] = instructions;
+        sampler->process_cpu_time[process_index] = cpu_time;
+        sampler->process_energy[process_index] = energy;
+
+        if (sampler->config.include_threads) {
+            for (uint32_t t = 0; t < process->row_count; t++) {
+                const system_thread_row_t *row = &process->rows[t];
+                sampler->thread_ids[thread_index] = row->thread_id;
+                sampler->thread_process_index[thread_index] = process_index;
+                sampler->thread_names[thread_index] = row->name;
+                sampler->thread_cycles[thread_index] = row->cycles;
+                sampler->thread_instructions[thread_index] = row->instructions;
+                sampler->thread_cpu_time[thread_index] = row->cpu_time;
+                sampler->thread_energy[thread_index] = row->energy;
+                thread_index += 1;
+            }
+        }
+        process_index += 1;
+    }
+
+    batch->process_count = process_count;
+    batch->process_ids = sampler->process_ids;
+    batch->process_names = sampler->process_names;
+    batch->process_first_thread = sampler->process_first_thread;
+    batch->process_thread_count = sampler->process_thread_count;
+    batch->process_cycles = sampler->process_cycles;
+    batch->process_instructions = sampler->process_instructions;
+    batch->process_cpu_time = sampler->process_cpu_time;
+    batch->process_energy = sampler->process_energy;
+    batch->thread_count = thread_count;
+    batch->thread_ids = sampler->thread_ids;
+    batch->thread_process_index = sampler->thread_process_index;
+    batch->thread_names = sampler->thread_names;
+    batch->thread_cycles = sampler->thread_cycles;
+    batch->thread_instructions = sampler->thread_instructions;
+    batch->thread_cpu_time = sampler->thread_cpu_time;
+    batch->thread_energy = sampler->thread_energy;
+    return true;
+}
+
+// MARK: - Public API
+
+system_sampler_t *system_sampler_create(system_sampler_config_t config) {
+    system_sampler_t *sampler = calloc(1, sizeof(system_sampler_t));
+    if (sampler == NULL) {
+        return NULL;
+    }
+    sampler->config = config;
+    sampler->pool = worker_pool_create(config.worker_count);
+    if (sampler->pool == NULL || !system_backend_create(sampler)) {
+        worker_pool_destroy(sampler->pool);
+        free(sampler);
+        return NULL;
+    }
+    return sampler;
+}
+
+void system_sampler_destroy(system_sampler_t *sampler) {
+    if (sampler == NULL) {
+        return;
+    }
+    worker_pool_destroy(sampler->pool);
+    for (uint32_t i = 0; i < sampler->process_count; i++) {
+        destroy_process(sampler, &sampler->processes[i]);
+    }
+    system_backend_destroy(sampler);
+    free(sampler->processes);
+    free(sampler->spare_processes);
+    free(sampler->pids);
+    free_columns(sampler);
+    free(sampler);
+}
+
+system_sample_batch_t system_sampler_sample(system_sampler_t *sampler) {
+    system_sample_batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+    uint64_t sample_time_ns = continuous_time_ns();
+    if (!update_processes(sampler)) {
+        return batch;
+    }
+
+    worker_pool_run(sampler->pool, sampler->process_count, sample_process_task, sampler);
+
+    double energy = system_backend_read_energy(sampler);
+    if (!system_backend_reports_thread_energy(sampler)) {
+        apportion_energy(sampler, energy);
+    }
+    if (!gather_columns(sampler, &batch)) {
+        memset(&batch, 0, sizeof(batch));
+        return batch;
+    }
+    if (system_backend_reports_thread_energy(sampler)) {
+        energy = 0.0;
+        for (uint32_t p = 0; p < batch.process_count; p++) {
+            energy += batch.process_energy[p];
+        }
+    }
+    batch.energy = energy;
+    if (sampler->previous_sample_time_ns != 0) {
+        batch.interval = (sample_time_ns - sampler->previous_sample_time_ns) / 1e9;
+    }
+    sampler->previous_sample_time_ns = sample_time_ns;
+    return batch;
+}
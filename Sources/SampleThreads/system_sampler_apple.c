@@ -0,0 +1,333 @@
+//
+//  system_sampler_apple.c
+//
+
+#include "system_sampler_internal.h"
+
+#if defined(__APPLE__)
+#include <TargetConditionals.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if TARGET_OS_OSX
+#include "proc_threadcounts.h"
+#include <libproc.h>
+#include <sys/proc_info.h>
+
+// The system-wide backend reads the same CLPC counters as sample_threads.c, but through
+// proc_pidinfo only: PROC_PIDLISTTHREADIDS lists the threads of a process, and
+// PROC_PIDTHREADCOUNTS reads the counters of each one, without needing a task port (which
+// task_for_pid only hands out to root, and with SIP disabled). proc_pidinfo still requires
+// root for processes of other users.
+
+#ifndef PROC_PIDLISTTHREADIDS
+#define PROC_PIDLISTTHREADIDS 28
+#endif
+
+typedef struct {
+    uint64_t thread_id;
+    /// Whether the thread was found in the latest list of the process' threads.
+    bool alive;
+    /// Whether the counters below hold the values of a previous tick.
+    bool has_previous;
+    system_sample_name_t name;
+    // Counters at the previous tick, adding up all perf levels.
+    uint64_t cycles;
+    uint64_t instructions;
+    double time;
+    double energy;
+} apple_thread_t;
+
+typedef struct {
+    /// Tracked threads, sorted by thread ID.
+    apple_thread_t *threads;
+    uint32_t thread_count;
+    uint32_t thread_capacity;
+} apple_process_t;
+
+typedef struct {
+    /// Buffer for the PIDs returned by proc_listallpids.
+    pid_t *pid_buffer;
+    uint32_t pid_buffer_capacity;
+    /// A buffer for the thread IDs of a process for each worker.
+    uint64_t **thread_id_buffers;
+    uint32_t *thread_id_buffer_capacities;
+    uint32_t worker_count;
+    /// Number of perf levels whose counters are added up.
+    uint32_t perf_level_count;
+} apple_system_backend_t;
+
+// MARK: - Threads
+
+/// Lists the thread IDs of a process into the worker's buffer.
+/// - Returns: The number of threads, or -1 if the process can't be read (or exited).
+static int64_t list_thread_ids(apple_system_backend_t *backend, int32_t pid, uint32_t worker_index) {
+    while (true) {
+        uint64_t *buffer = backend->thread_id_buffers[worker_index];
+        uint32_t capacity = backend->thread_id_buffer_capacities[worker_index];
+        int bytes = proc_pidinfo(pid, PROC_PIDLISTTHREADIDS, 0, buffer, (int) (capacity * sizeof(uint64_t)));
+        if (bytes <= 0) {
+            return -1;
+        }
+        uint32_t count = (uint32_t) bytes / sizeof(uint64_t);
+        if (count < capacity) {
+            return count;
+        }
+        // The buffer was filled, so there may be more threads.
+        uint64_t *new_buffer = realloc(buffer, capacity * 2 * sizeof(uint64_t));
+        if (new_buffer == NULL) {
+            return count;
+        }
+        backend->thread_id_buffers[worker_index] = new_buffer;
+        backend->thread_id_buffer_capacities[worker_index] = capacity * 2;
+    }
+}
+
+/// Returns the index of the thread with the given ID, or the index where it should be
+/// inserted (as a negative number, minus one) if it's not tracked yet.
+static int64_t find_thread(const apple_process_t *process, uint64_t thread_id) {
+    int64_t low = 0;
+    int64_t high = (int64_t) process->thread_count - 1;
+    while (low <= high) {
+        int64_t middle = (low + high) / 2;
+        uint64_t middle_id = process->threads[middle].thread_id;
+        if (middle_id == thread_id) {
+            return middle;
+        } else if (middle_id < thread_id) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -(low + 1);
+}
+
+static void track_thread(apple_process_t *process, int32_t pid, uint64_t thread_id) {
+    int64_t index = find_thread(process, thread_id);
+    if (index >= 0) {
+        process->threads[index].alive = true;
+        return;
+    }
+    index = -(index + 1);
+
+    if (process->thread_count == process->thread_capacity) {
+        uint32_t new_capacity = process->thread_capacity == 0 ? 8 : process->thread_capacity * 2;
+        apple_thread_t *new_threads = realloc(process->threads, new_capacity * sizeof(apple_thread_t));
+        if (new_threads == NULL) {
+            return;
+        }
+        process->threads = new_threads;
+        process->thread_capacity = new_capacity;
+    }
+    memmove(&process->threads[index + 1],
+            &process->threads[index],
+            (process->thread_count - index) * sizeof(apple_thread_t));
+    process->thread_count += 1;
+
+    apple_thread_t *thread = &process->threads[index];
+    memset(thread, 0, sizeof(apple_thread_t));
+    thread->thread_id = thread_id;
+    thread->alive = true;
+
+    struct proc_threadinfo info;
+    if (proc_pidinfo(pid, PROC_PIDTHREADID64INFO, thread_id, &info, sizeof(info)) == sizeof(info)) {
+        strlcpy(thread->name.name, info.pth_name, sizeof(thread->name.name));
+    }
+}
+
+// MARK: - Backend
+
+bool system_backend_create(system_sampler_t *sampler) {
+    apple_system_backend_t *backend = calloc(1, sizeof(apple_system_backend_t));
+    if (backend == NULL) {
+        return false;
+    }
+    sampler->backend = backend;
+    backend->worker_count = worker_pool_worker_count(sampler->pool);
+    backend->perf_level_count = proc_threadcounts_level_count();
+    backend->thread_id_buffers = calloc(backend->worker_count, sizeof(uint64_t *));
+    backend->thread_id_buffer_capacities = calloc(backend->worker_count, sizeof(uint32_t));
+    if (backend->thread_id_buffers == NULL || backend->thread_id_buffer_capacities == NULL) {
+        system_backend_destroy(sampler);
+        return false;
+    }
+    for (uint32_t i = 0; i < backend->worker_count; i++) {
+        backend->thread_id_buffers[i] = malloc(64 * sizeof(uint64_t));
+        if (backend->thread_id_buffers[i] == NULL) {
+            system_backend_destroy(sampler);
+            return false;
+        }
+        backend->thread_id_buffer_capacities[i] = 64;
+    }
+    return true;
+}
+
+void system_backend_destroy(system_sampler_t *sampler) {
+    apple_system_backend_t *backend = sampler->backend;
+    if (backend->thread_id_buffers != NULL) {
+        for (uint32_t i = 0; i < backend->worker_count; i++) {
+            free(backend->thread_id_buffers[i]);
+        }
+    }
+    free(backend->thread_id_buffers);
+    free(backend->thread_id_buffer_capacities);
+    free(backend->pid_buffer);
+    free(backend);
+    sampler->backend = NULL;
+}
+
+void system_backend_list_processes(system_sampler_t *sampler) {
+    apple_system_backend_t *backend = sampler->backend;
+    int count = proc_listallpids(NULL, 0);
+    if (count <= 0) {
+        return;
+    }
+    // Leave room for the processes spawned since the count was taken.
+    uint32_t required_capacity = (uint32_t) count + (uint32_t) count / 8 + 16;
+    if (required_capacity > backend->pid_buffer_capacity) {
+        pid_t *new_buffer = realloc(backend->pid_buffer, required_capacity * sizeof(pid_t));
+        if (new_buffer == NULL) {
+            return;
+        }
+        backend->pid_buffer = new_buffer;
+        backend->pid_buffer_capacity = required_capacity;
+    }
+    count = proc_listallpids(backend->pid_buffer, (int) (backend->pid_buffer_capacity * sizeof(pid_t)));
+    for (int i = 0; i < count; i++) {
+        if (!system_sampler_add_pid(sampler, backend->pid_buffer[i])) {
+            return;
+        }
+    }
+}
+
+bool system_backend_process_create(system_sampler_t *sampler, system_process_t *process) {
+    // Check that the process' threads can be read at all (ie: it's not another user's
+    // process and the caller is not root).
+    uint64_t first_thread_id;
+    if (proc_pidinfo(process->pid, PROC_PIDLISTTHREADIDS, 0, &first_thread_id, sizeof(first_thread_id)) <= 0) {
+        return false;
+    }
+    apple_process_t *apple_process = calloc(1, sizeof(apple_process_t));
+    if (apple_process == NULL) {
+        return false;
+    }
+    if (proc_name(process->pid, process->name.name, sizeof(process->name.name)) <= 0) {
+        process->name.name[0] = '\0';
+    }
+    process->backend = apple_process;
+    return true;
+}
+
+void system_backend_process_destroy(system_sampler_t *sampler, system_process_t *process) {
+    apple_process_t *apple_process = process->backend;
+    free(apple_process->threads);
+    free(apple_process);
+}
+
+bool system_backend_process_sample(system_sampler_t *sampler, system_process_t *process, uint32_t worker_index) {
+    apple_system_backend_t *backend = sampler->backend;
+    apple_process_t *apple_process = process->backend;
+    int64_t thread_id_count = list_thread_ids(backend, process->pid, worker_index);
+    if (thread_id_count < 0) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < apple_process->thread_count; i++) {
+        apple_process->threads[i].alive = false;
+    }
+    const uint64_t *thread_ids = backend->thread_id_buffers[worker_index];
+    for (int64_t i = 0; i < thread_id_count; i++) {
+        track_thread(apple_process, process->pid, thread_ids[i]);
+    }
+    uint32_t alive_count = 0;
+    for (uint32_t i = 0; i < apple_process->thread_count; i++) {
+        if (apple_process->threads[i].alive) {
+            apple_process->threads[alive_count++] = apple_process->threads[i];
+        }
+    }
+    apple_process->thread_count = alive_count;
+
+    if (!system_process_reserve_rows(process, apple_process->thread_count)) {
+        return true;
+    }
+    for (uint32_t i = 0; i < apple_process->thread_count; i++) {
+        apple_thread_t *thread = &apple_process->threads[i];
+        struct proc_threadcounts counters;
+        if (proc_pidinfo(process->pid, PROC_PIDTHREADCOUNTS, thread->thread_id, &counters, sizeof(counters)) <= 0) {
+            // The thread exited since the list was read.
+            continue;
+        }
+        // Add up the counters of all the perf levels.
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        double time = 0.0;
+        double energy = 0.0;
+        for (uint32_t level = 0; level < backend->perf_level_count; level++) {
+            const struct proc_threadcounts_data *data = &counters.ptc_counts[level];
+            cycles += data->ptcd_cycles;
+            instructions += data->ptcd_instructions;
+            time += convert_mach_time(data->ptcd_user_time_mach + data->ptcd_system_time_mach);
+            energy += data->ptcd_energy_nj / 1e9;
+        }
+
+        system_thread_row_t *row = &process->rows[process->row_count++];
+        memset(row, 0, sizeof(system_thread_row_t));
+        row->thread_id = thread->thread_id;
+        row->name = thread->name;
+        if (thread->has_previous) {
+            row->cycles = cycles - thread->cycles;
+            row->instructions = instructions - thread->instructions;
+            row->cpu_time = time - thread->time;
+            row->energy = energy - thread->energy;
+        }
+        thread->cycles = cycles;
+        thread->instructions = instructions;
+        thread->time = time;
+        thread->energy = energy;
+        thread->has_previous = true;
+    }
+    return true;
+}
+
+double system_backend_read_energy(system_sampler_t *sampler) {
+    // The energy of each thread is reported by the CLPC, and added up by the caller.
+    return 0.0;
+}
+
+bool system_backend_reports_thread_energy(const system_sampler_t *sampler) {
+    return true;
+}
+
+#else
+
+// Other processes can't be inspected on iOS, tvOS, watchOS and visionOS.
+
+bool system_backend_create(system_sampler_t *sampler) {
+    return false;
+}
+
+void system_backend_destroy(system_sampler_t *sampler) {}
+
+void system_backend_list_processes(system_sampler_t *sampler) {}
+
+bool system_backend_process_create(system_sampler_t *sampler, system_process_t *process) {
+    return false;
+}
+
+void system_backend_process_destroy(system_sampler_t *sampler, system_process_t *process) {}
+
+bool system_backend_process_sample(system_sampler_t *sampler, system_process_t *process, uint32_t worker_index) {
+    return false;
+}
+
+double system_backend_read_energy(system_sampler_t *sampler) {
+    return 0.0;
+}
+
+bool system_backend_reports_thread_energy(const system_sampler_t *sampler) {
+    return false;
+}
+
+#endif /* TARGET_OS_OSX */
+
+#endif /* defined(__APPLE__) */
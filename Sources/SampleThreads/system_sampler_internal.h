@@ -0,0 +1,124 @@
+//
+//  system_sampler_internal.h
+//
+
+#ifndef system_sampler_internal_h
+#define system_sampler_internal_h
+
+#include "system_sampler.h"
+#include "worker_pool.h"
+
+/// The change of a thread's counters since the previous tick.
+typedef struct {
+    uint64_t thread_id;
+    system_sample_name_t name;
+    uint64_t cycles;
+    uint64_t instructions;
+    /// CPU time, in seconds.
+    double cpu_time;
+    /// Energy, J. Left at 0 by backends that apportion the system's energy instead.
+    double energy;
+} system_thread_row_t;
+
+typedef struct {
+    int32_t pid;
+    system_sample_name_t name;
+    /// Whether the process couldn't be set up (ie: it belongs to another user), so it's not
+    /// tried again for as long as its PID exists.
+    bool unreadable;
+    /// Whether the process could be sampled in the current tick.
+    bool sampled;
+    /// The rows of the process' threads in the current tick, sorted by thread ID. Written
+    /// only by the worker sampling the process.
+    system_thread_row_t *rows;
+    uint32_t row_count;
+    uint32_t row_capacity;
+    /// Platform-specific state of the process, owned by the backend.
+    void *backend;
+} system_process_t;
+
+struct system_sampler {
+    system_sampler_config_t config;
+    worker_pool_t *pool;
+
+    /// Tracked processes, sorted by PID.
+    system_process_t *processes;
+    uint32_t process_count;
+    uint32_t process_capacity;
+    /// The array the processes are merged into when they're enumerated again.
+    system_process_t *spare_processes;
+    uint32_t spare_process_capacity;
+    /// PIDs found by the latest enumeration, in any order.
+    int32_t *pids;
+    uint32_t pid_count;
+    uint32_t pid_capacity;
+
+    /// Time of the previous tick in nanoseconds, 0 if there's no previous tick.
+    uint64_t previous_sample_time_ns;
+
+    // Columns of the latest batch, with room for `process_column_capacity` processes and
+    // `thread_column_capacity` threads.
+    uint32_t process_column_capacity;
+    int32_t *process_ids;
+    system_sample_name_t *process_names;
+    uint32_t *process_first_thread;
+    uint32_t *process_thread_count;
+    uint64_t *process_cycles;
+    uint64_t *process_instructions;
+    double *process_cpu_time;
+    double *process_energy;
+    uint32_t thread_column_capacity;
+    uint64_t *thread_ids;
+    uint32_t *thread_process_index;
+    system_sample_name_t *thread_names;
+    uint64_t *thread_cycles;
+    uint64_t *thread_instructions;
+    double *thread_cpu_time;
+    double *thread_energy;
+
+    /// Platform-specific state, owned by the backend.
+    void *backend;
+};
+
+/// Appends a PID to `sampler->pids`.
+bool system_sampler_add_pid(system_sampler_t *sampler, int32_t pid);
+
+/// Ensures there's room for at least `count` rows in the process.
+bool system_process_reserve_rows(system_process_t *process, uint32_t count);
+
+// MARK: - Backend
+
+// Each platform (system_sampler_linux.c on Linux, system_sampler_apple.c on macOS)
+// implements the functions below.
+
+/// Creates the platform-specific state of the sampler, storing it in `sampler->backend`.
+bool system_backend_create(system_sampler_t *sampler);
+
+/// Destroys the platform-specific state of the sampler.
+void system_backend_destroy(system_sampler_t *sampler);
+
+/// Fills `sampler->pids` with the PIDs of all the processes in the system (`pid_count` is 0
+/// on entry).
+void system_backend_list_processes(system_sampler_t *sampler);
+
+/// Creates the platform-specific state of a process seen for the first time, storing it in
+/// `process->backend`, and fills its name. Called concurrently for different processes.
+/// - Returns: `false` if the process can't be sampled (ie: it exited, or it's not readable).
+bool system_backend_process_create(system_sampler_t *sampler, system_process_t *process);
+
+/// Destroys the platform-specific state of a process.
+void system_backend_process_destroy(system_sampler_t *sampler, system_process_t *process);
+
+/// Samples all the threads of a process, filling `process->rows`. Called concurrently for
+/// different processes, each one on a worker identified by `worker_index`.
+/// - Returns: `false` if the process exited.
+bool system_backend_process_sample(system_sampler_t *sampler, system_process_t *process, uint32_t worker_index);
+
+/// Energy used by the whole system since the previous call, J.
+double system_backend_read_energy(system_sampler_t *sampler);
+
+/// Whether the backend reports the energy of each thread itself. Otherwise, the energy of
+/// the system is apportioned to the threads proportionally to their CPU time.
+bool system_backend_reports_thread_energy(const system_sampler_t *sampler);
+
+#endif /* system_sampler_internal_h */
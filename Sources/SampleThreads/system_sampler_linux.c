@@ -0,0 +1,384 @@
+//
+//  system_sampler_linux.c
+//
+
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include "system_sampler_internal.h"
+#include "linux_procfs.h"
+#include "linux_rapl.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// The system-wide backend only reads CPU time, from /proc/<pid>/task/<tid>/schedstat:
+// opening perf events for every thread in the system would take two file descriptors per
+// thread and CAP_PERFMON, so cycles and instructions are reported as 0, and the RAPL
+// package energy is apportioned by CPU time.
+//
+// File descriptors are kept open between ticks (the /proc directory, each process'
+// task directory and each thread's schedstat file) so that a tick costs a getdents64 per
+// process and a pread per thread. As a system can have many thousands of threads, at most
+// half of RLIMIT_NOFILE is used for them: past that, schedstat files are opened and closed
+// on every tick instead.
+
+// Size of the buffers used to read directory entries.
+#define DIRECTORY_BUFFER_SIZE 32768
+// File descriptors left for the rest of the process if RLIMIT_NOFILE can't be read.
+#define DEFAULT_FD_BUDGET 512
+
+typedef struct {
+    pid_t tid;
+    /// File descriptor for /proc/<pid>/task/<tid>/schedstat, -1 if it's opened on every tick.
+    int schedstat_fd;
+    /// Whether the thread was found in the latest enumeration of the task directory.
+    bool alive;
+    /// Whether `previous_time_ns` holds the CPU time of a previous tick.
+    bool has_previous;
+    /// Name of the thread, retrieved from /proc/<pid>/task/<tid>/comm.
+    system_sample_name_t name;
+    /// CPU time at the previous tick, in nanoseconds.
+    uint64_t previous_time_ns;
+} linux_task_t;
+
+typedef struct {
+    /// File descriptor for /proc/<pid>/task.
+    int task_dir_fd;
+    /// Tracked threads, sorted by thread ID.
+    linux_task_t *tasks;
+    uint32_t task_count;
+    uint32_t task_capacity;
+} linux_process_t;
+
+typedef struct {
+    /// File descriptor for /proc.
+    int proc_dir_fd;
+    /// RAPL package energy counters.
+    rapl_reader_t rapl;
+    /// Number of file descriptors that may still be kept open between ticks.
+    _Atomic int64_t fd_budget;
+    /// A buffer to read directory entries for each worker. The records returned by
+    /// getdents64 are 8-byte aligned relative to the start of the buffer, and malloc returns
+    /// memory aligned for any type.
+    char **directory_buffers;
+    uint32_t worker_count;
+} linux_system_backend_t;
+
+// MARK: - File descriptors
+
+/// Takes a file descriptor from the budget.
+/// - Returns: `false` if the budget is exhausted, so the file must not be kept open.
+static bool acquire_fd(linux_system_backend_t *backend) {
+    if (atomic_fetch_sub_explicit(&backend->fd_budget, 1, memory_order_relaxed) > 0) {
+        return true;
+    }
+    atomic_fetch_add_explicit(&backend->fd_budget, 1, memory_order_relaxed);
+    return false;
+}
+
+static void release_fd(linux_system_backend_t *backend, int fd) {
+    close(fd);
+    atomic_fetch_add_explicit(&backend->fd_budget, 1, memory_order_relaxed);
+}
+
+static int64_t initial_fd_budget(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return DEFAULT_FD_BUDGET;
+    }
+    return (int64_t) limit.rlim_cur / 2;
+}
+
+static void read_name_at(int dir_fd, const char *path, system_sample_name_t *name) {
+    name->name[0] = '\0';
+    int fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (read_file_at(fd, name->name, sizeof(name->name))) {
+        name->name[strcspn(name->name, "\n")] = '\0';
+    }
+    close(fd);
+}
+
+// MARK: - Threads
+
+/// Returns the index of the thread with the given ID, or the index where it should be
+/// inserted (as a negative number, minus one) if it's not tracked yet.
+static int64_t find_task(const linux_process_t *process, pid_t tid) {
+    int64_t low = 0;
+    int64_t high = (int64_t) process->task_count - 1;
+    while (low <= high) {
+        int64_t middle = (low + high) / 2;
+        pid_t middle_tid = process->tasks[middle].tid;
+        if (middle_tid == tid) {
+            return middle;
+        } else if (middle_tid < tid) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -(low + 1);
+}
+
+static void track_task(linux_system_backend_t *backend, linux_process_t *process, pid_t tid) {
+    int64_t index = find_task(process, tid);
+    if (index >= 0) {
+        process->tasks[index].alive = true;
+        return;
+    }
+    index = -(index + 1);
+
+    if (process->task_count == process->task_capacity) {
+        uint32_t new_capacity = process->task_capacity == 0 ? 4 : process->task_capacity * 2;
+        linux_task_t *new_tasks = realloc(process->tasks, new_capacity * sizeof(linux_task_t));
+        if (new_tasks == NULL) {
+            return;
+        }
+        process->tasks = new_tasks;
+        process->task_capacity = new_capacity;
+    }
+    memmove(&process->tasks[index + 1],
+            &process->tasks[index],
+            (process->task_count - index) * sizeof(linux_task_t));
+    process->task_count += 1;
+
+    linux_task_t *task = &process->tasks[index];
+    memset(task, 0, sizeof(linux_task_t));
+    task->tid = tid;
+    task->alive = true;
+    task->schedstat_fd = -1;
+
+    char path[64];
+    if (acquire_fd(backend)) {
+        snprintf(path, sizeof(path), "%d/schedstat", tid);
+        task->schedstat_fd = openat(process->task_dir_fd, path, O_RDONLY | O_CLOEXEC);
+        if (task->schedstat_fd < 0) {
+            atomic_fetch_add_explicit(&backend->fd_budget, 1, memory_order_relaxed);
+        }
+    }
+    snprintf(path, sizeof(path), "%d/comm", tid);
+    read_name_at(process->task_dir_fd, path, &task->name);
+}
+
+static void close_task(linux_system_backend_t *backend, linux_task_t *task) {
+    if (task->schedstat_fd >= 0) {
+        release_fd(backend, task->schedstat_fd);
+        task->schedstat_fd = -1;
+    }
+}
+
+/// Re-reads the task directory of a process, tracking new threads and dropping the ones
+/// that exited.
+/// - Returns: `false` if the process exited.
+static bool enumerate_tasks(linux_system_backend_t *backend, linux_process_t *process, char *buffer) {
+    for (uint32_t i = 0; i < process->task_count; i++) {
+        process->tasks[i].alive = false;
+    }
+
+    bool found_tasks = false;
+    lseek(process->task_dir_fd, 0, SEEK_SET);
+    while (true) {
+        long length = read_directory_entries(process->task_dir_fd, buffer, DIRECTORY_BUFFER_SIZE);
+        if (length <= 0) {
+            break;
+        }
+        for (long offset = 0; offset < length;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *) (buffer + offset);
+            offset += entry->d_reclen;
+            long tid = parse_numeric_entry(entry->d_name);
+            if (tid < 0) {
+                continue;
+            }
+            track_task(backend, process, (pid_t) tid);
+            found_tasks = true;
+        }
+    }
+
+    // Compact the array, closing the files of the threads that exited.
+    uint32_t alive_count = 0;
+    for (uint32_t i = 0; i < process->task_count; i++) {
+        if (process->tasks[i].alive) {
+            process->tasks[alive_count] = process->tasks[i];
+            alive_count += 1;
+        } else {
+            close_task(backend, &process->tasks[i]);
+        }
+    }
+    process->task_count = alive_count;
+    // The task directory of a process that exited is empty, even if a new process was
+    // given the same PID since.
+    return found_tasks;
+}
+
+/// Reads the CPU time of a thread from its schedstat file.
+static bool read_task_time(const linux_process_t *process, const linux_task_t *task, uint64_t *time_ns) {
+    char buffer[96];
+    bool success;
+    if (task->schedstat_fd >= 0) {
+        success = read_file_at(task->schedstat_fd, buffer, sizeof(buffer));
+    } else {
+        char path[64];
+        snprintf(path, sizeof(path), "%d/schedstat", task->tid);
+        int fd = openat(process->task_dir_fd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        success = read_file_at(fd, buffer, sizeof(buffer));
+        close(fd);
+    }
+    if (!success) {
+        return false;
+    }
+    // schedstat contains: time spent on the cpu (ns), time spent waiting on a runqueue (ns)
+    // and number of timeslices run on this cpu.
+    *time_ns = strtoull(buffer, NULL, 10);
+    return true;
+}
+
+// MARK: - Backend
+
+bool system_backend_create(system_sampler_t *sampler) {
+    linux_system_backend_t *backend = calloc(1, sizeof(linux_system_backend_t));
+    if (backend == NULL) {
+        return false;
+    }
+    backend->worker_count = worker_pool_worker_count(sampler->pool);
+    backend->directory_buffers = calloc(backend->worker_count, sizeof(char *));
+    backend->proc_dir_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    bool succeeded = backend->directory_buffers != NULL && backend->proc_dir_fd >= 0;
+    for (uint32_t i = 0; succeeded && i < backend->worker_count; i++) {
+        backend->directory_buffers[i] = malloc(DIRECTORY_BUFFER_SIZE);
+        succeeded = backend->directory_buffers[i] != NULL;
+    }
+    if (!succeeded) {
+        sampler->backend = backend;
+        system_backend_destroy(sampler);
+        return false;
+    }
+    atomic_store_explicit(&backend->fd_budget, initial_fd_budget(), memory_order_relaxed);
+    rapl_reader_open(&backend->rapl);
+    sampler->backend = backend;
+    return true;
+}
+
+void system_backend_destroy(system_sampler_t *sampler) {
+    linux_system_backend_t *backend = sampler->backend;
+    if (backend->directory_buffers != NULL) {
+        for (uint32_t i = 0; i < backend->worker_count; i++) {
+            free(backend->directory_buffers[i]);
+        }
+        free(backend->directory_buffers);
+    }
+    if (backend->proc_dir_fd >= 0) {
+        close(backend->proc_dir_fd);
+    }
+    rapl_reader_close(&backend->rapl);
+    free(backend);
+    sampler->backend = NULL;
+}
+
+void system_backend_list_processes(system_sampler_t *sampler) {
+    linux_system_backend_t *backend = sampler->backend;
+    // Processes are listed before the workers start, so any buffer is free.
+    char *buffer = backend->directory_buffers[0];
+    lseek(backend->proc_dir_fd, 0, SEEK_SET);
+    while (true) {
+        long length = read_directory_entries(backend->proc_dir_fd, buffer, DIRECTORY_BUFFER_SIZE);
+        if (length <= 0) {
+            break;
+        }
+        for (long offset = 0; offset < length;) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *) (buffer + offset);
+            offset += entry->d_reclen;
+            long pid = parse_numeric_entry(entry->d_name);
+            if (pid < 0) {
+                // Skip the entries that are not processes (ie: "self", "meminfo"...)
+                continue;
+            }
+            if (!system_sampler_add_pid(sampler, (int32_t) pid)) {
+                return;
+            }
+        }
+    }
+}
+
+bool system_backend_process_create(system_sampler_t *sampler, system_process_t *process) {
+    linux_system_backend_t *backend = sampler->backend;
+    linux_process_t *linux_process = calloc(1, sizeof(linux_process_t));
+    if (linux_process == NULL) {
+        return false;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "%d/task", process->pid);
+    // The task directory is always kept open, as it's needed to tell whether the process
+    // exited, but it counts towards the budget.
+    atomic_fetch_sub_explicit(&backend->fd_budget, 1, memory_order_relaxed);
+    linux_process->task_dir_fd = openat(backend->proc_dir_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (linux_process->task_dir_fd < 0) {
+        atomic_fetch_add_explicit(&backend->fd_budget, 1, memory_order_relaxed);
+        free(linux_process);
+        return false;
+    }
+    snprintf(path, sizeof(path), "%d/comm", process->pid);
+    read_name_at(backend->proc_dir_fd, path, &process->name);
+    process->backend = linux_process;
+    return true;
+}
+
+void system_backend_process_destroy(system_sampler_t *sampler, system_process_t *process) {
+    linux_system_backend_t *backend = sampler->backend;
+    linux_process_t *linux_process = process->backend;
+    for (uint32_t i = 0; i < linux_process->task_count; i++) {
+        close_task(backend, &linux_process->tasks[i]);
+    }
+    free(linux_process->tasks);
+    release_fd(backend, linux_process->task_dir_fd);
+    free(linux_process);
+}
+
+bool system_backend_process_sample(system_sampler_t *sampler, system_process_t *process, uint32_t worker_index) {
+    linux_system_backend_t *backend = sampler->backend;
+    linux_process_t *linux_process = process->backend;
+    if (!enumerate_tasks(backend, linux_process, backend->directory_buffers[worker_index])) {
+        return false;
+    }
+    if (!system_process_reserve_rows(process, linux_process->task_count)) {
+        return true;
+    }
+    for (uint32_t i = 0; i < linux_process->task_count; i++) {
+        linux_task_t *task = &linux_process->tasks[i];
+        uint64_t time_ns;
+        if (!read_task_time(linux_process, task, &time_ns)) {
+            // The thread exited since the directory was read.
+            continue;
+        }
+        system_thread_row_t *row = &process->rows[process->row_count++];
+        memset(row, 0, sizeof(system_thread_row_t));
+        row->thread_id = (uint64_t) task->tid;
+        row->name = task->name;
+        if (task->has_previous && time_ns >= task->previous_time_ns) {
+            row->cpu_time = (time_ns - task->previous_time_ns) / 1e9;
+        }
+        task->previous_time_ns = time_ns;
+        task->has_previous = true;
+    }
+    return true;
+}
+
+double system_backend_read_energy(system_sampler_t *sampler) {
+    linux_system_backend_t *backend = sampler->backend;
+    return rapl_reader_read_energy(&backend->rapl);
+}
+
+bool system_backend_reports_thread_energy(const system_sampler_t *sampler) {
+    // RAPL only measures whole packages.
+    (void) sampler;
+    return false;
+}
+
+#endif /* defined(__linux__) */
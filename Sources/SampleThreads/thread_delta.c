@@ -0,0 +1,458 @@
+//
+//  thread_delta.c
+//
+
+#include "thread_delta.h"
+#include "sampler_stats_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Marks an empty entry in the thread ID → slot table.
+#define EMPTY_SLOT UINT32_MAX
+// Initial capacities. The table is kept at most half full.
+#define INITIAL_TABLE_CAPACITY 128
+#define INITIAL_SLOT_CAPACITY 64
+
+// The counters tracked for each thread and core cluster, split in integer and floating point
+// columns so each one can be processed as a contiguous array. The columns of cluster `c` are
+// at `c * COLUMNS_PER_CLUSTER + COLUMN_*`.
+enum {
+    COLUMN_CYCLES,
+    COLUMN_INSTRUCTIONS
+};
+enum {
+    COLUMN_ENERGY,
+    COLUMN_TIME
+};
+#define COLUMNS_PER_CLUSTER 2
+#define MAX_COLUMN_COUNT (SAMPLE_MAX_CLUSTERS * COLUMNS_PER_CLUSTER)
+
+typedef struct {
+    uint64_t *integers[MAX_COLUMN_COUNT];
+    double *reals[MAX_COLUMN_COUNT];
+} counter_columns_t;
+
+struct thread_delta_engine {
+    /// Number of clusters of the counters, and of integer (and floating point) columns.
+    uint32_t cluster_count;
+    uint32_t column_count;
+
+    // Open-addressed (linear probing) thread ID → slot table.
+    uint64_t *table_thread_ids;
+    uint32_t *table_slots;
+    uint32_t table_capacity;
+    uint32_t table_count;
+
+    // Per-slot state, indexed by slot.
+    uint32_t slot_capacity;
+    /// Number of slots ever handed out (free slots included).
+    uint32_t slot_count;
+    uint64_t *slot_thread_ids;
+    /// Epoch in which the slot's thread was last seen, 0 if the slot is free.
+    uint64_t *slot_epochs;
+    /// Counters of each slot at the previous sample.
+    counter_columns_t previous;
+    /// Stack of free slots.
+    uint32_t *free_slots;
+    uint32_t free_slot_count;
+
+    /// Incremented on every update.
+    uint64_t epoch;
+
+    // Per-record scratch state, indexed like the records of the current update.
+    uint32_t scratch_capacity;
+    counter_columns_t current;
+    counter_columns_t gathered;
+
+    // Events of the latest update.
+    thread_event_t *events;
+    uint32_t event_count;
+    uint32_t event_capacity;
+};
+
+// MARK: - Memory
+
+static bool resize_columns(counter_columns_t *columns, uint32_t column_count, uint32_t capacity) {
+    for (uint32_t c = 0; c < column_count; c++) {
+        uint64_t *column = realloc(columns->integers[c], capacity * sizeof(uint64_t));
+        sampler_count_allocation();
+        if (column == NULL) {
+            return false;
+        }
+        columns->integers[c] = column;
+    }
+    for (uint32_t c = 0; c < column_count; c++) {
+        double *column = realloc(columns->reals[c], capacity * sizeof(double));
+        sampler_count_allocation();
+        if (column == NULL) {
+            return false;
+        }
+        columns->reals[c] = column;
+    }
+    return true;
+}
+
+static void free_columns(counter_columns_t *columns) {
+    for (int c = 0; c < MAX_COLUMN_COUNT; c++) {
+        free(columns->integers[c]);
+        free(columns->reals[c]);
+    }
+}
+
+static bool reserve_slots(thread_delta_engine_t *engine, uint32_t count) {
+    if (count <= engine->slot_capacity) {
+        return true;
+    }
+    uint32_t new_capacity = engine->slot_capacity == 0 ? INITIAL_SLOT_CAPACITY : engine->slot_capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    uint64_t *thread_ids = realloc(engine->slot_thread_ids, new_capacity * sizeof(uint64_t));
+    sampler_count_allocation();
+    if (thread_ids == NULL) {
+        return false;
+    }
+    engine->slot_thread_ids = thread_ids;
+    uint64_t *epochs = realloc(engine->slot_epochs, new_capacity * sizeof(uint64_t));
+    sampler_count_allocation();
+    if (epochs == NULL) {
+        return false;
+    }
+    engine->slot_epochs = epochs;
+    uint32_t *free_slots = realloc(engine->free_slots, new_capacity * sizeof(uint32_t));
+    sampler_count_allocation();
+    if (free_slots == NULL) {
+        return false;
+    }
+    engine->free_slots = free_slots;
+    if (!resize_columns(&engine->previous, engine->column_count, new_capacity)) {
+        return false;
+    }
+    engine->slot_capacity = new_capacity;
+    return true;
+}
+
+static bool reserve_scratch(thread_delta_engine_t *engine, uint32_t count) {
+    if (count <= engine->scratch_capacity) {
+        return true;
+    }
+    uint32_t new_capacity = engine->scratch_capacity == 0 ? INITIAL_SLOT_CAPACITY : engine->scratch_capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    if (!resize_columns(&engine->current, engine->column_count, new_capacity)
+        || !resize_columns(&engine->gathered, engine->column_count, new_capacity)) {
+        return false;
+    }
+    engine->scratch_capacity = new_capacity;
+    return true;
+}
+
+static bool reserve_events(thread_delta_engine_t *engine, uint32_t count) {
+    if (count <= engine->event_capacity) {
+        return true;
+    }
+    uint32_t new_capacity = engine->event_capacity == 0 ? INITIAL_SLOT_CAPACITY : engine->event_capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    thread_event_t *events = realloc(engine->events, new_capacity * sizeof(thread_event_t));
+    sampler_count_allocation();
+    if (events == NULL) {
+        return false;
+    }
+    engine->events = events;
+    engine->event_capacity = new_capacity;
+    return true;
+}
+
+// MARK: - Table
+
+static inline uint32_t table_home(const thread_delta_engine_t *engine, uint64_t thread_id) {
+    // Fibonacci hashing: thread IDs are usually sequential, so spread them out.
+    return (uint32_t) ((thread_id * 0x9E3779B97F4A7C15ull) >> 32) & (engine->table_capacity - 1);
+}
+
+static uint32_t table_find(const thread_delta_engine_t *engine, uint64_t thread_id) {
+    uint32_t mask = engine->table_capacity - 1;
+    for (uint32_t i = table_home(engine, thread_id);; i = (i + 1) & mask) {
+        if (engine->table_slots[i] == EMPTY_SLOT) {
+            return EMPTY_SLOT;
+        }
+        if (engine->table_thread_ids[i] == thread_id) {
+            return engine->table_slots[i];
+        }
+    }
+}
+
+static void table_insert_unchecked(thread_delta_engine_t *engine, uint64_t thread_id, uint32_t slot) {
+    uint32_t mask = engine->table_capacity - 1;
+    uint32_t i = table_home(engine, thread_id);
+    while (engine->table_slots[i] != EMPTY_SLOT) {
+        i = (i + 1) & mask;
+    }
+    engine->table_thread_ids[i] = thread_id;
+    engine->table_slots[i] = slot;
+    engine->table_count += 1;
+}
+
+static bool table_resize(thread_delta_engine_t *engine, uint32_t new_capacity) {
+    uint64_t *old_thread_ids = engine->table_thread_ids;
+    uint32_t *old_slots = engine->table_slots;
+    uint32_t old_capacity = engine->table_capacity;
+
+    uint64_t *thread_ids = malloc(new_capacity * sizeof(uint64_t));
+    uint32_t *slots = malloc(new_capacity * sizeof(uint32_t));
+    sampler_count_allocation();
+    sampler_count_allocation();
+    if (thread_ids == NULL || slots == NULL) {
+        free(thread_ids);
+        free(slots);
+        return false;
+    }
+    memset(slots, 0xFF, new_capacity * sizeof(uint32_t));
+    engine->table_thread_ids = thread_ids;
+    engine->table_slots = slots;
+    engine->table_capacity = new_capacity;
+    engine->table_count = 0;
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i] != EMPTY_SLOT) {
+            table_insert_unchecked(engine, old_thread_ids[i], old_slots[i]);
+        }
+    }
+    free(old_thread_ids);
+    free(old_slots);
+    return true;
+}
+
+static bool table_insert(thread_delta_engine_t *engine, uint64_t thread_id, uint32_t slot) {
+    if ((engine->table_count + 1) * 2 > engine->table_capacity) {
+        if (!table_resize(engine, engine->table_capacity * 2)) {
+            return false;
+        }
+    }
+    table_insert_unchecked(engine, thread_id, slot);
+    return true;
+}
+
+static void table_remove(thread_delta_engine_t *engine, uint64_t thread_id) {
+    uint32_t mask = engine->table_capacity - 1;
+    uint32_t i = table_home(engine, thread_id);
+    while (engine->table_thread_ids[i] != thread_id || engine->table_slots[i] == EMPTY_SLOT) {
+        if (engine->table_slots[i] == EMPTY_SLOT) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    // Backward-shift deletion: move back any entry of the cluster that would become
+    // unreachable once this entry is emptied, so no tombstones are needed.
+    uint32_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (engine->table_slots[j] == EMPTY_SLOT) {
+            break;
+        }
+        uint32_t home = table_home(engine, engine->table_thread_ids[j]);
+        bool home_is_cyclically_in_range = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!home_is_cyclically_in_range) {
+            engine->table_thread_ids[i] = engine->table_thread_ids[j];
+            engine->table_slots[i] = engine->table_slots[j];
+            i = j;
+        }
+    }
+    engine->table_slots[i] = EMPTY_SLOT;
+    engine->table_count -= 1;
+}
+
+// MARK: - Engine
+
+thread_delta_engine_t *thread_delta_engine_create(uint32_t cluster_count) {
+    thread_delta_engine_t *engine = calloc(1, sizeof(thread_delta_engine_t));
+    if (engine == NULL) {
+        return NULL;
+    }
+    if (cluster_count == 0) {
+        cluster_count = 1;
+    } else if (cluster_count > SAMPLE_MAX_CLUSTERS) {
+        cluster_count = SAMPLE_MAX_CLUSTERS;
+    }
+    engine->cluster_count = cluster_count;
+    engine->column_count = cluster_count * COLUMNS_PER_CLUSTER;
+    if (!table_resize(engine, INITIAL_TABLE_CAPACITY)
+        || !reserve_slots(engine, INITIAL_SLOT_CAPACITY)
+        || !reserve_scratch(engine, INITIAL_SLOT_CAPACITY)
+        || !reserve_events(engine, INITIAL_SLOT_CAPACITY)) {
+        thread_delta_engine_destroy(engine);
+        return NULL;
+    }
+    return engine;
+}
+
+void thread_delta_engine_destroy(thread_delta_engine_t *engine) {
+    if (engine == NULL) {
+        return;
+    }
+    free(engine->table_thread_ids);
+    free(engine->table_slots);
+    free(engine->slot_thread_ids);
+    free(engine->slot_epochs);
+    free(engine->free_slots);
+    free_columns(&engine->previous);
+    free_columns(&engine->current);
+    free_columns(&engine->gathered);
+    free(engine->events);
+    free(engine);
+}
+
+const thread_event_t *thread_delta_engine_events(const thread_delta_engine_t *engine, uint32_t *event_count) {
+    *event_count = engine->event_count;
+    return engine->events;
+}
+
+static inline void load_counters(const thread_delta_engine_t *engine, counter_columns_t *columns, uint32_t index, const sampled_thread_info_t *info) {
+    for (uint32_t cluster = 0; cluster < engine->cluster_count; cluster++) {
+        const cpu_counters_t *counters = &info->clusters[cluster];
+        uint32_t first_column = cluster * COLUMNS_PER_CLUSTER;
+        columns->integers[first_column + COLUMN_CYCLES][index] = counters->cycles;
+        columns->integers[first_column + COLUMN_INSTRUCTIONS][index] = counters->instructions;
+        columns->reals[first_column + COLUMN_ENERGY][index] = counters->energy;
+        columns->reals[first_column + COLUMN_TIME][index] = counters->time;
+    }
+}
+
+static inline void copy_counters(const thread_delta_engine_t *engine,
+                                 counter_columns_t *destination, uint32_t destination_index,
+                                 const counter_columns_t *source, uint32_t source_index) {
+    for (uint32_t c = 0; c < engine->column_count; c++) {
+        destination->integers[c][destination_index] = source->integers[c][source_index];
+        destination->reals[c][destination_index] = source->reals[c][source_index];
+    }
+}
+
+bool thread_delta_engine_update(thread_delta_engine_t *engine,
+                                sampled_thread_record_t *records,
+                                uint32_t record_count,
+                                cpu_counters_t *cluster_totals) {
+
+    // Worst case: every record is a new thread, and every known thread died.
+    uint32_t max_slot_count = engine->slot_count + record_count;
+    if (!reserve_scratch(engine, record_count)
+        || !reserve_slots(engine, max_slot_count)
+        || !reserve_events(engine, record_count + engine->slot_count)) {
+        return false;
+    }
+
+    engine->epoch += 1;
+    engine->event_count = 0;
+
+    // First pass: find (or assign) the slot of each thread, and gather the current and
+    // previous counters into contiguous per-record columns.
+    for (uint32_t i = 0; i < record_count; i++) {
+        sampled_thread_record_t *record = &records[i];
+        uint64_t thread_id = record->info.thread_id;
+        load_counters(engine, &engine->current, i, &record->info);
+
+        uint32_t slot = table_find(engine, thread_id);
+        if (slot == EMPTY_SLOT) {
+            if (engine->free_slot_count > 0) {
+                engine->free_slot_count -= 1;
+                slot = engine->free_slots[engine->free_slot_count];
+            } else {
+                slot = engine->slot_count;
+                engine->slot_count += 1;
+            }
+            if (!table_insert(engine, thread_id, slot)) {
+                return false;
+            }
+            engine->slot_thread_ids[slot] = thread_id;
+            engine->events[engine->event_count++] = (thread_event_t) {
+                .type = THREAD_EVENT_BIRTH,
+                .slot = slot,
+                .thread_id = thread_id
+            };
+            // New threads have no previous sample: gather their current counters so their
+            // deltas are zero.
+            copy_counters(engine, &engine->gathered, i, &engine->current, i);
+            record->is_new = true;
+        } else {
+            copy_counters(engine, &engine->gathered, i, &engine->previous, slot);
+            record->is_new = false;
+        }
+        engine->slot_epochs[slot] = engine->epoch;
+        record->slot = slot;
+    }
+
+    // Second pass: compute the deltas and their totals, one column at a time. Counters can
+    // only go down if they were reset, so negative deltas are clamped to zero. These loops
+    // only touch contiguous arrays, so they can be vectorized by the compiler.
+    uint64_t integer_totals[MAX_COLUMN_COUNT];
+    double real_totals[MAX_COLUMN_COUNT];
+    for (uint32_t c = 0; c < engine->column_count; c++) {
+        const uint64_t *restrict current = engine->current.integers[c];
+        uint64_t *restrict gathered = engine->gathered.integers[c];
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < record_count; i++) {
+            uint64_t delta = current[i] > gathered[i] ? current[i] - gathered[i] : 0;
+            gathered[i] = delta;
+            total += delta;
+        }
+        integer_totals[c] = total;
+    }
+    for (uint32_t c = 0; c < engine->column_count; c++) {
+        const double *restrict current = engine->current.reals[c];
+        double *restrict gathered = engine->gathered.reals[c];
+        double total = 0.0;
+        for (uint32_t i = 0; i < record_count; i++) {
+            double delta = current[i] - gathered[i];
+            delta = delta > 0.0 ? delta : 0.0;
+            gathered[i] = delta;
+            total += delta;
+        }
+        real_totals[c] = total;
+    }
+    memset(cluster_totals, 0, SAMPLE_MAX_CLUSTERS * sizeof(cpu_counters_t));
+    for (uint32_t cluster = 0; cluster < engine->cluster_count; cluster++) {
+        uint32_t first_column = cluster * COLUMNS_PER_CLUSTER;
+        cluster_totals[cluster].cycles = integer_totals[first_column + COLUMN_CYCLES];
+        cluster_totals[cluster].instructions = integer_totals[first_column + COLUMN_INSTRUCTIONS];
+        cluster_totals[cluster].energy = real_totals[first_column + COLUMN_ENERGY];
+        cluster_totals[cluster].time = real_totals[first_column + COLUMN_TIME];
+    }
+
+    // Third pass: write the deltas back to the records, and store the current counters as
+    // the previous counters of each slot.
+    for (uint32_t i = 0; i < record_count; i++) {
+        sampled_thread_record_t *record = &records[i];
+        const counter_columns_t *deltas = &engine->gathered;
+        for (uint32_t cluster = 0; cluster < engine->cluster_count; cluster++) {
+            uint32_t first_column = cluster * COLUMNS_PER_CLUSTER;
+            record->deltas[cluster].cycles = deltas->integers[first_column + COLUMN_CYCLES][i];
+            record->deltas[cluster].instructions = deltas->integers[first_column + COLUMN_INSTRUCTIONS][i];
+            record->deltas[cluster].energy = deltas->reals[first_column + COLUMN_ENERGY][i];
+            record->deltas[cluster].time = deltas->reals[first_column + COLUMN_TIME][i];
+        }
+        memset(&record->deltas[engine->cluster_count], 0,
+               (SAMPLE_MAX_CLUSTERS - engine->cluster_count) * sizeof(cpu_counters_t));
+        copy_counters(engine, &engine->previous, record->slot, &engine->current, i);
+    }
+
+    // Finally, free the slots of the threads that were not seen in this update.
+    for (uint32_t slot = 0; slot < engine->slot_count; slot++) {
+        uint64_t slot_epoch = engine->slot_epochs[slot];
+        if (slot_epoch == 0 || slot_epoch == engine->epoch) {
+            continue;
+        }
+        uint64_t thread_id = engine->slot_thread_ids[slot];
+        table_remove(engine, thread_id);
+        engine->slot_epochs[slot] = 0;
+        engine->free_slots[engine->free_slot_count++] = slot;
+        engine->events[engine->event_count++] = (thread_event_t) {
+            .type = THREAD_EVENT_DEATH,
+            .slot = slot,
+            .thread_id = thread_id
+        };
+    }
+
+    return true;
+}
@@ -0,0 +1,40 @@
+//
+//  thread_delta.h
+//
+
+#ifndef thread_delta_h
+#define thread_delta_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sample_session.h"
+
+/// Computes the per-thread counter deltas between consecutive samples of a session.
+///
+/// Each thread is assigned a stable slot when it's first seen, found through an
+/// open-addressed thread ID → slot table that persists between samples. The counters of the
+/// previous sample are stored per slot in struct-of-arrays form, so computing the deltas of
+/// all threads is a single pass over contiguous arrays, without sorting or rebuilding any
+/// table. Slots are recycled when their threads exit.
+typedef struct thread_delta_engine thread_delta_engine_t;
+
+/// Creates an engine for counters broken down by `cluster_count` core clusters (at most
+/// `SAMPLE_MAX_CLUSTERS`). Only the columns of those clusters are stored and processed.
+thread_delta_engine_t *thread_delta_engine_create(uint32_t cluster_count);
+
+void thread_delta_engine_destroy(thread_delta_engine_t *engine);
+
+/// Fills the `slot`, `is_new` and delta counters of the given records, and records the
+/// births and deaths of threads since the previous call. The sums of the deltas of all the
+/// records are written to `cluster_totals`, which must have room for `SAMPLE_MAX_CLUSTERS`
+/// counters. Deltas and totals of the clusters past the engine's cluster count are zero.
+/// - Returns: `false` if the engine failed to allocate memory.
+bool thread_delta_engine_update(thread_delta_engine_t *engine,
+                                sampled_thread_record_t *records,
+                                uint32_t record_count,
+                                cpu_counters_t *cluster_totals);
+
+/// The births and deaths recorded in the latest call to `thread_delta_engine_update`.
+const thread_event_t *thread_delta_engine_events(const thread_delta_engine_t *engine, uint32_t *event_count);
+
+#endif /* thread_delta_h */
@@ -0,0 +1,307 @@
+//
+//  worker_pool.c
+//
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "worker_pool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+// Each worker claims this many chunks per batch on average: small enough chunks to balance
+// uneven tasks, but large enough to keep the number of atomic operations low.
+#define CHUNKS_PER_WORKER 8
+// Shards are aligned to cache lines, so claiming tasks from a shard doesn't invalidate the
+// other workers' shards.
+#define CACHE_LINE_SIZE 64
+
+typedef struct {
+    worker_pool_t *pool;
+    uint32_t worker_index;
+} worker_t;
+
+/// The tasks of a batch initially assigned to a worker: `[next_task, end)`.
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t next_task;
+    uint32_t end;
+} worker_shard_t;
+
+struct worker_pool {
+    pthread_t *threads;
+    worker_t *workers;
+    uint32_t thread_count;
+    /// Number of threads that were pinned to a CPU.
+    uint32_t pinned_count;
+    /// A shard per worker, indexed by worker index.
+    worker_shard_t *shards;
+
+    pthread_mutex_t lock;
+    /// Signaled when a new batch starts, or when the pool is destroyed.
+    pthread_cond_t batch_started;
+    /// Signaled when the last worker finishes a batch.
+    pthread_cond_t batch_finished;
+    /// Incremented for every batch, so workers can tell a new batch from a spurious wakeup.
+    uint64_t batch;
+    /// Number of pool threads still running the current batch.
+    uint32_t busy_threads;
+    bool stopping;
+
+    // The current batch.
+    worker_pool_task_t task;
+    void *context;
+    uint32_t chunk_size;
+};
+
+/// Claims and runs chunks of the tasks of a shard until there are none left.
+static void run_shard(worker_pool_t *pool, worker_shard_t *shard, uint32_t worker_index) {
+    while (true) {
+        uint32_t start = atomic_fetch_add_explicit(&shard->next_task, pool->chunk_size, memory_order_relaxed);
+        if (start >= shard->end) {
+            return;
+        }
+        uint32_t end = start + pool->chunk_size;
+        if (end > shard->end) {
+            end = shard->end;
+        }
+        for (uint32_t task_index = start; task_index < end; task_index++) {
+            pool->task(pool->context, task_index, worker_index);
+        }
+    }
+}
+
+/// Runs the tasks of the worker's own shard, and then steals from the other shards, starting
+/// with the next worker's, until there are no tasks left.
+static void run_tasks(worker_pool_t *pool, uint32_t worker_index) {
+    uint32_t worker_count = pool->thread_count + 1;
+    for (uint32_t i = 0; i < worker_count; i++) {
+        run_shard(pool, &pool->shards[(worker_index + i) % worker_count], worker_index);
+    }
+}
+
+static void *worker_main(void *argument) {
+    worker_t *worker = argument;
+    worker_pool_t *pool = worker->pool;
+    uint64_t last_batch = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->stopping && pool->batch == last_batch) {
+            pthread_cond_wait(&pool->batch_started, &pool->lock);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        last_batch = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_tasks(pool, worker->worker_index);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->busy_threads -= 1;
+        if (pool->busy_threads == 0) {
+            pthread_cond_signal(&pool->batch_finished);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/// Pins each thread of the pool to its own CPU, picked round-robin from the CPUs the process
+/// is allowed to run on (ie: by `taskset` or a cgroup's cpuset), leaving the first one to the
+/// calling thread.
+/// - Returns: The number of threads that were pinned.
+static uint32_t pin_threads(const pthread_t *threads, uint32_t thread_count) {
+    #if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return 0;
+    }
+    uint32_t allowed_count = (uint32_t) CPU_COUNT(&allowed);
+    if (allowed_count <= 1) {
+        // All the threads would share the same CPU anyway.
+        return 0;
+    }
+    int allowed_cpus[CPU_SETSIZE];
+    uint32_t cpu_index = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && cpu_index < allowed_count; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            allowed_cpus[cpu_index++] = cpu;
+        }
+    }
+    uint32_t pinned_count = 0;
+    for (uint32_t i = 0; i < thread_count; i++) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(allowed_cpus[(i + 1) % allowed_count], &cpus);
+        if (pthread_setaffinity_np(threads[i], sizeof(cpus), &cpus) == 0) {
+            pinned_count += 1;
+        }
+    }
+    return pinned_count;
+    #else
+    (void) threads;
+    (void) thread_count;
+    return 0;
+    #endif
+}
+
+static worker_pool_t *create_pool(uint32_t thread_count, bool pinned) {
+    worker_pool_t *pool = calloc(1, sizeof(worker_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = calloc(thread_count == 0 ? 1 : thread_count, sizeof(pthread_t));
+    pool->workers = calloc(thread_count == 0 ? 1 : thread_count, sizeof(worker_t));
+    pool->shards = aligned_alloc(CACHE_LINE_SIZE, (thread_count + 1) * sizeof(worker_shard_t));
+    if (pool->threads == NULL || pool->workers == NULL || pool->shards == NULL) {
+        free(pool->threads);
+        free(pool->workers);
+        free(pool->shards);
+        free(pool);
+        return NULL;
+    }
+    for (uint32_t i = 0; i <= thread_count; i++) {
+        atomic_init(&pool->shards[i].next_task, 0);
+        pool->shards[i].end = 0;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->batch_started, NULL);
+    pthread_cond_init(&pool->batch_finished, NULL);
+
+    for (uint32_t i = 0; i < thread_count; i++) {
+        pool->workers[i].pool = pool;
+        // Worker 0 is the calling thread.
+        pool->workers[i].worker_index = i + 1;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->workers[i]) != 0) {
+            // Run with the threads that could be created.
+            break;
+        }
+        pool->thread_count += 1;
+    }
+    if (pinned) {
+        pool->pinned_count = pin_threads(pool->threads, pool->thread_count);
+    }
+    return pool;
+}
+
+worker_pool_t *worker_pool_create(uint32_t thread_count) {
+    return create_pool(thread_count, false);
+}
+
+worker_pool_t *worker_pool_create_pinned(uint32_t thread_count) {
+    return create_pool(thread_count, true);
+}
+
+void worker_pool_destroy(worker_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->batch_started);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->batch_finished);
+    pthread_cond_destroy(&pool->batch_started);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool->shards);
+    free(pool);
+}
+
+uint32_t worker_pool_worker_count(const worker_pool_t *pool) {
+    return pool->thread_count + 1;
+}
+
+uint32_t worker_pool_pinned_count(const worker_pool_t *pool) {
+    return pool->pinned_count;
+}
+
+bool worker_pool_owns_thread(const worker_pool_t *pool, pthread_t thread) {
+    for (uint32_t i = 0; i < pool->thread_count; i++) {
+        if (pthread_equal(pool->threads[i], thread)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+double worker_pool_cpu_time(const worker_pool_t *pool) {
+    double cpu_time = 0.0;
+    for (uint32_t i = 0; i < pool->thread_count; i++) {
+        #if defined(__APPLE__)
+        thread_basic_info_data_t info;
+        mach_msg_type_number_t info_count = THREAD_BASIC_INFO_COUNT;
+        if (thread_info(pthread_mach_thread_np(pool->threads[i]),
+                        THREAD_BASIC_INFO,
+                        (thread_info_t)&info,
+                        &info_count) == KERN_SUCCESS) {
+            cpu_time += info.user_time.seconds + info.user_time.microseconds / 1e6;
+            cpu_time += info.system_time.seconds + info.system_time.microseconds / 1e6;
+        }
+        #else
+        clockid_t clock;
+        struct timespec thread_time;
+        if (pthread_getcpuclockid(pool->threads[i], &clock) == 0
+            && clock_gettime(clock, &thread_time) == 0) {
+            cpu_time += (double) thread_time.tv_sec + (double) thread_time.tv_nsec / 1e9;
+        }
+        #endif
+    }
+    return cpu_time;
+}
+
+void worker_pool_run(worker_pool_t *pool, uint32_t task_count, worker_pool_task_t task, void *context) {
+    if (task_count == 0) {
+        return;
+    }
+    uint32_t worker_count = worker_pool_worker_count(pool);
+    uint32_t chunk_size = task_count / (worker_count * CHUNKS_PER_WORKER);
+    pool->task = task;
+    pool->context = context;
+    pool->chunk_size = chunk_size == 0 ? 1 : chunk_size;
+
+    if (pool->thread_count == 0 || task_count == 1) {
+        worker_shard_t *shard = &pool->shards[0];
+        atomic_store_explicit(&shard->next_task, 0, memory_order_relaxed);
+        shard->end = task_count;
+        run_shard(pool, shard, 0);
+        return;
+    }
+    // The shards are published to the pool's threads by the lock below.
+    for (uint32_t i = 0; i < worker_count; i++) {
+        atomic_store_explicit(&pool->shards[i].next_task,
+                              (uint32_t) ((uint64_t) task_count * i / worker_count),
+                              memory_order_relaxed);
+        pool->shards[i].end = (uint32_t) ((uint64_t) task_count * (i + 1) / worker_count);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy_threads = pool->thread_count;
+    pool->batch += 1;
+    pthread_cond_broadcast(&pool->batch_started);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(pool, 0);
+
+    // Wait for the tasks still running on the pool's threads.
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy_threads != 0) {
+        pthread_cond_wait(&pool->batch_finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,62 @@
+//
+//  worker_pool.h
+//
+
+#ifndef worker_pool_h
+#define worker_pool_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/// Runs a task on a worker. `worker_index` identifies the worker running the task (0 is the
+/// calling thread), so tasks can use per-worker scratch memory without synchronization.
+typedef void (*worker_pool_task_t)(void *context, uint32_t task_index, uint32_t worker_index);
+
+/// A small pool of threads that run batches of independent tasks in parallel.
+///
+/// The threads are created once and wait on a condition variable between batches. The tasks
+/// of a batch are split into a contiguous shard per worker, and each worker claims chunks of
+/// its own shard through the shard's atomic counter, so workers don't contend with each other
+/// while they have work. Workers that finish their shard early steal chunks from the other
+/// shards, so uneven tasks are still balanced, and the calling thread takes part in running
+/// them.
+typedef struct worker_pool worker_pool_t;
+
+/// Creates a pool with the given number of worker threads, in addition to the calling thread.
+/// A pool with 0 threads runs all the tasks on the calling thread.
+/// - Returns: The pool, or `NULL` if it couldn't be created.
+worker_pool_t *worker_pool_create(uint32_t thread_count);
+
+/// Creates a pool like `worker_pool_create`, with each of its threads pinned to a different
+/// CPU (the calling thread is not pinned), so they keep their caches warm between batches.
+/// CPUs are picked from the process's affinity mask, and reused if there are more threads
+/// than allowed CPUs. Threads are only pinned on Linux, and only if the process may run on
+/// more than one CPU: otherwise, the scheduler decides. Threads that couldn't be pinned still
+/// run tasks (see `worker_pool_pinned_count`).
+/// - Returns: The pool, or `NULL` if it couldn't be created.
+worker_pool_t *worker_pool_create_pinned(uint32_t thread_count);
+
+/// Stops and joins all the threads of the pool.
+void worker_pool_destroy(worker_pool_t *pool);
+
+/// The number of workers that may run tasks (the pool's threads and the calling thread).
+/// Worker indices passed to tasks are always below this number.
+uint32_t worker_pool_worker_count(const worker_pool_t *pool);
+
+/// The number of the pool's threads that were pinned to a CPU, 0 for pools that were not
+/// created pinned.
+uint32_t worker_pool_pinned_count(const worker_pool_t *pool);
+
+/// Whether `thread` is one of the pool's threads (the calling thread is not).
+bool worker_pool_owns_thread(const worker_pool_t *pool, pthread_t thread);
+
+/// CPU time used by the pool's threads (not the calling thread) since they started, in
+/// seconds.
+double worker_pool_cpu_time(const worker_pool_t *pool);
+
+/// Runs `task` for every index in `[0, task_count)`, returning once all of them finished.
+/// Must only be called from one thread at a time.
+void worker_pool_run(worker_pool_t *pool, uint32_t task_count, worker_pool_task_t task, void *context);
+
+#endif /* worker_pool_h */
@@ -0,0 +1,125 @@
+//
+//  json_writer.c
+//
+
+#include "json_writer.h"
+#include <math.h>
+
+static void write_escaped(FILE *file, const char *string) {
+    fputc('"', file);
+    for (const char *c = string; *c != '\0'; c++) {
+        switch (*c) {
+        case '"':
+            fputs("\\\"", file);
+            break;
+        case '\\':
+            fputs("\\\\", file);
+            break;
+        case '\n':
+            fputs("\\n", file);
+            break;
+        default:
+            if ((unsigned char) *c < 0x20) {
+                fprintf(file, "\\u%04x", (unsigned char) *c);
+            } else {
+                fputc(*c, file);
+            }
+        }
+    }
+    fputc('"', file);
+}
+
+/// Writes the separator, indentation and key that precede a value.
+static void begin_value(json_writer_t *writer, const char *key) {
+    if (writer->depth > 0) {
+        if (writer->has_values[writer->depth]) {
+            fputc(',', writer->file);
+        }
+        fputc('\n', writer->file);
+        for (int i = 0; i < writer->depth; i++) {
+            fputs("  ", writer->file);
+        }
+        if (!writer->is_array[writer->depth] && key != NULL) {
+            write_escaped(writer->file, key);
+            fputs(": ", writer->file);
+        }
+        writer->has_values[writer->depth] = true;
+    }
+}
+
+static void begin_container(json_writer_t *writer, const char *key, bool is_array) {
+    begin_value(writer, key);
+    fputc(is_array ? '[' : '{', writer->file);
+    if (writer->depth + 1 < JSON_MAX_DEPTH) {
+        writer->depth += 1;
+        writer->has_values[writer->depth] = false;
+        writer->is_array[writer->depth] = is_array;
+    }
+}
+
+static void end_container(json_writer_t *writer, bool is_array) {
+    bool had_values = writer->has_values[writer->depth];
+    writer->depth -= 1;
+    if (had_values) {
+        fputc('\n', writer->file);
+        for (int i = 0; i < writer->depth; i++) {
+            fputs("  ", writer->file);
+        }
+    }
+    fputc(is_array ? ']' : '}', writer->file);
+    if (writer->depth == 0) {
+        fputc('\n', writer->file);
+    }
+}
+
+void json_writer_init(json_writer_t *writer, FILE *file) {
+    writer->file = file;
+    writer->depth = 0;
+    writer->has_values[0] = false;
+    writer->is_array[0] = false;
+}
+
+void json_begin_object(json_writer_t *writer, const char *key) {
+    begin_container(writer, key, false);
+}
+
+void json_end_object(json_writer_t *writer) {
+    end_container(writer, false);
+}
+
+void json_begin_array(json_writer_t *writer, const char *key) {
+    begin_container(writer, key, true);
+}
+
+void json_end_array(json_writer_t *writer) {
+    end_container(writer, true);
+}
+
+void json_string(json_writer_t *writer, const char *key, const char *value) {
+    begin_value(writer, key);
+    write_escaped(writer->file, value);
+}
+
+void json_integer(json_writer_t *writer, const char *key, uint64_t value) {
+    begin_value(writer, key);
+    fprintf(writer->file, "%llu", (unsigned long long) value);
+}
+
+void json_number(json_writer_t *writer, const char *key, double value) {
+    begin_value(writer, key);
+    if (isfinite(value)) {
+        fprintf(writer->file, "%.6g", value);
+    } else {
+        fputs("null", writer->file);
+    }
+}
+
+void json_bool(json_writer_t *writer, const char *key, bool value) {
+    begin_value(writer, key);
+    fputs(value ? "true" : "false", writer->file);
+}
+
+void json_null(json_writer_t *writer, const char *key) {
+    begin_value(writer, key);
+    fputs("null", writer->file);
+}
@@ -0,0 +1,40 @@
+//
+//  json_writer.h
+//
+
+#ifndef json_writer_h
+#define json_writer_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/// Maximum nesting of objects and arrays.
+#define JSON_MAX_DEPTH 16
+
+/// Writes indented JSON to a file, keeping track of the commas between values. Keys are
+/// ignored (and may be `NULL`) for values written inside arrays.
+typedef struct {
+    FILE *file;
+    int depth;
+    /// Whether a value was already written at each depth.
+    bool has_values[JSON_MAX_DEPTH];
+    /// Whether the container at each depth is an array.
+    bool is_array[JSON_MAX_DEPTH];
+} json_writer_t;
+
+void json_writer_init(json_writer_t *writer, FILE *file);
+
+void json_begin_object(json_writer_t *writer, const char *key);
+void json_end_object(json_writer_t *writer);
+void json_begin_array(json_writer_t *writer, const char *key);
+void json_end_array(json_writer_t *writer);
+
+void json_string(json_writer_t *writer, const char *key, const char *value);
+void json_integer(json_writer_t *writer, const char *key, uint64_t value);
+/// Writes a number, or `null` if it's not finite.
+void json_number(json_writer_t *writer, const char *key, double value);
+void json_bool(json_writer_t *writer, const char *key, bool value);
+void json_null(json_writer_t *writer, const char *key);
+
+#endif /* json_writer_h */
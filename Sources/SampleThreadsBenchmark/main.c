@@ -0,0 +1,546 @@
+//
+//  main.c
+//
+
+// Benchmarks the sampling pipeline of the SampleThreads target against synthetic thread
+// farms, and prints the results as JSON.
+//
+// For each combination of thread count, stack depth and busy fraction, a farm of threads is
+// spawned in this process and sampled with a sample_session_t, at a fixed period. The time
+// spent in each stage of every sample (enumeration, counter reads, name reads, backtraces,
+// deltas) is read from the session's sampler_stats_t, and the work done by the busy threads
+// with and without sampling is compared to measure how much sampling slows them down. Each
+// farm is sampled once per worker count, to compare the latency of serial and sharded ticks.
+// The stack table, the sample ring and the per-core usage reader are also benchmarked on their
+// own.
+//
+// Build in release mode with frame pointers, so backtraces have the expected depth:
+//
+//     swift run -c release -Xcc -fno-omit-frame-pointer SampleThreadsBenchmark --threads 10,100,1000
+//
+// To compare the tick latency of sharded sampling against the thread count:
+//
+//     swift run -c release SampleThreadsBenchmark --threads 100,1000,4000 --workers 0,2,4 --no-backtraces
+
+#include "json_writer.h"
+#include "thread_farm.h"
+#include "get_cpu_usage.h"
+#include "sample_ring.h"
+#include "sample_session.h"
+#include "sampler_stats.h"
+#include "stack_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LIST_LENGTH 16
+
+typedef struct {
+    uint32_t thread_counts[MAX_LIST_LENGTH];
+    int thread_count_length;
+    uint32_t stack_depths[MAX_LIST_LENGTH];
+    int stack_depth_length;
+    double busy_fractions[MAX_LIST_LENGTH];
+    int busy_fraction_length;
+    /// Workers of the sampling sessions, 0 to sample from the calling thread only.
+    uint32_t worker_counts[MAX_LIST_LENGTH];
+    int worker_count_length;
+    /// Samples measured per scenario.
+    uint32_t ticks;
+    /// Samples taken (and not measured) before the measured ones, so the session's memory
+    /// is already grown.
+    uint32_t warmup_ticks;
+    /// Time between samples, in seconds.
+    double period;
+    bool retrieve_backtraces;
+    const char *output_path;
+} benchmark_options_t;
+
+static void print_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --threads LIST     Thread counts of the farms (default: 10,100,1000)\n"
+            "  --depth LIST       Deepest stack of the farms (default: 16)\n"
+            "  --busy LIST        Fractions of busy threads, 0 to 1 (default: 0.1)\n"
+            "  --workers LIST     Workers of the sampling sessions (default: 0)\n"
+            "  --ticks N          Samples measured per farm (default: 100)\n"
+            "  --warmup N         Samples taken before measuring (default: 5)\n"
+            "  --period-ms MS     Time between samples (default: 10)\n"
+            "  --no-backtraces    Don't retrieve backtraces\n"
+            "  --output PATH      Write the JSON results to PATH instead of stdout\n",
+            name);
+}
+
+static uint64_t now_ns(void) {
+    return sampler_stats_now_ns();
+}
+
+static void sleep_until_ns(uint64_t deadline_ns) {
+    uint64_t current_ns = now_ns();
+    if (current_ns >= deadline_ns) {
+        return;
+    }
+    uint64_t remaining_ns = deadline_ns - current_ns;
+    struct timespec remaining = {
+        .tv_sec = (time_t) (remaining_ns / 1000000000ull),
+        .tv_nsec = (long) (remaining_ns % 1000000000ull)
+    };
+    while (nanosleep(&remaining, &remaining) != 0) {}
+}
+
+// MARK: - Options
+
+/// Parses a comma-separated list of numbers.
+/// - Returns: The number of parsed numbers, or -1 if the list is not valid.
+static int parse_list(const char *string, double *values) {
+    int count = 0;
+    const char *start = string;
+    while (*start != '\0' && count < MAX_LIST_LENGTH) {
+        char *end;
+        double value = strtod(start, &end);
+        if (end == start || value < 0) {
+            return -1;
+        }
+        values[count++] = value;
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        start = end;
+    }
+    return count > 0 ? count : -1;
+}
+
+static int parse_integer_list(const char *string, uint32_t *values) {
+    double parsed[MAX_LIST_LENGTH];
+    int count = parse_list(string, parsed);
+    for (int i = 0; i < count; i++) {
+        values[i] = (uint32_t) parsed[i];
+    }
+    return count;
+}
+
+static bool parse_options(int argc, char **argv, benchmark_options_t *options) {
+    memset(options, 0, sizeof(benchmark_options_t));
+    options->thread_count_length = parse_integer_list("10,100,1000", options->thread_counts);
+    options->stack_depth_length = parse_integer_list("16", options->stack_depths);
+    options->busy_fraction_length = parse_list("0.1", options->busy_fractions);
+    options->worker_count_length = parse_integer_list("0", options->worker_counts);
+    options->ticks = 100;
+    options->warmup_ticks = 5;
+    options->period = 0.01;
+    options->retrieve_backtraces = true;
+
+    for (int i = 1; i < argc; i++) {
+        const char *argument = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argument, "--no-backtraces") == 0) {
+            options->retrieve_backtraces = false;
+            continue;
+        }
+        if (value == NULL) {
+            return false;
+        }
+        i++;
+        if (strcmp(argument, "--threads") == 0) {
+            options->thread_count_length = parse_integer_list(value, options->thread_counts);
+        } else if (strcmp(argument, "--depth") == 0) {
+            options->stack_depth_length = parse_integer_list(value, options->stack_depths);
+        } else if (strcmp(argument, "--busy") == 0) {
+            options->busy_fraction_length = parse_list(value, options->busy_fractions);
+        } else if (strcmp(argument, "--workers") == 0) {
+            options->worker_count_length = parse_integer_list(value, options->worker_counts);
+        } else if (strcmp(argument, "--ticks") == 0) {
+            options->ticks = (uint32_t) strtoul(value, NULL, 10);
+        } else if (strcmp(argument, "--warmup") == 0) {
+            options->warmup_ticks = (uint32_t) strtoul(value, NULL, 10);
+        } else if (strcmp(argument, "--period-ms") == 0) {
+            options->period = strtod(value, NULL) / 1000.0;
+        } else if (strcmp(argument, "--output") == 0) {
+            options->output_path = value;
+        } else {
+            return false;
+        }
+    }
+    for (int i = 0; i < options->busy_fraction_length; i++) {
+        if (options->busy_fractions[i] > 1) {
+            return false;
+        }
+    }
+    return options->thread_count_length > 0
+        && options->stack_depth_length > 0
+        && options->busy_fraction_length > 0
+        && options->worker_count_length > 0
+        && options->ticks > 0
+        && options->period > 0;
+}
+
+// MARK: - Output
+
+/// Writes the fields of a summary, suffixing their names with the unit of the values.
+static void write_summary_fields(json_writer_t *json, sampler_summary_t summary, const char *unit) {
+    char name[32];
+    json_integer(json, "count", summary.count);
+    snprintf(name, sizeof(name), "mean_%s", unit);
+    json_number(json, name, summary.mean);
+    snprintf(name, sizeof(name), "min_%s", unit);
+    json_integer(json, name, summary.min);
+    snprintf(name, sizeof(name), "p50_%s", unit);
+    json_integer(json, name, summary.p50);
+    snprintf(name, sizeof(name), "p90_%s", unit);
+    json_integer(json, name, summary.p90);
+    snprintf(name, sizeof(name), "p99_%s", unit);
+    json_integer(json, name, summary.p99);
+    snprintf(name, sizeof(name), "max_%s", unit);
+    json_integer(json, name, summary.max);
+}
+
+static void write_counter(json_writer_t *json, const char *key, const sampler_stats_t *stats, sampler_counter_t counter) {
+    json_begin_object(json, key);
+    write_summary_fields(json, sampler_stats_counter_summary(stats, counter), "count");
+    json_end_object(json);
+}
+
+/// Writes the durations of a stage of sampling and, if `thread_count` is not 0, how many
+/// threads per second it processes.
+static void write_stage(json_writer_t *json, const char *key, const sampler_stats_t *stats, sampler_phase_t phase, uint32_t thread_count) {
+    sampler_summary_t summary = sampler_stats_phase_summary(stats, phase);
+    json_begin_object(json, key);
+    write_summary_fields(json, summary, "ns");
+    if (thread_count > 0 && summary.mean > 0) {
+        json_number(json, "threads_per_second", thread_count / (summary.mean / 1e9));
+    }
+    json_end_object(json);
+}
+
+// MARK: - Scenarios
+
+/// Work done by the busy threads of the farm per second, over the given time.
+static double measure_work_rate(thread_farm_t *farm, uint64_t start_ns, uint64_t start_work, uint64_t *end_ns) {
+    *end_ns = now_ns();
+    uint64_t work = thread_farm_work_done(farm) - start_work;
+    return (double) work / ((double) (*end_ns - start_ns) / 1e9);
+}
+
+static void run_scenario(json_writer_t *json, const benchmark_options_t *options, thread_farm_config_t config, uint32_t worker_count) {
+    fprintf(stderr, "Sampling %u threads (max depth %u, %.0f%% busy) with %u workers...\n",
+            config.thread_count, config.max_stack_depth, config.busy_fraction * 100, worker_count);
+    thread_farm_t *farm = thread_farm_start(config);
+    if (farm == NULL) {
+        fprintf(stderr, "Couldn't create the thread farm\n");
+        return;
+    }
+    uint32_t period_ns = (uint32_t) (options->period * 1e9);
+    uint64_t window_ns = (uint64_t) options->ticks * period_ns;
+
+    // Baseline: the work done by the farm, without sampling, over as long as the measured
+    // samples will take.
+    uint64_t end_ns;
+    uint64_t baseline_start_ns = now_ns();
+    uint64_t baseline_start_work = thread_farm_work_done(farm);
+    sleep_until_ns(baseline_start_ns + window_ns);
+    double baseline_rate = measure_work_rate(farm, baseline_start_ns, baseline_start_work, &end_ns);
+
+    sample_session_config_t session_config = { .worker_count = worker_count };
+    sample_session_t *session = sample_session_create_with_config(getpid(), session_config);
+    if (session == NULL) {
+        fprintf(stderr, "Couldn't create the sampling session\n");
+        thread_farm_stop(farm);
+        return;
+    }
+    sampler_stats_t *stats = sample_session_stats(session);
+    uint64_t deadline_ns = now_ns();
+    for (uint32_t i = 0; i < options->warmup_ticks; i++) {
+        sample_session_sample_into(session, false, options->retrieve_backtraces);
+        deadline_ns += period_ns;
+        sleep_until_ns(deadline_ns);
+    }
+    sampler_stats_reset(stats);
+
+    uint64_t sampled_start_ns = now_ns();
+    uint64_t sampled_start_work = thread_farm_work_done(farm);
+    uint64_t unique_stacks = 0;
+    deadline_ns = sampled_start_ns;
+    for (uint32_t i = 0; i < options->ticks; i++) {
+        sample_session_result_t result = sample_session_sample_into(session, false, options->retrieve_backtraces);
+        unique_stacks = stack_table_count(result.stacks);
+        deadline_ns += period_ns;
+        sleep_until_ns(deadline_ns);
+    }
+    double sampled_rate = measure_work_rate(farm, sampled_start_ns, sampled_start_work, &end_ns);
+
+    uint32_t thread_count = thread_farm_thread_count(farm);
+    json_begin_object(json, NULL);
+    json_integer(json, "threads", thread_count);
+    json_integer(json, "requested_threads", config.thread_count);
+    json_integer(json, "busy_threads", thread_farm_busy_count(farm));
+    json_integer(json, "max_stack_depth", config.max_stack_depth);
+    json_number(json, "busy_fraction", config.busy_fraction);
+    json_integer(json, "workers", worker_count);
+    json_integer(json, "pinned_workers", sample_session_pinned_worker_count(session));
+    json_integer(json, "ticks", sampler_stats_tick_count(stats));
+    json_integer(json, "unique_stacks", unique_stacks);
+
+    // The sampling thread, the session's workers and the farm's threads are all sampled.
+    uint32_t sampled_threads = thread_count + 1 + worker_count;
+    json_begin_object(json, "stages");
+    write_stage(json, "tick", stats, SAMPLER_PHASE_TICK, sampled_threads);
+    write_stage(json, "enumerate_threads", stats, SAMPLER_PHASE_ENUMERATE_THREADS, sampled_threads);
+    write_stage(json, "read_counters", stats, SAMPLER_PHASE_READ_COUNTERS, sampled_threads);
+    write_stage(json, "read_names", stats, SAMPLER_PHASE_READ_NAMES, sampled_threads);
+    write_stage(json, "backtraces", stats, SAMPLER_PHASE_BACKTRACES, sampled_threads);
+    write_stage(json, "thread_backtrace", stats, SAMPLER_PHASE_THREAD_BACKTRACE, 0);
+    write_stage(json, "deltas", stats, SAMPLER_PHASE_DELTAS, sampled_threads);
+    json_end_object(json);
+    write_counter(json, "allocations_per_tick", stats, SAMPLER_COUNTER_ALLOCATIONS);
+    write_counter(json, "syscalls_per_tick", stats, SAMPLER_COUNTER_SYSCALLS);
+
+    json_begin_object(json, "slowdown");
+    if (thread_farm_busy_count(farm) > 0 && baseline_rate > 0) {
+        json_number(json, "baseline_work_per_second", baseline_rate);
+        json_number(json, "sampled_work_per_second", sampled_rate);
+        // The fraction of the work the farm didn't get to do because it was being sampled.
+        json_number(json, "fraction", 1.0 - sampled_rate / baseline_rate);
+    } else {
+        json_null(json, "fraction");
+    }
+    json_end_object(json);
+    json_end_object(json);
+
+    sample_session_destroy(session);
+    thread_farm_stop(farm);
+}
+
+// MARK: - Data structures
+
+/// Deterministic pseudo-random numbers, so every run interns the same stacks.
+static uint64_t next_random(uint64_t *state) {
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return *state >> 17;
+}
+
+/// Benchmarks interning stacks that were never seen (misses) and that were (hits).
+static void benchmark_stack_table(json_writer_t *json) {
+    const uint32_t stack_count = 16384;
+    const uint32_t depth = 32;
+    const uint32_t hit_rounds = 16;
+    backtrace_address_t *stacks = malloc((size_t) stack_count * depth * sizeof(backtrace_address_t));
+    stack_table_t *table = stack_table_create();
+    if (stacks == NULL || table == NULL) {
+        free(stacks);
+        stack_table_destroy(table);
+        return;
+    }
+    uint64_t state = 42;
+    for (uint64_t i = 0; i < (uint64_t) stack_count * depth; i++) {
+        stacks[i].address = 0x100000000ull + (next_random(&state) & 0xFFFFFF);
+    }
+
+    uint64_t start_ns = now_ns();
+    for (uint32_t i = 0; i < stack_count; i++) {
+        stack_table_intern(table, &stacks[(size_t) i * depth], depth);
+    }
+    uint64_t miss_ns = now_ns() - start_ns;
+
+    start_ns = now_ns();
+    for (uint32_t round = 0; round < hit_rounds; round++) {
+        for (uint32_t i = 0; i < stack_count; i++) {
+            stack_table_intern(table, &stacks[(size_t) i * depth], depth);
+        }
+    }
+    uint64_t hit_ns = now_ns() - start_ns;
+
+    json_begin_object(json, "stack_table");
+    json_integer(json, "stack_depth", depth);
+    json_integer(json, "unique_stacks", stack_table_count(table));
+    json_number(json, "intern_miss_ns_per_op", (double) miss_ns / stack_count);
+    json_number(json, "intern_hit_ns_per_op", (double) hit_ns / ((double) stack_count * hit_rounds));
+    json_end_object(json);
+
+    stack_table_destroy(table);
+    free(stacks);
+}
+
+/// Benchmarks pushing batches of records to the sample ring, and reading them back.
+static void benchmark_sample_ring(json_writer_t *json) {
+    const uint32_t capacity = 4096;
+    const uint32_t batch_size = 64;
+    const uint32_t batch_count = 16384;
+    sample_ring_t *ring = sample_ring_create(capacity);
+    sampled_thread_info_t *records = calloc(capacity, sizeof(sampled_thread_info_t));
+    if (ring == NULL || records == NULL) {
+        sample_ring_destroy(ring);
+        free(records);
+        return;
+    }
+    for (uint32_t i = 0; i < batch_size; i++) {
+        records[i].thread_id = i;
+        snprintf(records[i].pthread_name, sizeof(records[i].pthread_name), "Thread %u", i);
+    }
+
+    // Push while reading behind the writer, as a consumer polling the ring would.
+    uint64_t cursor = 0;
+    uint64_t dropped = 0;
+    uint64_t push_ns = 0;
+    uint64_t read_ns = 0;
+    uint64_t read_count = 0;
+    for (uint32_t batch = 0; batch < batch_count; batch++) {
+        uint64_t start_ns = now_ns();
+        sample_ring_push(ring, records, batch_size);
+        uint64_t pushed_ns = now_ns();
+        read_count += sample_ring_read_from(ring, &cursor, records + batch_size, capacity - batch_size, &dropped);
+        read_ns += now_ns() - pushed_ns;
+        push_ns += pushed_ns - start_ns;
+    }
+
+    const uint32_t snapshot_count = 1024;
+    uint64_t start_ns = now_ns();
+    for (uint32_t i = 0; i < snapshot_count; i++) {
+        sample_ring_snapshot(ring, records, capacity, NULL);
+    }
+    uint64_t snapshot_ns = now_ns() - start_ns;
+
+    json_begin_object(json, "sample_ring");
+    json_integer(json, "capacity", sample_ring_capacity(ring));
+    json_integer(json, "record_size", sizeof(sampled_thread_info_t));
+    json_number(json, "push_ns_per_record", (double) push_ns / ((double) batch_count * batch_size));
+    json_number(json, "read_ns_per_record", read_count > 0 ? (double) read_ns / read_count : 0);
+    json_integer(json, "dropped_records", dropped);
+    json_number(json, "snapshot_ns_per_record", (double) snapshot_ns / ((double) snapshot_count * capacity));
+    json_end_object(json);
+
+    sample_ring_destroy(ring);
+    free(records);
+}
+
+/// Benchmarks reading the usage of each core. On Linux, parsing is also benchmarked on its own
+/// with a synthetic `/proc/stat` of a large host, which is where it's polled the most.
+static void benchmark_cpu_usage(json_writer_t *json) {
+    json_begin_object(json, "cpu_usage");
+    #if defined(__linux__)
+    const int synthetic_core_count = 256;
+    const uint32_t parse_count = 4096;
+    size_t text_size = (size_t) (synthetic_core_count + 2) * 256;
+    char *text = malloc(text_size);
+    core_usage_t *totals = calloc(synthetic_core_count, sizeof(core_usage_t));
+    core_usage_t *deltas = calloc(synthetic_core_count, sizeof(core_usage_t));
+    if (text != NULL && totals != NULL && deltas != NULL) {
+        uint64_t state = 42;
+        size_t length = (size_t) snprintf(text, text_size, "cpu  %llu 0 %llu %llu 0 0 0 0 0 0\n", 1ull << 40, 1ull << 38, 1ull << 42);
+        for (int i = 0; i < synthetic_core_count; i++) {
+            length += (size_t) snprintf(text + length, text_size - length, "cpu%d %llu %llu %llu %llu %llu %llu %llu 0 0 0\n", i,
+                                        (unsigned long long) (next_random(&state) & 0xFFFFFFF),
+                                        (unsigned long long) (next_random(&state) & 0xFFFF),
+                                        (unsigned long long) (next_random(&state) & 0xFFFFFF),
+                                        (unsigned long long) (next_random(&state) & 0xFFFFFFFF),
+                                        (unsigned long long) (next_random(&state) & 0xFFFFF),
+                                        (unsigned long long) (next_random(&state) & 0xFFF),
+                                        (unsigned long long) (next_random(&state) & 0xFFFFF));
+        }
+        snprintf(text + length, text_size - length, "intr 0\n");
+
+        int parsed_core_count = 0;
+        uint64_t start_ns = now_ns();
+        for (uint32_t i = 0; i < parse_count; i++) {
+            parsed_core_count = cpu_usage_parse_proc_stat(text, totals, deltas, synthetic_core_count);
+        }
+        uint64_t parse_ns = now_ns() - start_ns;
+
+        json_integer(json, "synthetic_core_count", (uint64_t) (parsed_core_count > 0 ? parsed_core_count : 0));
+        json_number(json, "parse_ns", (double) parse_ns / parse_count);
+        json_number(json, "parse_ns_per_core", (double) parse_ns / ((double) parse_count * synthetic_core_count));
+    }
+    free(text);
+    free(totals);
+    free(deltas);
+    #endif
+
+    // Reads of this system, with the syscall.
+    cpu_usage_reader_t *reader = cpu_usage_reader_create();
+    if (reader != NULL) {
+        const uint32_t read_count = 1024;
+        int core_count = cpu_usage_reader_core_count(reader);
+        core_usage_t *read_totals = calloc(core_count, sizeof(core_usage_t));
+        core_usage_t *read_deltas = calloc(core_count, sizeof(core_usage_t));
+        if (read_totals != NULL && read_deltas != NULL) {
+            uint64_t start_ns = now_ns();
+            for (uint32_t i = 0; i < read_count; i++) {
+                cpu_usage_reader_read(reader, read_totals, read_deltas, core_count);
+            }
+            uint64_t read_ns = now_ns() - start_ns;
+            json_integer(json, "core_count", (uint64_t) core_count);
+            json_number(json, "read_ns", (double) read_ns / read_count);
+        }
+        free(read_totals);
+        free(read_deltas);
+        cpu_usage_reader_destroy(reader);
+    }
+    json_end_object(json);
+}
+
+// MARK: - Main
+
+int main(int argc, char **argv) {
+    benchmark_options_t options;
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    FILE *output = stdout;
+    if (options.output_path != NULL) {
+        output = fopen(options.output_path, "w");
+        if (output == NULL) {
+            perror(options.output_path);
+            return 1;
+        }
+    }
+
+    json_writer_t json;
+    json_writer_init(&json, output);
+    json_begin_object(&json, NULL);
+    json_string(&json, "benchmark", "SampleThreads");
+    #if defined(__linux__)
+    json_string(&json, "platform", "linux");
+    #elif defined(__APPLE__)
+    json_string(&json, "platform", "apple");
+    #endif
+    json_integer(&json, "cpu_count", (uint64_t) sysconf(_SC_NPROCESSORS_ONLN));
+    json_begin_object(&json, "options");
+    json_integer(&json, "ticks", options.ticks);
+    json_integer(&json, "warmup_ticks", options.warmup_ticks);
+    json_number(&json, "period_seconds", options.period);
+    json_bool(&json, "retrieve_backtraces", options.retrieve_backtraces);
+    json_end_object(&json);
+
+    json_begin_array(&json, "scenarios");
+    for (int t = 0; t < options.thread_count_length; t++) {
+        for (int d = 0; d < options.stack_depth_length; d++) {
+            for (int b = 0; b < options.busy_fraction_length; b++) {
+                thread_farm_config_t config = {
+                    .thread_count = options.thread_counts[t],
+                    .max_stack_depth = options.stack_depths[d],
+                    .busy_fraction = options.busy_fractions[b]
+                };
+                for (int w = 0; w < options.worker_count_length; w++) {
+                    run_scenario(&json, &options, config, options.worker_counts[w]);
+                }
+            }
+        }
+    }
+    json_end_array(&json);
+
+    json_begin_object(&json, "data_structures");
+    benchmark_stack_table(&json);
+    benchmark_sample_ring(&json);
+    benchmark_cpu_usage(&json);
+    json_end_object(&json);
+    json_end_object(&json);
+
+    if (output != stdout) {
+        fclose(output);
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+//
+//  thread_farm.c
+//
+
+#include "thread_farm.h"
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Stack size of the farm threads, on top of the room needed for their frames, so farms of
+/// thousands of threads don't reserve gigabytes of address space.
+#define BASE_STACK_SIZE (64 * 1024)
+/// Generous upper bound of the size of each frame of `descend`.
+#define FRAME_SIZE 256
+
+typedef struct {
+    /// Iterations of the work loop. Each thread has its own cache line, so spinning threads
+    /// don't slow each other down.
+    _Alignas(64) _Atomic uint64_t work_done;
+    thread_farm_t *farm;
+    uint32_t stack_depth;
+    bool busy;
+} farm_thread_t;
+
+struct thread_farm {
+    farm_thread_t *threads;
+    pthread_t *handles;
+    uint32_t thread_count;
+    uint32_t busy_count;
+    atomic_bool stopped;
+    /// Number of threads that reached their target stack depth.
+    _Atomic uint32_t ready_count;
+    /// Idle threads wait on this condition until the farm is stopped.
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+};
+
+static void run_leaf(farm_thread_t *thread) {
+    thread_farm_t *farm = thread->farm;
+    atomic_fetch_add_explicit(&farm->ready_count, 1, memory_order_release);
+    if (thread->busy) {
+        while (!atomic_load_explicit(&farm->stopped, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&thread->work_done, 1, memory_order_relaxed);
+        }
+        return;
+    }
+    pthread_mutex_lock(&farm->mutex);
+    while (!atomic_load_explicit(&farm->stopped, memory_order_relaxed)) {
+        pthread_cond_wait(&farm->condition, &farm->mutex);
+    }
+    pthread_mutex_unlock(&farm->mutex);
+}
+
+/// Recurses until the thread's target depth, so its backtrace has that many frames.
+__attribute__((noinline)) static void descend(farm_thread_t *thread, uint32_t depth, volatile uint32_t *unwound) {
+    if (depth <= 1) {
+        run_leaf(thread);
+    } else {
+        descend(thread, depth - 1, unwound);
+    }
+    // Prevents the recursive call from being turned into a jump, which would not push frames.
+    *unwound += 1;
+}
+
+static void *farm_thread_main(void *argument) {
+    farm_thread_t *thread = argument;
+    volatile uint32_t unwound = 0;
+    descend(thread, thread->stack_depth, &unwound);
+    return NULL;
+}
+
+thread_farm_t *thread_farm_start(thread_farm_config_t config) {
+    thread_farm_t *farm = calloc(1, sizeof(thread_farm_t));
+    if (farm == NULL) {
+        return NULL;
+    }
+    farm->threads = aligned_alloc(_Alignof(farm_thread_t), (config.thread_count + 1) * sizeof(farm_thread_t));
+    farm->handles = calloc(config.thread_count + 1, sizeof(pthread_t));
+    if (farm->threads == NULL || farm->handles == NULL) {
+        free(farm->threads);
+        free(farm->handles);
+        free(farm);
+        return NULL;
+    }
+    atomic_init(&farm->stopped, false);
+    atomic_init(&farm->ready_count, 0);
+    pthread_mutex_init(&farm->mutex, NULL);
+    pthread_cond_init(&farm->condition, NULL);
+
+    uint32_t max_depth = config.max_stack_depth == 0 ? 1 : config.max_stack_depth;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    size_t stack_size = BASE_STACK_SIZE + (size_t) max_depth * FRAME_SIZE;
+    if (stack_size < PTHREAD_STACK_MIN) {
+        stack_size = PTHREAD_STACK_MIN;
+    }
+    pthread_attr_setstacksize(&attributes, stack_size);
+
+    for (uint32_t i = 0; i < config.thread_count; i++) {
+        farm_thread_t *thread = &farm->threads[farm->thread_count];
+        memset(thread, 0, sizeof(farm_thread_t));
+        atomic_init(&thread->work_done, 0);
+        thread->farm = farm;
+        // Spread the depths over the whole range, and the busy threads evenly among the idle
+        // ones.
+        thread->stack_depth = 1 + (uint32_t) (((uint64_t) i * 7919) % max_depth);
+        thread->busy = (uint32_t) ((i + 1) * config.busy_fraction) > (uint32_t) (i * config.busy_fraction);
+        if (pthread_create(&farm->handles[farm->thread_count], &attributes, farm_thread_main, thread) != 0) {
+            fprintf(stderr, "thread_farm: could only spawn %u of %u threads\n", farm->thread_count, config.thread_count);
+            break;
+        }
+        farm->thread_count += 1;
+        farm->busy_count += thread->busy ? 1 : 0;
+    }
+    pthread_attr_destroy(&attributes);
+
+    while (atomic_load_explicit(&farm->ready_count, memory_order_acquire) < farm->thread_count) {
+        sched_yield();
+    }
+    return farm;
+}
+
+void thread_farm_stop(thread_farm_t *farm) {
+    pthread_mutex_lock(&farm->mutex);
+    atomic_store_explicit(&farm->stopped, true, memory_order_relaxed);
+    pthread_cond_broadcast(&farm->condition);
+    pthread_mutex_unlock(&farm->mutex);
+    for (uint32_t i = 0; i < farm->thread_count; i++) {
+        pthread_join(farm->handles[i], NULL);
+    }
+    pthread_mutex_destroy(&farm->mutex);
+    pthread_cond_destroy(&farm->condition);
+    free(farm->threads);
+    free(farm->handles);
+    free(farm);
+}
+
+uint32_t thread_farm_thread_count(const thread_farm_t *farm) {
+    return farm->thread_count;
+}
+
+uint32_t thread_farm_busy_count(const thread_farm_t *farm) {
+    return farm->busy_count;
+}
+
+uint64_t thread_farm_work_done(const thread_farm_t *farm) {
+    uint64_t work_done = 0;
+    for (uint32_t i = 0; i < farm->thread_count; i++) {
+        work_done += atomic_load_explicit(&farm->threads[i].work_done, memory_order_relaxed);
+    }
+    return work_done;
+}
@@ -0,0 +1,46 @@
+//
+//  thread_farm.h
+//
+
+#ifndef thread_farm_h
+#define thread_farm_h
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    /// Number of threads to spawn.
+    uint32_t thread_count;
+    /// Deepest stack of the farm. Each thread recurses to a different depth, between 1 and
+    /// this number of frames, before it starts working or waiting.
+    uint32_t max_stack_depth;
+    /// Fraction of the threads that spin doing work, from 0 to 1. The rest block on a
+    /// condition variable until the farm is stopped.
+    double busy_fraction;
+} thread_farm_config_t;
+
+/// A set of synthetic threads in the calling process, to be sampled by the benchmarks.
+///
+/// Busy threads count the iterations of their work loop, so the throughput of the farm can be
+/// compared with and without sampling to measure the slowdown sampling causes.
+typedef struct thread_farm thread_farm_t;
+
+/// Spawns the threads of the farm, and waits until all of them reached their target stack
+/// depth.
+/// - Returns: The farm, or `NULL` if it couldn't be created. Fewer threads than requested may
+/// be spawned if the system runs out of resources (see `thread_farm_thread_count`).
+thread_farm_t *thread_farm_start(thread_farm_config_t config);
+
+/// Stops and joins all the threads of the farm, and destroys it.
+void thread_farm_stop(thread_farm_t *farm);
+
+/// Number of threads actually spawned.
+uint32_t thread_farm_thread_count(const thread_farm_t *farm);
+
+/// Number of threads spinning.
+uint32_t thread_farm_busy_count(const thread_farm_t *farm);
+
+/// Total number of work loop iterations done by the busy threads so far.
+uint64_t thread_farm_work_done(const thread_farm_t *farm);
+
+#endif /* thread_farm_h */
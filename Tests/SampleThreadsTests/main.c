@@ -0,0 +1,169 @@
+//
+//  main.c
+//
+
+// Tests of the SampleThreads target that need more than a unit test harness: concurrent
+// stress tests, fake sysfs trees and large files. Each suite runs in this process, and the
+// executable exits with a non-zero status if any check failed:
+//
+//     swift run -c release SampleThreadsTests
+//
+// The defaults are sized for CI. Locally, run the large variants with:
+//
+//     swift run -c release SampleThreadsTests --capture-mb 4096 --ring-seconds 30
+
+#define _GNU_SOURCE
+
+#include "test_support.h"
+#include <ftw.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    const char *name;
+    test_suite_t run;
+} test_suite_entry_t;
+
+static const test_suite_entry_t suites[] = {
+    { "sample_ring", test_sample_ring },
+    { "capture_file", test_capture_file },
+    { "linux_rapl", test_linux_rapl },
+    { "energy_model", test_energy_model },
+};
+
+#define SUITE_COUNT (sizeof(suites) / sizeof(suites[0]))
+
+static void print_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options] [suite...]\n"
+            "  --capture-mb N     Size of the round-tripped capture, in MiB (default: 64)\n"
+            "  --ring-readers N   Concurrent readers of the sample ring (default: 4)\n"
+            "  --ring-seconds S   Duration of the sample ring stress test (default: 2)\n"
+            "  --scratch PATH     Directory for temporary files (default: $TMPDIR or /tmp)\n"
+            "Suites:",
+            name);
+    for (size_t i = 0; i < SUITE_COUNT; i++) {
+        fprintf(stderr, " %s", suites[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+bool test_check(test_context_t *context, bool condition, const char *file, int line, const char *format, ...) {
+    if (condition) {
+        return true;
+    }
+    context->failure_count += 1;
+    fprintf(stderr, "[%s] %s:%d: ", context->suite, file, line);
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(stderr, format, arguments);
+    va_end(arguments);
+    fprintf(stderr, "\n");
+    return false;
+}
+
+bool test_make_scratch_directory(const test_context_t *context, const char *name, char *path, size_t path_size) {
+    int length = snprintf(path, path_size, "%s/%s-XXXXXX", context->options->scratch_directory, name);
+    if (length < 0 || (size_t) length >= path_size) {
+        return false;
+    }
+    return mkdtemp(path) != NULL;
+}
+
+static int remove_entry(const char *path, const struct stat *info, int flag, struct FTW *ftw) {
+    (void) info;
+    (void) flag;
+    (void) ftw;
+    remove(path);
+    return 0;
+}
+
+void test_remove_scratch_directory(const char *path) {
+    nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// MARK: - Main
+
+static bool parse_options(int argc, char **argv, test_options_t *options, bool *selected) {
+    const char *tmpdir = getenv("TMPDIR");
+    options->capture_megabytes = 64;
+    options->ring_readers = 4;
+    options->ring_seconds = 2;
+    options->scratch_directory = tmpdir != NULL && tmpdir[0] != '\0' ? tmpdir : "/tmp";
+
+    bool any_selected = false;
+    for (int i = 1; i < argc; i++) {
+        const char *argument = argv[i];
+        if (argument[0] != '-') {
+            bool found = false;
+            for (size_t s = 0; s < SUITE_COUNT; s++) {
+                if (strcmp(argument, suites[s].name) == 0) {
+                    selected[s] = true;
+                    found = true;
+                }
+            }
+            if (!found) {
+                return false;
+            }
+            any_selected = true;
+            continue;
+        }
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value == NULL) {
+            return false;
+        }
+        i++;
+        if (strcmp(argument, "--capture-mb") == 0) {
+            options->capture_megabytes = strtoull(value, NULL, 10);
+        } else if (strcmp(argument, "--ring-readers") == 0) {
+            options->ring_readers = (uint32_t) strtoul(value, NULL, 10);
+        } else if (strcmp(argument, "--ring-seconds") == 0) {
+            options->ring_seconds = strtod(value, NULL);
+        } else if (strcmp(argument, "--scratch") == 0) {
+            options->scratch_directory = value;
+        } else {
+            return false;
+        }
+    }
+    if (!any_selected) {
+        for (size_t s = 0; s < SUITE_COUNT; s++) {
+            selected[s] = true;
+        }
+    }
+    return options->capture_megabytes > 0
+        && options->ring_readers > 0
+        && options->ring_seconds > 0;
+}
+
+int main(int argc, char **argv) {
+    test_options_t options;
+    bool selected[SUITE_COUNT] = { false };
+    if (!parse_options(argc, argv, &options, selected)) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    uint32_t failed_suites = 0;
+    for (size_t s = 0; s < SUITE_COUNT; s++) {
+        if (!selected[s]) {
+            continue;
+        }
+        test_context_t context = {
+            .options = &options,
+            .suite = suites[s].name,
+            .failure_count = 0
+        };
+        fprintf(stderr, "[%s] running\n", suites[s].name);
+        suites[s].run(&context);
+        if (context.failure_count == 0) {
+            fprintf(stderr, "[%s] passed\n", suites[s].name);
+        } else {
+            fprintf(stderr, "[%s] FAILED (%u checks)\n", suites[s].name, context.failure_count);
+            failed_suites += 1;
+        }
+    }
+    return failed_suites == 0 ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+//
+//  test_capture_file.c
+//
+
+// Round trip of a large capture: synthetic samples are appended until the file reaches the
+// size given with `--capture-mb`, then every sample, stack and name is read back and compared
+// with the samples it was written from. Samples are generated from their index alone, so
+// they're generated again to check them instead of being kept in memory, and multi-GB
+// captures (past the 32-bit offsets) can be tested on any machine.
+
+#include "test_support.h"
+#include "capture_file.h"
+#include "sample_session.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define THREAD_COUNT 256
+#define CLUSTER_COUNT 3
+/// Stacks are picked from a fixed set, so the stack table stays small for any capture size.
+#define DISTINCT_STACKS 4096
+#define MAX_STACK_LENGTH 24
+#define TICK_INTERVAL_NS 250000000ull
+/// How often the size of the file is checked while writing.
+#define SIZE_CHECK_INTERVAL 64
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint32_t stack_length(uint64_t stack) {
+    return 1 + (uint32_t) (mix(stack + 1) % MAX_STACK_LENGTH);
+}
+
+static void fill_stack(uint64_t stack, backtrace_address_t *addresses) {
+    uint32_t length = stack_length(stack);
+    for (uint32_t i = 0; i < length; i++) {
+        addresses[i].address = 0x100000000ull + (mix(stack * MAX_STACK_LENGTH + i) & 0xFFFFFFF0ull);
+    }
+}
+
+/// Fills the records of a sample from its index, interning their stacks in `stacks`.
+static void fill_tick(uint64_t tick, sampled_thread_record_t *records, stack_table_t *stacks) {
+    for (uint32_t i = 0; i < THREAD_COUNT; i++) {
+        uint64_t random = mix(tick * THREAD_COUNT + i + 1);
+        sampled_thread_record_t *record = &records[i];
+        memset(record, 0, sizeof(sampled_thread_record_t));
+        // Threads come and go, so the IDs (delta encoded) change every now and then.
+        record->info.thread_id = 1000 + i * 3 + (tick / 1000) * 7;
+        if (i % 4 != 0) {
+            snprintf(record->info.pthread_name, sizeof(record->info.pthread_name), "worker-%u", i % 37);
+        }
+        if (i % 3 == 0) {
+            snprintf(record->info.dispatch_queue_name, sizeof(record->info.dispatch_queue_name),
+                     "com.example.queue-%u", (uint32_t) ((tick / 500 + i) % 50));
+        }
+        for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+            uint64_t value = mix(random + cluster);
+            record->deltas[cluster].cycles = value % 10000000;
+            record->deltas[cluster].instructions = (value >> 24) % 20000000;
+            record->deltas[cluster].time = (double) (value % 250000000) * 1e-9;
+            record->deltas[cluster].energy = (double) ((value >> 32) % 777777) * 1e-9;
+        }
+        record->stack_id = STACK_ID_NONE;
+        if (random % 10 != 0) {
+            backtrace_address_t addresses[MAX_STACK_LENGTH];
+            uint64_t stack = (random >> 8) % DISTINCT_STACKS;
+            fill_stack(stack, addresses);
+            record->stack_id = stack_table_intern(stacks, addresses, stack_length(stack));
+        }
+    }
+}
+
+static bool same_name(const capture_reader_t *reader, capture_name_id_t name_id, const char *expected) {
+    uint32_t length = 0;
+    const char *name = name_id == CAPTURE_NAME_NONE ? "" : capture_reader_name(reader, name_id, &length);
+    return name != NULL && length == strlen(expected) && memcmp(name, expected, length) == 0;
+}
+
+static bool same_counters(const cpu_counters_t *read, const cpu_counters_t *written) {
+    // Times and energies are stored in billionths.
+    return read->cycles == written->cycles
+        && read->instructions == written->instructions
+        && fabs(read->time - written->time) < 1e-9
+        && fabs(read->energy - written->energy) < 1e-9;
+}
+
+/// Checks every sample and stack of the capture against the ones it was written from.
+static void check_capture(test_context_t *context, capture_reader_t *reader, uint64_t tick_count, bool closed) {
+    uint64_t read_tick_count = capture_reader_tick_count(reader);
+    if (!TEST_CHECK(context, read_tick_count == tick_count,
+                    "The %s capture has %llu samples instead of %llu",
+                    closed ? "closed" : "recovered",
+                    (unsigned long long) read_tick_count,
+                    (unsigned long long) tick_count)) {
+        return;
+    }
+    stack_table_t *stacks = stack_table_create();
+    sampled_thread_record_t *records = malloc(THREAD_COUNT * sizeof(sampled_thread_record_t));
+    uint32_t failure_count = context->failure_count;
+    for (uint64_t tick = 0; tick < tick_count && context->failure_count - failure_count < 16; tick++) {
+        // The stacks must be interned in the same order as when writing, for the same IDs.
+        fill_tick(tick, records, stacks);
+        capture_tick_t read;
+        if (!TEST_CHECK(context, capture_reader_read_tick(reader, tick, &read), "Couldn't read sample %llu", (unsigned long long) tick)) {
+            continue;
+        }
+        TEST_CHECK(context,
+                   read.time_ns == tick * TICK_INTERVAL_NS
+                   && read.cluster_count == CLUSTER_COUNT
+                   && read.thread_count == THREAD_COUNT
+                   && fabs(read.interval - TICK_INTERVAL_NS * 1e-9) < 1e-9,
+                   "Sample %llu has a wrong header", (unsigned long long) tick);
+        for (uint32_t i = 0; i < read.thread_count && i < THREAD_COUNT; i++) {
+            const capture_thread_t *thread = &read.threads[i];
+            const sampled_thread_record_t *record = &records[i];
+            bool same = thread->thread_id == record->info.thread_id
+                && thread->stack_id == record->stack_id
+                && same_name(reader, thread->pthread_name, record->info.pthread_name)
+                && same_name(reader, thread->dispatch_queue_name, record->info.dispatch_queue_name);
+            for (uint32_t cluster = 0; cluster < SAMPLE_MAX_CLUSTERS; cluster++) {
+                same = same && same_counters(&thread->clusters[cluster], &record->deltas[cluster]);
+            }
+            TEST_CHECK(context, same, "Thread %u of sample %llu doesn't match", i, (unsigned long long) tick);
+        }
+    }
+
+    uint32_t stack_count = capture_reader_stack_count(reader);
+    TEST_CHECK(context, stack_count == stack_table_count(stacks),
+               "The capture has %u stacks instead of %u", stack_count, stack_table_count(stacks));
+    for (stack_id_t stack_id = 0; stack_id < stack_count; stack_id++) {
+        backtrace_address_t addresses[MAX_STACK_LENGTH];
+        uint32_t length = capture_reader_stack(reader, stack_id, addresses, MAX_STACK_LENGTH);
+        uint32_t expected_length;
+        const backtrace_address_t *expected = stack_table_stack(stacks, stack_id, &expected_length);
+        TEST_CHECK(context,
+                   length == expected_length && memcmp(addresses, expected, length * sizeof(backtrace_address_t)) == 0,
+                   "Stack %u doesn't match", stack_id);
+    }
+
+    uint64_t middle = tick_count / 2;
+    TEST_CHECK(context, capture_reader_find_tick(reader, middle * TICK_INTERVAL_NS - 1) == middle,
+               "Sample %llu wasn't found by time", (unsigned long long) middle);
+    TEST_CHECK(context, capture_reader_find_tick(reader, tick_count * TICK_INTERVAL_NS) == tick_count,
+               "Found a sample after the last one");
+    free(records);
+    stack_table_destroy(stacks);
+}
+
+void test_capture_file(test_context_t *context) {
+    char directory[4096];
+    char path[4200];
+    if (!TEST_CHECK(context, test_make_scratch_directory(context, "capture", directory, sizeof(directory)),
+                    "Couldn't create a scratch directory")) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/capture.pmkcapture", directory);
+
+    capture_writer_t *writer = capture_writer_create(path);
+    stack_table_t *stacks = stack_table_create();
+    sampled_thread_record_t *records = malloc(THREAD_COUNT * sizeof(sampled_thread_record_t));
+    if (!TEST_CHECK(context, writer != NULL && stacks != NULL && records != NULL, "Couldn't create the writer")) {
+        free(records);
+        stack_table_destroy(stacks);
+        test_remove_scratch_directory(directory);
+        return;
+    }
+    uint64_t target_size = context->options->capture_megabytes << 20;
+    uint64_t tick_count = 0;
+    struct stat info = { 0 };
+    while (tick_count % SIZE_CHECK_INTERVAL != 0 || stat(path, &info) != 0 || (uint64_t) info.st_size < target_size) {
+        fill_tick(tick_count, records, stacks);
+        sample_session_result_t result = {
+            .thread_count = THREAD_COUNT,
+            .threads = records,
+            .stacks = stacks,
+            .cluster_count = CLUSTER_COUNT,
+            .interval = TICK_INTERVAL_NS * 1e-9
+        };
+        if (!TEST_CHECK(context, capture_writer_append(writer, &result, tick_count * TICK_INTERVAL_NS),
+                        "Couldn't append sample %llu", (unsigned long long) tick_count)) {
+            break;
+        }
+        tick_count += 1;
+    }
+    bool closed = capture_writer_close(writer);
+    TEST_CHECK(context, closed, "Couldn't close the writer");
+    stat(path, &info);
+    fprintf(stderr, "[%s] wrote %llu samples, %.1f MiB\n",
+            context->suite,
+            (unsigned long long) tick_count,
+            (double) info.st_size / (1 << 20));
+    free(records);
+    stack_table_destroy(stacks);
+
+    capture_reader_t *reader = closed ? capture_reader_open(path) : NULL;
+    if (TEST_CHECK(context, reader != NULL, "Couldn't open the capture")) {
+        check_capture(context, reader, tick_count, true);
+        capture_reader_close(reader);
+    }
+
+    // Without its trailer, as if the writer was never closed, the index must be rebuilt from
+    // the chunks.
+    if (closed && truncate(path, info.st_size - 1) == 0) {
+        reader = capture_reader_open(path);
+        if (TEST_CHECK(context, reader != NULL, "Couldn't open the capture without its trailer")) {
+            check_capture(context, reader, tick_count, false);
+            capture_reader_close(reader);
+        }
+    }
+    test_remove_scratch_directory(directory);
+}
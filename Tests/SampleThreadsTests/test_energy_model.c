@@ -0,0 +1,142 @@
+//
+//  test_energy_model.c
+//
+
+// Fits the linear energy model to synthetic intervals whose energy is a known linear
+// function of their cycles and instructions, and checks that the weights are recovered, then
+// that calibrated weights are used as they are, both by the model and through the session.
+
+#include "test_support.h"
+#include "energy_model.h"
+#include "sample_session.h"
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CLUSTER_COUNT 2
+#define OBSERVATION_COUNT 1000
+
+/// Static power (J/s), then J per 10⁹ cycles and instructions of each cluster.
+static const double true_weights[1 + 2 * CLUSTER_COUNT] = { 4.0, 2.0, 0.5, 0.8, 0.2 };
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ull;
+
+/// A uniformly distributed value in [0, 1).
+static double next_random(void) {
+    // xorshift64*
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return (double) ((random_state * 0x2545F4914F6CDD1Dull) >> 11) / (double) (1ull << 53);
+}
+
+static double true_energy(const cpu_counters_t *totals, double interval) {
+    double energy = true_weights[0] * interval;
+    for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+        energy += true_weights[1 + 2 * cluster] * (totals[cluster].cycles / 1e9)
+            + true_weights[2 + 2 * cluster] * (totals[cluster].instructions / 1e9);
+    }
+    return energy;
+}
+
+static void check_weight_recovery(test_context_t *context) {
+    energy_model_t model;
+    energy_model_init(&model, ENERGY_MODEL_LINEAR, CLUSTER_COUNT);
+    TEST_CHECK(context, !energy_model_is_absolute(&model), "The model is absolute before any observation");
+    for (uint32_t i = 0; i < OBSERVATION_COUNT; i++) {
+        cpu_counters_t totals[SAMPLE_MAX_CLUSTERS];
+        memset(totals, 0, sizeof(totals));
+        double interval = 0.25 + 0.5 * next_random();
+        for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+            // IPC varies between intervals, so cycles and instructions can be told apart.
+            double cycles = 4e9 * interval * next_random();
+            totals[cluster].cycles = (uint64_t) cycles;
+            totals[cluster].instructions = (uint64_t) (cycles * (0.5 + 2.5 * next_random()));
+        }
+        // 1% of measurement noise.
+        double energy = true_energy(totals, interval) * (0.99 + 0.02 * next_random());
+        energy_model_observe(&model, totals, interval, energy);
+    }
+    if (!TEST_CHECK(context, energy_model_is_absolute(&model), "The model wasn't fitted")) {
+        return;
+    }
+    double weights[ENERGY_MODEL_MAX_FEATURES];
+    uint32_t weight_count = energy_model_weights(&model, weights);
+    TEST_CHECK(context, weight_count == 1 + 2 * CLUSTER_COUNT, "The model has %u weights", weight_count);
+    for (uint32_t i = 0; i < weight_count && i < 1 + 2 * CLUSTER_COUNT; i++) {
+        double error = fabs(weights[i] - true_weights[i]) / true_weights[i];
+        TEST_CHECK(context, error < 0.1, "Weight %u is %f instead of %f", i, weights[i], true_weights[i]);
+    }
+
+    // The estimates of a fitted model are the energy of each cluster, in J.
+    double estimate = energy_model_estimate(&model, 1, 2000000000, 1000000000);
+    double expected = 2 * true_weights[3] + true_weights[4];
+    TEST_CHECK(context, fabs(estimate - expected) / expected < 0.1, "Estimated %f J instead of %f J", estimate, expected);
+    double static_energy = energy_model_static_energy(&model, 0.5);
+    TEST_CHECK(context, fabs(static_energy - 2) < 0.2, "Static energy is %f J instead of 2 J", static_energy);
+}
+
+static void check_calibrated_weights(test_context_t *context) {
+    energy_model_t model;
+    energy_model_init(&model, ENERGY_MODEL_LINEAR, CLUSTER_COUNT);
+    energy_model_set_weights(&model, true_weights, 1 + 2 * CLUSTER_COUNT);
+    cpu_counters_t totals[SAMPLE_MAX_CLUSTERS] = { { .cycles = 1000000000, .instructions = 1000000000 } };
+    // Calibrated weights are not refitted.
+    energy_model_observe(&model, totals, 1, 1000);
+    double weights[ENERGY_MODEL_MAX_FEATURES];
+    uint32_t weight_count = energy_model_weights(&model, weights);
+    TEST_CHECK(context,
+               weight_count == 1 + 2 * CLUSTER_COUNT && memcmp(weights, true_weights, sizeof(true_weights)) == 0,
+               "Calibrated weights changed");
+
+    // The proportional models are never absolute, and estimate with the raw counts.
+    energy_model_init(&model, ENERGY_MODEL_INSTRUCTIONS, CLUSTER_COUNT);
+    energy_model_observe(&model, totals, 1, 1000);
+    TEST_CHECK(context,
+               !energy_model_is_absolute(&model) && energy_model_estimate(&model, 0, 10, 20) == 20,
+               "The instructions model doesn't estimate with instructions");
+    energy_model_init(&model, ENERGY_MODEL_CYCLES, CLUSTER_COUNT);
+    TEST_CHECK(context,
+               energy_model_estimate(&model, 0, 10, 20) == 10 && energy_model_static_energy(&model, 1) == 0,
+               "The cycles model doesn't estimate with cycles");
+}
+
+static void check_session_weights(test_context_t *context) {
+    // The session's model has a weight for the static power, and two per cluster it samples.
+    double calibrated[ENERGY_MODEL_MAX_FEATURES];
+    for (uint32_t i = 0; i < ENERGY_MODEL_MAX_FEATURES; i++) {
+        calibrated[i] = 1 + i;
+    }
+    sample_session_config_t config = {
+        .energy_model = ENERGY_MODEL_LINEAR,
+        .energy_model_weights = calibrated,
+        .energy_model_weight_count = ENERGY_MODEL_MAX_FEATURES
+    };
+    sample_session_t *session = sample_session_create_with_config(getpid(), config);
+    if (!TEST_CHECK(context, session != NULL, "Couldn't create a session")) {
+        return;
+    }
+    uint32_t expected_count = 1 + 2 * sample_session_topology(session)->cluster_count;
+    double weights[ENERGY_MODEL_MAX_FEATURES];
+    uint32_t weight_count = sample_session_energy_model_weights(session, weights);
+    TEST_CHECK(context,
+               weight_count == expected_count && memcmp(weights, calibrated, weight_count * sizeof(double)) == 0,
+               "The session has %u weights instead of the %u calibrated ones", weight_count, expected_count);
+    sample_session_destroy(session);
+
+    config.energy_model = ENERGY_MODEL_CYCLES;
+    config.energy_model_weights = NULL;
+    config.energy_model_weight_count = 0;
+    session = sample_session_create_with_config(getpid(), config);
+    if (TEST_CHECK(context, session != NULL, "Couldn't create a session")) {
+        TEST_CHECK(context, sample_session_energy_model_weights(session, weights) == 0,
+                   "A proportional model has weights");
+        sample_session_destroy(session);
+    }
+}
+
+void test_energy_model(test_context_t *context) {
+    check_weight_recovery(context);
+    check_calibrated_weights(context);
+    check_session_weights(context);
+}
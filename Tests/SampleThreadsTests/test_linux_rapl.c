@@ -0,0 +1,145 @@
+//
+//  test_linux_rapl.c
+//
+
+// Reads the RAPL counters of a fake powercap tree, laid out like /sys/class/powercap on a
+// dual-socket Intel machine: two packages with core, uncore and DRAM subzones, plus the zones
+// the reader must skip (the platform-wide psys zone, the MMIO duplicate of package 0 and the
+// intel-rapl control type). The counter of the second package wraps around between reads.
+
+#include "test_support.h"
+#include "linux_rapl.h"
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+
+typedef struct {
+    const char *zone;
+    const char *name;
+    uint64_t max_energy_range_uj;
+    /// Counter value when the reader is opened.
+    uint64_t first_energy_uj;
+    /// Counter value at the first read.
+    uint64_t second_energy_uj;
+} fake_zone_t;
+
+static const fake_zone_t zones[] = {
+    { "intel-rapl:0", "package-0", 262143328850, 1000000, 3500000 },
+    { "intel-rapl:0:0", "core", 262143328850, 500000, 1500000 },
+    { "intel-rapl:0:1", "uncore", 262143328850, 100000, 200000 },
+    { "intel-rapl:0:2", "dram", 65712999613, 200000, 450000 },
+    // Wraps around: (1000000 - 999000) + 4000 = 5000 µJ.
+    { "intel-rapl:1", "package-1", 1000000, 999000, 4000 },
+    // Overlaps with the rest of zones, so it must be skipped.
+    { "intel-rapl:2", "psys", 262143328850, 0, 50000000 },
+    // Duplicates package 0 on some Intel processors.
+    { "intel-rapl-mmio:0", "package-0", 262143328850, 0, 50000000 },
+};
+
+#define ZONE_COUNT (sizeof(zones) / sizeof(zones[0]))
+/// The zones that must be opened: all but psys and MMIO.
+#define READ_ZONE_COUNT 5
+
+static bool write_file(const char *directory, const char *zone, const char *file, const char *contents) {
+    char path[4200];
+    snprintf(path, sizeof(path), "%s/%s/%s", directory, zone, file);
+    FILE *stream = fopen(path, "w");
+    if (stream == NULL) {
+        return false;
+    }
+    bool success = fputs(contents, stream) >= 0;
+    return fclose(stream) == 0 && success;
+}
+
+static bool write_counter(const char *directory, const char *zone, const char *file, uint64_t value) {
+    char contents[32];
+    snprintf(contents, sizeof(contents), "%llu\n", (unsigned long long) value);
+    return write_file(directory, zone, file, contents);
+}
+
+static bool make_tree(const char *directory) {
+    char path[4200];
+    // The control type has no name nor counter of its own.
+    snprintf(path, sizeof(path), "%s/intel-rapl", directory);
+    if (mkdir(path, 0755) != 0 || !write_file(directory, "intel-rapl", "enabled", "1\n")) {
+        return false;
+    }
+    for (size_t i = 0; i < ZONE_COUNT; i++) {
+        const fake_zone_t *zone = &zones[i];
+        char name[64];
+        snprintf(name, sizeof(name), "%s\n", zone->name);
+        snprintf(path, sizeof(path), "%s/%s", directory, zone->zone);
+        if (mkdir(path, 0755) != 0
+            || !write_file(directory, zone->zone, "name", name)
+            || !write_counter(directory, zone->zone, "max_energy_range_uj", zone->max_energy_range_uj)
+            || !write_counter(directory, zone->zone, "energy_uj", zone->first_energy_uj)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_close(double value, double expected) {
+    return fabs(value - expected) < 1e-9;
+}
+
+void test_linux_rapl(test_context_t *context) {
+    char directory[4096];
+    if (!TEST_CHECK(context, test_make_scratch_directory(context, "powercap", directory, sizeof(directory)),
+                    "Couldn't create a scratch directory")) {
+        return;
+    }
+    if (!TEST_CHECK(context, make_tree(directory), "Couldn't create the fake powercap tree")) {
+        test_remove_scratch_directory(directory);
+        return;
+    }
+
+    rapl_reader_t reader;
+    rapl_reader_open_at(&reader, directory);
+    TEST_CHECK(context, reader.domain_count == READ_ZONE_COUNT,
+               "Opened %d domains instead of %d", reader.domain_count, READ_ZONE_COUNT);
+
+    // Nothing changed since the reader was opened.
+    rapl_energy_t energy;
+    rapl_reader_read(&reader, &energy);
+    TEST_CHECK(context, energy.package == 0 && energy.core == 0 && energy.uncore == 0 && energy.dram == 0,
+               "Read energy before the counters changed");
+
+    for (size_t i = 0; i < ZONE_COUNT; i++) {
+        write_counter(directory, zones[i].zone, "energy_uj", zones[i].second_energy_uj);
+    }
+    rapl_reader_read(&reader, &energy);
+    TEST_CHECK(context, is_close(energy.package, 2.5 + 0.005), "Package energy is %f J", energy.package);
+    TEST_CHECK(context, is_close(energy.core, 1), "Core energy is %f J", energy.core);
+    TEST_CHECK(context, is_close(energy.uncore, 0.1), "Uncore energy is %f J", energy.uncore);
+    TEST_CHECK(context, is_close(energy.dram, 0.25), "DRAM energy is %f J", energy.dram);
+
+    // Deltas are relative to the previous read, including the wrapped counter.
+    write_counter(directory, "intel-rapl:0", "energy_uj", 4500000);
+    write_counter(directory, "intel-rapl:1", "energy_uj", 6000);
+    double package_energy = rapl_reader_read_energy(&reader);
+    TEST_CHECK(context, is_close(package_energy, 1 + 0.002), "Package energy is %f J after the wrap", package_energy);
+
+    rapl_reader_close(&reader);
+    TEST_CHECK(context, reader.domain_count == 0, "The closed reader still has domains");
+
+    // A missing tree is not an error: the reader just has no domains.
+    snprintf(directory + strlen(directory), sizeof(directory) - strlen(directory), "/missing");
+    rapl_reader_open_at(&reader, directory);
+    TEST_CHECK(context, reader.domain_count == 0, "Opened domains of a missing tree");
+    rapl_reader_read(&reader, &energy);
+    TEST_CHECK(context, energy.package == 0 && energy.dram == 0, "Read energy without domains");
+    directory[strlen(directory) - strlen("/missing")] = '\0';
+    test_remove_scratch_directory(directory);
+}
+
+#else
+
+void test_linux_rapl(test_context_t *context) {
+    // RAPL is only read on Linux.
+    (void) context;
+}
+
+#endif /* defined(__linux__) */
@@ -0,0 +1,196 @@
+//
+//  test_sample_ring.c
+//
+
+// Stress test of the sample ring: a single writer pushes records as fast as it can into a
+// small ring, so it laps the readers all the time, while several readers copy records out
+// of it concurrently, half of them following a cursor and half of them taking snapshots.
+// Every record is filled from its sequence number, so a reader can tell whether a record it
+// accepted is torn (which the slot versions must prevent) or out of order.
+
+#include "test_support.h"
+#include "sample_ring.h"
+#include "sampler_stats.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Small, so the writer overwrites records while they are being read.
+#define RING_CAPACITY 256
+#define MAX_BATCH 64
+
+typedef struct {
+    test_context_t *context;
+    sample_ring_t *ring;
+    _Atomic bool stopping;
+    pthread_mutex_t lock;
+} ring_test_t;
+
+typedef struct {
+    ring_test_t *test;
+    bool snapshots;
+    uint64_t accepted;
+    uint64_t dropped;
+    uint32_t failure_count;
+} ring_reader_t;
+
+static void fill_record(uint64_t sequence, sampled_thread_info_t *record) {
+    memset(record, 0, sizeof(sampled_thread_info_t));
+    record->thread_id = sequence;
+    snprintf(record->pthread_name, sizeof(record->pthread_name), "thread-%llu", (unsigned long long) sequence);
+    memset(record->dispatch_queue_name, 'a' + (int) (sequence % 26), sizeof(record->dispatch_queue_name) - 1);
+    for (uint32_t cluster = 0; cluster < SAMPLE_MAX_CLUSTERS; cluster++) {
+        record->clusters[cluster].cycles = sequence * 3 + cluster;
+        record->clusters[cluster].instructions = ~sequence - cluster;
+        record->clusters[cluster].energy = (double) sequence * 0.5 + cluster;
+        record->clusters[cluster].time = (double) cluster - (double) sequence;
+    }
+}
+
+/// Whether a record is exactly the one pushed with its sequence number.
+static bool is_consistent(const sampled_thread_info_t *record) {
+    sampled_thread_info_t expected;
+    fill_record(record->thread_id, &expected);
+    return memcmp(record, &expected, sizeof(sampled_thread_info_t)) == 0;
+}
+
+/// Records a failure from a reader thread. Failures are rare, so a lock is fine here.
+static void reader_failure(ring_reader_t *reader, const char *message, uint64_t value) {
+    pthread_mutex_lock(&reader->test->lock);
+    TEST_CHECK(reader->test->context, false, "%s (%llu)", message, (unsigned long long) value);
+    pthread_mutex_unlock(&reader->test->lock);
+    reader->failure_count += 1;
+}
+
+static void read_with_cursor(ring_reader_t *reader, sampled_thread_info_t *records, uint64_t *cursor, uint32_t max_count) {
+    uint64_t start = *cursor;
+    uint64_t dropped = reader->dropped;
+    uint32_t count = sample_ring_read_from(reader->test->ring, cursor, records, max_count, &dropped);
+    if (dropped < reader->dropped) {
+        reader_failure(reader, "The drop count went backwards", dropped);
+    }
+    // Every record between the cursors is either copied or counted as dropped.
+    if (*cursor - start != count + (dropped - reader->dropped)) {
+        reader_failure(reader, "Copied and dropped records don't add up to the cursor advance", *cursor - start);
+    }
+    uint64_t previous = start;
+    for (uint32_t i = 0; i < count; i++) {
+        const sampled_thread_info_t *record = &records[i];
+        if (!is_consistent(record)) {
+            reader_failure(reader, "Accepted a torn record", record->thread_id);
+        } else if (record->thread_id < previous || record->thread_id >= *cursor) {
+            reader_failure(reader, "Accepted a record out of order", record->thread_id);
+        }
+        previous = record->thread_id + 1;
+    }
+    reader->accepted += count;
+    reader->dropped = dropped;
+}
+
+static void read_snapshot(ring_reader_t *reader, sampled_thread_info_t *records, uint32_t max_count) {
+    uint64_t first_sequence = 0;
+    uint32_t count = sample_ring_snapshot(reader->test->ring, records, max_count, &first_sequence);
+    for (uint32_t i = 0; i < count; i++) {
+        const sampled_thread_info_t *record = &records[i];
+        if (!is_consistent(record)) {
+            reader_failure(reader, "Snapshot has a torn record", record->thread_id);
+        } else if (record->thread_id != first_sequence + i) {
+            reader_failure(reader, "Snapshot is not contiguous", record->thread_id);
+        }
+    }
+    reader->accepted += count;
+}
+
+static void *reader_main(void *argument) {
+    ring_reader_t *reader = argument;
+    sampled_thread_info_t *records = malloc(RING_CAPACITY * sizeof(sampled_thread_info_t));
+    uint64_t cursor = 0;
+    uint32_t max_count = 1;
+    while (!atomic_load_explicit(&reader->test->stopping, memory_order_relaxed) && reader->failure_count < 16) {
+        // Vary how much is read at once, so reads start and end at every point of the ring.
+        max_count = max_count % RING_CAPACITY + 7;
+        if (reader->snapshots) {
+            read_snapshot(reader, records, max_count);
+        } else {
+            read_with_cursor(reader, records, &cursor, max_count);
+        }
+    }
+    free(records);
+    return NULL;
+}
+
+void test_sample_ring(test_context_t *context) {
+    ring_test_t test = {
+        .context = context,
+        .ring = sample_ring_create(RING_CAPACITY)
+    };
+    if (!TEST_CHECK(context, test.ring != NULL, "Couldn't create the ring")) {
+        return;
+    }
+    atomic_init(&test.stopping, false);
+    pthread_mutex_init(&test.lock, NULL);
+
+    uint32_t reader_count = context->options->ring_readers;
+    ring_reader_t *readers = calloc(reader_count, sizeof(ring_reader_t));
+    pthread_t *threads = calloc(reader_count, sizeof(pthread_t));
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < reader_count; i++) {
+        readers[i].test = &test;
+        readers[i].snapshots = i % 2 == 1;
+        if (pthread_create(&threads[i], NULL, reader_main, &readers[i]) != 0) {
+            break;
+        }
+        started += 1;
+    }
+    TEST_CHECK(context, started == reader_count, "Only %u of %u readers started", started, reader_count);
+
+    // The writer runs on this thread, pushing batches of every size up to MAX_BATCH.
+    sampled_thread_info_t batch[MAX_BATCH];
+    uint64_t sequence = 0;
+    uint64_t deadline_ns = sampler_stats_now_ns() + (uint64_t) (context->options->ring_seconds * 1e9);
+    for (uint32_t round = 0; sampler_stats_now_ns() < deadline_ns; round++) {
+        uint32_t count = round % MAX_BATCH + 1;
+        for (uint32_t i = 0; i < count; i++) {
+            fill_record(sequence + i, &batch[i]);
+        }
+        sample_ring_push(test.ring, batch, count);
+        sequence += count;
+    }
+    atomic_store_explicit(&test.stopping, true, memory_order_relaxed);
+
+    uint64_t accepted = 0;
+    uint64_t dropped = 0;
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        accepted += readers[i].accepted;
+        dropped += readers[i].dropped;
+    }
+    TEST_CHECK(context, sample_ring_head(test.ring) == sequence, "The head is not the number of pushed records");
+    TEST_CHECK(context, accepted > 0, "The readers didn't accept any record");
+
+    // Without a concurrent writer, a reader starting from the beginning must get exactly the
+    // records still in the ring, and count all the older ones as dropped.
+    sampled_thread_info_t *records = malloc(RING_CAPACITY * sizeof(sampled_thread_info_t));
+    uint64_t cursor = 0;
+    uint64_t final_dropped = 0;
+    uint32_t count = sample_ring_read_from(test.ring, &cursor, records, RING_CAPACITY, &final_dropped);
+    TEST_CHECK(context, count == RING_CAPACITY && final_dropped == sequence - RING_CAPACITY,
+               "Read %u records and dropped %llu after the writer stopped",
+               count, (unsigned long long) final_dropped);
+    for (uint32_t i = 0; i < count; i++) {
+        TEST_CHECK(context, is_consistent(&records[i]) && records[i].thread_id == sequence - count + i,
+                   "Record %u is wrong after the writer stopped", i);
+    }
+    fprintf(stderr, "[%s] pushed %llu records, readers accepted %llu and dropped %llu\n",
+            context->suite,
+            (unsigned long long) sequence,
+            (unsigned long long) accepted,
+            (unsigned long long) dropped);
+
+    free(records);
+    free(threads);
+    free(readers);
+    pthread_mutex_destroy(&test.lock);
+    sample_ring_destroy(test.ring);
+}
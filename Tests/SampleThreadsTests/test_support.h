@@ -0,0 +1,59 @@
+//
+//  test_support.h
+//
+
+#ifndef test_support_h
+#define test_support_h
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/// The options of a test run, shared by all the suites.
+typedef struct {
+    /// Size of the synthetic capture written and read back by the capture suite, in MiB.
+    uint64_t capture_megabytes;
+    /// Number of concurrent readers of the sample ring stress test.
+    uint32_t ring_readers;
+    /// How long the sample ring stress test runs, in seconds.
+    double ring_seconds;
+    /// Directory where the suites create their temporary files and trees.
+    const char *scratch_directory;
+} test_options_t;
+
+/// The state of the suite being run.
+typedef struct {
+    const test_options_t *options;
+    /// Name of the suite, printed along with its failures.
+    const char *suite;
+    /// Number of failed checks.
+    uint32_t failure_count;
+} test_context_t;
+
+/// Runs the checks of a suite, recording failures in the context.
+typedef void (*test_suite_t)(test_context_t *context);
+
+/// Records a failure, with a printf-style message, if `condition` doesn't hold.
+/// - Returns: Whether the condition held, so suites can stop early when later checks would
+/// only repeat the failure.
+#define TEST_CHECK(context, condition, ...) \
+    test_check((context), (condition), __FILE__, __LINE__, __VA_ARGS__)
+
+bool test_check(test_context_t *context, bool condition, const char *file, int line, const char *format, ...)
+    __attribute__((format(printf, 5, 6)));
+
+/// Creates a new empty directory under the scratch directory, writing its path to `path`.
+/// - Returns: `false` if it couldn't be created.
+bool test_make_scratch_directory(const test_context_t *context, const char *name, char *path, size_t path_size);
+
+/// Removes a scratch directory created by `test_make_scratch_directory`, and everything in it.
+void test_remove_scratch_directory(const char *path);
+
+// MARK: - Suites
+
+void test_sample_ring(test_context_t *context);
+void test_capture_file(test_context_t *context);
+void test_linux_rapl(test_context_t *context);
+void test_energy_model(test_context_t *context);
+
+#endif /* test_support_h */